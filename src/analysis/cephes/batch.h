@@ -0,0 +1,258 @@
+/*                                                     batch.h
+ *
+ *     Batched evaluation helpers
+ *
+ *
+ *
+ * SYNOPSIS:
+ *
+ * cephes_vd x, y;
+ * double coef[N+1], xa[n], ya[n];
+ *
+ * y = polevl_v( x, coef, N );
+ * polevl_batch( xa, ya, n, coef, N );
+ *
+ *
+ *
+ * DESCRIPTION:
+ *
+ * The type cephes_vd holds CEPHES_VLEN doubles that are operated on
+ * together, in SIMD registers where the compiler supports GCC style
+ * vector extensions and as a plain double otherwise. Comparisons of
+ * cephes_vd values give masks of type cephes_vm, which select between two
+ * values lane by lane with vsel() instead of branching.
+ *
+ * polevl_v(), p1evl_v() and chbevl_v() are the vector versions of
+ * polevl(), p1evl() and chbevl(); exp_v() computes the exponential of
+ * each lane with the Pade approximation of the Cephes exp() routine.
+ * polevl_batch() and p1evl_batch() evaluate a polynomial over an array;
+ * the vector kernels of the batched special functions are applied to
+ * arrays with CEPHES_BATCH1() and CEPHES_BATCH2().
+ *
+ */
+
+#ifndef CEPHES_BATCH_H
+#define CEPHES_BATCH_H
+
+#include <math.h>
+#include <string.h>
+#include "protos.h"
+#include "polevl.h"
+
+#if CEPHES_VLEN > 1
+
+typedef double cephes_vd __attribute__ ((vector_size(8 * CEPHES_VLEN)));
+typedef __typeof__ ((cephes_vd) { 0 } < (cephes_vd) { 0 }) cephes_vm;
+
+#define vlane(v, i) ((v)[i])
+#define vand(m, n) ((m) & (n))
+#define vor(m, n) ((m) | (n))
+#define vnot(m) (~(m))
+#define vsel(m, a, b) \
+    ((cephes_vd) (((cephes_vm) (a) & (m)) | ((cephes_vm) (b) & ~(m))))
+
+static CEPHES_INLINE cephes_vd vsplat(double a)
+{
+    cephes_vd v;
+    int i;
+
+    for (i = 0; i < CEPHES_VLEN; i++)
+	v[i] = a;
+    return v;
+}
+
+static CEPHES_INLINE int vany(cephes_vm m)
+{
+    int i;
+
+    for (i = 0; i < CEPHES_VLEN; i++)
+	if (m[i])
+	    return 1;
+    return 0;
+}
+
+static CEPHES_INLINE cephes_vd vabs(cephes_vd v)
+{
+    return (cephes_vd) ((cephes_vm) v & ~(cephes_vm) vsplat(-0.0));
+}
+
+#else
+
+typedef double cephes_vd;
+typedef int cephes_vm;
+
+#define vlane(v, i) (v)
+#define vand(m, n) ((m) && (n))
+#define vor(m, n) ((m) || (n))
+#define vnot(m) (!(m))
+#define vsel(m, a, b) ((m) ? (a) : (b))
+#define vsplat(a) ((double) (a))
+#define vany(m) (m)
+#define vabs(v) fabs(v)
+
+#endif
+
+/* Load the first n elements of p, padding the remaining lanes with pad. */
+static CEPHES_INLINE cephes_vd vload(const double *p, int n, double pad)
+{
+    cephes_vd v;
+    int i;
+
+    if (n >= CEPHES_VLEN) {
+	memcpy(&v, p, sizeof(v));
+	return v;
+    }
+    for (i = 0; i < CEPHES_VLEN; i++)
+	vlane(v, i) = i < n ? p[i] : pad;
+    return v;
+}
+
+/* Store the first n lanes of v to p. */
+static CEPHES_INLINE void vstore(double *p, cephes_vd v, int n)
+{
+    int i;
+
+    if (n >= CEPHES_VLEN) {
+	memcpy(p, &v, sizeof(v));
+	return;
+    }
+    for (i = 0; i < n; i++)
+	p[i] = vlane(v, i);
+}
+
+static CEPHES_INLINE cephes_vd vsqrt(cephes_vd v)
+{
+    int i;
+
+    for (i = 0; i < CEPHES_VLEN; i++)
+	vlane(v, i) = sqrt(vlane(v, i));
+    return v;
+}
+
+static CEPHES_INLINE cephes_vd polevl_v(cephes_vd x, double coef[], int N)
+{
+    cephes_vd ans;
+    int i;
+
+    ans = vsplat(coef[0]);
+    for (i = 1; i <= N; i++)
+	ans = ans * x + coef[i];
+    return ans;
+}
+
+static CEPHES_INLINE cephes_vd p1evl_v(cephes_vd x, double coef[], int N)
+{
+    cephes_vd ans;
+    int i;
+
+    ans = x + coef[0];
+    for (i = 1; i < N; i++)
+	ans = ans * x + coef[i];
+    return ans;
+}
+
+static CEPHES_INLINE cephes_vd chbevl_v(cephes_vd x, double array[], int n)
+{
+    cephes_vd b0, b1, b2;
+    int i;
+
+    b0 = vsplat(array[0]);
+    b1 = vsplat(0.0);
+    b2 = b1;
+    for (i = 1; i < n; i++) {
+	b2 = b1;
+	b1 = b0;
+	b0 = x * b1 - b2 + array[i];
+    }
+    return 0.5 * (b0 - b2);
+}
+
+/* exp(x) = 2^n exp(r) with |r| <= ln(2)/2 and the Pade approximation
+ * exp(r) = 1 + 2r P(r^2) / (Q(r^2) - r P(r^2)) of Cephes exp(). The
+ * scaling by 2^n is split in two factors so that results in the subnormal
+ * range are not flushed to zero.
+ */
+static CEPHES_INLINE cephes_vd exp_v(cephes_vd x)
+{
+    static double P[] = {
+	1.26177193074810590878E-4,
+	3.02994407707441961300E-2,
+	9.99999999999999999910E-1,
+    };
+    static double Q[] = {
+	3.00198505138664455042E-6,
+	2.52448340349684104192E-3,
+	2.27265548208155028766E-1,
+	2.00000000000000000009E0,
+    };
+    const double C1 = 6.93145751953125E-1;
+    const double C2 = 1.42860682030941723212E-6;
+    const double LOG2E = 1.4426950408889634073599;
+    const double ROUND = 6755399441055744.0;	/* 1.5 * 2^52 */
+    const double EXP_MAXLOG = 7.09782712893383996732E2;
+    const double EXP_MINLOG = -7.451332191019412076235E2;
+    cephes_vd t, px, xx, r, y;
+
+    /* round x / ln(2) to the nearest integer, which is also left in the
+     * low bits of t */
+    t = x * LOG2E + ROUND;
+    px = t - ROUND;
+    r = x - px * C1;
+    r = r - px * C2;
+    xx = r * r;
+    y = r * polevl_v(xx, P, 2);
+    y = y / (polevl_v(xx, Q, 3) - y);
+    y = 1.0 + 2.0 * y;
+
+#if CEPHES_VLEN > 1
+    {
+	cephes_vm n, n1, n2;
+
+	n = (cephes_vm) t - (cephes_vm) vsplat(ROUND);
+	n1 = n >> 1;
+	n2 = n - n1;
+	y = y * (cephes_vd) ((n1 + 1023) << 52) * (cephes_vd) ((n2 + 1023) << 52);
+    }
+#else
+    y = ldexp(y, (int) px);
+#endif
+
+    y = vsel(x > EXP_MAXLOG, vsplat(INFINITY), y);
+    y = vsel(x < EXP_MINLOG, vsplat(0.0), y);
+    return vsel(x != x, x, y);
+}
+
+/* Batched versions of polevl() and p1evl(): evaluate the polynomial at
+ * each of x[0], ..., x[n-1] and store the results in y.
+ */
+static CEPHES_INLINE void polevl_batch(const double *x, double *y, int n,
+				       double coef[], int N)
+{
+    int k;
+
+    for (k = 0; k < n; k += CEPHES_VLEN)
+	vstore(y + k, polevl_v(vload(x + k, n - k, 0.0), coef, N), n - k);
+}
+
+static CEPHES_INLINE void p1evl_batch(const double *x, double *y, int n,
+				      double coef[], int N)
+{
+    int k;
+
+    for (k = 0; k < n; k += CEPHES_VLEN)
+	vstore(y + k, p1evl_v(vload(x + k, n - k, 0.0), coef, N), n - k);
+}
+
+/* Define the array function NAME(x, y, n) that applies the vector kernel
+ * KERNEL to each group of CEPHES_VLEN elements.
+ */
+#define CEPHES_BATCH1(NAME, KERNEL)					\
+void NAME(const double *x, double *y, int n)				\
+{									\
+    int k;								\
+									\
+    for (k = 0; k < n; k += CEPHES_VLEN)				\
+	vstore(y + k, KERNEL(vload(x + k, n - k, 1.0)), n - k);	\
+}
+
+#endif
@@ -94,4 +94,14 @@
 #define kolmogorov cephes_kolmogorov
 #define kolmogi cephes_kolmogi
 
+#define erf_batch cephes_erf_batch
+#define erfc_batch cephes_erfc_batch
+#define ndtr_batch cephes_ndtr_batch
+#define Gamma_batch cephes_Gamma_batch
+#define i0_batch cephes_i0_batch
+#define i0e_batch cephes_i0e_batch
+#define i1_batch cephes_i1_batch
+#define i1e_batch cephes_i1e_batch
+#define j0_batch cephes_j0_batch
+
 #endif
@@ -59,6 +59,7 @@
 
 #include <stdio.h>
 #include "protos.h"
+#include "batch.h"
 
 double chbevl(x, array, n)
 double x;
@@ -82,3 +83,21 @@ int n;
 
     return (0.5 * (b0 - b2));
 }
+
+/*                                                     chbevl_batch()
+ *
+ * Batched version of chbevl(): y[j] = chbevl(x[j], array, n) for j < m.
+ */
+
+void chbevl_batch(x, y, m, array, n)
+const double *x;
+double *y;
+int m;
+double array[];
+int n;
+{
+    int k;
+
+    for (k = 0; k < m; k += CEPHES_VLEN)
+	vstore(y + k, chbevl_v(vload(x + k, m - k, 0.0), array, n), m - k);
+}
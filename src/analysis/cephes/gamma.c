@@ -92,6 +92,7 @@
 
 
 #include "mconf.h"
+#include "batch.h"
 
 static double P[] = {
     1.60119522476751861407E-4,
@@ -234,6 +235,65 @@ double Gamma(double x)
 }
 
 
+/*                                                     Gamma_batch()
+ *
+ * Batched version of Gamma(). For |x| <= 33, the lanes of a vector are
+ * shifted into [2, 3) by the recurrence of Gamma(), taking masked steps
+ * (four at a time while far from the interval) until no lane moves, and
+ * the rational approximation is evaluated for the whole vector. Lanes out
+ * of that range, not finite, or close to a pole use Gamma() itself.
+ */
+
+static cephes_vd Gamma_v(cephes_vd x)
+{
+    cephes_vd u, r, num, den, y;
+    cephes_vm other, down, up;
+    int i;
+
+    u = x;
+    num = vsplat(1.0);
+    den = vsplat(1.0);
+    other = vnot(vabs(x) <= 33.0);
+
+    /* near a pole: x rounded to the nearest integer (|x| <= 33 here) */
+    r = (x + 6755399441055744.0) - 6755399441055744.0;
+    other = vor(other, vand(x < 1.e-9, vabs(x - r) < 1.e-9));
+
+    /* four steps at a time while no lane can reach a pole */
+    for (;;) {
+	down = vand(u >= 6.0, vnot(other));
+	up = vand(u < -2.0, vnot(other));
+	if (!vany(vor(down, up)))
+	    break;
+	num = vsel(down, num * ((u - 1.0) * (u - 2.0))
+		   * ((u - 3.0) * (u - 4.0)), num);
+	den = vsel(up, den * (u * (u + 1.0)) * ((u + 2.0) * (u + 3.0)), den);
+	u = vsel(down, u - 4.0, vsel(up, u + 4.0, u));
+    }
+
+    for (;;) {
+	other = vor(other, vand(u > -1.E-9, u < 1.e-9));
+	down = vand(u >= 3.0, vnot(other));
+	up = vand(u < 2.0, vnot(other));
+	if (!vany(vor(down, up)))
+	    break;
+	num = vsel(down, num * (u - 1.0), num);
+	den = vsel(up, den * u, den);
+	u = vsel(down, u - 1.0, vsel(up, u + 1.0, u));
+    }
+
+    u = u - 2.0;
+    y = (num * polevl_v(u, P, 6)) / (den * polevl_v(u, Q, 7));
+    y = vsel(u == 0.0, num / den, y);
+
+    for (i = 0; i < CEPHES_VLEN; i++)
+	if (vlane(other, i))
+	    vlane(y, i) = Gamma(vlane(x, i));
+    return y;
+}
+
+CEPHES_BATCH1(Gamma_batch, Gamma_v)
+
 
 /* A[]: Stirling's formula expansion of log Gamma
  * B[], C[]: log Gamma function between 2 and 3
@@ -74,6 +74,7 @@
  */
 
 #include "mconf.h"
+#include "batch.h"
 
 /* Chebyshev coefficients for exp(-x) I0(x)
  * in the interval [0,8].
@@ -180,3 +181,33 @@ double x;
     return (chbevl(32.0 / x - 2.0, B, 25) / sqrt(x));
 
 }
+
+
+/*                                                     i0_batch()
+ *                                                     i0e_batch()
+ *
+ * Batched versions of i0() and i0e(). The Chebyshev expansions for both
+ * intervals are evaluated for a whole vector of arguments and the result of
+ * each lane is selected by masking.
+ */
+
+static cephes_vd i0e_v(cephes_vd x)
+{
+    cephes_vd z, y;
+    cephes_vm small;
+
+    z = vabs(x);
+    small = z <= 8.0;
+    y = chbevl_v(z / 2.0 - 2.0, A, 30);
+    if (!vany(vnot(small)))
+	return y;
+    return vsel(small, y, chbevl_v(32.0 / z - 2.0, B, 25) / vsqrt(z));
+}
+
+static cephes_vd i0_v(cephes_vd x)
+{
+    return exp_v(vabs(x)) * i0e_v(x);
+}
+
+CEPHES_BATCH1(i0_batch, i0_v)
+CEPHES_BATCH1(i0e_batch, i0e_v)
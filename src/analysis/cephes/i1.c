@@ -75,6 +75,7 @@
  */
 
 #include "mconf.h"
+#include "batch.h"
 
 /* Chebyshev coefficients for exp(-x) I1(x) / x
  * in the interval [0,8].
@@ -184,3 +185,33 @@ double x;
 	z = -z;
     return (z);
 }
+
+
+/*                                                     i1_batch()
+ *                                                     i1e_batch()
+ *
+ * Batched versions of i1() and i1e(). The Chebyshev expansions for both
+ * intervals are evaluated for a whole vector of arguments and the result of
+ * each lane is selected by masking.
+ */
+
+static cephes_vd i1e_v(cephes_vd x)
+{
+    cephes_vd z, y;
+    cephes_vm small;
+
+    z = vabs(x);
+    small = z <= 8.0;
+    y = chbevl_v(z / 2.0 - 2.0, A, 29) * z;
+    if (vany(vnot(small)))
+	y = vsel(small, y, chbevl_v(32.0 / z - 2.0, B, 25) / vsqrt(z));
+    return vsel(x < 0.0, -y, y);
+}
+
+static cephes_vd i1_v(cephes_vd x)
+{
+    return exp_v(vabs(x)) * i1e_v(x);
+}
+
+CEPHES_BATCH1(i1_batch, i1_v)
+CEPHES_BATCH1(i1e_batch, i1e_v)
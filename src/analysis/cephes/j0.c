@@ -90,6 +90,7 @@
  * except YP, YQ which are designed for absolute error. */
 
 #include "mconf.h"
+#include "batch.h"
 
 static double PP[7] = {
     7.96936729297347051624E-4,
@@ -209,6 +210,47 @@ double x;
     return (p * SQ2OPI / sqrt(x));
 }
 
+
+/*                                                     j0_batch()
+ *
+ * Batched version of j0(). The rational approximations for both intervals
+ * are evaluated for a whole vector of arguments and the result of each lane
+ * is selected by masking; the sine and cosine of the phase are computed
+ * lane by lane.
+ */
+
+static cephes_vd j0_v(cephes_vd x)
+{
+    cephes_vd z, y, w, q, p, c, s;
+    cephes_vm small;
+    int i;
+
+    x = vabs(x);
+    z = x * x;
+    small = x <= 5.0;
+
+    y = (z - DR1) * (z - DR2) * polevl_v(z, RP, 3) / p1evl_v(z, RQ, 8);
+    y = vsel(x < 1.0e-5, 1.0 - z / 4.0, y);
+    if (!vany(vnot(small)))
+	return y;
+
+    w = 5.0 / x;
+    q = 25.0 / z;
+    p = polevl_v(q, PP, 6) / polevl_v(q, PQ, 6);
+    q = polevl_v(q, QP, 7) / p1evl_v(q, QQ, 7);
+    c = x - CEPHES_PI_4;
+    s = c;
+    for (i = 0; i < CEPHES_VLEN; i++) {
+	vlane(c, i) = cos(vlane(c, i));
+	vlane(s, i) = sin(vlane(s, i));
+    }
+    p = (p * c - w * q * s) * SQ2OPI / vsqrt(x);
+
+    return vsel(small, y, p);
+}
+
+CEPHES_BATCH1(j0_batch, j0_v)
+
 /*                                                     y0() 2  */
 /* Bessel function of second kind, order zero  */
 
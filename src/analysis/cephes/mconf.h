@@ -58,6 +58,8 @@
 #ifndef CEPHES_MCONF_H
 #define CEPHES_MCONF_H
 
+#include <math.h>
+
 #include "cephes_names.h"
 #include "protos.h"
 #include "polevl.h"
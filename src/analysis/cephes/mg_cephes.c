@@ -3,47 +3,425 @@
 #include <math.h>
 
 #include "mg_idl_export.h"
+#include "mg_threads.h"
 #include "protos.h"
 
-static IDL_VPTR IDL_CDECL IDL_mg_fdtr(int argc, IDL_VPTR *argv) {
-  double a, b, x;
-  a = IDL_DoubleScalar(argv[0]);
-  b = IDL_DoubleScalar(argv[1]);
-  x = IDL_DoubleScalar(argv[2]);
-  return IDL_GettmpDouble(cephes_fdtr(a, b, x));
+// most inputs and outputs of any routine in mg_cephes_functions.h
+#define MG_CEPHES_MAX_INPUTS  4
+#define MG_CEPHES_MAX_OUTPUTS 4
+
+// evaluates one element: reads inputs from x, writes outputs to y
+typedef void (*mg_cephes_kernel)(const double *x, double *y);
+
+// evaluates n elements of a function: reads the contiguous input arrays
+// x[0], ..., writes the results to y
+typedef void (*mg_cephes_batch_kernel)(const double **x, double *y, int n);
+
+
+/**************************************************************************
+  Broadcasting loop
+***************************************************************************/
+
+typedef struct {
+  mg_cephes_kernel kernel;
+  mg_cephes_batch_kernel batch;  // NULL if there is no batched version
+  int n_inputs;
+  int n_outputs;
+  int out_double;
+
+  // inputs, converted to double
+  double *in[MG_CEPHES_MAX_INPUTS];
+
+  // element stride of each input along each output dimension, 0 along
+  // dimensions the input is broadcast over
+  IDL_MEMINT strides[MG_CEPHES_MAX_INPUTS][IDL_MAX_ARRAY_DIM];
+
+  // set if every input is either a scalar or has the output's shape, so
+  // inputs can be indexed linearly
+  int linear;
+  IDL_MEMINT linear_step[MG_CEPHES_MAX_INPUTS];
+
+  void *out[MG_CEPHES_MAX_OUTPUTS];
+
+  int n_dim;
+  IDL_MEMINT dims[IDL_MAX_ARRAY_DIM];
+  IDL_MEMINT n_elts;
+} mg_cephes_loop;
+
+
+static void mg_cephes_store(mg_cephes_loop *loop, IDL_MEMINT e, double *y) {
+  int o;
+
+  if (loop->out_double) {
+    for (o = 0; o < loop->n_outputs; o++) ((double *) loop->out[o])[e] = y[o];
+  } else {
+    for (o = 0; o < loop->n_outputs; o++) ((float *) loop->out[o])[e] = (float) y[o];
+  }
+}
+
+
+// set the multi-index into the output and the input offsets for element e
+static void mg_cephes_loop_seek(mg_cephes_loop *loop, IDL_MEMINT e,
+                                IDL_MEMINT *index, IDL_MEMINT *offsets) {
+  int a, d;
+
+  for (d = 0; d < loop->n_dim; d++) {
+    index[d] = e % loop->dims[d];
+    e /= loop->dims[d];
+  }
+  for (a = 0; a < loop->n_inputs; a++) {
+    offsets[a] = 0;
+    for (d = 0; d < loop->n_dim; d++) {
+      offsets[a] += index[d] * loop->strides[a][d];
+    }
+  }
 }
 
-static IDL_VPTR IDL_CDECL IDL_mg_fdtrc(int argc, IDL_VPTR *argv) {
-  double a, b, x;
-  a = IDL_DoubleScalar(argv[0]);
-  b = IDL_DoubleScalar(argv[1]);
-  x = IDL_DoubleScalar(argv[2]);
-  return IDL_GettmpDouble(cephes_fdtrc(a, b, x));
+
+// advance the multi-index and the input offsets to the next element
+static void mg_cephes_loop_next(mg_cephes_loop *loop,
+                                IDL_MEMINT *index, IDL_MEMINT *offsets) {
+  int a, d;
+
+  for (d = 0; d < loop->n_dim; d++) {
+    index[d]++;
+    for (a = 0; a < loop->n_inputs; a++) offsets[a] += loop->strides[a][d];
+    if (index[d] < loop->dims[d]) break;
+    for (a = 0; a < loop->n_inputs; a++) {
+      offsets[a] -= loop->dims[d] * loop->strides[a][d];
+    }
+    index[d] = 0;
+  }
 }
 
-static IDL_VPTR IDL_CDECL IDL_mg_fdtri(int argc, IDL_VPTR *argv) {
-  double a, b, x;
-  a = IDL_DoubleScalar(argv[0]);
-  b = IDL_DoubleScalar(argv[1]);
-  x = IDL_DoubleScalar(argv[2]);
-  return IDL_GettmpDouble(cephes_fdtri(a, b, x));
+
+/*
+  Evaluate elements [start, end) with the batch kernel, CEPHES_BATCH elements
+  at a time. Inputs that are already contiguous are passed directly, others
+  are gathered into buffers first; double results are written in place.
+*/
+static void mg_cephes_loop_batch(mg_cephes_loop *loop,
+                                 IDL_MEMINT start, IDL_MEMINT end) {
+  double buffers[MG_CEPHES_MAX_INPUTS][CEPHES_BATCH];
+  double results[CEPHES_BATCH];
+  const double *x[MG_CEPHES_MAX_INPUTS];
+  double *y;
+  IDL_MEMINT offsets[MG_CEPHES_MAX_INPUTS];
+  IDL_MEMINT index[IDL_MAX_ARRAY_DIM];
+  IDL_MEMINT e;
+  int a, i, n;
+
+  if (!loop->linear) mg_cephes_loop_seek(loop, start, index, offsets);
+
+  for (e = start; e < end; e += n) {
+    n = end - e < CEPHES_BATCH ? (int) (end - e) : CEPHES_BATCH;
+
+    if (loop->linear) {
+      for (a = 0; a < loop->n_inputs; a++) {
+        if (loop->linear_step[a]) {
+          x[a] = loop->in[a] + e;
+        } else {
+          for (i = 0; i < n; i++) buffers[a][i] = loop->in[a][0];
+          x[a] = buffers[a];
+        }
+      }
+    } else {
+      for (i = 0; i < n; i++) {
+        for (a = 0; a < loop->n_inputs; a++) {
+          buffers[a][i] = loop->in[a][offsets[a]];
+        }
+        mg_cephes_loop_next(loop, index, offsets);
+      }
+      for (a = 0; a < loop->n_inputs; a++) x[a] = buffers[a];
+    }
+
+    y = loop->out_double ? (double *) loop->out[0] + e : results;
+    loop->batch(x, y, n);
+    if (!loop->out_double) {
+      for (i = 0; i < n; i++) ((float *) loop->out[0])[e + i] = (float) results[i];
+    }
+  }
 }
 
+
+// thread work function: evaluate elements [start, end) of the output
+static void mg_cephes_loop_range(void *data,
+                                 IDL_MEMINT start, IDL_MEMINT end,
+                                 int thread) {
+  mg_cephes_loop *loop = (mg_cephes_loop *) data;
+  double x[MG_CEPHES_MAX_INPUTS], y[MG_CEPHES_MAX_OUTPUTS];
+  IDL_MEMINT offsets[MG_CEPHES_MAX_INPUTS];
+  IDL_MEMINT index[IDL_MAX_ARRAY_DIM];
+  IDL_MEMINT e;
+  int a;
+
+  if (loop->batch) {
+    mg_cephes_loop_batch(loop, start, end);
+    return;
+  }
+
+  if (loop->linear) {
+    for (a = 0; a < loop->n_inputs; a++) {
+      offsets[a] = start * loop->linear_step[a];
+    }
+    for (e = start; e < end; e++) {
+      for (a = 0; a < loop->n_inputs; a++) {
+        x[a] = loop->in[a][offsets[a]];
+        offsets[a] += loop->linear_step[a];
+      }
+      loop->kernel(x, y);
+      mg_cephes_store(loop, e, y);
+    }
+    return;
+  }
+
+  // general broadcasting: keep a multi-index into the output and advance
+  // each input's offset with it
+  mg_cephes_loop_seek(loop, start, index, offsets);
+  for (e = start; e < end; e++) {
+    for (a = 0; a < loop->n_inputs; a++) x[a] = loop->in[a][offsets[a]];
+    loop->kernel(x, y);
+    mg_cephes_store(loop, e, y);
+    mg_cephes_loop_next(loop, index, offsets);
+  }
+}
+
+
+/*
+  Determine the broadcast shape of the inputs. Dimensions are matched from the
+  first (fastest varying) dimension; each input dimension must either match
+  the other inputs or be 1.
+*/
+static void mg_cephes_broadcast(const char *name, mg_cephes_loop *loop,
+                                IDL_VPTR *inputs) {
+  IDL_MEMINT in_dims[MG_CEPHES_MAX_INPUTS][IDL_MAX_ARRAY_DIM];
+  IDL_MEMINT stride;
+  int a, d;
+
+  loop->n_dim = 0;
+  for (a = 0; a < loop->n_inputs; a++) {
+    for (d = 0; d < IDL_MAX_ARRAY_DIM; d++) in_dims[a][d] = 1;
+    if (inputs[a]->flags & IDL_V_ARR) {
+      for (d = 0; d < inputs[a]->value.arr->n_dim; d++) {
+        in_dims[a][d] = inputs[a]->value.arr->dim[d];
+      }
+      if (inputs[a]->value.arr->n_dim > loop->n_dim) {
+        loop->n_dim = inputs[a]->value.arr->n_dim;
+      }
+    }
+  }
+
+  loop->n_elts = 1;
+  for (d = 0; d < IDL_MAX_ARRAY_DIM; d++) {
+    loop->dims[d] = 1;
+    for (a = 0; a < loop->n_inputs; a++) {
+      if (in_dims[a][d] == 1) continue;
+      if (loop->dims[d] != 1 && loop->dims[d] != in_dims[a][d]) {
+        IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                    "%s: incompatible dimensions in argument %d",
+                    name, a + 1);
+      }
+      loop->dims[d] = in_dims[a][d];
+    }
+    if (d < loop->n_dim) loop->n_elts *= loop->dims[d];
+  }
+
+  loop->linear = 1;
+  for (a = 0; a < loop->n_inputs; a++) {
+    IDL_MEMINT n = (inputs[a]->flags & IDL_V_ARR) ? inputs[a]->value.arr->n_elts : 1;
+
+    stride = 1;
+    for (d = 0; d < IDL_MAX_ARRAY_DIM; d++) {
+      loop->strides[a][d] = in_dims[a][d] == 1 ? 0 : stride;
+      stride *= in_dims[a][d];
+    }
+
+    if (n == 1) {
+      loop->linear_step[a] = 0;
+    } else if (n == loop->n_elts) {
+      loop->linear_step[a] = 1;
+    } else {
+      loop->linear = 0;
+    }
+  }
+}
+
+
+/*
+  Shared implementation of every routine in the table: convert the inputs to
+  double, broadcast them against each other, allocate float or double
+  outputs, and evaluate the kernel over the outputs in parallel. The new
+  temporary outputs are returned in `outputs`.
+*/
+static void mg_cephes_evaluate(const char *name, mg_cephes_kernel kernel,
+                               mg_cephes_batch_kernel batch,
+                               int n_inputs, int n_outputs,
+                               int argc, IDL_VPTR *argv, char *argk,
+                               IDL_VPTR *outputs) {
+  typedef struct {
+    IDL_KW_RESULT_FIRST_FIELD;
+    IDL_LONG double_kw;
+    IDL_LONG tpool_min_elts;
+    IDL_LONG tpool_nthreads;
+  } KW_RESULT;
+
+  // make sure to list keyword in alphabetical order
+  static IDL_KW_PAR kw_pars[] = {
+    { "DOUBLE", IDL_TYP_LONG, 1, IDL_KW_ZERO,
+      0, IDL_KW_OFFSETOF(double_kw) },
+    { "TPOOL_MIN_ELTS", IDL_TYP_LONG, 1, IDL_KW_ZERO,
+      0, IDL_KW_OFFSETOF(tpool_min_elts) },
+    { "TPOOL_NTHREADS", IDL_TYP_LONG, 1, IDL_KW_ZERO,
+      0, IDL_KW_OFFSETOF(tpool_nthreads) },
+    { NULL }
+  };
+
+  KW_RESULT kw;
+  IDL_VPTR plain_args[MG_CEPHES_MAX_INPUTS + MG_CEPHES_MAX_OUTPUTS];
+  IDL_VPTR inputs[MG_CEPHES_MAX_INPUTS];
+  mg_cephes_loop loop;
+  int a, o, nthreads;
+
+  IDL_KWProcessByOffset(argc, argv, argk, kw_pars, plain_args, 1, &kw);
+
+  loop.kernel = kernel;
+  loop.batch = batch;
+  loop.n_inputs = n_inputs;
+  loop.n_outputs = n_outputs;
+  loop.out_double = kw.double_kw;
+
+  for (a = 0; a < n_inputs; a++) {
+    IDL_ENSURE_SIMPLE(plain_args[a]);
+    if (plain_args[a]->type == IDL_TYP_DOUBLE
+          || plain_args[a]->type == IDL_TYP_DCOMPLEX) {
+      loop.out_double = 1;
+    }
+  }
+
+  mg_cephes_broadcast(name, &loop, plain_args);
+
+  for (a = 0; a < n_inputs; a++) {
+    IDL_MEMINT n;
+    char *data;
+
+    inputs[a] = IDL_CvtDbl(1, &plain_args[a]);
+    IDL_VarGetData(inputs[a], &n, &data, IDL_TRUE);
+    loop.in[a] = (double *) data;
+  }
+
+  for (o = 0; o < n_outputs; o++) {
+    int type = loop.out_double ? IDL_TYP_DOUBLE : IDL_TYP_FLOAT;
+    if (loop.n_dim == 0) {
+      outputs[o] = IDL_Gettmp();
+      outputs[o]->type = type;
+      loop.out[o] = &outputs[o]->value.c;
+    } else {
+      loop.out[o] = IDL_MakeTempArray(type, loop.n_dim, loop.dims,
+                                      IDL_ARR_INI_NOP, &outputs[o]);
+    }
+  }
+
+  nthreads = mg_threads_count(loop.n_elts, kw.tpool_nthreads, kw.tpool_min_elts);
+  mg_threads_for(loop.n_elts, nthreads, mg_cephes_loop_range, &loop);
+
+  for (a = 0; a < n_inputs; a++) {
+    if (inputs[a] != plain_args[a]) IDL_Deltmp(inputs[a]);
+  }
+
+  IDL_KW_FREE;
+}
+
+
+/**************************************************************************
+  Generated wrappers
+***************************************************************************/
+
+#define MG_CEPHES_FUNCTION(NAME, IDL_NAME, N_INPUTS, EXPR)                   \
+static void mg_cephes_kernel_ ## NAME(const double *x, double *y) {          \
+  y[0] = EXPR;                                                               \
+}                                                                            \
+static IDL_VPTR IDL_CDECL IDL_mg_ ## NAME(int argc, IDL_VPTR *argv,          \
+                                          char *argk) {                      \
+  IDL_VPTR result;                                                           \
+  mg_cephes_evaluate(IDL_NAME, mg_cephes_kernel_ ## NAME, NULL,              \
+                     N_INPUTS, 1, argc, argv, argk, &result);                \
+  return result;                                                             \
+}
+
+// the batched evaluation is only used where it is faster than the scalar
+// loop, i.e., when the vector kernels have at least LANES lanes
+#define MG_CEPHES_BATCH_FUNCTION(NAME, IDL_NAME, N_INPUTS, LANES, EXPR, BATCH_EXPR) \
+static void mg_cephes_kernel_ ## NAME(const double *x, double *y) {          \
+  y[0] = EXPR;                                                               \
+}                                                                            \
+static void mg_cephes_batch_ ## NAME(const double **x, double *y, int n) {   \
+  BATCH_EXPR;                                                                \
+}                                                                            \
+static IDL_VPTR IDL_CDECL IDL_mg_ ## NAME(int argc, IDL_VPTR *argv,          \
+                                          char *argk) {                      \
+  IDL_VPTR result;                                                           \
+  mg_cephes_evaluate(IDL_NAME, mg_cephes_kernel_ ## NAME,                    \
+                     CEPHES_VLEN >= LANES ? mg_cephes_batch_ ## NAME : NULL, \
+                     N_INPUTS, 1, argc, argv, argk, &result);                \
+  return result;                                                             \
+}
+
+#define MG_CEPHES_PROCEDURE(NAME, IDL_NAME, N_INPUTS, N_OUTPUTS, EXPR)       \
+static void mg_cephes_kernel_ ## NAME(const double *x, double *y) {          \
+  EXPR;                                                                      \
+}                                                                            \
+static void IDL_CDECL IDL_mg_ ## NAME(int argc, IDL_VPTR *argv, char *argk) { \
+  IDL_VPTR results[N_OUTPUTS];                                               \
+  int o;                                                                     \
+  for (o = 0; o < N_OUTPUTS; o++) IDL_EXCLUDE_EXPR(argv[N_INPUTS + o]);      \
+  mg_cephes_evaluate(IDL_NAME, mg_cephes_kernel_ ## NAME, NULL,              \
+                     N_INPUTS, N_OUTPUTS, argc, argv, argk, results);        \
+  for (o = 0; o < N_OUTPUTS; o++) IDL_VarCopy(results[o], argv[N_INPUTS + o]); \
+}
+
+#include "mg_cephes_functions.h"
+
+#undef MG_CEPHES_FUNCTION
+#undef MG_CEPHES_BATCH_FUNCTION
+#undef MG_CEPHES_PROCEDURE
+
+
 int IDL_Load(void) {
   /*
    * These tables contain information on the functions and procedures
-   * that make up the analysis DLM. The information contained in these
-   * tables must be identical to that contained in mg_analysis.dlm.
+   * that make up the cephes DLM. They are generated from
+   * mg_cephes_functions.h, as is the routine list in mg_cephes.dlm.
    */
+#define MG_CEPHES_FUNCTION(NAME, IDL_NAME, N_INPUTS, EXPR)                   \
+    { IDL_mg_ ## NAME, IDL_NAME, N_INPUTS, N_INPUTS,                         \
+      IDL_SYSFUN_DEF_F_KEYWORDS, 0 },
+#define MG_CEPHES_BATCH_FUNCTION(NAME, IDL_NAME, N_INPUTS, LANES, EXPR, BATCH_EXPR) \
+  MG_CEPHES_FUNCTION(NAME, IDL_NAME, N_INPUTS, EXPR)
+#define MG_CEPHES_PROCEDURE(NAME, IDL_NAME, N_INPUTS, N_OUTPUTS, EXPR)
   static IDL_SYSFUN_DEF2 function_addr[] = {
-    { IDL_mg_fdtrc,       "MG_FDTR",        3, 3, 0, 0 },
-    { IDL_mg_fdtrc,       "MG_FDTRC",       3, 3, 0, 0 },
-    { IDL_mg_fdtrc,       "MG_FDTRI",       3, 3, 0, 0 },
+#include "mg_cephes_functions.h"
+  };
+#undef MG_CEPHES_FUNCTION
+#undef MG_CEPHES_BATCH_FUNCTION
+#undef MG_CEPHES_PROCEDURE
+
+#define MG_CEPHES_FUNCTION(NAME, IDL_NAME, N_INPUTS, EXPR)
+#define MG_CEPHES_BATCH_FUNCTION(NAME, IDL_NAME, N_INPUTS, LANES, EXPR, BATCH_EXPR)
+#define MG_CEPHES_PROCEDURE(NAME, IDL_NAME, N_INPUTS, N_OUTPUTS, EXPR)       \
+    { (IDL_SYSRTN_GENERIC) IDL_mg_ ## NAME, IDL_NAME,                        \
+      N_INPUTS + N_OUTPUTS, N_INPUTS + N_OUTPUTS,                            \
+      IDL_SYSFUN_DEF_F_KEYWORDS, 0 },
+  static IDL_SYSFUN_DEF2 procedure_addr[] = {
+#include "mg_cephes_functions.h"
   };
+#undef MG_CEPHES_FUNCTION
+#undef MG_CEPHES_BATCH_FUNCTION
+#undef MG_CEPHES_PROCEDURE
 
   /*
    * Register our routines. The routines must be specified exactly the same
-   * as in mg_analysis.dlm.
+   * as in mg_cephes.dlm.
    */
-  return IDL_SysRtnAdd(function_addr, TRUE, IDL_CARRAY_ELTS(function_addr));
+  return IDL_SysRtnAdd(procedure_addr, FALSE, IDL_CARRAY_ELTS(procedure_addr))
+      && IDL_SysRtnAdd(function_addr, TRUE, IDL_CARRAY_ELTS(function_addr));
 }
@@ -0,0 +1,724 @@
+/*
+  Accuracy and throughput benchmark for the Cephes routines of the mg_cephes
+  DLM.
+
+  Every routine in mg_cephes_functions.h is evaluated on a dense grid and on
+  a random sample of its domain. The error of the double precision result is
+  reported in units in the last place (ULPs) against a long double reference
+  where the C library provides one, and the batched kernels are compared
+  against the scalar routines. Timings are the best of several runs in
+  ns/element for the scalar loop, the batched kernel (if there is one), and
+  the loop the DLM runs, batched only with enough vector lanes, split across
+  threads.
+
+  Usage:
+
+    mg_cephes_bench [-n n_elts] [-r repeats] [-t n_threads] [-s seed]
+                    [-f text|csv|json] [function ...]
+
+  With no function names, all routines are benchmarked. Routines with
+  several outputs are checked on their first output.
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "protos.h"
+
+// most inputs and outputs of any routine in mg_cephes_functions.h
+#define BENCH_MAX_INPUTS  4
+#define BENCH_MAX_OUTPUTS 4
+
+#define BENCH_MAX_THREADS 64
+
+#define BENCH_PI 3.14159265358979323846264338327950288L
+
+// evaluates one element: reads inputs from x, writes outputs to y
+typedef void (*bench_kernel)(const double *x, double *y);
+
+// evaluates n elements from the contiguous input arrays x[0], ...
+typedef void (*bench_batch_kernel)(const double **x, double *y, int n);
+
+// long double reference value of the (first) output
+typedef long double (*bench_reference)(const long double *x);
+
+typedef struct {
+  const char *name;
+  int n_inputs;
+  int n_outputs;
+  bench_kernel kernel;
+  bench_batch_kernel batch;  // NULL if there is no batched version
+  int lanes;                 // fewest vector lanes the DLM uses batch with
+} bench_function;
+
+typedef struct {
+  const char *name;
+  bench_reference reference;
+} bench_reference_def;
+
+typedef struct {
+  const char *name;
+  double lo[BENCH_MAX_INPUTS];
+  double hi[BENCH_MAX_INPUTS];
+} bench_domain;
+
+
+/**************************************************************************
+  Routines, generated from the table of the DLM
+***************************************************************************/
+
+#define MG_CEPHES_FUNCTION(NAME, IDL_NAME, N_INPUTS, EXPR)                   \
+static void bench_kernel_ ## NAME(const double *x, double *y) {              \
+  y[0] = EXPR;                                                               \
+}
+#define MG_CEPHES_BATCH_FUNCTION(NAME, IDL_NAME, N_INPUTS, LANES, EXPR, BATCH_EXPR) \
+static void bench_kernel_ ## NAME(const double *x, double *y) {              \
+  y[0] = EXPR;                                                               \
+}                                                                            \
+static void bench_batch_ ## NAME(const double **x, double *y, int n) {       \
+  BATCH_EXPR;                                                                \
+}
+#define MG_CEPHES_PROCEDURE(NAME, IDL_NAME, N_INPUTS, N_OUTPUTS, EXPR)       \
+static void bench_kernel_ ## NAME(const double *x, double *y) {              \
+  EXPR;                                                                      \
+}
+#include "mg_cephes_functions.h"
+#undef MG_CEPHES_FUNCTION
+#undef MG_CEPHES_BATCH_FUNCTION
+#undef MG_CEPHES_PROCEDURE
+
+static bench_function bench_functions[] = {
+#define MG_CEPHES_FUNCTION(NAME, IDL_NAME, N_INPUTS, EXPR)                   \
+  { #NAME, N_INPUTS, 1, bench_kernel_ ## NAME, NULL, 0 },
+#define MG_CEPHES_BATCH_FUNCTION(NAME, IDL_NAME, N_INPUTS, LANES, EXPR, BATCH_EXPR) \
+  { #NAME, N_INPUTS, 1, bench_kernel_ ## NAME, bench_batch_ ## NAME, LANES },
+#define MG_CEPHES_PROCEDURE(NAME, IDL_NAME, N_INPUTS, N_OUTPUTS, EXPR)       \
+  { #NAME, N_INPUTS, N_OUTPUTS, bench_kernel_ ## NAME, NULL, 0 },
+#include "mg_cephes_functions.h"
+#undef MG_CEPHES_FUNCTION
+#undef MG_CEPHES_BATCH_FUNCTION
+#undef MG_CEPHES_PROCEDURE
+};
+
+
+/**************************************************************************
+  Long double references
+***************************************************************************/
+
+// power series sum_k (x^2/4)^k / (k! (k + nu)!) * (x/2)^nu for nu = 0, 1,
+// accurate for the |x| <= 10 of the default domain
+static long double bench_bessel_i(int nu, long double x) {
+  long double q = x * x / 4.0L, term = nu ? x / 2.0L : 1.0L, sum = 0.0L;
+  int k;
+
+  for (k = 0; k < 200 && term != 0.0L; k++) {
+    sum += term;
+    term *= q / ((k + 1.0L) * (k + 1.0L + nu));
+    if (term < sum * 1.0e-22L && term > -sum * 1.0e-22L) break;
+  }
+  return sum;
+}
+
+static long double bench_ref_cbrt(const long double *x) { return cbrtl(x[0]); }
+static long double bench_ref_cosdg(const long double *x) { return cosl(x[0] * BENCH_PI / 180.0L); }
+static long double bench_ref_cosm1(const long double *x) {
+  long double s = sinl(x[0] / 2.0L);
+  return -2.0L * s * s;
+}
+static long double bench_ref_cotdg(const long double *x) { return 1.0L / tanl(x[0] * BENCH_PI / 180.0L); }
+static long double bench_ref_erf(const long double *x) { return erfl(x[0]); }
+static long double bench_ref_erfc(const long double *x) { return erfcl(x[0]); }
+static long double bench_ref_exp10(const long double *x) { return exp10l(x[0]); }
+static long double bench_ref_exp2(const long double *x) { return exp2l(x[0]); }
+static long double bench_ref_expm1(const long double *x) { return expm1l(x[0]); }
+static long double bench_ref_gamma(const long double *x) { return tgammal(x[0]); }
+static long double bench_ref_i0(const long double *x) { return bench_bessel_i(0, x[0]); }
+static long double bench_ref_i0e(const long double *x) { return expl(-fabsl(x[0])) * bench_bessel_i(0, x[0]); }
+static long double bench_ref_i1(const long double *x) { return bench_bessel_i(1, x[0]); }
+static long double bench_ref_i1e(const long double *x) { return expl(-fabsl(x[0])) * bench_bessel_i(1, x[0]); }
+static long double bench_ref_j0(const long double *x) { return j0l(x[0]); }
+static long double bench_ref_j1(const long double *x) { return j1l(x[0]); }
+static long double bench_ref_lgam(const long double *x) { return lgammal(x[0]); }
+static long double bench_ref_log1p(const long double *x) { return log1pl(x[0]); }
+static long double bench_ref_log_ndtr(const long double *x) {
+  long double z = x[0] / sqrtl(2.0L);
+  return z > 0.0L ? log1pl(-0.5L * erfcl(z)) : logl(0.5L * erfcl(-z));
+}
+static long double bench_ref_ndtr(const long double *x) { return 0.5L * erfcl(-x[0] / sqrtl(2.0L)); }
+static long double bench_ref_rgamma(const long double *x) { return 1.0L / tgammal(x[0]); }
+static long double bench_ref_sindg(const long double *x) { return sinl(x[0] * BENCH_PI / 180.0L); }
+static long double bench_ref_tandg(const long double *x) { return tanl(x[0] * BENCH_PI / 180.0L); }
+static long double bench_ref_y0(const long double *x) { return y0l(x[0]); }
+static long double bench_ref_y1(const long double *x) { return y1l(x[0]); }
+static long double bench_ref_beta(const long double *x) {
+  return expl(lgammal(x[0]) + lgammal(x[1]) - lgammal(x[0] + x[1]));
+}
+static long double bench_ref_yn(const long double *x) { return ynl((int) x[0], x[1]); }
+
+static bench_reference_def bench_references[] = {
+  { "beta", bench_ref_beta },
+  { "cbrt", bench_ref_cbrt },
+  { "cosdg", bench_ref_cosdg },
+  { "cosm1", bench_ref_cosm1 },
+  { "cotdg", bench_ref_cotdg },
+  { "erf", bench_ref_erf },
+  { "erfc", bench_ref_erfc },
+  { "exp10", bench_ref_exp10 },
+  { "exp2", bench_ref_exp2 },
+  { "expm1", bench_ref_expm1 },
+  { "gamma", bench_ref_gamma },
+  { "i0", bench_ref_i0 },
+  { "i0e", bench_ref_i0e },
+  { "i1", bench_ref_i1 },
+  { "i1e", bench_ref_i1e },
+  { "j0", bench_ref_j0 },
+  { "j1", bench_ref_j1 },
+  { "lgam", bench_ref_lgam },
+  { "log1p", bench_ref_log1p },
+  { "log_ndtr", bench_ref_log_ndtr },
+  { "ndtr", bench_ref_ndtr },
+  { "rgamma", bench_ref_rgamma },
+  { "sindg", bench_ref_sindg },
+  { "tandg", bench_ref_tandg },
+  { "y0", bench_ref_y0 },
+  { "y1", bench_ref_y1 },
+  { "yn", bench_ref_yn },
+  { NULL, NULL }
+};
+
+
+/**************************************************************************
+  Argument domains, [0, 10] for each input unless listed
+***************************************************************************/
+
+static bench_domain bench_domains[] = {
+  { "bdtr", { 0.0, 10.0, 0.0 }, { 10.0, 20.0, 1.0 } },
+  { "bdtrc", { 0.0, 10.0, 0.0 }, { 10.0, 20.0, 1.0 } },
+  { "bdtri", { 0.0, 10.0, 0.0 }, { 10.0, 20.0, 1.0 } },
+  { "btdtr", { 0.0, 0.0, 0.0 }, { 10.0, 10.0, 1.0 } },
+  { "cbrt", { -1000.0 }, { 1000.0 } },
+  { "chdtri", { 0.0, 0.0 }, { 10.0, 1.0 } },
+  { "cosdg", { -720.0 }, { 720.0 } },
+  { "cosm1", { -3.2 }, { 3.2 } },
+  { "cotdg", { -720.0 }, { 720.0 } },
+  { "dawsn", { -10.0 }, { 10.0 } },
+  { "ellie", { -10.0, -10.0 }, { 10.0, 1.0 } },
+  { "ellik", { -1.5, -10.0 }, { 1.5, 1.0 } },
+  { "ellpe", { 0.0 }, { 1.0 } },
+  { "ellpj", { -10.0, 0.0 }, { 10.0, 1.0 } },
+  { "ellpk", { 0.0 }, { 1.0 } },
+  { "erf", { -6.0 }, { 6.0 } },
+  { "erfc", { -6.0 }, { 26.0 } },
+  { "exp10", { -300.0 }, { 300.0 } },
+  { "exp2", { -1000.0 }, { 1000.0 } },
+  { "expm1", { -5.0 }, { 5.0 } },
+  { "fdtri", { 1.0, 1.0, 0.0 }, { 10.0, 10.0, 1.0 } },
+  { "fresnl", { -10.0 }, { 10.0 } },
+  { "gamma", { -10.0 }, { 10.0 } },
+  { "gdtri", { 0.0, 0.0, 0.0 }, { 10.0, 10.0, 1.0 } },
+  { "hyp2f1", { 0.0, 0.0, 0.0, -1.0 }, { 5.0, 5.0, 5.0, 1.0 } },
+  { "hyperg", { 0.0, 0.0, -10.0 }, { 5.0, 5.0, 10.0 } },
+  { "i0", { -10.0 }, { 10.0 } },
+  { "i0e", { -10.0 }, { 10.0 } },
+  { "i1", { -10.0 }, { 10.0 } },
+  { "i1e", { -10.0 }, { 10.0 } },
+  { "igami", { 0.0, 0.0 }, { 10.0, 1.0 } },
+  { "incbet", { 0.0, 0.0, 0.0 }, { 10.0, 10.0, 1.0 } },
+  { "incbi", { 0.0, 0.0, 0.0 }, { 10.0, 10.0, 1.0 } },
+  { "j0", { -30.0 }, { 30.0 } },
+  { "j1", { -30.0 }, { 30.0 } },
+  { "jv", { -5.0, -30.0 }, { 5.0, 30.0 } },
+  { "kolmogi", { 0.0 }, { 1.0 } },
+  { "kolmogorov", { 0.0 }, { 3.0 } },
+  { "lgam", { -10.0 }, { 100.0 } },
+  { "log1p", { -0.9 }, { 10.0 } },
+  { "log_ndtr", { -10.0 }, { 10.0 } },
+  { "nbdtr", { 0.0, 1.0, 0.0 }, { 10.0, 10.0, 1.0 } },
+  { "nbdtrc", { 0.0, 1.0, 0.0 }, { 10.0, 10.0, 1.0 } },
+  { "nbdtri", { 0.0, 1.0, 0.0 }, { 10.0, 10.0, 1.0 } },
+  { "ndtr", { -10.0 }, { 10.0 } },
+  { "ndtri", { 0.0 }, { 1.0 } },
+  { "pdtri", { 0.0, 0.0 }, { 10.0, 1.0 } },
+  { "psi", { -10.0 }, { 10.0 } },
+  { "radian", { -360.0, 0.0, 0.0 }, { 360.0, 60.0, 60.0 } },
+  { "rgamma", { -10.0 }, { 10.0 } },
+  { "shichi", { -10.0 }, { 10.0 } },
+  { "sici", { -10.0 }, { 10.0 } },
+  { "sindg", { -720.0 }, { 720.0 } },
+  { "smirnov", { 1.0, 0.0 }, { 20.0, 1.0 } },
+  { "smirnovi", { 1.0, 0.0 }, { 20.0, 1.0 } },
+  { "stdtr", { 1.0, -10.0 }, { 20.0, 10.0 } },
+  { "stdtri", { 1.0, 0.0 }, { 20.0, 1.0 } },
+  { "tandg", { -720.0 }, { 720.0 } },
+  { "tukeylambdacdf", { -10.0, -2.0 }, { 10.0, 2.0 } },
+  { "zetac", { -10.0 }, { 50.0 } },
+  { NULL }
+};
+
+
+static bench_reference bench_find_reference(const char *name) {
+  int i;
+
+  for (i = 0; bench_references[i].name; i++) {
+    if (strcmp(bench_references[i].name, name) == 0) return bench_references[i].reference;
+  }
+  return NULL;
+}
+
+
+static void bench_find_domain(const char *name, double *lo, double *hi) {
+  int a, i;
+
+  for (a = 0; a < BENCH_MAX_INPUTS; a++) {
+    lo[a] = 0.0;
+    hi[a] = 10.0;
+  }
+  for (i = 0; bench_domains[i].name; i++) {
+    if (strcmp(bench_domains[i].name, name) == 0) {
+      memcpy(lo, bench_domains[i].lo, sizeof(bench_domains[i].lo));
+      memcpy(hi, bench_domains[i].hi, sizeof(bench_domains[i].hi));
+      return;
+    }
+  }
+}
+
+
+/**************************************************************************
+  Argument grids
+***************************************************************************/
+
+// xorshift64* generator, so that the random grid only depends on the seed
+static double bench_random(uint64_t *state) {
+  *state ^= *state >> 12;
+  *state ^= *state << 25;
+  *state ^= *state >> 27;
+  return (double) ((*state * 2685821657736338717ULL) >> 11) / 9007199254740992.0;
+}
+
+
+// dense lattice of k^n_inputs <= n points at the centers of the grid cells;
+// returns the number of points
+static int bench_dense_grid(double **x, int n_inputs, int n,
+                            const double *lo, const double *hi) {
+  int k, a, e, i, total;
+
+  k = (int) floor(pow((double) n, 1.0 / n_inputs) + 1.0e-9);
+  if (k < 1) k = 1;
+  for (total = 1, a = 0; a < n_inputs; a++) total *= k;
+
+  for (e = 0; e < total; e++) {
+    for (i = e, a = 0; a < n_inputs; a++, i /= k) {
+      x[a][e] = lo[a] + (hi[a] - lo[a]) * ((i % k) + 0.5) / k;
+    }
+  }
+  return total;
+}
+
+
+static int bench_random_grid(double **x, int n_inputs, int n,
+                             const double *lo, const double *hi,
+                             uint64_t seed) {
+  uint64_t state = seed ? seed : 1;
+  int a, e;
+
+  for (e = 0; e < n; e++) {
+    for (a = 0; a < n_inputs; a++) {
+      x[a][e] = lo[a] + (hi[a] - lo[a]) * bench_random(&state);
+    }
+  }
+  return n;
+}
+
+
+/**************************************************************************
+  Evaluation paths
+***************************************************************************/
+
+typedef struct {
+  bench_function *f;
+  double **x;
+  double *y;
+  int start;
+  int end;
+  int batched;
+} bench_chunk;
+
+
+// evaluate elements [start, end) of the first output
+static void bench_run_chunk(bench_chunk *chunk) {
+  bench_function *f = chunk->f;
+  double x[BENCH_MAX_INPUTS], y[BENCH_MAX_OUTPUTS];
+  const double *xb[BENCH_MAX_INPUTS];
+  int a, e, n;
+
+  if (chunk->batched) {
+    for (e = chunk->start; e < chunk->end; e += n) {
+      n = chunk->end - e < CEPHES_BATCH ? chunk->end - e : CEPHES_BATCH;
+      for (a = 0; a < f->n_inputs; a++) xb[a] = chunk->x[a] + e;
+      f->batch(xb, chunk->y + e, n);
+    }
+    return;
+  }
+
+  for (e = chunk->start; e < chunk->end; e++) {
+    for (a = 0; a < f->n_inputs; a++) x[a] = chunk->x[a][e];
+    f->kernel(x, y);
+    chunk->y[e] = y[0];
+  }
+}
+
+
+static void *bench_run_thread(void *arg) {
+  bench_run_chunk((bench_chunk *) arg);
+  return NULL;
+}
+
+
+// evaluate all n elements, split into n_threads chunks
+static void bench_run(bench_function *f, double **x, double *y, int n,
+                      int batched, int n_threads) {
+  bench_chunk chunks[BENCH_MAX_THREADS];
+  pthread_t threads[BENCH_MAX_THREADS];
+  int started[BENCH_MAX_THREADS];
+  int chunk_size, t;
+
+  if (n_threads > n) n_threads = n > 0 ? n : 1;
+  chunk_size = (n + n_threads - 1) / n_threads;
+  for (t = 0; t < n_threads; t++) {
+    chunks[t].f = f;
+    chunks[t].x = x;
+    chunks[t].y = y;
+    chunks[t].start = t * chunk_size < n ? t * chunk_size : n;
+    chunks[t].end = (t + 1) * chunk_size < n ? (t + 1) * chunk_size : n;
+    chunks[t].batched = batched;
+  }
+
+  for (t = 1; t < n_threads; t++) {
+    started[t] = pthread_create(&threads[t], NULL, bench_run_thread, &chunks[t]) == 0;
+  }
+  bench_run_chunk(&chunks[0]);
+  for (t = 1; t < n_threads; t++) {
+    if (started[t]) {
+      pthread_join(threads[t], NULL);
+    } else {
+      bench_run_chunk(&chunks[t]);
+    }
+  }
+}
+
+
+static double bench_now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1.0e9 + ts.tv_nsec;
+}
+
+
+// best time of repeats evaluations in ns/element
+static double bench_time(bench_function *f, double **x, double *y, int n,
+                         int batched, int n_threads, int repeats) {
+  double best = HUGE_VAL, start, elapsed;
+  int r;
+
+  for (r = 0; r < repeats; r++) {
+    start = bench_now();
+    bench_run(f, x, y, n, batched, n_threads);
+    elapsed = bench_now() - start;
+    if (elapsed < best) best = elapsed;
+  }
+  return best / n;
+}
+
+
+/**************************************************************************
+  Errors
+***************************************************************************/
+
+// map a double to an integer so that adjacent doubles differ by 1
+static int64_t bench_ordered(double d) {
+  int64_t i;
+
+  memcpy(&i, &d, sizeof(i));
+  return i < 0 ? INT64_MIN - i : i;
+}
+
+
+// distance in ULPs between two doubles, HUGE_VAL if exactly one is NaN
+static double bench_ulps_double(double a, double b) {
+  int64_t ia, ib;
+
+  if (isnan(a) || isnan(b)) return isnan(a) && isnan(b) ? 0.0 : HUGE_VAL;
+  if (a == b) return 0.0;
+  ia = bench_ordered(a);
+  ib = bench_ordered(b);
+  return (double) (ia > ib ? (uint64_t) ia - (uint64_t) ib : (uint64_t) ib - (uint64_t) ia);
+}
+
+
+// error of y in ULPs of the reference value r
+static double bench_ulps_reference(double y, long double r) {
+  double rd = (double) r;
+  long double ulp;
+
+  if (isnan(rd) || isinf(rd)) return bench_ulps_double(y, rd);
+  if (!isfinite(y)) return HUGE_VAL;
+
+  ulp = rd == 0.0 ? 0.0L : ldexpl(1.0L, ilogbl(r) - 52);
+  if (ulp < 0x1p-1074L) ulp = 0x1p-1074L;
+  return (double) (fabsl((long double) y - r) / ulp);
+}
+
+
+typedef struct {
+  const char *function;
+  const char *grid;
+  int n;
+  int has_reference;
+  double max_ulps;       // against the reference
+  double mean_ulps;
+  int n_bad;             // NaN/infinite where the reference is not, etc.
+  double batch_max_ulps; // batched against scalar, NaN if no batch kernel
+  double scalar_ns;
+  double batch_ns;       // NaN if no batch kernel
+  double threaded_ns;
+} bench_result;
+
+
+static void bench_accuracy(bench_function *f, bench_reference reference,
+                           double **x, const double *y, const double *yb,
+                           int n, bench_result *result) {
+  long double xl[BENCH_MAX_INPUTS];
+  double err, sum = 0.0;
+  int a, e, n_finite = 0;
+
+  result->max_ulps = 0.0;
+  result->n_bad = 0;
+  result->batch_max_ulps = f->batch ? 0.0 : NAN;
+
+  for (e = 0; e < n; e++) {
+    if (reference) {
+      for (a = 0; a < f->n_inputs; a++) xl[a] = x[a][e];
+      err = bench_ulps_reference(y[e], reference(xl));
+      if (err == HUGE_VAL) {
+        result->n_bad++;
+      } else {
+        sum += err;
+        n_finite++;
+        if (err > result->max_ulps) result->max_ulps = err;
+      }
+    }
+    if (f->batch) {
+      err = bench_ulps_double(y[e], yb[e]);
+      if (err > result->batch_max_ulps) result->batch_max_ulps = err;
+    }
+  }
+
+  result->has_reference = reference != NULL;
+  result->mean_ulps = n_finite > 0 ? sum / n_finite : 0.0;
+}
+
+
+/**************************************************************************
+  Output
+***************************************************************************/
+
+typedef enum { BENCH_TEXT, BENCH_CSV, BENCH_JSON } bench_format;
+
+
+// print a number, or the missing value of the format if it is NaN
+static void bench_print_number(bench_format format, const char *fmt, double v) {
+  if (!isnan(v)) {
+    printf(fmt, v);
+  } else if (format == BENCH_JSON) {
+    printf("null");
+  } else if (format == BENCH_TEXT) {
+    printf("%*s", atoi(fmt + 1), "-");
+  }
+}
+
+
+static void bench_print_header(bench_format format) {
+  switch (format) {
+    case BENCH_TEXT:
+      printf("%-16s %-6s %8s %10s %10s %6s %10s %10s %10s %10s\n",
+             "function", "grid", "n", "max_ulp", "mean_ulp", "bad",
+             "batch_ulp", "scalar_ns", "batch_ns", "thread_ns");
+      break;
+    case BENCH_CSV:
+      printf("function,grid,n,max_ulp,mean_ulp,bad,batch_ulp,scalar_ns,batch_ns,thread_ns\n");
+      break;
+    case BENCH_JSON:
+      printf("[");
+      break;
+  }
+}
+
+
+static void bench_print_result(bench_format format, const bench_result *r, int first) {
+  double max_ulps = r->has_reference ? r->max_ulps : NAN;
+  double mean_ulps = r->has_reference ? r->mean_ulps : NAN;
+
+  switch (format) {
+    case BENCH_TEXT:
+      printf("%-16s %-6s %8d ", r->function, r->grid, r->n);
+      bench_print_number(format, "%10.2f", max_ulps);
+      printf(" ");
+      bench_print_number(format, "%10.3f", mean_ulps);
+      printf(" %6d ", r->n_bad);
+      bench_print_number(format, "%10.0f", r->batch_max_ulps);
+      printf(" %10.1f ", r->scalar_ns);
+      bench_print_number(format, "%10.1f", r->batch_ns);
+      printf(" %10.1f\n", r->threaded_ns);
+      break;
+    case BENCH_CSV:
+      printf("%s,%s,%d,", r->function, r->grid, r->n);
+      bench_print_number(format, "%.3f", max_ulps);
+      printf(",");
+      bench_print_number(format, "%.4f", mean_ulps);
+      printf(",%d,", r->n_bad);
+      bench_print_number(format, "%.0f", r->batch_max_ulps);
+      printf(",%.2f,", r->scalar_ns);
+      bench_print_number(format, "%.2f", r->batch_ns);
+      printf(",%.2f\n", r->threaded_ns);
+      break;
+    case BENCH_JSON:
+      printf("%s\n  {\"function\": \"%s\", \"grid\": \"%s\", \"n\": %d, ",
+             first ? "" : ",", r->function, r->grid, r->n);
+      printf("\"max_ulp\": ");
+      bench_print_number(format, "%.3f", max_ulps);
+      printf(", \"mean_ulp\": ");
+      bench_print_number(format, "%.4f", mean_ulps);
+      printf(", \"bad\": %d, \"batch_ulp\": ", r->n_bad);
+      bench_print_number(format, "%.0f", r->batch_max_ulps);
+      printf(", \"scalar_ns\": %.2f, \"batch_ns\": ", r->scalar_ns);
+      bench_print_number(format, "%.2f", r->batch_ns);
+      printf(", \"thread_ns\": %.2f}", r->threaded_ns);
+      break;
+  }
+}
+
+
+static void bench_print_footer(bench_format format) {
+  if (format == BENCH_JSON) printf("\n]\n");
+}
+
+
+/**************************************************************************
+  Main
+***************************************************************************/
+
+static void bench_usage(const char *prog) {
+  fprintf(stderr,
+          "usage: %s [-n n_elts] [-r repeats] [-t n_threads] [-s seed] "
+          "[-f text|csv|json] [function ...]\n", prog);
+}
+
+
+static int bench_selected(const char *name, int argc, char **argv) {
+  int i;
+
+  if (argc == 0) return 1;
+  for (i = 0; i < argc; i++) {
+    if (strcmp(argv[i], name) == 0) return 1;
+  }
+  return 0;
+}
+
+
+int main(int argc, char **argv) {
+  bench_format format = BENCH_TEXT;
+  int n_elts = 100000, repeats = 3, n_threads = 0;
+  uint64_t seed = 1;
+  double *x[BENCH_MAX_INPUTS], *y, *yb;
+  double lo[BENCH_MAX_INPUTS], hi[BENCH_MAX_INPUTS];
+  bench_result result;
+  bench_function *f;
+  const char *grids[] = { "dense", "random" };
+  int a, g, i, n, opt, first = 1;
+
+  while ((opt = getopt(argc, argv, "n:r:t:s:f:h")) != -1) {
+    switch (opt) {
+      case 'n': n_elts = atoi(optarg); break;
+      case 'r': repeats = atoi(optarg); break;
+      case 't': n_threads = atoi(optarg); break;
+      case 's': seed = strtoull(optarg, NULL, 10); break;
+      case 'f':
+        if (strcmp(optarg, "text") == 0) {
+          format = BENCH_TEXT;
+        } else if (strcmp(optarg, "csv") == 0) {
+          format = BENCH_CSV;
+        } else if (strcmp(optarg, "json") == 0) {
+          format = BENCH_JSON;
+        } else {
+          bench_usage(argv[0]);
+          return EXIT_FAILURE;
+        }
+        break;
+      default:
+        bench_usage(argv[0]);
+        return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+
+  if (n_elts < 1 || repeats < 1) {
+    bench_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  if (n_threads <= 0) n_threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+  if (n_threads < 1) n_threads = 1;
+  if (n_threads > BENCH_MAX_THREADS) n_threads = BENCH_MAX_THREADS;
+
+  for (a = 0; a < BENCH_MAX_INPUTS; a++) x[a] = malloc(n_elts * sizeof(double));
+  y = malloc(n_elts * sizeof(double));
+  yb = malloc(n_elts * sizeof(double));
+  for (a = 0; a < BENCH_MAX_INPUTS; a++) {
+    if (!x[a]) return EXIT_FAILURE;
+  }
+  if (!y || !yb) return EXIT_FAILURE;
+
+  bench_print_header(format);
+
+  for (i = 0; i < (int) (sizeof(bench_functions) / sizeof(bench_functions[0])); i++) {
+    f = &bench_functions[i];
+    if (!bench_selected(f->name, argc - optind, argv + optind)) continue;
+
+    bench_find_domain(f->name, lo, hi);
+    for (g = 0; g < 2; g++) {
+      n = g == 0
+            ? bench_dense_grid(x, f->n_inputs, n_elts, lo, hi)
+            : bench_random_grid(x, f->n_inputs, n_elts, lo, hi, seed);
+
+      result.function = f->name;
+      result.grid = grids[g];
+      result.n = n;
+
+      result.batch_ns = f->batch ? bench_time(f, x, yb, n, 1, 1, repeats) : NAN;
+      result.threaded_ns = bench_time(f, x, yb, n,
+                                      f->batch && CEPHES_VLEN >= f->lanes,
+                                      n_threads, repeats);
+      result.scalar_ns = bench_time(f, x, y, n, 0, 1, repeats);
+
+      bench_accuracy(f, bench_find_reference(f->name), x, y, yb, n, &result);
+      bench_print_result(format, &result, first);
+      first = 0;
+      fflush(stdout);
+    }
+  }
+
+  bench_print_footer(format);
+
+  for (a = 0; a < BENCH_MAX_INPUTS; a++) free(x[a]);
+  free(y);
+  free(yb);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,125 @@
+/*
+  Table of the Cephes routines exposed by the mg_cephes DLM.
+
+  This file is included by mg_cephes.c with the macros below defined to
+  generate a kernel, an IDL wrapper, and a registration entry for each line.
+  CMake also scans it to generate the routine list in mg_cephes.dlm, so each
+  entry must stay on a single line and must not contain a semicolon.
+
+    MG_CEPHES_FUNCTION(name, IDL_NAME, n_inputs, expr)
+      `expr` evaluates the function on the inputs `x[0]`, ..., `x[n - 1]`
+
+    MG_CEPHES_BATCH_FUNCTION(name, IDL_NAME, n_inputs, lanes, expr, batch_expr)
+      like MG_CEPHES_FUNCTION, but also gives a batched evaluation
+      `batch_expr` of the function on the `n` contiguous elements of the
+      input arrays `x[0]`, ... storing the results in the array `y`; the
+      batched evaluation is used when the vector kernels have at least
+      `lanes` lanes (CEPHES_VLEN), the fewest at which it is measured to be
+      faster than the scalar loop
+
+    MG_CEPHES_PROCEDURE(name, IDL_NAME, n_inputs, n_outputs, expr)
+      `expr` evaluates the routine on the inputs `x[0]`, ... and stores its
+      results in the outputs `y[0]`, ...
+
+  Integer parameters (counts, orders, degrees of freedom) are passed as
+  doubles and truncated. The internal helpers `cephes_onef2`,
+  `cephes_threef0`, `cephes_hyp2f0`, `cephes_sincos`, and `cephes_round` are
+  not exposed.
+*/
+
+// special functions of one argument
+MG_CEPHES_FUNCTION(cbrt, "MG_CBRT", 1, cephes_cbrt(x[0]))
+MG_CEPHES_FUNCTION(cosdg, "MG_COSDG", 1, cephes_cosdg(x[0]))
+MG_CEPHES_FUNCTION(cosm1, "MG_COSM1", 1, cephes_cosm1(x[0]))
+MG_CEPHES_FUNCTION(cotdg, "MG_COTDG", 1, cephes_cotdg(x[0]))
+MG_CEPHES_FUNCTION(dawsn, "MG_DAWSN", 1, cephes_dawsn(x[0]))
+MG_CEPHES_FUNCTION(ellpe, "MG_ELLPE", 1, cephes_ellpe(x[0]))
+MG_CEPHES_FUNCTION(ellpk, "MG_ELLPK", 1, cephes_ellpk(x[0]))
+MG_CEPHES_BATCH_FUNCTION(erf, "MG_ERF", 1, 4, cephes_erf(x[0]), cephes_erf_batch(x[0], y, n))
+MG_CEPHES_BATCH_FUNCTION(erfc, "MG_ERFC", 1, 4, cephes_erfc(x[0]), cephes_erfc_batch(x[0], y, n))
+MG_CEPHES_FUNCTION(exp10, "MG_EXP10", 1, cephes_exp10(x[0]))
+MG_CEPHES_FUNCTION(exp2, "MG_EXP2", 1, cephes_exp2(x[0]))
+MG_CEPHES_FUNCTION(expm1, "MG_EXPM1", 1, cephes_expm1(x[0]))
+MG_CEPHES_BATCH_FUNCTION(gamma, "MG_GAMMA", 1, 4, cephes_Gamma(x[0]), cephes_Gamma_batch(x[0], y, n))
+MG_CEPHES_BATCH_FUNCTION(i0, "MG_I0", 1, 2, cephes_i0(x[0]), cephes_i0_batch(x[0], y, n))
+MG_CEPHES_BATCH_FUNCTION(i0e, "MG_I0E", 1, 2, cephes_i0e(x[0]), cephes_i0e_batch(x[0], y, n))
+MG_CEPHES_BATCH_FUNCTION(i1, "MG_I1", 1, 2, cephes_i1(x[0]), cephes_i1_batch(x[0], y, n))
+MG_CEPHES_BATCH_FUNCTION(i1e, "MG_I1E", 1, 2, cephes_i1e(x[0]), cephes_i1e_batch(x[0], y, n))
+MG_CEPHES_BATCH_FUNCTION(j0, "MG_J0", 1, 2, cephes_j0(x[0]), cephes_j0_batch(x[0], y, n))
+MG_CEPHES_FUNCTION(j1, "MG_J1", 1, cephes_j1(x[0]))
+MG_CEPHES_FUNCTION(k0, "MG_K0", 1, cephes_k0(x[0]))
+MG_CEPHES_FUNCTION(k0e, "MG_K0E", 1, cephes_k0e(x[0]))
+MG_CEPHES_FUNCTION(k1, "MG_K1", 1, cephes_k1(x[0]))
+MG_CEPHES_FUNCTION(k1e, "MG_K1E", 1, cephes_k1e(x[0]))
+MG_CEPHES_FUNCTION(kolmogi, "MG_KOLMOGI", 1, cephes_kolmogi(x[0]))
+MG_CEPHES_FUNCTION(kolmogorov, "MG_KOLMOGOROV", 1, cephes_kolmogorov(x[0]))
+MG_CEPHES_FUNCTION(lgam, "MG_LGAM", 1, cephes_lgam(x[0]))
+MG_CEPHES_FUNCTION(log1p, "MG_LOG1P", 1, cephes_log1p(x[0]))
+MG_CEPHES_FUNCTION(log_ndtr, "MG_LOG_NDTR", 1, log_ndtr(x[0]))
+MG_CEPHES_BATCH_FUNCTION(ndtr, "MG_NDTR", 1, 4, cephes_ndtr(x[0]), cephes_ndtr_batch(x[0], y, n))
+MG_CEPHES_FUNCTION(ndtri, "MG_NDTRI", 1, cephes_ndtri(x[0]))
+MG_CEPHES_FUNCTION(psi, "MG_PSI", 1, cephes_psi(x[0]))
+MG_CEPHES_FUNCTION(rgamma, "MG_RGAMMA", 1, cephes_rgamma(x[0]))
+MG_CEPHES_FUNCTION(sindg, "MG_SINDG", 1, cephes_sindg(x[0]))
+MG_CEPHES_FUNCTION(spence, "MG_SPENCE", 1, cephes_spence(x[0]))
+MG_CEPHES_FUNCTION(tandg, "MG_TANDG", 1, cephes_tandg(x[0]))
+MG_CEPHES_FUNCTION(y0, "MG_Y0", 1, cephes_y0(x[0]))
+MG_CEPHES_FUNCTION(y1, "MG_Y1", 1, cephes_y1(x[0]))
+MG_CEPHES_FUNCTION(zetac, "MG_ZETAC", 1, cephes_zetac(x[0]))
+
+// special functions of two arguments
+MG_CEPHES_FUNCTION(beta, "MG_BETA", 2, cephes_beta(x[0], x[1]))
+MG_CEPHES_FUNCTION(chdtr, "MG_CHDTR", 2, cephes_chdtr(x[0], x[1]))
+MG_CEPHES_FUNCTION(chdtrc, "MG_CHDTRC", 2, cephes_chdtrc(x[0], x[1]))
+MG_CEPHES_FUNCTION(chdtri, "MG_CHDTRI", 2, cephes_chdtri(x[0], x[1]))
+MG_CEPHES_FUNCTION(ellie, "MG_ELLIE", 2, cephes_ellie(x[0], x[1]))
+MG_CEPHES_FUNCTION(ellik, "MG_ELLIK", 2, cephes_ellik(x[0], x[1]))
+MG_CEPHES_FUNCTION(expn, "MG_EXPN", 2, cephes_expn((int) x[0], x[1]))
+MG_CEPHES_FUNCTION(igam, "MG_IGAM", 2, cephes_igam(x[0], x[1]))
+MG_CEPHES_FUNCTION(igamc, "MG_IGAMC", 2, cephes_igamc(x[0], x[1]))
+MG_CEPHES_FUNCTION(igami, "MG_IGAMI", 2, cephes_igami(x[0], x[1]))
+MG_CEPHES_FUNCTION(iv, "MG_IV", 2, cephes_iv(x[0], x[1]))
+MG_CEPHES_FUNCTION(jv, "MG_JV", 2, cephes_jv(x[0], x[1]))
+MG_CEPHES_FUNCTION(kn, "MG_KN", 2, cephes_kn((int) x[0], x[1]))
+MG_CEPHES_FUNCTION(lbeta, "MG_LBETA", 2, cephes_lbeta(x[0], x[1]))
+MG_CEPHES_FUNCTION(pdtr, "MG_PDTR", 2, cephes_pdtr((int) x[0], x[1]))
+MG_CEPHES_FUNCTION(pdtrc, "MG_PDTRC", 2, cephes_pdtrc((int) x[0], x[1]))
+MG_CEPHES_FUNCTION(pdtri, "MG_PDTRI", 2, cephes_pdtri((int) x[0], x[1]))
+MG_CEPHES_FUNCTION(smirnov, "MG_SMIRNOV", 2, cephes_smirnov((int) x[0], x[1]))
+MG_CEPHES_FUNCTION(smirnovi, "MG_SMIRNOVI", 2, cephes_smirnovi((int) x[0], x[1]))
+MG_CEPHES_FUNCTION(stdtr, "MG_STDTR", 2, cephes_stdtr((int) x[0], x[1]))
+MG_CEPHES_FUNCTION(stdtri, "MG_STDTRI", 2, cephes_stdtri((int) x[0], x[1]))
+MG_CEPHES_FUNCTION(struve, "MG_STRUVE", 2, cephes_struve(x[0], x[1]))
+MG_CEPHES_FUNCTION(tukeylambdacdf, "MG_TUKEYLAMBDACDF", 2, tukeylambdacdf(x[0], x[1]))
+MG_CEPHES_FUNCTION(yn, "MG_YN", 2, cephes_yn((int) x[0], x[1]))
+MG_CEPHES_FUNCTION(yv, "MG_YV", 2, cephes_yv(x[0], x[1]))
+MG_CEPHES_FUNCTION(zeta, "MG_ZETA", 2, cephes_zeta(x[0], x[1]))
+
+// special functions of three arguments
+MG_CEPHES_FUNCTION(bdtr, "MG_BDTR", 3, cephes_bdtr((int) x[0], (int) x[1], x[2]))
+MG_CEPHES_FUNCTION(bdtrc, "MG_BDTRC", 3, cephes_bdtrc((int) x[0], (int) x[1], x[2]))
+MG_CEPHES_FUNCTION(bdtri, "MG_BDTRI", 3, cephes_bdtri((int) x[0], (int) x[1], x[2]))
+MG_CEPHES_FUNCTION(btdtr, "MG_BTDTR", 3, cephes_btdtr(x[0], x[1], x[2]))
+MG_CEPHES_FUNCTION(fdtr, "MG_FDTR", 3, cephes_fdtr(x[0], x[1], x[2]))
+MG_CEPHES_FUNCTION(fdtrc, "MG_FDTRC", 3, cephes_fdtrc(x[0], x[1], x[2]))
+MG_CEPHES_FUNCTION(fdtri, "MG_FDTRI", 3, cephes_fdtri(x[0], x[1], x[2]))
+MG_CEPHES_FUNCTION(gdtr, "MG_GDTR", 3, cephes_gdtr(x[0], x[1], x[2]))
+MG_CEPHES_FUNCTION(gdtrc, "MG_GDTRC", 3, cephes_gdtrc(x[0], x[1], x[2]))
+MG_CEPHES_FUNCTION(gdtri, "MG_GDTRI", 3, cephes_gdtri(x[0], x[1], x[2]))
+MG_CEPHES_FUNCTION(hyperg, "MG_HYPERG", 3, cephes_hyperg(x[0], x[1], x[2]))
+MG_CEPHES_FUNCTION(incbet, "MG_INCBET", 3, cephes_incbet(x[0], x[1], x[2]))
+MG_CEPHES_FUNCTION(incbi, "MG_INCBI", 3, cephes_incbi(x[0], x[1], x[2]))
+MG_CEPHES_FUNCTION(nbdtr, "MG_NBDTR", 3, cephes_nbdtr((int) x[0], (int) x[1], x[2]))
+MG_CEPHES_FUNCTION(nbdtrc, "MG_NBDTRC", 3, cephes_nbdtrc((int) x[0], (int) x[1], x[2]))
+MG_CEPHES_FUNCTION(nbdtri, "MG_NBDTRI", 3, cephes_nbdtri((int) x[0], (int) x[1], x[2]))
+MG_CEPHES_FUNCTION(radian, "MG_RADIAN", 3, cephes_radian(x[0], x[1], x[2]))
+
+// special functions of four arguments
+MG_CEPHES_FUNCTION(hyp2f1, "MG_HYP2F1", 4, cephes_hyp2f1(x[0], x[1], x[2], x[3]))
+
+// routines with several outputs
+MG_CEPHES_PROCEDURE(airy, "MG_AIRY", 1, 4, cephes_airy(x[0], &y[0], &y[1], &y[2], &y[3]))
+MG_CEPHES_PROCEDURE(ellpj, "MG_ELLPJ", 2, 4, cephes_ellpj(x[0], x[1], &y[0], &y[1], &y[2], &y[3]))
+MG_CEPHES_PROCEDURE(fresnl, "MG_FRESNL", 1, 2, cephes_fresnl(x[0], &y[0], &y[1]))
+MG_CEPHES_PROCEDURE(shichi, "MG_SHICHI", 1, 2, cephes_shichi(x[0], &y[0], &y[1]))
+MG_CEPHES_PROCEDURE(sici, "MG_SICI", 1, 2, cephes_sici(x[0], &y[0], &y[1]))
@@ -132,6 +132,7 @@
 
 #include <float.h>		/* DBL_EPSILON */
 #include "mconf.h"
+#include "batch.h"
 
 extern double MAXLOG;
 
@@ -339,3 +340,86 @@ double log_ndtr(double a)
     }
     return log_LHS + log(right_hand_side);
 }
+
+
+/*                                                     erf_batch()
+ *                                                     erfc_batch()
+ *                                                     ndtr_batch()
+ *
+ * Batched versions of erf(), erfc() and ndtr(). The rational approximation
+ * of erf() for small arguments and the approximation of erfc() for large
+ * arguments are evaluated for a whole vector of arguments, and the result
+ * of each lane is selected by masking instead of branching. exp() is
+ * replaced by exp_v(), so results can differ from the scalar routines in
+ * the last place.
+ */
+
+/* erf(x) for |x| <= 1 */
+static cephes_vd erf_small_v(cephes_vd x)
+{
+    cephes_vd z;
+
+    z = x * x;
+    return x * polevl_v(z, T, 4) / p1evl_v(z, U, 5);
+}
+
+/* erfc(a) for |a| >= 1, with the underflow handling of erfc() */
+static cephes_vd erfc_large_v(cephes_vd a)
+{
+    cephes_vd x, z, p, q, y;
+    cephes_vm mid, neg;
+
+    x = vabs(a);
+    z = -a * a;
+    mid = x < 8.0;
+    neg = a < 0.0;
+
+    p = vsel(mid, polevl_v(x, P, 8), polevl_v(x, R, 5));
+    q = vsel(mid, p1evl_v(x, Q, 8), p1evl_v(x, S, 6));
+    y = (exp_v(z) * p) / q;
+    y = vsel(neg, 2.0 - y, y);
+
+    return vsel(vor(z < -MAXLOG, y == 0.0), vsel(neg, vsplat(2.0), vsplat(0.0)), y);
+}
+
+static cephes_vd erf_v(cephes_vd x)
+{
+    cephes_vm large;
+
+    large = vabs(x) > 1.0;
+    if (!vany(large))
+	return erf_small_v(x);
+    return vsel(large, 1.0 - erfc_large_v(x), erf_small_v(x));
+}
+
+static cephes_vd erfc_v(cephes_vd a)
+{
+    cephes_vm small;
+
+    small = vabs(a) < 1.0;
+    if (!vany(vnot(small)))
+	return 1.0 - erf_small_v(a);
+    return vsel(small, 1.0 - erf_small_v(a), erfc_large_v(a));
+}
+
+static cephes_vd ndtr_v(cephes_vd a)
+{
+    cephes_vd x, z, s, y;
+    cephes_vm center, tail;
+
+    x = a * CEPHES_SQRT1_2;
+    z = vabs(x);
+    center = z < CEPHES_SQRT1_2;
+    tail = z < 1.0;
+
+    s = erf_small_v(vsel(center, x, z));
+    y = vany(vnot(tail)) ? vsel(tail, 1.0 - s, erfc_large_v(z)) : 1.0 - s;
+    y = 0.5 * y;
+    y = vsel(x > 0.0, 1.0 - y, y);
+
+    return vsel(center, 0.5 + 0.5 * s, y);
+}
+
+CEPHES_BATCH1(erf_batch, erf_v)
+CEPHES_BATCH1(erfc_batch, erfc_v)
+CEPHES_BATCH1(ndtr_batch, ndtr_v)
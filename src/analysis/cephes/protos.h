@@ -55,7 +55,7 @@ extern double cephes_ellpe(double x);
 extern int    cephes_ellpj(double u, double m, double *sn, double *cn, double *dn, double *ph);
 extern double cephes_ellpk(double x);
 extern double exp(double x);
-extern double exp10(double x);
+extern double cephes_exp10(double x);
 extern double cephes_exp1m(double x);
 extern double cephes_exp2(double x);
 extern double cephes_expn(int n, double x);
@@ -73,6 +73,7 @@ extern double lgam_sgn(double x, int *sign);
 extern double lgam1p(double x);
 extern double cephes_gdtr(double a, double b, double x);
 extern double cephes_gdtrc(double a, double b, double x);
+extern double cephes_gdtri(double a, double b, double y);
 extern int    gels(double A[], double R[], int M, double EPS, double AUX[]);
 extern double cephes_hyp2f1(double a, double b, double c, double x);
 extern double cephes_hyperg(double a, double b, double x);
@@ -99,6 +100,8 @@ extern double cephes_k0e(double x);
 extern double cephes_k1(double x);
 extern double cephes_k1e(double x);
 extern double cephes_kn(int nn, double x);
+extern double cephes_kolmogorov(double y);
+extern double cephes_kolmogi(double p);
 
 //extern int levnsn ( int n, double r[], double a[], double e[], double refl[] );
 
@@ -114,6 +117,7 @@ extern double cephes_nbdtrc(int k, int n, double p);
 extern double cephes_nbdtr(int k, int n, double p);
 extern double cephes_nbdtri(int k, int n, double p);
 extern double cephes_ndtr(double a);
+extern double log_ndtr(double a);
 extern double cephes_erfc(double a);
 extern double cephes_erf(double x);
 extern double cephes_ndtri(double y0);
@@ -135,6 +139,8 @@ extern double cephes_radian(double d, double m, double s);
 extern double cephes_sindg(double x);
 extern double cephes_cosdg(double x);
 extern double sinh(double x);
+extern double cephes_smirnov(int n, double e);
+extern double cephes_smirnovi(int n, double p);
 extern double cephes_spence(double x);
 extern double sqrt(double x);
 extern double cephes_stdtr(int k, double t);
@@ -145,6 +151,7 @@ extern double cephes_struve(double v, double x);
 extern double tan(double x);
 extern double cot(double x);
 extern double cephes_tandg(double x);
+extern double tukeylambdacdf(double x, double lmbda);
 extern double cephes_cotdg(double x);
 extern double tanh(double x);
 extern double cephes_log1p(double x);
@@ -163,4 +170,36 @@ extern double lanczos_sum_expg_scaled(double x);
 extern double lanczos_sum_near_1(double dx);
 extern double lanczos_sum_near_2(double dx);
 
+/* Batched versions: evaluate the routine at each of n inputs and store the
+ * results in y. They are built on the vector kernels in batch.h and agree
+ * with the scalar routines to within a few units in the last place.
+ * CEPHES_BATCH is the block size used for scratch space and CEPHES_VLEN the
+ * number of lanes of the vector kernels: 4 with AVX, 2 with SSE2, and 1
+ * without GCC style vector extensions. There are no batched versions of
+ * igam() and igamc(): their branches differ from element to element, so
+ * batching them was slower than the scalar routines.
+ */
+#define CEPHES_BATCH 256
+
+#if defined(__GNUC__) && !defined(CEPHES_NO_VECTOR)
+#ifdef __AVX__
+#define CEPHES_VLEN 4
+#else
+#define CEPHES_VLEN 2
+#endif
+#else
+#define CEPHES_VLEN 1
+#endif
+
+extern void chbevl_batch(const double *x, double *y, int m, double array[], int n);
+extern void cephes_erf_batch(const double *x, double *y, int n);
+extern void cephes_erfc_batch(const double *a, double *y, int n);
+extern void cephes_ndtr_batch(const double *a, double *y, int n);
+extern void cephes_Gamma_batch(const double *x, double *y, int n);
+extern void cephes_i0_batch(const double *x, double *y, int n);
+extern void cephes_i0e_batch(const double *x, double *y, int n);
+extern void cephes_i1_batch(const double *x, double *y, int n);
+extern void cephes_i1e_batch(const double *x, double *y, int n);
+extern void cephes_j0_batch(const double *x, double *y, int n);
+
 #endif
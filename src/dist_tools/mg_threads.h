@@ -0,0 +1,121 @@
+// Simple data-parallel loop helpers for DLMs: split the range [0, n) into
+// contiguous chunks and run a work function on each chunk in its own thread.
+// Work functions must not call the IDL API; convert inputs and allocate
+// outputs before starting the loop.
+
+#ifndef MG_THREADS_H
+#define MG_THREADS_H
+
+#include <stdlib.h>
+
+#ifndef WIN32
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+// default minimum number of elements given to each thread
+#define MG_THREADS_MIN_ELTS 100000
+
+// largest number of threads started by a single loop
+#define MG_THREADS_MAX 64
+
+typedef void (*mg_threads_work)(void *data,
+                                IDL_MEMINT start, IDL_MEMINT end,
+                                int thread);
+
+typedef struct {
+  mg_threads_work work;
+  void *data;
+  IDL_MEMINT start;
+  IDL_MEMINT end;
+  int thread;
+} mg_threads_chunk;
+
+
+// number of online processors, 1 if unknown
+static int mg_threads_ncpus(void) {
+#ifdef WIN32
+  return 1;
+#else
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n < 1 ? 1 : (n > MG_THREADS_MAX ? MG_THREADS_MAX : (int) n);
+#endif
+}
+
+
+// Number of threads to use for a loop over n elements given the values of
+// TPOOL_NTHREADS and TPOOL_MIN_ELTS style keywords, i.e., 0 means the
+// default for either.
+static int mg_threads_count(IDL_MEMINT n, IDL_LONG nthreads, IDL_MEMINT min_elts) {
+  IDL_MEMINT max_threads;
+
+  if (nthreads <= 0) nthreads = mg_threads_ncpus();
+  if (nthreads > MG_THREADS_MAX) nthreads = MG_THREADS_MAX;
+  if (min_elts <= 0) min_elts = MG_THREADS_MIN_ELTS;
+
+  max_threads = n / min_elts;
+  if (max_threads < 1) max_threads = 1;
+
+  return nthreads < max_threads ? nthreads : (int) max_threads;
+}
+
+
+#ifndef WIN32
+static void *mg_threads_run_chunk(void *arg) {
+  mg_threads_chunk *chunk = (mg_threads_chunk *) arg;
+  chunk->work(chunk->data, chunk->start, chunk->end, chunk->thread);
+  return NULL;
+}
+#endif
+
+
+// Call work on nthreads contiguous chunks of [0, n), the first chunk in the
+// calling thread. Falls back to running the chunks serially if threads can't
+// be started.
+static void mg_threads_for(IDL_MEMINT n, int nthreads,
+                           mg_threads_work work, void *data) {
+  mg_threads_chunk chunks[MG_THREADS_MAX];
+  IDL_MEMINT chunk_size;
+  int t;
+#ifndef WIN32
+  pthread_t threads[MG_THREADS_MAX];
+  int started[MG_THREADS_MAX];
+#endif
+
+  if (n <= 0) return;
+  if (nthreads < 1) nthreads = 1;
+  if (nthreads > MG_THREADS_MAX) nthreads = MG_THREADS_MAX;
+  if (nthreads > n) nthreads = (int) n;
+
+  chunk_size = (n + nthreads - 1) / nthreads;
+  for (t = 0; t < nthreads; t++) {
+    chunks[t].work = work;
+    chunks[t].data = data;
+    chunks[t].start = t * chunk_size < n ? t * chunk_size : n;
+    chunks[t].end = (t + 1) * chunk_size < n ? (t + 1) * chunk_size : n;
+    chunks[t].thread = t;
+  }
+
+#ifdef WIN32
+  for (t = 0; t < nthreads; t++) {
+    work(data, chunks[t].start, chunks[t].end, t);
+  }
+#else
+  for (t = 1; t < nthreads; t++) {
+    started[t] = pthread_create(&threads[t], NULL,
+                                mg_threads_run_chunk, &chunks[t]) == 0;
+  }
+
+  work(data, chunks[0].start, chunks[0].end, 0);
+
+  for (t = 1; t < nthreads; t++) {
+    if (started[t]) {
+      pthread_join(threads[t], NULL);
+    } else {
+      work(data, chunks[t].start, chunks[t].end, t);
+    }
+  }
+#endif
+}
+
+#endif
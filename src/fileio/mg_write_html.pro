@@ -30,6 +30,15 @@ function mg_write_html_structure, s, $
   cs = n_elements(cellspacing) eq 0L $
          ? '' $
          : string(cellspacing, format='(%" cellspacing=\"%d\"")')
+  ; convert each scalar field for all rows at once
+  n_fields = n_tags(s[0])
+  cells = strarr(n_fields, n_elements(s))
+  is_scalar = bytarr(n_fields)
+  for i = 0L, n_fields - 1L do begin
+    is_scalar[i] = size(s[0].(i), /n_dimensions) eq 0L
+    if (is_scalar[i]) then cells[i, *] = strtrim(s.(i), 2)
+  endfor
+
   result = string(cs, format='(%"<table%s>")')
   for r = 0L, n_elements(s) - 1L do begin
     class = nr eq 0L $
@@ -40,7 +49,8 @@ function mg_write_html_structure, s, $
       class = nc eq 0L $
                 ? '' $
                 : string(column_classes[i mod nc], format='(%" class=\"%s\"")')
-      result += string(class, strtrim(s[r].(i), 2), format='(%"<td%s>%s</td>")')
+      cell = is_scalar[i] ? cells[i, r] : strtrim(s[r].(i), 2)
+      result += string(class, cell, format='(%"<td%s>%s</td>")')
     endfor
     result += '</tr>'
   endfor
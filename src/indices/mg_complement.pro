@@ -3,6 +3,8 @@
 ;+
 ; Returns the complement of an index array.
 ;
+; To combine large sets of indices, use the `MGBitmap` class.
+;
 ; :Examples:
 ;   For example, try::
 ;
@@ -0,0 +1,1182 @@
+/*
+  Compressed bitmap indices in the style of Roaring bitmaps.
+
+  A bitmap is a set of 32-bit unsigned integers, i.e., indices into arrays of
+  up to 2^32 elements. The index space is split into chunks of 65536 values
+  by the high 16 bits of an index and each non-empty chunk is stored in a
+  container: a sorted array of the low 16 bits when the chunk has at most
+  4096 elements, otherwise a 65536-bit bitset. Operations between bitsets
+  are plain loops over 1024 64-bit words, which the compiler vectorizes.
+
+  Bitmaps are referred to from IDL by a handle returned by the routines
+  creating them and must be freed with MG_BITMAP_FREE; the MGBitmap class
+  does this automatically.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "mg_idl_export.h"
+#include "mg_threads.h"
+
+// number of values in the chunk covered by a container
+#define MG_BITMAP_CHUNK 65536
+
+// number of 64-bit words in a bitset container
+#define MG_BITMAP_WORDS 1024
+
+// largest number of elements in an array container
+#define MG_BITMAP_ARRAY_MAX 4096
+
+// largest index that can be stored in a bitmap
+#define MG_BITMAP_MAX_INDEX 4294967295LL
+
+#define MG_CONTAINER_ARRAY  0
+#define MG_CONTAINER_BITSET 1
+
+#define MG_BITMAP_AND    0
+#define MG_BITMAP_OR     1
+#define MG_BITMAP_ANDNOT 2
+#define MG_BITMAP_XOR    3
+
+#if defined(__GNUC__) || defined(__clang__)
+#define MG_POPCOUNT(x) __builtin_popcountll(x)
+#define MG_CTZ(x)      __builtin_ctzll(x)
+#define MG_CLZ(x)      __builtin_clzll(x)
+#else
+static int MG_POPCOUNT(uint64_t x) {
+  int n = 0;
+  for (; x; n++) x &= x - 1;
+  return n;
+}
+static int MG_CTZ(uint64_t x) {
+  int n = 0;
+  for (; !(x & 1); n++) x >>= 1;
+  return n;
+}
+static int MG_CLZ(uint64_t x) {
+  int n = 0;
+  for (; !(x >> 63); n++) x <<= 1;
+  return n;
+}
+#endif
+
+
+typedef struct {
+  uint16_t key;          // high 16 bits of the values in the container
+  uint16_t type;         // MG_CONTAINER_ARRAY or MG_CONTAINER_BITSET
+  int32_t cardinality;   // 0 for an empty container, which has no data
+  union {
+    uint16_t *array;
+    uint64_t *words;
+  } data;
+} mg_container;
+
+typedef struct {
+  mg_container *containers;   // non-empty containers sorted by key
+  IDL_MEMINT n;
+} mg_bitmap;
+
+
+/**************************************************************************
+  Containers
+***************************************************************************/
+
+static void mg_container_free(mg_container *c) {
+  if (c->type == MG_CONTAINER_BITSET) {
+    free(c->data.words);
+  } else {
+    free(c->data.array);
+  }
+}
+
+
+static int mg_container_contains(const mg_container *c, uint16_t v) {
+  int32_t lo = 0, hi = c->cardinality - 1, mid;
+
+  if (c->type == MG_CONTAINER_BITSET) {
+    return (c->data.words[v >> 6] >> (v & 63)) & 1;
+  }
+
+  while (lo <= hi) {
+    mid = (lo + hi) / 2;
+    if (c->data.array[mid] < v) {
+      lo = mid + 1;
+    } else if (c->data.array[mid] > v) {
+      hi = mid - 1;
+    } else return 1;
+  }
+
+  return 0;
+}
+
+
+// Index of the first value >= v in an array container.
+static int32_t mg_container_lower_bound(const mg_container *c, int32_t v) {
+  int32_t lo = 0, hi = c->cardinality, mid;
+
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (c->data.array[mid] < v) {
+      lo = mid + 1;
+    } else hi = mid;
+  }
+
+  return lo;
+}
+
+
+// Make a container from a bitset, as an array if it is sparse enough.
+static int mg_container_from_words(uint16_t key, const uint64_t *words,
+                                   mg_container *c) {
+  int32_t i, k, cardinality = 0;
+  uint64_t bits;
+
+  for (i = 0; i < MG_BITMAP_WORDS; i++) cardinality += MG_POPCOUNT(words[i]);
+
+  c->key = key;
+  c->cardinality = cardinality;
+  c->type = cardinality > MG_BITMAP_ARRAY_MAX
+              ? MG_CONTAINER_BITSET
+              : MG_CONTAINER_ARRAY;
+  c->data.array = NULL;
+  if (cardinality == 0) return 1;
+
+  if (c->type == MG_CONTAINER_BITSET) {
+    c->data.words = (uint64_t *) malloc(MG_BITMAP_WORDS * sizeof(uint64_t));
+    if (!c->data.words) return 0;
+    memcpy(c->data.words, words, MG_BITMAP_WORDS * sizeof(uint64_t));
+  } else {
+    c->data.array = (uint16_t *) malloc(cardinality * sizeof(uint16_t));
+    if (!c->data.array) return 0;
+    for (i = k = 0; i < MG_BITMAP_WORDS; i++) {
+      for (bits = words[i]; bits; bits &= bits - 1) {
+        c->data.array[k++] = (uint16_t) (64 * i + MG_CTZ(bits));
+      }
+    }
+  }
+
+  return 1;
+}
+
+
+// Make a container from sorted, unique values, as a bitset if it is dense.
+static int mg_container_from_array(uint16_t key, const uint16_t *values,
+                                   int32_t n, mg_container *c) {
+  int32_t i;
+
+  c->key = key;
+  c->cardinality = n;
+  c->type = n > MG_BITMAP_ARRAY_MAX ? MG_CONTAINER_BITSET : MG_CONTAINER_ARRAY;
+  c->data.array = NULL;
+  if (n == 0) return 1;
+
+  if (c->type == MG_CONTAINER_BITSET) {
+    c->data.words = (uint64_t *) calloc(MG_BITMAP_WORDS, sizeof(uint64_t));
+    if (!c->data.words) return 0;
+    for (i = 0; i < n; i++) {
+      c->data.words[values[i] >> 6] |= (uint64_t) 1 << (values[i] & 63);
+    }
+  } else {
+    c->data.array = (uint16_t *) malloc(n * sizeof(uint16_t));
+    if (!c->data.array) return 0;
+    memcpy(c->data.array, values, n * sizeof(uint16_t));
+  }
+
+  return 1;
+}
+
+
+static int mg_container_clone(const mg_container *a, mg_container *c) {
+  size_t size = a->type == MG_CONTAINER_BITSET
+                  ? MG_BITMAP_WORDS * sizeof(uint64_t)
+                  : a->cardinality * sizeof(uint16_t);
+
+  *c = *a;
+  c->data.array = malloc(size);
+  if (!c->data.array) return 0;
+  memcpy(c->data.array, a->data.array, size);
+
+  return 1;
+}
+
+
+static void mg_container_to_words(const mg_container *c, uint64_t *words) {
+  int32_t i;
+
+  if (c->type == MG_CONTAINER_BITSET) {
+    memcpy(words, c->data.words, MG_BITMAP_WORDS * sizeof(uint64_t));
+  } else {
+    memset(words, 0, MG_BITMAP_WORDS * sizeof(uint64_t));
+    for (i = 0; i < c->cardinality; i++) {
+      words[c->data.array[i] >> 6] |= (uint64_t) 1 << (c->data.array[i] & 63);
+    }
+  }
+}
+
+
+// Merge two sorted arrays of values, returns the number of values in out.
+static int32_t mg_array_merge(int op,
+                              const uint16_t *a, int32_t na,
+                              const uint16_t *b, int32_t nb,
+                              uint16_t *out) {
+  int32_t i = 0, j = 0, k = 0;
+  int keep_a = op != MG_BITMAP_AND;
+  int keep_b = op == MG_BITMAP_OR || op == MG_BITMAP_XOR;
+  int keep_both = op == MG_BITMAP_AND || op == MG_BITMAP_OR;
+
+  while (i < na && j < nb) {
+    if (a[i] < b[j]) {
+      if (keep_a) out[k++] = a[i];
+      i++;
+    } else if (a[i] > b[j]) {
+      if (keep_b) out[k++] = b[j];
+      j++;
+    } else {
+      if (keep_both) out[k++] = a[i];
+      i++;
+      j++;
+    }
+  }
+  if (keep_a) while (i < na) out[k++] = a[i++];
+  if (keep_b) while (j < nb) out[k++] = b[j++];
+
+  return k;
+}
+
+
+// Combine two containers with the same key.
+static int mg_container_op(int op,
+                           const mg_container *a, const mg_container *b,
+                           mg_container *c) {
+  uint16_t values[2 * MG_BITMAP_ARRAY_MAX];
+  uint64_t words[MG_BITMAP_WORDS];
+  const mg_container *sparse, *dense;
+  int32_t i, n;
+  uint16_t v;
+
+  if (a->type == MG_CONTAINER_ARRAY && b->type == MG_CONTAINER_ARRAY) {
+    n = mg_array_merge(op,
+                       a->data.array, a->cardinality,
+                       b->data.array, b->cardinality,
+                       values);
+    return mg_container_from_array(a->key, values, n, c);
+  }
+
+  // the result of intersecting with an array is at most as large as the
+  // array, so filter the array instead of expanding it to a bitset
+  if ((op == MG_BITMAP_AND || op == MG_BITMAP_ANDNOT)
+      && a->type == MG_CONTAINER_ARRAY) {
+    for (i = n = 0; i < a->cardinality; i++) {
+      v = a->data.array[i];
+      if (mg_container_contains(b, v) == (op == MG_BITMAP_AND)) values[n++] = v;
+    }
+    return mg_container_from_array(a->key, values, n, c);
+  }
+
+  if (op == MG_BITMAP_AND && b->type == MG_CONTAINER_ARRAY) {
+    for (i = n = 0; i < b->cardinality; i++) {
+      v = b->data.array[i];
+      if (mg_container_contains(a, v)) values[n++] = v;
+    }
+    return mg_container_from_array(a->key, values, n, c);
+  }
+
+  // expand one side to a bitset and apply the other side to it; OR and XOR
+  // are symmetric, so expand the bitset side for them
+  if (b->type == MG_CONTAINER_BITSET) {
+    dense = b;
+    sparse = a;
+  } else {
+    dense = a;
+    sparse = b;
+  }
+  if (op == MG_BITMAP_ANDNOT) {
+    dense = a;
+    sparse = b;
+  }
+
+  mg_container_to_words(dense, words);
+
+  if (sparse->type == MG_CONTAINER_BITSET) {
+    const uint64_t *w = sparse->data.words;
+    switch (op) {
+      case MG_BITMAP_AND:
+        for (i = 0; i < MG_BITMAP_WORDS; i++) words[i] &= w[i];
+        break;
+      case MG_BITMAP_OR:
+        for (i = 0; i < MG_BITMAP_WORDS; i++) words[i] |= w[i];
+        break;
+      case MG_BITMAP_ANDNOT:
+        for (i = 0; i < MG_BITMAP_WORDS; i++) words[i] &= ~w[i];
+        break;
+      case MG_BITMAP_XOR:
+        for (i = 0; i < MG_BITMAP_WORDS; i++) words[i] ^= w[i];
+        break;
+    }
+  } else {
+    for (i = 0; i < sparse->cardinality; i++) {
+      v = sparse->data.array[i];
+      switch (op) {
+        case MG_BITMAP_OR:
+          words[v >> 6] |= (uint64_t) 1 << (v & 63);
+          break;
+        case MG_BITMAP_ANDNOT:
+          words[v >> 6] &= ~((uint64_t) 1 << (v & 63));
+          break;
+        case MG_BITMAP_XOR:
+          words[v >> 6] ^= (uint64_t) 1 << (v & 63);
+          break;
+      }
+    }
+  }
+
+  return mg_container_from_words(a->key, words, c);
+}
+
+
+/**************************************************************************
+  Bitmaps
+***************************************************************************/
+
+static mg_bitmap *mg_bitmap_alloc(IDL_MEMINT n) {
+  mg_bitmap *bitmap = (mg_bitmap *) malloc(sizeof(mg_bitmap));
+
+  if (!bitmap) return NULL;
+  bitmap->n = 0;
+  bitmap->containers = (mg_container *) malloc((n > 0 ? n : 1) * sizeof(mg_container));
+  if (!bitmap->containers) {
+    free(bitmap);
+    return NULL;
+  }
+
+  return bitmap;
+}
+
+
+static void mg_bitmap_free(mg_bitmap *bitmap) {
+  IDL_MEMINT i;
+
+  if (!bitmap) return;
+  for (i = 0; i < bitmap->n; i++) mg_container_free(&bitmap->containers[i]);
+  free(bitmap->containers);
+  free(bitmap);
+}
+
+
+static IDL_LONG64 mg_bitmap_cardinality(const mg_bitmap *bitmap) {
+  IDL_LONG64 cardinality = 0;
+  IDL_MEMINT i;
+
+  for (i = 0; i < bitmap->n; i++) {
+    cardinality += bitmap->containers[i].cardinality;
+  }
+
+  return cardinality;
+}
+
+
+// Combine two bitmaps with one of the MG_BITMAP_* set operations.
+static mg_bitmap *mg_bitmap_op(int op, const mg_bitmap *a, const mg_bitmap *b) {
+  mg_bitmap *c = mg_bitmap_alloc(a->n + b->n);
+  const mg_container *ca, *cb;
+  mg_container *next;
+  IDL_MEMINT i = 0, j = 0;
+  int ok = 1;
+
+  if (!c) return NULL;
+
+  while (ok && (i < a->n || j < b->n)) {
+    ca = i < a->n ? &a->containers[i] : NULL;
+    cb = j < b->n ? &b->containers[j] : NULL;
+    next = &c->containers[c->n];
+    next->cardinality = 0;
+
+    if (op == MG_BITMAP_AND && (!ca || !cb)) break;
+    if (op == MG_BITMAP_ANDNOT && !ca) break;
+
+    if (ca && (!cb || ca->key < cb->key)) {
+      if (op != MG_BITMAP_AND) ok = mg_container_clone(ca, next);
+      i++;
+    } else if (!ca || cb->key < ca->key) {
+      if (op == MG_BITMAP_OR || op == MG_BITMAP_XOR) {
+        ok = mg_container_clone(cb, next);
+      }
+      j++;
+    } else {
+      ok = mg_container_op(op, ca, cb, next);
+      i++;
+      j++;
+    }
+
+    if (next->cardinality > 0) c->n++;
+  }
+
+  if (!ok) {
+    mg_bitmap_free(c);
+    return NULL;
+  }
+
+  return c;
+}
+
+
+static int mg_bitmap_uint32_cmp(const void *a, const void *b) {
+  uint32_t ua = *(const uint32_t *) a, ub = *(const uint32_t *) b;
+  return ua < ub ? -1 : (ua > ub ? 1 : 0);
+}
+
+
+// Make a bitmap from values, which are sorted in place if needed.
+static mg_bitmap *mg_bitmap_from_values(uint32_t *values, IDL_MEMINT n) {
+  mg_bitmap *bitmap;
+  uint16_t *low;
+  IDL_MEMINT i, n_keys;
+  int32_t n_low;
+  uint32_t key;
+  int ok = 1;
+
+  for (i = 1; i < n; i++) {
+    if (values[i] < values[i - 1]) {
+      qsort(values, n, sizeof(uint32_t), mg_bitmap_uint32_cmp);
+      break;
+    }
+  }
+
+  for (i = 0, n_keys = 0; i < n; i++) {
+    if (i == 0 || (values[i] >> 16) != (values[i - 1] >> 16)) n_keys++;
+  }
+
+  bitmap = mg_bitmap_alloc(n_keys);
+  low = (uint16_t *) malloc(MG_BITMAP_CHUNK * sizeof(uint16_t));
+  if (!bitmap || !low) {
+    mg_bitmap_free(bitmap);
+    free(low);
+    return NULL;
+  }
+
+  for (i = 0; ok && i < n; ) {
+    key = values[i] >> 16;
+    for (n_low = 0; i < n && (values[i] >> 16) == key; i++) {
+      if (n_low == 0 || low[n_low - 1] != (uint16_t) values[i]) {
+        low[n_low++] = (uint16_t) values[i];
+      }
+    }
+    ok = mg_container_from_array((uint16_t) key, low, n_low,
+                                 &bitmap->containers[bitmap->n]);
+    bitmap->n++;
+  }
+
+  free(low);
+  if (!ok) {
+    mg_bitmap_free(bitmap);
+    return NULL;
+  }
+
+  return bitmap;
+}
+
+
+// Make a bitmap of the values first to last, inclusive.
+static mg_bitmap *mg_bitmap_from_range(IDL_LONG64 first, IDL_LONG64 last) {
+  mg_bitmap *bitmap;
+  uint16_t values[MG_BITMAP_ARRAY_MAX];
+  uint64_t words[MG_BITMAP_WORDS];
+  IDL_LONG64 key, lo, hi, v;
+  int ok = 1;
+
+  if (first > last) return mg_bitmap_alloc(0);
+
+  bitmap = mg_bitmap_alloc((last >> 16) - (first >> 16) + 1);
+  if (!bitmap) return NULL;
+
+  for (key = first >> 16; ok && key <= last >> 16; key++) {
+    lo = key == first >> 16 ? first & 0xffff : 0;
+    hi = key == last >> 16 ? last & 0xffff : MG_BITMAP_CHUNK - 1;
+    if (hi - lo + 1 <= MG_BITMAP_ARRAY_MAX) {
+      for (v = lo; v <= hi; v++) values[v - lo] = (uint16_t) v;
+      ok = mg_container_from_array((uint16_t) key, values, (int32_t) (hi - lo + 1),
+                                   &bitmap->containers[bitmap->n]);
+    } else {
+      memset(words, 0, sizeof(words));
+      memset(words + lo / 64 + 1, 0xff, (hi / 64 - lo / 64 - 1) * sizeof(uint64_t));
+      words[lo / 64] = ~(uint64_t) 0 << (lo & 63);
+      words[hi / 64] |= ~(uint64_t) 0 >> (63 - (hi & 63));
+      ok = mg_container_from_words((uint16_t) key, words,
+                                   &bitmap->containers[bitmap->n]);
+    }
+    bitmap->n++;
+  }
+
+  if (!ok) {
+    mg_bitmap_free(bitmap);
+    return NULL;
+  }
+
+  return bitmap;
+}
+
+
+// Find the index of the first container with key >= key.
+static IDL_MEMINT mg_bitmap_find(const mg_bitmap *bitmap, uint32_t key) {
+  IDL_MEMINT lo = 0, hi = bitmap->n, mid;
+
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (bitmap->containers[mid].key < key) {
+      lo = mid + 1;
+    } else hi = mid;
+  }
+
+  return lo;
+}
+
+
+// Largest value in a non-empty bitmap.
+static IDL_LONG64 mg_bitmap_max(const mg_bitmap *bitmap) {
+  const mg_container *c = &bitmap->containers[bitmap->n - 1];
+  int32_t w;
+
+  if (c->type == MG_CONTAINER_ARRAY) {
+    return ((IDL_LONG64) c->key << 16) + c->data.array[c->cardinality - 1];
+  }
+
+  for (w = MG_BITMAP_WORDS - 1; c->data.words[w] == 0; w--);
+  return ((IDL_LONG64) c->key << 16) + 64 * w + 63 - MG_CLZ(c->data.words[w]);
+}
+
+
+/*
+  Write at most n_max values >= start to out, returns the number written. The
+  values of each container are written in increasing order. The container
+  holding start is entered at start, not scanned from its first value, so
+  iterating in blocks is linear in the size of the bitmap.
+*/
+static IDL_MEMINT mg_bitmap_values(const mg_bitmap *bitmap, IDL_LONG64 start,
+                                   IDL_MEMINT n_max, IDL_LONG64 *out) {
+  const mg_container *c;
+  IDL_MEMINT i, n = 0;
+  IDL_LONG64 base;
+  int32_t j, w, lo;
+  uint64_t bits;
+
+  if (start < 0) start = 0;
+  if (start > MG_BITMAP_MAX_INDEX) return 0;
+
+  for (i = mg_bitmap_find(bitmap, (uint32_t) (start >> 16));
+       i < bitmap->n && n < n_max;
+       i++) {
+    c = &bitmap->containers[i];
+    base = (IDL_LONG64) c->key << 16;
+
+    // low 16 bits of the first value wanted from this container
+    lo = base < start ? (int32_t) (start - base) : 0;
+
+    if (c->type == MG_CONTAINER_BITSET) {
+      for (w = lo >> 6; w < MG_BITMAP_WORDS && n < n_max; w++) {
+        bits = c->data.words[w];
+        if (w == lo >> 6) bits &= ~(uint64_t) 0 << (lo & 63);
+        for (; bits && n < n_max; bits &= bits - 1) {
+          out[n++] = base + 64 * w + MG_CTZ(bits);
+        }
+      }
+    } else {
+      for (j = mg_container_lower_bound(c, lo);
+           j < c->cardinality && n < n_max;
+           j++) {
+        out[n++] = base + c->data.array[j];
+      }
+    }
+  }
+
+  return n;
+}
+
+
+/**************************************************************************
+  Building bitmaps from masks
+***************************************************************************/
+
+typedef struct {
+  UCHAR *data;
+  int type;
+  IDL_MEMINT n;
+  mg_container *containers;
+  volatile int failed;
+} mg_bitmap_mask_loop;
+
+
+#define MG_BITMAP_MASK_WORDS(TYPE)                                        \
+  {                                                                       \
+    const TYPE *x = (const TYPE *) loop->data + offset;                   \
+    for (w = 0; w < n_words; w++) {                                       \
+      m = len - 64 * w < 64 ? len - 64 * w : 64;                          \
+      bits = 0;                                                           \
+      for (b = 0; b < m; b++) bits |= (uint64_t) (x[64 * w + b] != 0) << b; \
+      words[w] = bits;                                                    \
+    }                                                                     \
+  }
+
+
+#ifdef __SSE2__
+// Byte masks are the output of relational operators, so convert them 16
+// bytes at a time.
+static void mg_bitmap_byte_words(const UCHAR *x, IDL_MEMINT len,
+                                 uint64_t *words) {
+  const __m128i zero = _mm_setzero_si128();
+  IDL_MEMINT w, b, q;
+  uint64_t bits;
+
+  for (w = 0; w < len / 64; w++) {
+    bits = 0;
+    for (q = 0; q < 4; q++) {
+      __m128i v = _mm_loadu_si128((const __m128i *) (x + 64 * w + 16 * q));
+      bits |= (uint64_t) (_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)) & 0xffff) << (16 * q);
+    }
+    words[w] = ~bits;
+  }
+  if (len % 64 != 0) {
+    for (bits = 0, b = 0; b < len % 64; b++) {
+      bits |= (uint64_t) (x[64 * w + b] != 0) << b;
+    }
+    words[w] = bits;
+  }
+}
+#endif
+
+
+// Build the containers for the chunks start to end - 1 of a mask.
+static void mg_bitmap_mask_range(void *data, IDL_MEMINT start, IDL_MEMINT end,
+                                 int thread) {
+  mg_bitmap_mask_loop *loop = (mg_bitmap_mask_loop *) data;
+  uint64_t words[MG_BITMAP_WORDS], bits;
+  IDL_MEMINT k, offset, len, w, n_words, m, b;
+
+  for (k = start; k < end && !loop->failed; k++) {
+    offset = k * MG_BITMAP_CHUNK;
+    len = loop->n - offset < MG_BITMAP_CHUNK ? loop->n - offset : MG_BITMAP_CHUNK;
+    n_words = (len + 63) / 64;
+    memset(words, 0, sizeof(words));
+
+    switch (loop->type) {
+#ifdef __SSE2__
+      case IDL_TYP_BYTE:
+        mg_bitmap_byte_words(loop->data + offset, len, words);
+        break;
+#else
+      case IDL_TYP_BYTE:    MG_BITMAP_MASK_WORDS(UCHAR); break;
+#endif
+      case IDL_TYP_INT:     MG_BITMAP_MASK_WORDS(IDL_INT); break;
+      case IDL_TYP_UINT:    MG_BITMAP_MASK_WORDS(IDL_UINT); break;
+      case IDL_TYP_LONG:    MG_BITMAP_MASK_WORDS(IDL_LONG); break;
+      case IDL_TYP_ULONG:   MG_BITMAP_MASK_WORDS(IDL_ULONG); break;
+      case IDL_TYP_LONG64:  MG_BITMAP_MASK_WORDS(IDL_LONG64); break;
+      case IDL_TYP_ULONG64: MG_BITMAP_MASK_WORDS(IDL_ULONG64); break;
+      case IDL_TYP_FLOAT:   MG_BITMAP_MASK_WORDS(float); break;
+      case IDL_TYP_DOUBLE:  MG_BITMAP_MASK_WORDS(double); break;
+    }
+
+    if (!mg_container_from_words((uint16_t) k, words, &loop->containers[k])) {
+      loop->failed = 1;
+    }
+  }
+}
+
+
+/**************************************************************************
+  IDL routines
+***************************************************************************/
+
+static mg_bitmap *mg_bitmap_get(IDL_VPTR arg) {
+  mg_bitmap *bitmap = (mg_bitmap *) IDL_MEMINTScalar(arg);
+
+  if (!bitmap) {
+    IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP, "invalid bitmap");
+  }
+
+  return bitmap;
+}
+
+
+static IDL_VPTR mg_bitmap_handle(mg_bitmap *bitmap) {
+  if (!bitmap) {
+    IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                "unable to allocate memory for bitmap");
+  }
+
+  return IDL_GettmpMEMINT((IDL_MEMINT) bitmap);
+}
+
+
+static IDL_VPTR IDL_CDECL IDL_mg_bitmap_from_mask(int argc, IDL_VPTR *argv, char *argk) {
+  typedef struct {
+    IDL_KW_RESULT_FIRST_FIELD;
+    IDL_LONG tpool_min_elts;
+    IDL_LONG tpool_nthreads;
+  } KW_RESULT;
+
+  // make sure to list keyword in alphabetical order
+  static IDL_KW_PAR kw_pars[] = {
+    { "TPOOL_MIN_ELTS", IDL_TYP_LONG, 1, IDL_KW_ZERO,
+      0, IDL_KW_OFFSETOF(tpool_min_elts) },
+    { "TPOOL_NTHREADS", IDL_TYP_LONG, 1, IDL_KW_ZERO,
+      0, IDL_KW_OFFSETOF(tpool_nthreads) },
+    { NULL }
+  };
+
+  KW_RESULT kw;
+  IDL_VPTR mask, plain_args[1];
+  mg_bitmap_mask_loop loop;
+  mg_bitmap *bitmap;
+  IDL_MEMINT n_chunks, k;
+  int nthreads;
+
+  IDL_KWProcessByOffset(argc, argv, argk, kw_pars, plain_args, 1, &kw);
+
+  mask = plain_args[0];
+  IDL_ENSURE_SIMPLE(mask);
+  switch (mask->type) {
+    case IDL_TYP_BYTE:
+    case IDL_TYP_INT:
+    case IDL_TYP_UINT:
+    case IDL_TYP_LONG:
+    case IDL_TYP_ULONG:
+    case IDL_TYP_LONG64:
+    case IDL_TYP_ULONG64:
+    case IDL_TYP_FLOAT:
+    case IDL_TYP_DOUBLE:
+      break;
+    default:
+      IDL_KW_FREE;
+      IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                  "mask must be an integer or real array");
+  }
+
+  if (mask->flags & IDL_V_ARR) {
+    loop.data = mask->value.arr->data;
+    loop.n = mask->value.arr->n_elts;
+  } else {
+    loop.data = (UCHAR *) &mask->value;
+    loop.n = 1;
+  }
+  loop.type = mask->type;
+  loop.failed = 0;
+
+  if ((IDL_LONG64) loop.n - 1 > MG_BITMAP_MAX_INDEX) {
+    IDL_KW_FREE;
+    IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                "mask must have at most 2^32 elements");
+  }
+
+  n_chunks = (loop.n + MG_BITMAP_CHUNK - 1) / MG_BITMAP_CHUNK;
+  bitmap = mg_bitmap_alloc(n_chunks);
+  if (!bitmap) {
+    IDL_KW_FREE;
+    mg_bitmap_handle(NULL);
+  }
+  loop.containers = bitmap->containers;
+  for (k = 0; k < n_chunks; k++) loop.containers[k].cardinality = 0;
+
+  // chunks are independent, so each thread builds a range of containers
+  nthreads = mg_threads_count(loop.n, kw.tpool_nthreads, kw.tpool_min_elts);
+  mg_threads_for(n_chunks, nthreads, mg_bitmap_mask_range, &loop);
+
+  // drop empty containers
+  for (k = 0; k < n_chunks; k++) {
+    if (bitmap->containers[k].cardinality > 0) {
+      bitmap->containers[bitmap->n++] = bitmap->containers[k];
+    }
+  }
+
+  IDL_KW_FREE;
+
+  if (loop.failed) {
+    mg_bitmap_free(bitmap);
+    bitmap = NULL;
+  }
+
+  return mg_bitmap_handle(bitmap);
+}
+
+
+static IDL_VPTR IDL_CDECL IDL_mg_bitmap_from_indices(int argc, IDL_VPTR *argv) {
+  IDL_VPTR indices;
+  IDL_LONG64 *data;
+  IDL_MEMINT n, i, n_valid = 0;
+  uint32_t *values;
+  mg_bitmap *bitmap;
+
+  IDL_ENSURE_SIMPLE(argv[0]);
+  indices = argv[0]->type == IDL_TYP_LONG64 ? argv[0] : IDL_CvtLng64(1, argv);
+  if (indices->flags & IDL_V_ARR) {
+    data = (IDL_LONG64 *) indices->value.arr->data;
+    n = indices->value.arr->n_elts;
+  } else {
+    data = &indices->value.l64;
+    n = 1;
+  }
+
+  values = (uint32_t *) malloc((n > 0 ? n : 1) * sizeof(uint32_t));
+  if (!values) {
+    if (indices != argv[0]) IDL_Deltmp(indices);
+    mg_bitmap_handle(NULL);
+  }
+
+  // negative indices, such as the -1 returned by WHERE, are ignored
+  for (i = 0; i < n; i++) {
+    if (data[i] >= 0 && data[i] <= MG_BITMAP_MAX_INDEX) {
+      values[n_valid++] = (uint32_t) data[i];
+    }
+  }
+  if (indices != argv[0]) IDL_Deltmp(indices);
+
+  bitmap = mg_bitmap_from_values(values, n_valid);
+  free(values);
+
+  return mg_bitmap_handle(bitmap);
+}
+
+
+static IDL_VPTR IDL_CDECL IDL_mg_bitmap_from_range(int argc, IDL_VPTR *argv) {
+  IDL_LONG64 first = IDL_Long64Scalar(argv[0]);
+  IDL_LONG64 last = IDL_Long64Scalar(argv[1]);
+
+  if (first < 0) first = 0;
+  if (last > MG_BITMAP_MAX_INDEX) last = MG_BITMAP_MAX_INDEX;
+
+  return mg_bitmap_handle(mg_bitmap_from_range(first, last));
+}
+
+
+static IDL_VPTR mg_bitmap_nary_op(int op, int argc, IDL_VPTR *argv) {
+  mg_bitmap *result, *next;
+  int a;
+
+  result = mg_bitmap_op(op, mg_bitmap_get(argv[0]), mg_bitmap_get(argv[1]));
+  for (a = 2; result && a < argc; a++) {
+    next = mg_bitmap_op(op, result, mg_bitmap_get(argv[a]));
+    mg_bitmap_free(result);
+    result = next;
+  }
+
+  return mg_bitmap_handle(result);
+}
+
+
+static IDL_VPTR IDL_CDECL IDL_mg_bitmap_and(int argc, IDL_VPTR *argv) {
+  return mg_bitmap_nary_op(MG_BITMAP_AND, argc, argv);
+}
+
+
+static IDL_VPTR IDL_CDECL IDL_mg_bitmap_or(int argc, IDL_VPTR *argv) {
+  return mg_bitmap_nary_op(MG_BITMAP_OR, argc, argv);
+}
+
+
+static IDL_VPTR IDL_CDECL IDL_mg_bitmap_andnot(int argc, IDL_VPTR *argv) {
+  return mg_bitmap_nary_op(MG_BITMAP_ANDNOT, argc, argv);
+}
+
+
+static IDL_VPTR IDL_CDECL IDL_mg_bitmap_xor(int argc, IDL_VPTR *argv) {
+  return mg_bitmap_nary_op(MG_BITMAP_XOR, argc, argv);
+}
+
+
+static IDL_VPTR IDL_CDECL IDL_mg_bitmap_complement(int argc, IDL_VPTR *argv) {
+  mg_bitmap *bitmap = mg_bitmap_get(argv[0]), *all, *result;
+  IDL_LONG64 n = IDL_Long64Scalar(argv[1]);
+
+  all = mg_bitmap_from_range(0, n - 1 < MG_BITMAP_MAX_INDEX ? n - 1 : MG_BITMAP_MAX_INDEX);
+  if (!all) mg_bitmap_handle(NULL);
+
+  result = mg_bitmap_op(MG_BITMAP_ANDNOT, all, bitmap);
+  mg_bitmap_free(all);
+
+  return mg_bitmap_handle(result);
+}
+
+
+static IDL_VPTR IDL_CDECL IDL_mg_bitmap_cardinality(int argc, IDL_VPTR *argv) {
+  return IDL_GettmpLong64(mg_bitmap_cardinality(mg_bitmap_get(argv[0])));
+}
+
+
+static IDL_VPTR IDL_CDECL IDL_mg_bitmap_n_bytes(int argc, IDL_VPTR *argv) {
+  mg_bitmap *bitmap = mg_bitmap_get(argv[0]);
+  IDL_LONG64 n_bytes = sizeof(mg_bitmap) + bitmap->n * sizeof(mg_container);
+  IDL_MEMINT i;
+
+  for (i = 0; i < bitmap->n; i++) {
+    n_bytes += bitmap->containers[i].type == MG_CONTAINER_BITSET
+                 ? MG_BITMAP_WORDS * sizeof(uint64_t)
+                 : bitmap->containers[i].cardinality * sizeof(uint16_t);
+  }
+
+  return IDL_GettmpLong64(n_bytes);
+}
+
+
+static IDL_VPTR IDL_CDECL IDL_mg_bitmap_contains(int argc, IDL_VPTR *argv) {
+  mg_bitmap *bitmap = mg_bitmap_get(argv[0]);
+  IDL_VPTR values, result;
+  IDL_LONG64 *data, v;
+  IDL_MEMINT n, i, c;
+  UCHAR *out;
+
+  IDL_ENSURE_SIMPLE(argv[1]);
+  values = argv[1]->type == IDL_TYP_LONG64 ? argv[1] : IDL_CvtLng64(1, &argv[1]);
+  if (values->flags & IDL_V_ARR) {
+    data = (IDL_LONG64 *) values->value.arr->data;
+    n = values->value.arr->n_elts;
+    out = (UCHAR *) IDL_MakeTempArray(IDL_TYP_BYTE,
+                                      values->value.arr->n_dim,
+                                      values->value.arr->dim,
+                                      IDL_ARR_INI_NOP, &result);
+  } else {
+    data = &values->value.l64;
+    n = 1;
+    result = IDL_Gettmp();
+    result->type = IDL_TYP_BYTE;
+    out = &result->value.c;
+  }
+
+  for (i = 0; i < n; i++) {
+    v = data[i];
+    out[i] = 0;
+    if (v < 0 || v > MG_BITMAP_MAX_INDEX) continue;
+    c = mg_bitmap_find(bitmap, (uint32_t) (v >> 16));
+    if (c < bitmap->n && bitmap->containers[c].key == (v >> 16)) {
+      out[i] = (UCHAR) mg_container_contains(&bitmap->containers[c],
+                                             (uint16_t) v);
+    }
+  }
+
+  if (values != argv[1]) IDL_Deltmp(values);
+
+  return result;
+}
+
+
+// Write all the values of the bitmap to out, which has type TYPE.
+#define MG_BITMAP_FILL(out, TYPE)                                          \
+  for (i = 0; i < bitmap->n; i++) {                                       \
+    c = &bitmap->containers[i];                                           \
+    base = (IDL_LONG64) c->key << 16;                                     \
+    if (c->type == MG_CONTAINER_BITSET) {                                 \
+      for (w = 0; w < MG_BITMAP_WORDS; w++) {                             \
+        for (bits = c->data.words[w]; bits; bits &= bits - 1) {           \
+          out[k++] = (TYPE) (base + 64 * w + MG_CTZ(bits));               \
+        }                                                                 \
+      }                                                                   \
+    } else {                                                              \
+      for (j = 0; j < c->cardinality; j++) {                              \
+        out[k++] = (TYPE) (base + c->data.array[j]);                      \
+      }                                                                   \
+    }                                                                     \
+  }
+
+
+/*
+  Return the values of the bitmap as indices in increasing order: as a LONG
+  array when all of them fit, otherwise as a LONG64 array, or -1L if the
+  bitmap is empty.
+*/
+static IDL_VPTR IDL_CDECL IDL_mg_bitmap_to_indices(int argc, IDL_VPTR *argv, char *argk) {
+  typedef struct {
+    IDL_KW_RESULT_FIRST_FIELD;
+    IDL_VPTR count;
+    int count_present;
+  } KW_RESULT;
+
+  // make sure to list keyword in alphabetical order
+  static IDL_KW_PAR kw_pars[] = {
+    { "COUNT", IDL_TYP_UNDEF, 1, IDL_KW_OUT | IDL_KW_ZERO,
+      IDL_KW_OFFSETOF(count_present), IDL_KW_OFFSETOF(count) },
+    { NULL }
+  };
+
+  KW_RESULT kw;
+  IDL_VPTR plain_args[1], result;
+  IDL_ALLTYPES count;
+  mg_bitmap *bitmap;
+  const mg_container *c;
+  IDL_LONG64 n, base, *out;
+  IDL_MEMINT i, k = 0;
+  IDL_LONG *lout;
+  int32_t j, w;
+  uint64_t bits;
+
+  IDL_KWProcessByOffset(argc, argv, argk, kw_pars, plain_args, 1, &kw);
+
+  bitmap = mg_bitmap_get(plain_args[0]);
+  n = mg_bitmap_cardinality(bitmap);
+
+  if (n == 0) {
+    result = IDL_GettmpLong(-1);
+  } else if (mg_bitmap_max(bitmap) < 2147483648LL) {
+    // indices less than 2^31 are returned as LONG, like WHERE
+    lout = (IDL_LONG *) IDL_MakeTempVector(IDL_TYP_LONG, n,
+                                           IDL_ARR_INI_NOP, &result);
+    MG_BITMAP_FILL(lout, IDL_LONG);
+  } else {
+    out = (IDL_LONG64 *) IDL_MakeTempVector(IDL_TYP_LONG64, n,
+                                            IDL_ARR_INI_NOP, &result);
+    MG_BITMAP_FILL(out, IDL_LONG64);
+  }
+
+  if (kw.count_present) {
+    count.l64 = n;
+    IDL_StoreScalar(kw.count, IDL_TYP_LONG64, &count);
+  }
+
+  IDL_KW_FREE;
+
+  return result;
+}
+
+
+static IDL_VPTR IDL_CDECL IDL_mg_bitmap_to_mask(int argc, IDL_VPTR *argv) {
+  mg_bitmap *bitmap = mg_bitmap_get(argv[0]);
+  IDL_LONG64 n = IDL_Long64Scalar(argv[1]), base, v;
+  const mg_container *c;
+  IDL_VPTR result;
+  IDL_MEMINT i;
+  int32_t j, w;
+  uint64_t bits;
+  UCHAR *mask;
+
+  if (n < 1) {
+    IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                "number of elements must be positive");
+  }
+
+  mask = (UCHAR *) IDL_MakeTempVector(IDL_TYP_BYTE, n, IDL_ARR_INI_ZERO, &result);
+
+  for (i = 0; i < bitmap->n; i++) {
+    c = &bitmap->containers[i];
+    base = (IDL_LONG64) c->key << 16;
+    if (base >= n) break;
+    if (c->type == MG_CONTAINER_BITSET) {
+      for (w = 0; w < MG_BITMAP_WORDS; w++) {
+        for (bits = c->data.words[w]; bits; bits &= bits - 1) {
+          v = base + 64 * w + MG_CTZ(bits);
+          if (v < n) mask[v] = 1;
+        }
+      }
+    } else {
+      for (j = 0; j < c->cardinality; j++) {
+        v = base + c->data.array[j];
+        if (v < n) mask[v] = 1;
+      }
+    }
+  }
+
+  return result;
+}
+
+
+/*
+  Iterate over a bitmap: returns up to n_max values >= start as a LONG64
+  array, or -1L if there are no more values.
+*/
+static IDL_VPTR IDL_CDECL IDL_mg_bitmap_next(int argc, IDL_VPTR *argv, char *argk) {
+  typedef struct {
+    IDL_KW_RESULT_FIRST_FIELD;
+    IDL_VPTR count;
+    int count_present;
+  } KW_RESULT;
+
+  // make sure to list keyword in alphabetical order
+  static IDL_KW_PAR kw_pars[] = {
+    { "COUNT", IDL_TYP_UNDEF, 1, IDL_KW_OUT | IDL_KW_ZERO,
+      IDL_KW_OFFSETOF(count_present), IDL_KW_OFFSETOF(count) },
+    { NULL }
+  };
+
+  KW_RESULT kw;
+  IDL_VPTR plain_args[3], result;
+  IDL_ALLTYPES count;
+  mg_bitmap *bitmap;
+  IDL_LONG64 start, n_max, *out;
+  IDL_MEMINT n;
+
+  IDL_KWProcessByOffset(argc, argv, argk, kw_pars, plain_args, 1, &kw);
+
+  bitmap = mg_bitmap_get(plain_args[0]);
+  start = IDL_Long64Scalar(plain_args[1]);
+  n_max = IDL_Long64Scalar(plain_args[2]);
+
+  out = (IDL_LONG64 *) malloc((n_max > 0 ? n_max : 1) * sizeof(IDL_LONG64));
+  if (!out) {
+    IDL_KW_FREE;
+    IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                "unable to allocate memory for values");
+  }
+
+  n = n_max > 0 ? mg_bitmap_values(bitmap, start, n_max, out) : 0;
+
+  if (n > 0) {
+    result = IDL_ImportArray(1, &n, IDL_TYP_LONG64, (UCHAR *) out,
+                             (IDL_ARRAY_FREE_CB) free, NULL);
+  } else {
+    free(out);
+    result = IDL_GettmpLong(-1);
+  }
+
+  if (kw.count_present) {
+    count.l64 = n;
+    IDL_StoreScalar(kw.count, IDL_TYP_LONG64, &count);
+  }
+
+  IDL_KW_FREE;
+
+  return result;
+}
+
+
+static void IDL_CDECL IDL_mg_bitmap_free(int argc, IDL_VPTR *argv) {
+  mg_bitmap_free((mg_bitmap *) IDL_MEMINTScalar(argv[0]));
+}
+
+
+int IDL_Load(void) {
+  /*
+   * These tables contain information on the functions and procedures
+   * that make up the indices DLM. The information contained in these
+   * tables must be identical to that contained in mg_indices.dlm.
+   */
+  static IDL_SYSFUN_DEF2 function_addr[] = {
+    { IDL_mg_bitmap_and,          "MG_BITMAP_AND",          2, 32, 0, 0 },
+    { IDL_mg_bitmap_andnot,       "MG_BITMAP_ANDNOT",       2, 32, 0, 0 },
+    { IDL_mg_bitmap_cardinality,  "MG_BITMAP_CARDINALITY",  1, 1, 0, 0 },
+    { IDL_mg_bitmap_complement,   "MG_BITMAP_COMPLEMENT",   2, 2, 0, 0 },
+    { IDL_mg_bitmap_contains,     "MG_BITMAP_CONTAINS",     2, 2, 0, 0 },
+    { IDL_mg_bitmap_from_indices, "MG_BITMAP_FROM_INDICES", 1, 1, 0, 0 },
+    { IDL_mg_bitmap_from_mask,    "MG_BITMAP_FROM_MASK",    1, 1, IDL_SYSFUN_DEF_F_KEYWORDS, 0 },
+    { IDL_mg_bitmap_from_range,   "MG_BITMAP_FROM_RANGE",   2, 2, 0, 0 },
+    { IDL_mg_bitmap_n_bytes,      "MG_BITMAP_N_BYTES",      1, 1, 0, 0 },
+    { IDL_mg_bitmap_next,         "MG_BITMAP_NEXT",         3, 3, IDL_SYSFUN_DEF_F_KEYWORDS, 0 },
+    { IDL_mg_bitmap_or,           "MG_BITMAP_OR",           2, 32, 0, 0 },
+    { IDL_mg_bitmap_to_indices,   "MG_BITMAP_TO_INDICES",   1, 1, IDL_SYSFUN_DEF_F_KEYWORDS, 0 },
+    { IDL_mg_bitmap_to_mask,      "MG_BITMAP_TO_MASK",      2, 2, 0, 0 },
+    { IDL_mg_bitmap_xor,          "MG_BITMAP_XOR",          2, 32, 0, 0 },
+  };
+
+  static IDL_SYSFUN_DEF2 procedure_addr[] = {
+    { (IDL_SYSRTN_GENERIC) IDL_mg_bitmap_free, "MG_BITMAP_FREE", 1, 1, 0, 0 },
+  };
+
+  /*
+   * Register our routines. The routines must be specified exactly the same
+   * as in mg_indices.dlm.
+   */
+  return IDL_SysRtnAdd(function_addr, TRUE, IDL_CARRAY_ELTS(function_addr))
+           && IDL_SysRtnAdd(procedure_addr, FALSE, IDL_CARRAY_ELTS(procedure_addr));
+}
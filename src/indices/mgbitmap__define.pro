@@ -0,0 +1,405 @@
+; docformat = 'rst'
+
+;+
+; Compressed bitmap of array indices, an alternative to the index arrays
+; returned by `WHERE` and used by `MG_COMPLEMENT` and friends. Bitmaps store
+; dense regions of indices in 1 bit per element and sparse regions in 2
+; bytes per index, and are combined much faster than index arrays.
+;
+; :Examples:
+;   Combine quality masks and retrieve the indices of the good pixels::
+;
+;     good = MGBitmap(mask=(data gt 0.0) and finite(data))
+;     flagged = MGBitmap(indices=where(flags ne 0))
+;     result = good - flagged
+;     ind = result->indices(count=n_good)
+;     obj_destroy, [good, flagged, result]
+;
+; :Properties:
+;   cardinality : type=long64
+;     number of indices in the bitmap
+;   n_bytes : type=long64
+;     memory used by the bitmap
+;-
+
+
+;= operator overloading methods
+
+;+
+; Intersection of two bitmaps.
+;
+; :Returns:
+;   `MGBitmap` object
+;
+; :Params:
+;   left : in, required, type=MGBitmap
+;     left-side operand
+;   right : in, required, type=MGBitmap
+;     right-side operand
+;-
+function mgbitmap::_overloadAnd, left, right
+  compile_opt strictarr
+  on_error, 2
+
+  return, obj_new('MGBitmap', $
+                  handle=mg_bitmap_and(left->_handle(), right->_handle()))
+end
+
+
+;+
+; Union of two bitmaps.
+;
+; :Returns:
+;   `MGBitmap` object
+;
+; :Params:
+;   left : in, required, type=MGBitmap
+;     left-side operand
+;   right : in, required, type=MGBitmap
+;     right-side operand
+;-
+function mgbitmap::_overloadOr, left, right
+  compile_opt strictarr
+  on_error, 2
+
+  return, obj_new('MGBitmap', $
+                  handle=mg_bitmap_or(left->_handle(), right->_handle()))
+end
+
+
+;+
+; Union of two bitmaps.
+;
+; :Returns:
+;   `MGBitmap` object
+;
+; :Params:
+;   left : in, required, type=MGBitmap
+;     left-side operand
+;   right : in, required, type=MGBitmap
+;     right-side operand
+;-
+function mgbitmap::_overloadPlus, left, right
+  compile_opt strictarr
+  on_error, 2
+
+  return, self->_overloadOr(left, right)
+end
+
+
+;+
+; Indices of the left bitmap that are not in the right bitmap.
+;
+; :Returns:
+;   `MGBitmap` object
+;
+; :Params:
+;   left : in, required, type=MGBitmap
+;     left-side operand
+;   right : in, required, type=MGBitmap
+;     right-side operand
+;-
+function mgbitmap::_overloadMinus, left, right
+  compile_opt strictarr
+  on_error, 2
+
+  return, obj_new('MGBitmap', $
+                  handle=mg_bitmap_andnot(left->_handle(), right->_handle()))
+end
+
+
+;+
+; Symmetric difference of two bitmaps.
+;
+; :Returns:
+;   `MGBitmap` object
+;
+; :Params:
+;   left : in, required, type=MGBitmap
+;     left-side operand
+;   right : in, required, type=MGBitmap
+;     right-side operand
+;-
+function mgbitmap::_overloadXor, left, right
+  compile_opt strictarr
+  on_error, 2
+
+  return, obj_new('MGBitmap', $
+                  handle=mg_bitmap_xor(left->_handle(), right->_handle()))
+end
+
+
+;+
+; Handle iterating over the indices of the bitmap in increasing order.
+;
+; :Returns:
+;   1 if there is a current element to retrieve, 0 if not
+;
+; :Params:
+;   value : in, required, type=long64
+;     return value for the iteration
+;   key : in, required, type=undefined or lon64arr
+;     undefined on initial item; for subsequent calls, a block of indices
+;     retrieved from the bitmap, preceded by the position of the current
+;     index in it
+;-
+function mgbitmap::_overloadForeach, value, key
+  compile_opt strictarr
+
+  ; step through the current block of indices
+  if (n_elements(key) gt 0L) then begin
+    if (key[0] lt n_elements(key) - 1L) then begin
+      key[0]++
+      value = key[key[0]]
+      return, 1
+    endif
+  endif
+
+  ; retrieve the next block, starting after the last index of the current one
+  start = n_elements(key) eq 0L ? 0LL : (key[-1] + 1LL)
+  values = mg_bitmap_next(self.bitmap, start, 1024L, count=count)
+  if (count eq 0L) then return, 0
+
+  key = [1LL, values]
+  value = key[1]
+
+  return, 1
+end
+
+
+;+
+; Evaluates bitmap for truth. True if bitmap contains any indices, false
+; otherwise.
+;
+; :Returns:
+;   byte
+;-
+function mgbitmap::_overloadIsTrue
+  compile_opt strictarr
+
+  return, mg_bitmap_cardinality(self.bitmap) gt 0LL
+end
+
+
+;+
+; Returns the indices to print. Called by `PRINT` to determine what should
+; be displayed.
+;
+; :Returns:
+;   indices in the bitmap or -1L if empty
+;-
+function mgbitmap::_overloadPrint
+  compile_opt strictarr
+
+  return, self->indices()
+end
+
+
+;+
+; Returns a string describing the bitmap. Called by the `HELP` routine.
+;
+; :Returns:
+;   string
+;
+; :Params:
+;   varname : in, required, type=string
+;     name of the variable to retrieve help for
+;-
+function mgbitmap::_overloadHelp, varname
+  compile_opt strictarr
+
+  return, string(varname, obj_class(self), $
+                 mg_bitmap_cardinality(self.bitmap), $
+                 mg_bitmap_n_bytes(self.bitmap), $
+                 format='(%"%-15s %s  <cardinality: %d, bytes: %d>")')
+end
+
+
+;= other methods
+
+;+
+; Returns the native handle of the bitmap, for use with the `MG_BITMAP_*`
+; routines.
+;
+; :Private:
+;
+; :Returns:
+;   long64
+;-
+function mgbitmap::_handle
+  compile_opt strictarr
+
+  return, self.bitmap
+end
+
+
+;+
+; Indices in the bitmap.
+;
+; :Returns:
+;   `lonarr` of sorted indices, `lon64arr` if the bitmap contains indices of
+;   2^31 or more, or -1L if the bitmap is empty
+;
+; :Keywords:
+;   count : out, optional, type=long64
+;     set to a named variable to retrieve the number of indices
+;-
+function mgbitmap::indices, count=count
+  compile_opt strictarr
+
+  return, mg_bitmap_to_indices(self.bitmap, count=count)
+end
+
+
+;+
+; Mask with 1B for indices in the bitmap.
+;
+; :Returns:
+;   `bytarr(n)`
+;
+; :Params:
+;   n : in, required, type=integer/array
+;     full array or number of elements in full array
+;-
+function mgbitmap::mask, n
+  compile_opt strictarr
+  on_error, 2
+
+  _n = size(n, /n_dimensions) eq 0L ? n : n_elements(n)
+  return, mg_bitmap_to_mask(self.bitmap, _n)
+end
+
+
+;+
+; Complement of the bitmap in an array.
+;
+; :Returns:
+;   `MGBitmap` object
+;
+; :Params:
+;   n : in, required, type=integer/array
+;     full array or number of elements in full array
+;-
+function mgbitmap::complement, n
+  compile_opt strictarr
+  on_error, 2
+
+  _n = size(n, /n_dimensions) eq 0L ? n : n_elements(n)
+  return, obj_new('MGBitmap', handle=mg_bitmap_complement(self.bitmap, _n))
+end
+
+
+;+
+; Determine whether indices are in the bitmap.
+;
+; :Returns:
+;   `bytarr` of the same dimensions as `indices`
+;
+; :Params:
+;   indices : in, required, type=integer array
+;     indices to check
+;-
+function mgbitmap::contains, indices
+  compile_opt strictarr
+  on_error, 2
+
+  return, mg_bitmap_contains(self.bitmap, indices)
+end
+
+
+;+
+; Retrieve indices in chunks, to iterate over large bitmaps.
+;
+; :Returns:
+;   `lon64arr` of the next indices in increasing order or -1L if there are
+;   no more indices
+;
+; :Params:
+;   start : in, required, type=integer
+;     smallest index to return
+;   n_max : in, required, type=integer
+;     maximum number of indices to return
+;
+; :Keywords:
+;   count : out, optional, type=long64
+;     set to a named variable to retrieve the number of indices returned
+;-
+function mgbitmap::next, start, n_max, count=count
+  compile_opt strictarr
+  on_error, 2
+
+  return, mg_bitmap_next(self.bitmap, start, n_max, count=count)
+end
+
+
+;+
+; Get properties.
+;-
+pro mgbitmap::getProperty, cardinality=cardinality, n_bytes=n_bytes
+  compile_opt strictarr
+
+  if (arg_present(cardinality)) then begin
+    cardinality = mg_bitmap_cardinality(self.bitmap)
+  endif
+  if (arg_present(n_bytes)) then n_bytes = mg_bitmap_n_bytes(self.bitmap)
+end
+
+
+;+
+; Free resources.
+;-
+pro mgbitmap::cleanup
+  compile_opt strictarr
+
+  if (self.bitmap ne 0) then mg_bitmap_free, self.bitmap
+end
+
+
+;+
+; Create a bitmap. Without any keywords, the bitmap is empty.
+;
+; :Returns:
+;   1 for success, 0 for failure
+;
+; :Keywords:
+;   mask : in, optional, type=integer or real array
+;     mask of at most 2^32 elements whose non-zero elements are the indices
+;     of the bitmap
+;   indices : in, optional, type=integer array
+;     indices less than 2^32, negative indices are ignored
+;   range : in, optional, type=lonarr(2)
+;     first and last index of a range of indices, inclusive
+;   handle : in, optional, private, type=long64
+;     native handle of a bitmap, which the new object takes ownership of
+;   _extra : in, optional, type=keywords
+;     `TPOOL_NTHREADS` and `TPOOL_MIN_ELTS` for `MASK`
+;-
+function mgbitmap::init, mask=mask, indices=indices, range=range, $
+                         handle=handle, _extra=e
+  compile_opt strictarr
+  on_error, 2
+
+  case 1 of
+    n_elements(handle) gt 0L: self.bitmap = handle
+    n_elements(mask) gt 0L: self.bitmap = mg_bitmap_from_mask(mask, _extra=e)
+    n_elements(indices) gt 0L: self.bitmap = mg_bitmap_from_indices(indices)
+    n_elements(range) gt 0L: self.bitmap = mg_bitmap_from_range(range[0], range[1])
+    else: self.bitmap = mg_bitmap_from_indices(-1L)
+  endcase
+
+  return, 1
+end
+
+
+;+
+; Define instance variables.
+;
+; :Fields:
+;   bitmap
+;     handle to the native bitmap
+;-
+pro mgbitmap__define
+  compile_opt strictarr
+
+  define = { MGBitmap, inherits IDL_Object, bitmap: 0LL }
+end
@@ -17,6 +17,16 @@
 ;= API
 
 
+;+
+; Determine the vocabulary of the training documents and the number of
+; documents each word occurs in.
+;
+; :Params:
+;   x : in, required, type=strarr
+;     array of documents to fit
+;   y : in, optional, type=any
+;     not used
+;-
 pro mg_tfidftransformer::fit, x, y, _extra=e
   compile_opt strictarr
 
@@ -25,6 +35,22 @@ pro mg_tfidftransformer::fit, x, y, _extra=e
   n_samples = n_elements(x)
   self._all_words_hash->remove, /all
 
+  if (mg_hasroutine('mg_word_counts')) then begin
+    ; words are separated by spaces and tabs, like STRSPLIT
+    !null = mg_word_counts(x, delimiters=string([32B, 9B]), $
+                           vocabulary=vocabulary, $
+                           document_frequency=document_frequency)
+    if (document_frequency[0] ge 0L) then begin
+      self._all_words_hash[vocabulary] = document_frequency
+      *self._all_words = vocabulary
+      *self._document_frequency = document_frequency
+    endif else begin
+      *self._all_words = !null
+      *self._document_frequency = !null
+    endelse
+    return
+  endif
+
   for d = 0L, n_samples - 1L do begin
     words = strsplit(x[d], /extract)
     word_counts = mg_word_count(words)
@@ -40,8 +66,14 @@ pro mg_tfidftransformer::fit, x, y, _extra=e
 
   all_words_list = self._all_words_hash->keys()
   *self._all_words = all_words_list->toArray()
-
   obj_destroy, all_words_list
+
+  n_words = n_elements(*self._all_words)
+  document_frequency = lonarr(n_words > 1)
+  for t = 0L, n_words - 1L do begin
+    document_frequency[t] = self._all_words_hash[(*self._all_words)[t]]
+  endfor
+  *self._document_frequency = n_words eq 0L ? !null : document_frequency
 end
 
 
@@ -57,35 +89,42 @@ function mg_tfidftransformer::transform, x
   compile_opt strictarr
 
   n_samples = n_elements(x)
-  word_counts = objarr(n_samples)         ; word frequency by document
-
-  for d = 0L, n_samples - 1L do begin
-    words = strsplit(x[d], /extract)
-    word_counts[d] = mg_word_count(words)
-  endfor
-
   n_words = n_elements(*self._all_words)
 
   *self.feature_names = *self._all_words
 
+  if (n_words eq 0L) then return, fltarr(1, n_samples)
+
+  idf = alog(float(n_samples + 1) / (*self._document_frequency + 1.0)) + 1
   tfidf = fltarr(n_words, n_samples)
-  for t = 0L, n_words - 1L do begin
-    word = (*self._all_words)[t]
-    count = self._all_words_hash->hasKey(word) ? self._all_words_hash[word] : 0L
-    idf = alog(float(n_samples + 1) / (count + 1.0)) + 1
+
+  if (mg_hasroutine('mg_word_counts')) then begin
+    ; counts of the words of the fitted vocabulary in each document
+    counts = mg_word_counts(x, delimiters=string([32B, 9B]), $
+                            fixed_vocabulary=*self._all_words, $
+                            ids=ids, offsets=offsets)
+    if (ids[0] ge 0L) then begin
+      documents = value_locate(offsets, lindgen(n_elements(ids)))
+      tfidf[ids + n_words * documents] = counts * idf[ids]
+    endif
+  endif else begin
     for d = 0L, n_samples - 1L do begin
-      tf = ((word_counts[d])->haskey(word) ? (word_counts[d])[word] : 0)
-      tfidf[t, d] =  tf * idf
+      word_counts = mg_word_count(strsplit(x[d], /extract))
+      for t = 0L, n_words - 1L do begin
+        word = (*self._all_words)[t]
+        if (word_counts->haskey(word)) then begin
+          tfidf[t, d] = word_counts[word] * idf[t]
+        endif
+      endfor
+      obj_destroy, word_counts
     endfor
-  endfor
+  endelse
 
   ; normalize rows
   for d = 0L, n_samples - 1L do begin
     tfidf[*, d] /= sqrt(total((tfidf[*, d])^2, /preserve_type))
   endfor
 
-  obj_destroy, word_counts
-
   return, tfidf
 end
 
@@ -132,7 +171,7 @@ end
 pro mg_tfidftransformer::cleanup
   compile_opt strictarr
 
-  ptr_free, self._all_words
+  ptr_free, self._all_words, self._document_frequency
   obj_destroy, self._all_words_hash
 
   self->mg_transformer::cleanup
@@ -145,6 +184,7 @@ function mg_tfidftransformer::init, _extra=e
   if (~self->mg_transformer::init()) then return, 0
 
   self._all_words = ptr_new(/allocate_heap)
+  self._document_frequency = ptr_new(/allocate_heap)
   self._all_words_hash = hash()
 
   self->setProperty, _extra=e
@@ -158,6 +198,7 @@ pro mg_tfidftransformer__define
 
   !null = {mg_tfidftransformer, inherits mg_transformer, $
            _all_words: ptr_new(), $
+           _document_frequency: ptr_new(), $
            _all_words_hash: obj_new()}
 end
 
@@ -8,15 +8,23 @@
   rick.towler@noaa.gov
 */
 
+/* recvmmsg and sendmmsg */
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <stddef.h>
 #include <string.h>
+#include <errno.h>
+#include <time.h>
 
 #include "mg_idl_export.h"
 #include "mg_net.h"
 
-#define MAX_SOCKETS 256
+#define INITIAL_SOCKETS 256
 #define NET_UNUSED 0
 #define NET_LISTEN 1
 #define NET_IO 2
@@ -24,6 +32,67 @@
 #define NET_TCP 1
 #define NET_UDP_PEER 2
 
+/* events reported by MG_NET_POLL, NET_POLL_EDGE is only used internally */
+#define NET_POLL_READ 1
+#define NET_POLL_WRITE 2
+#define NET_POLL_ACCEPT 4
+#define NET_POLL_HANGUP 8
+#define NET_POLL_EDGE 16
+
+/* MG_NET_SELECT and MG_NET_POLL check for an interrupt this often (seconds) */
+#define NET_POLL_SLICE 2.0
+
+/* largest UDP datagram, MG_NET_SENDVAR sends a variable in one datagram */
+#define NET_MAX_DATAGRAM 65536
+
+/*
+  MG_NET_RECVMMSG reads NET_DEFAULT_BATCH datagrams by default; at most
+  NET_MAX_BATCH datagrams are passed to each system call
+*/
+#define NET_DEFAULT_BATCH 64
+#define NET_MAX_BATCH 1024
+
+/* room for the control messages of a datagram, i.e., its timestamp */
+#define NET_CMSG_SIZE 64
+
+/* MG_NET_SENDVAR sends the data of a variable in chunks of this many bytes */
+#define NET_CHUNK_SIZE 4194304
+
+/* number of partially received variables kept for resuming */
+#define NET_MAX_PENDING 16
+
+/*
+  MG_NET_SEND_ASYNC and MG_NET_RECV_ASYNC refuse new requests while this many
+  are in flight (a power of 2) or, for sends, while this many bytes are queued
+*/
+#define NET_ASYNC_QUEUE 1024
+#define NET_ASYNC_MAX_BYTES 268435456
+
+/* operations of asynchronous requests */
+#define NET_ASYNC_SEND 0
+#define NET_ASYNC_RECV 1
+#define NET_ASYNC_RECVVAR 2
+
+/* stages of a variable received by MG_NET_RECV_ASYNC */
+#define NET_STAGE_TOKEN 0
+#define NET_STAGE_HEADER 1
+#define NET_STAGE_CHUNK 2
+#define NET_STAGE_CHECKSUM 3
+
+/*
+  Bins of the round trip latency histogram of MG_NET_STATS; bin k counts round
+  trips of 2^k to 2^(k+1) microseconds, bin 0 also those under a microsecond.
+*/
+#define NET_STATS_BINS 32
+
+/* variables sent whose send times are kept to time their round trips */
+#define NET_STATS_PENDING 16
+
+/* shared memory channels set up by MG_NET_SHM */
+#define NET_SHM_MAGIC 0x4d474e53
+#define NET_SHM_HEADER 4096           /* bytes before the data of the rings */
+#define NET_SHM_DEFAULT 16777216      /* default bytes in each ring */
+
 #ifndef WIN32
 #include <sys/types.h>
 #include <sys/time.h>
@@ -32,29 +101,278 @@
 #include <netinet/tcp.h>
 #include <netdb.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <poll.h>
 #include <unistd.h>
 #define SOCKET int
 #define IOCTL ioctl
 #define CLOSE close
+#define POLL poll
 #else
 #include <winsock2.h>
 #define IOCTL ioctlsocket
 #define CLOSE closesocket
+#define POLL WSAPoll
+struct iovec {
+  void *iov_base;
+  size_t iov_len;
+};
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+#ifndef MSG_MORE
+#define MSG_MORE 0
+#endif
+#ifndef MSG_DONTWAIT
+#define MSG_DONTWAIT 0
+#endif
+
+/*
+  Asynchronous requests are served by an I/O thread where pthreads and GCC
+  style atomics are available; elsewhere they complete when submitted.
+*/
+#if !defined(WIN32) && defined(__GNUC__)
+#include <pthread.h>
+#include <signal.h>
+#include <fcntl.h>
+#define MG_NET_THREAD
+#define NET_LOAD(x) __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define NET_STORE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+#define NET_EXCHANGE(x, v) __atomic_exchange_n(&(x), (v), __ATOMIC_SEQ_CST)
+#define NET_FENCE() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define MG_NET_SHM
+#else
+#define NET_LOAD(x) (x)
+#define NET_STORE(x, v) ((x) = (v))
+#undef MSG_DONTWAIT
+#define MSG_DONTWAIT 0
+#endif
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __SSE4_2__
+#include <nmmintrin.h>
+#endif
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#define MG_NET_EPOLL
+#define MG_NET_MMSG
 #endif
 
+/* statistics of a socket reported by MG_NET_STATS */
+typedef struct {
+  IDL_LONG64 bytes_sent, bytes_received;
+  IDL_LONG64 messages_sent, messages_received;
+  IDL_LONG64 syscalls;          /* send and receive system calls */
+  IDL_LONG64 retries;           /* calls repeated after partial I/O or signals */
+  IDL_LONG64 send_errors, recv_errors;
+  IDL_LONG64 round_trips;
+  IDL_LONG64 latency[NET_STATS_BINS];
+  double latency_total, latency_max;
+  double send_time, recv_time;  /* seconds in MG_NET_SENDVAR and MG_NET_RECVVAR */
+  double sent[NET_STATS_PENDING];   /* times of variables sent, not yet answered */
+  int first_sent, n_sent;
+} net_stats;
+
 typedef struct _sock {
   IDL_LONG iState;
   IDL_LONG iType;
   SOCKET socket;
+  IDL_LONG iPoll;      /* events watched by MG_NET_POLL, 0 if not watched */
+  IDL_LONG iAsync;     /* asynchronous requests in flight */
+  IDL_LONG iTimestamps;  /* kernel receive timestamps are enabled */
+  struct _net_shm *pShm;  /* shared memory channel, NULL if none */
+  char *pPath;         /* file of a Unix domain listener, NULL if none */
+  net_stats stats;
+  IDL_LONG iNextFree;  /* next unused entry in the free list */
 } sock;
 
+/* source of the data of a variable read by MG_NET_RECVVAR */
+typedef struct {
+  SOCKET s;
+  char *payload;       /* rest of the datagram, NULL for TCP sockets */
+  IDL_MEMINT avail;    /* bytes left in payload */
+  struct _net_shm *shm;   /* shared memory channel of the socket, if any */
+  net_stats *stats;
+  IDL_MEMINT got;      /* bytes read so far */
+  double deadline;     /* mg_net_clock time to give up by, 0.0 for none */
+} net_reader;
+
+/* datagram read by MG_NET_RECVMMSG */
+typedef struct {
+  struct sockaddr_in from;
+  IDL_MEMINT len;
+  double time;              /* arrival time in seconds since 1970 */
+} net_datagram;
+
+/* partially received variable that can be resumed by MG_NET_RECVVAR */
+typedef struct {
+  IDL_LONG64 transfer_id;   /* 0 for unused entries */
+  i_var2 var;               /* header of the transfer */
+  IDL_MEMINT received;      /* bytes received with valid checksums */
+  char *buffer;             /* packed data, NULL if received into the variable */
+} net_pending;
+
+/* preallocated buffer that MG_NET_RECVVAR receives arrays into */
+typedef struct {
+  char *data;
+  IDL_MEMINT size;
+  int in_use;               /* buffer holds the data of an IDL variable */
+} net_ring_buffer;
+
+/* request made by MG_NET_SEND_ASYNC or MG_NET_RECV_ASYNC */
+typedef struct _net_request {
+  IDL_LONG64 id;
+  int op;                   /* NET_ASYNC_SEND, NET_ASYNC_RECV or NET_ASYNC_RECVVAR */
+  IDL_LONG index;           /* socket identifier */
+  SOCKET socket;
+  int datagram;             /* receive a single datagram */
+  int status;               /* 1 for success, -1 for failure */
+  int completed;            /* completion has been seen by the IDL thread */
+  char *buffer;             /* data sent or received */
+  IDL_MEMINT len;           /* bytes in buffer */
+  IDL_MEMINT done;          /* bytes sent or received when complete */
+  char *target;             /* piece of data being sent or received */
+  IDL_MEMINT want;          /* bytes in the piece */
+  IDL_MEMINT got;           /* bytes of the piece sent or received so far */
+  int stage;                /* stage of a variable being received */
+  int swab;                 /* variable received needs byteswapping */
+  char header[sizeof(i_var2)];
+  i_var2 var;               /* header of a variable sent or received */
+  IDL_MEMINT chunk;         /* bytes in the current chunk of a variable */
+  IDL_ULONG checksum;       /* checksum received after the current chunk */
+  IDL_LONG64 syscalls;      /* send or receive system calls made */
+  struct _net_request *next;   /* next request not yet collected */
+} net_request;
+
+/*
+  Queue of requests between the IDL thread and the I/O thread. Each queue has
+  a single producer and a single consumer, so it needs no locks; the head
+  and tail are on separate cache lines.
+*/
+typedef struct {
+  net_request *items[NET_ASYNC_QUEUE];
+  IDL_ULONG64 head;         /* next item to take, written by the consumer */
+  char pad[64];
+  IDL_ULONG64 tail;         /* next free item, written by the producer */
+  char pad2[64];
+} net_queue;
+
+/*
+  Control block of one direction of a shared memory channel. The writer only
+  advances head and the reader only advances tail; each sets its waiting flag
+  before blocking on the socket, so the other end knows to send a byte.
+*/
+typedef struct {
+  IDL_ULONG64 head;         /* bytes written */
+  char pad[56];
+  IDL_ULONG64 tail;         /* bytes read */
+  char pad2[56];
+  int reader_waiting;
+  int writer_waiting;
+  char pad3[56];
+} net_shm_ring;
+
+/* start of the shared memory of a channel */
+typedef struct {
+  IDL_ULONG magic;
+  IDL_ULONG version;
+  IDL_ULONG64 size;         /* bytes of data in each ring */
+  char pad[48];
+  net_shm_ring rings[2];    /* ring 0 is written by the end that created it */
+} net_shm_header;
+
+/* shared memory channel of a socket */
+typedef struct _net_shm {
+  char *base;
+  IDL_MEMINT map_size;
+  IDL_MEMINT size;          /* bytes of data in each ring */
+  net_shm_ring *out, *in;
+  char *out_data, *in_data;
+} net_shm;
+
 /* local prototypes */
-static int mg_recv_packet(SOCKET s, void *buffer, int len);
+static int mg_recv_packet(SOCKET s, void *buffer, IDL_MEMINT len,
+                          double deadline, net_stats *stats);
+static IDL_MEMINT mg_send_all(SOCKET s, struct iovec *iov, int iovcnt,
+                              struct sockaddr_in *to, int flags,
+                              net_stats *stats);
 static void mg_rebuffer_socket(SOCKET s, int len);
+static void mg_crc32c_init(void);
+static void mg_ring_free(void);
+static IDL_ULONG mg_crc32c(const void *data, IDL_MEMINT len);
 static void mg_nodelay_socket(SOCKET s, int flag);
+static int mg_net_poll_ctl(IDL_LONG i, IDL_LONG events);
+static IDL_VPTR mg_stats_struct(net_stats *stats);
+static void mg_async_drain(void);
+static int mg_async_busy(IDL_LONG i);
+static void mg_async_wait(double timeout);
+static void mg_async_stop(void);
+static void mg_shm_free(IDL_LONG i);
+static void mg_net_unlink(IDL_LONG i);
+static int mg_shm_write(net_shm *shm, SOCKET s, const char *data, IDL_MEMINT len,
+                        net_stats *stats);
+static int mg_shm_read(net_shm *shm, SOCKET s, char *data, IDL_MEMINT len,
+                       net_stats *stats);
+static double mg_net_clock(void);
+
+/*
+  Global table of sockets, indexed by the socket identifiers returned to IDL.
+  The table grows as needed and unused entries are kept in a free list, so
+  entries never move to a different index.
+*/
+static sock *net_list = NULL;
+static IDL_LONG net_list_size = 0;
+static IDL_LONG net_free = -1;
+
+/* sockets watched by MG_NET_POLL */
+static IDL_LONG net_n_polled = 0;
+#ifdef MG_NET_EPOLL
+static int net_epoll = -1;
+#endif
+
+static net_pending net_pending_list[NET_MAX_PENDING];
+
+/* buffer MG_NET_RECVMMSG reads datagrams into */
+static char *net_batch = NULL;
+static IDL_MEMINT net_batch_size = 0;
+
+/* receive buffers set up by MG_NET_RECVRING */
+static net_ring_buffer *net_ring = NULL;
+static IDL_LONG net_ring_size = 0;
+static IDL_ULONG crc32c_table[8][256];
+
+/*
+  Asynchronous requests. The IDL thread submits requests to the I/O thread
+  through net_submitted and collects them from net_completed; requests stay
+  in the net_requests list until collected by MG_NET_WAIT or MG_NET_TEST.
+*/
+static net_queue net_submitted, net_completed;
+static net_request *net_requests = NULL;
+static IDL_LONG64 net_next_request = 1;
+#ifdef MG_NET_THREAD
+static pthread_t net_thread;
+static int net_thread_started = 0;
+static int net_thread_stop = 0;
+static int net_thread_sleeping = 0;   /* I/O thread waits on net_submit_pipe */
+static int net_idl_waiting = 0;       /* IDL thread waits on net_done_pipe */
+static int net_submit_pipe[2] = { -1, -1 };
+static int net_done_pipe[2] = { -1, -1 };
+#endif
 
-/* global list of sockets */
-sock net_list[MAX_SOCKETS];
+/* statistics reported by MG_NET_ASYNC_STATS */
+static IDL_LONG64 net_n_submitted = 0, net_n_completed = 0, net_n_failed = 0;
+static IDL_LONG64 net_n_rejected = 0, net_max_queued = 0;
+static IDL_LONG64 net_queued = 0, net_queued_bytes = 0;
+static IDL_LONG64 net_n_requests = 0;     /* requests not yet collected */
 
 /* function protos */
 static IDL_VPTR IDL_CDECL mg_net_createport(int argc, IDL_VPTR argv[], char *argk);
@@ -64,10 +382,21 @@ static IDL_VPTR IDL_CDECL mg_net_accept(int argc, IDL_VPTR argv[], char *argk);
 static IDL_VPTR IDL_CDECL mg_net_send(int argc, IDL_VPTR argv[], char *argk);
 static IDL_VPTR IDL_CDECL mg_net_sendto(int argc, IDL_VPTR argv[], char *argk);
 static IDL_VPTR IDL_CDECL mg_net_recv(int argc, IDL_VPTR argv[], char *argk);
+static IDL_VPTR IDL_CDECL mg_net_recvmmsg(int argc, IDL_VPTR argv[], char *argk);
+static IDL_VPTR IDL_CDECL mg_net_sendmmsg(int argc, IDL_VPTR argv[], char *argk);
 static IDL_VPTR IDL_CDECL mg_net_query(int argc, IDL_VPTR argv[], char *argk);
+static IDL_VPTR IDL_CDECL mg_net_stats(int argc, IDL_VPTR argv[], char *argk);
 static IDL_VPTR IDL_CDECL mg_net_sendvar(int argc, IDL_VPTR argv[], char *argk);
 static IDL_VPTR IDL_CDECL mg_net_recvvar(int argc, IDL_VPTR argv[], char *argk);
+static IDL_VPTR IDL_CDECL mg_net_recvring(int argc, IDL_VPTR argv[], char *argk);
+static IDL_VPTR IDL_CDECL mg_net_shm(int argc, IDL_VPTR argv[], char *argk);
+static IDL_VPTR IDL_CDECL mg_net_send_async(int argc, IDL_VPTR argv[], char *argk);
+static IDL_VPTR IDL_CDECL mg_net_recv_async(int argc, IDL_VPTR argv[], char *argk);
+static IDL_VPTR IDL_CDECL mg_net_wait(int argc, IDL_VPTR argv[], char *argk);
+static IDL_VPTR IDL_CDECL mg_net_test(int argc, IDL_VPTR argv[], char *argk);
+static IDL_VPTR IDL_CDECL mg_net_async_stats(int argc, IDL_VPTR argv[], char *argk);
 static IDL_VPTR IDL_CDECL mg_net_select(int argc, IDL_VPTR argv[], char *argk);
+static IDL_VPTR IDL_CDECL mg_net_poll(int argc, IDL_VPTR argv[], char *argk);
 static IDL_VPTR IDL_CDECL mg_net_name2host(int argc, IDL_VPTR argv[], char *argk);
 static IDL_VPTR IDL_CDECL mg_net_host2name(int argc, IDL_VPTR argv[], char *argk);
 
@@ -76,15 +405,26 @@ static IDL_VPTR IDL_CDECL mg_net_host2name(int argc, IDL_VPTR argv[], char *argk
 static IDL_SYSFUN_DEF2 net_functions[] = {
     { mg_net_createport, "MG_NET_CREATEPORT", 1, 1, IDL_SYSFUN_DEF_F_KEYWORDS, 0 },
     { mg_net_close,      "MG_NET_CLOSE",      1, 1, 0, 0 },
-    { mg_net_connect,    "MG_NET_CONNECT",    2, 2, IDL_SYSFUN_DEF_F_KEYWORDS, 0 },
+    { mg_net_connect,    "MG_NET_CONNECT",    1, 2, IDL_SYSFUN_DEF_F_KEYWORDS, 0 },
     { mg_net_accept,     "MG_NET_ACCEPT",     1, 1, IDL_SYSFUN_DEF_F_KEYWORDS, 0 },
     { mg_net_send,       "MG_NET_SEND",       2, 2, 0, 0 },
     { mg_net_recv,       "MG_NET_RECV",       2, 2, IDL_SYSFUN_DEF_F_KEYWORDS, 0 },
     { mg_net_query,      "MG_NET_QUERY",      1, 1, IDL_SYSFUN_DEF_F_KEYWORDS, 0 },
+    { mg_net_stats,      "MG_NET_STATS",      1, 1, IDL_SYSFUN_DEF_F_KEYWORDS, 0 },
     { mg_net_sendto,     "MG_NET_SENDTO",     4, 4, 0, 0 },
-    { mg_net_sendvar,    "MG_NET_SENDVAR",    2, 4, 0, 0 },
-    { mg_net_recvvar,    "MG_NET_RECVVAR",    2, 2, 0, 0 },
+    { mg_net_recvmmsg,   "MG_NET_RECVMMSG",   2, 2, IDL_SYSFUN_DEF_F_KEYWORDS, 0 },
+    { mg_net_sendmmsg,   "MG_NET_SENDMMSG",   2, 4, IDL_SYSFUN_DEF_F_KEYWORDS, 0 },
+    { mg_net_sendvar,    "MG_NET_SENDVAR",    2, 4, IDL_SYSFUN_DEF_F_KEYWORDS, 0 },
+    { mg_net_recvvar,    "MG_NET_RECVVAR",    2, 2, IDL_SYSFUN_DEF_F_KEYWORDS, 0 },
+    { mg_net_recvring,   "MG_NET_RECVRING",   2, 2, 0, 0 },
+    { mg_net_shm,        "MG_NET_SHM",        1, 2, 0, 0 },
+    { mg_net_send_async, "MG_NET_SEND_ASYNC", 2, 2, IDL_SYSFUN_DEF_F_KEYWORDS, 0 },
+    { mg_net_recv_async, "MG_NET_RECV_ASYNC", 1, 2, IDL_SYSFUN_DEF_F_KEYWORDS, 0 },
+    { mg_net_wait,       "MG_NET_WAIT",       1, 2, IDL_SYSFUN_DEF_F_KEYWORDS, 0 },
+    { mg_net_test,       "MG_NET_TEST",       1, 1, IDL_SYSFUN_DEF_F_KEYWORDS, 0 },
+    { mg_net_async_stats, "MG_NET_ASYNC_STATS", 0, 0, IDL_SYSFUN_DEF_F_KEYWORDS, 0 },
     { mg_net_select,     "MG_NET_SELECT",     2, 2, 0, 0 },
+    { mg_net_poll,       "MG_NET_POLL",       1, 2, IDL_SYSFUN_DEF_F_KEYWORDS, 0 },
     { mg_net_name2host,  "MG_NET_NAME2HOST",  0, 1, 0, 0 },
     { mg_net_host2name,  "MG_NET_HOST2NAME",  0, 1, 0, 0 },
 };
@@ -111,12 +451,31 @@ static int iInitW2 = 0;
 static void mg_net_exit_handler(void) {
   IDL_LONG i;
 
-  for(i = 0; i < MAX_SOCKETS; i++) {
+  mg_async_stop();
+  for(i = 0; i < net_list_size; i++) {
     if (net_list[i].iState != NET_UNUSED) {
+      mg_shm_free(i);
       shutdown(net_list[i].socket, 2);
       CLOSE(net_list[i].socket);
+      mg_net_unlink(i);
     }
   }
+  free(net_list);
+  net_list = NULL;
+  net_list_size = 0;
+  net_free = -1;
+
+  for (i = 0; i < NET_MAX_PENDING; i++) free(net_pending_list[i].buffer);
+  memset(net_pending_list, 0, sizeof(net_pending_list));
+  mg_ring_free();
+  free(net_batch);
+  net_batch = NULL;
+  net_batch_size = 0;
+
+#ifdef MG_NET_EPOLL
+  if (net_epoll != -1) CLOSE(net_epoll);
+  net_epoll = -1;
+#endif
 
 #ifdef WIN32
   if (iInitW2) WSACleanup();
@@ -153,11 +512,148 @@ int IDL_Load(void) {
   }
 
   IDL_ExitRegister(mg_net_exit_handler);
+  mg_crc32c_init();
 
   return IDL_TRUE;
 }
 
 
+/*
+  Internal function to find an unused entry in the socket table, growing the
+  table if there are none. The entry stays unused until mg_net_claim is
+  called. Returns -2 if the table can not grow.
+*/
+static IDL_LONG mg_net_free_slot(void) {
+  IDL_LONG i, new_size;
+  sock *new_list;
+
+  if (net_free >= 0) return(net_free);
+
+  new_size = net_list_size > 0 ? 2 * net_list_size : INITIAL_SOCKETS;
+  new_list = (sock *) realloc(net_list, new_size * sizeof(sock));
+  if (!new_list) return(-2);
+
+  /* add the new entries to the free list, lowest index first */
+  for (i = new_size - 1; i >= net_list_size; i--) {
+    new_list[i].iState = NET_UNUSED;
+    new_list[i].iPoll = 0;
+    new_list[i].pShm = NULL;
+    new_list[i].iNextFree = net_free;
+    net_free = i;
+  }
+  net_list = new_list;
+  net_list_size = new_size;
+
+  return(net_free);
+}
+
+
+/*
+  Internal function to use the entry returned by mg_net_free_slot for an open
+  socket.
+*/
+static void mg_net_claim(IDL_LONG i, SOCKET s, IDL_LONG state, IDL_LONG type) {
+  net_free = net_list[i].iNextFree;
+  net_list[i].iState = state;
+  net_list[i].iType = type;
+  net_list[i].socket = s;
+  net_list[i].iPoll = 0;
+  net_list[i].iAsync = 0;
+  net_list[i].iTimestamps = 0;
+  net_list[i].pShm = NULL;
+  net_list[i].pPath = NULL;
+  memset(&net_list[i].stats, 0, sizeof(net_stats));
+}
+
+
+/*
+  Internal function to remove the file a Unix domain listener is bound to, so
+  that the path can be used again.
+*/
+static void mg_net_unlink(IDL_LONG i) {
+  if (!net_list[i].pPath) return;
+#ifndef WIN32
+  unlink(net_list[i].pPath);
+#endif
+  free(net_list[i].pPath);
+  net_list[i].pPath = NULL;
+}
+
+
+/*
+  Internal function to return an entry to the free list.
+*/
+static void mg_net_release(IDL_LONG i) {
+  net_list[i].iState = NET_UNUSED;
+  net_list[i].iNextFree = net_free;
+  net_free = i;
+}
+
+
+/*
+  Internal function to count a send of bytes in messages on a socket, or an
+  error if bytes is negative.
+*/
+static void mg_stats_sent(net_stats *stats, IDL_MEMINT bytes, IDL_LONG64 messages) {
+  if (bytes < 0) {
+    stats->send_errors++;
+  } else {
+    stats->bytes_sent += bytes;
+    stats->messages_sent += messages;
+  }
+}
+
+
+/*
+  Internal function to count a receive of bytes in messages on a socket, or
+  an error if bytes is negative.
+*/
+static void mg_stats_received(net_stats *stats, IDL_MEMINT bytes, IDL_LONG64 messages) {
+  if (bytes < 0) {
+    stats->recv_errors++;
+  } else {
+    stats->bytes_received += bytes;
+    stats->messages_received += messages;
+  }
+}
+
+
+/*
+  Internal function to remember the time a variable was sent, so that its
+  round trip can be timed when a variable is received in reply.
+*/
+static void mg_stats_start_trip(net_stats *stats, double t) {
+  if (stats->n_sent == NET_STATS_PENDING) return;
+  stats->sent[(stats->first_sent + stats->n_sent) % NET_STATS_PENDING] = t;
+  stats->n_sent++;
+}
+
+
+/*
+  Internal function to add the round trip of the earliest variable sent and
+  not yet answered, answered at time t, to the latency histogram.
+*/
+static void mg_stats_end_trip(net_stats *stats, double t) {
+  double us;
+  int bin = 0;
+
+  if (stats->n_sent == 0) return;
+  t -= stats->sent[stats->first_sent];
+  stats->first_sent = (stats->first_sent + 1) % NET_STATS_PENDING;
+  stats->n_sent--;
+
+  us = 1.0e6 * t;
+  if (us >= 2.0) {
+    frexp(us, &bin);
+    bin = IDL_MIN(bin - 1, NET_STATS_BINS - 1);
+  }
+  stats->latency[bin]++;
+  stats->round_trips++;
+  stats->latency_total += t;
+  if (t > stats->latency_max) stats->latency_max = t;
+}
+
+
 /*
   General notes:
      * All error codes return -1 on failure.
@@ -169,12 +665,76 @@ int IDL_Load(void) {
 
 
 /*
-  socket = MG_NET_CREATEPORT(portnum [, /TCP] [, /UDP])
+  Internal function to create a Unix domain stream socket bound to, or
+  connected to, the path given by an IDL string. On Linux, paths starting
+  with "@" are in the abstract namespace and leave no file behind. Returns -1
+  for error.
+*/
+static SOCKET mg_unix_socket(IDL_VPTR vpPath, int listener) {
+#ifndef WIN32
+  struct sockaddr_un sun;
+  socklen_t len;
+  size_t n;
+  char *path;
+  SOCKET s;
+  int err;
+
+  IDL_ENSURE_SCALAR(vpPath);
+  path = IDL_VarGetString(vpPath);
+  n = strlen(path);
+  if ((n == 0) || (n >= sizeof(sun.sun_path))) return(-1);
+
+  memset(&sun, 0, sizeof(sun));
+  sun.sun_family = AF_UNIX;
+  memcpy(sun.sun_path, path, n);
+  len = (socklen_t) (offsetof(struct sockaddr_un, sun_path) + n + 1);
+#ifdef __linux__
+  if (path[0] == '@') {
+    /* abstract names are exactly n bytes, starting with a null byte */
+    sun.sun_path[0] = '\0';
+    len--;
+  }
+#endif
+
+  s = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (s == -1) return(-1);
+  if (listener) {
+    err = bind(s, (struct sockaddr *) &sun, len);
+  } else {
+    err = connect(s, (struct sockaddr *) &sun, len);
+  }
+  if (err == -1) {
+    CLOSE(s);
+    return(-1);
+  }
+
+  return(s);
+#else
+  return(-1);
+#endif
+}
+
+
+/*
+  socket = MG_NET_CREATEPORT(portnum [, BUFFER=size] [, /TCP] [, /UDP])
+  socket = MG_NET_CREATEPORT(path [, BUFFER=size])
 
   Creates a socket listening on the specified port for a new connection. Set
   the TCP keyword to create a TCP/IP port, or set the UDP keyword to create a
   UDP/IP port. By default a TCP port is created.
 
+  When given a path instead of a port number, creates a Unix domain socket
+  listening at that path, for connections from processes on the same host.
+  Sockets accepted from it are used like TCP sockets, and can be given a
+  shared memory channel with MG_NET_SHM. The path must not exist, and the
+  file created there is removed when the listener is closed; on Linux, a
+  path starting with "@" names an abstract socket that leaves no file
+  behind. Not available on Windows.
+
+  The BUFFER keyword sets the socket buffer size, as for MG_NET_CONNECT. For
+  UDP ports receiving many datagrams, a buffer of several megabytes keeps
+  datagrams from being dropped while IDL is busy.
+
   For TCP sockets, MG_NET_SELECT returns true for this socket if there is an
   attempt to connect to it (which should be serviced by MG_NET_ACCEPT).
 
@@ -185,10 +745,12 @@ static IDL_VPTR IDL_CDECL mg_net_createport(int argc, IDL_VPTR argv[], char *arg
   struct sockaddr_in sin;
   short	port;
   int err;
-  IDL_LONG i;
+  IDL_LONG i, iType, iState;
+  char *path;
 
-  static IDL_LONG	iUDP,iTCP;
+  static IDL_LONG	iBuffer,iUDP,iTCP;
   static IDL_KW_PAR kw_pars[] = { IDL_KW_FAST_SCAN,
+    { "BUFFER", IDL_TYP_LONG, 1, IDL_KW_ZERO, 0, IDL_CHARA(iBuffer) },
     { "TCP", IDL_TYP_LONG, 1, IDL_KW_ZERO, 0, IDL_CHARA(iTCP) },
     { "UDP", IDL_TYP_LONG, 1, IDL_KW_ZERO, 0, IDL_CHARA(iUDP) },
     { NULL }
@@ -196,22 +758,41 @@ static IDL_VPTR IDL_CDECL mg_net_createport(int argc, IDL_VPTR argv[], char *arg
 
   IDL_KWCleanup(IDL_KW_MARK);
   IDL_KWGetParams(argc, argv, argk, kw_pars, argv, 1);
-  port = (short) IDL_LongScalar(argv[0]);
   IDL_KWCleanup(IDL_KW_CLEAN);
 
-  for(i = 0; i < MAX_SOCKETS; i++) {
-    if (net_list[i].iState == NET_UNUSED) break;
+  i = mg_net_free_slot();
+  if (i < 0) return (IDL_GettmpLong(-2));
+
+  if (argv[0]->type == IDL_TYP_STRING) {
+    if (iUDP) return (IDL_GettmpLong(-1));
+    s = mg_unix_socket(argv[0], 1);
+    if (s == -1) return (IDL_GettmpLong(-1));
+    if (iBuffer) mg_rebuffer_socket(s, iBuffer);
+    if (listen(s, SOMAXCONN) == -1) {
+      CLOSE(s);
+      return (IDL_GettmpLong(-1));
+    }
+    mg_net_claim(i, s, NET_LISTEN, NET_TCP);
+    path = IDL_VarGetString(argv[0]);
+#ifdef __linux__
+    /* abstract sockets have no file to remove */
+    if (path[0] != '@') net_list[i].pPath = strdup(path);
+#else
+    net_list[i].pPath = strdup(path);
+#endif
+    return(IDL_GettmpLong(i));
   }
-  if (i == MAX_SOCKETS) return (IDL_GettmpLong(-2));
+  port = (short) IDL_LongScalar(argv[0]);
 
   if (iUDP) {
     s = socket(AF_INET, SOCK_DGRAM, 0);
-    net_list[i].iType = NET_UDP;
+    iType = NET_UDP;
   } else {
     s = socket(AF_INET, SOCK_STREAM, 0);
-    net_list[i].iType = NET_TCP;
+    iType = NET_TCP;
   }
   if (s == -1) return (IDL_GettmpLong(-1));
+  if (iBuffer) mg_rebuffer_socket(s, iBuffer);
 
   sin.sin_family = AF_INET;
   sin.sin_addr.s_addr = htonl(INADDR_ANY);
@@ -222,17 +803,17 @@ static IDL_VPTR IDL_CDECL mg_net_createport(int argc, IDL_VPTR argv[], char *arg
     return(IDL_GettmpLong(-1));
   }
   if (!iUDP) {
-    err = listen(s, 5);
+    err = listen(s, SOMAXCONN);
     if (err == -1) {
       CLOSE(s);
       return (IDL_GettmpLong(-1));
     }
-    net_list[i].iState = NET_LISTEN;
+    iState = NET_LISTEN;
   } else {
-    net_list[i].iState = NET_IO;
+    iState = NET_IO;
   }
 
-  net_list[i].socket = s;
+  mg_net_claim(i, s, iState, iType);
 
   return(IDL_GettmpLong(i));
 }
@@ -247,13 +828,22 @@ static IDL_VPTR IDL_CDECL mg_net_close(int argc, IDL_VPTR argv[], char *argk) {
   IDL_LONG i;
 
   i = IDL_LongScalar(argv[0]);
-  if ((i < 0) || (i >= MAX_SOCKETS)) return (IDL_GettmpLong(-1));
+  if ((i < 0) || (i >= net_list_size)) return (IDL_GettmpLong(-1));
   if (net_list[i].iState == NET_UNUSED) return (IDL_GettmpLong(-1));
 
+  mg_net_poll_ctl(i, 0);
   shutdown(net_list[i].socket,2);
+
+  /* requests in flight fail once the socket is shut down */
+  while (net_list[i].iAsync > 0) {
+    mg_async_drain();
+    if (net_list[i].iAsync > 0) mg_async_wait(NET_POLL_SLICE);
+  }
+  mg_shm_free(i);
   CLOSE(net_list[i].socket);
+  mg_net_unlink(i);
 
-  net_list[i].iState = NET_UNUSED;
+  mg_net_release(i);
 
   return (IDL_GettmpLong(0));
 }
@@ -262,6 +852,7 @@ static IDL_VPTR IDL_CDECL mg_net_close(int argc, IDL_VPTR argv[], char *argk) {
 /*
   socket = MG_NET_CONNECT(host, port [, BUFFER=size] [, LOCAL_PORT=lp]
                           [, /NODELAY] [, /TCP] [, /UDP])
+  socket = MG_NET_CONNECT(path [, BUFFER=size])
 
   Connect to a TCP socket listener on some specified host and port. The
   returned socket can be used for I/O after the server "accepts" the
@@ -279,6 +870,10 @@ static IDL_VPTR IDL_CDECL mg_net_close(int argc, IDL_VPTR argv[], char *argk) {
   This is useful if you will be sending data to primarily one host/port.
 
   MG_NET_CONNECT only creates TCP based sockets.
+
+  Given only a path, connects to a Unix domain socket created by
+  MG_NET_CREATEPORT with that path on the same host. The socket is used like a
+  TCP socket; only the BUFFER keyword applies.
 */
 static IDL_VPTR IDL_CDECL mg_net_connect(int argc, IDL_VPTR inargv[], char *argk) {
   SOCKET s;
@@ -286,7 +881,7 @@ static IDL_VPTR IDL_CDECL mg_net_connect(int argc, IDL_VPTR inargv[], char *argk
   int	addr_len,err;
   short	port;
   int	host;
-  IDL_LONG i;
+  IDL_LONG i, iType, nargs;
   IDL_VPTR argv[2];
 
   static IDL_LONG	iBuffer,iNoDelay,iUDP,iTCP, iLocPort;
@@ -300,24 +895,32 @@ static IDL_VPTR IDL_CDECL mg_net_connect(int argc, IDL_VPTR inargv[], char *argk
   };
 
   IDL_KWCleanup(IDL_KW_MARK);
-  IDL_KWGetParams(argc,inargv,argk,kw_pars,argv,1);
-  host = IDL_ULongScalar(argv[0]);
-  port = (short) IDL_LongScalar(argv[1]);
+  nargs = IDL_KWGetParams(argc,inargv,argk,kw_pars,argv,1);
   IDL_KWCleanup(IDL_KW_CLEAN);
 
-  for (i = 0; i < MAX_SOCKETS; i++) {
-    if (net_list[i].iState == NET_UNUSED) break;
+  i = mg_net_free_slot();
+  if (i < 0) return (IDL_GettmpLong(-2));
+
+  if (argv[0]->type == IDL_TYP_STRING) {
+    if ((nargs != 1) || iUDP) return (IDL_GettmpLong(-1));
+    s = mg_unix_socket(argv[0], 0);
+    if (s == -1) return (IDL_GettmpLong(-1));
+    if (iBuffer) mg_rebuffer_socket(s, iBuffer);
+    mg_net_claim(i, s, NET_IO, NET_TCP);
+    return (IDL_GettmpLong(i));
   }
-  if (i == MAX_SOCKETS) return (IDL_GettmpLong(-2));
+  if (nargs != 2) return (IDL_GettmpLong(-1));
+  host = IDL_ULongScalar(argv[0]);
+  port = (short) IDL_LongScalar(argv[1]);
 
   if (iUDP) {
     s = socket(AF_INET,SOCK_DGRAM, 0);
-    net_list[i].iType = NET_UDP_PEER;
+    iType = NET_UDP_PEER;
   } else {
     s = socket(AF_INET, SOCK_STREAM, 0);
     if (iBuffer) mg_rebuffer_socket(s, iBuffer);
     if (iNoDelay) mg_nodelay_socket(s, 1);
-    net_list[i].iType = NET_TCP;
+    iType = NET_TCP;
   }
   if (s == -1) return (IDL_GettmpLong(-2));
 
@@ -342,8 +945,7 @@ static IDL_VPTR IDL_CDECL mg_net_connect(int argc, IDL_VPTR inargv[], char *argk
     return (IDL_GettmpLong(-1));
   }
 
-  net_list[i].iState = NET_IO;
-  net_list[i].socket = s;
+  mg_net_claim(i, s, NET_IO, iType);
 
   return (IDL_GettmpLong(i));
 }
@@ -381,13 +983,11 @@ static IDL_VPTR IDL_CDECL mg_net_accept(int argc, IDL_VPTR inargv[], char *argk)
   j = IDL_LongScalar(argv[0]);
   IDL_KWCleanup(IDL_KW_CLEAN);
   
-  if ((j < 0) || (j >= MAX_SOCKETS)) return (IDL_GettmpLong(-1));
+  if ((j < 0) || (j >= net_list_size)) return (IDL_GettmpLong(-1));
   if (net_list[j].iState != NET_LISTEN) return (IDL_GettmpLong(-1));
-  
-  for(i = 0; i < MAX_SOCKETS; i++) {
-    if (net_list[i].iState == NET_UNUSED) break;
-  }
-  if (i == MAX_SOCKETS) return(IDL_GettmpLong(-2));
+
+  i = mg_net_free_slot();
+  if (i < 0) return(IDL_GettmpLong(-2));
 
   addr_len = sizeof(struct sockaddr_in);
   s = accept(net_list[j].socket, (struct sockaddr *)&peer_addr, &addr_len);
@@ -395,8 +995,7 @@ static IDL_VPTR IDL_CDECL mg_net_accept(int argc, IDL_VPTR inargv[], char *argk)
 
   if (iBuffer) mg_rebuffer_socket(s, iBuffer);
   if (iNoDelay) mg_nodelay_socket(s, 1);
-  net_list[i].iState = NET_IO;
-  net_list[i].socket = s;
+  mg_net_claim(i, s, NET_IO, NET_TCP);
 
   return(IDL_GettmpLong(i));
 }
@@ -406,21 +1005,25 @@ static IDL_VPTR IDL_CDECL mg_net_accept(int argc, IDL_VPTR inargv[], char *argk)
   nbytes = MG_NET_SEND(socket, variable [, host] [, port])
 
   Sends the raw byte data from the IDL variable on the socket. Returns the
-  number of bytes sent or -1 for error. Note: no byteswapping is performed.
+  number of bytes sent, as a LONG64, or -1 for error. Note: no byteswapping
+  is performed. On TCP sockets, all the data is sent even if the system sends
+  it in pieces.
 
 	When sending data from a UDP socket, you must specify the remote host and
 	port arguments where host is the value returned from the MG_NET_NAME2HOST
 	function.
 */
 static IDL_VPTR IDL_CDECL mg_net_send(int argc, IDL_VPTR argv[], char *argk) {
-  IDL_LONG i, iRet;
+  IDL_LONG i;
   IDL_VPTR vpTmp;
   char *pbuffer;
-  IDL_MEMINT iNum;
+  IDL_MEMINT iNum, iRet;
+  struct iovec iov;
 
   i = IDL_LongScalar(argv[0]);
-  if ((i < 0) || (i >= MAX_SOCKETS)) return(IDL_GettmpLong(-1));
-  if ((net_list[i].iState != NET_IO) || (net_list[i].iType != NET_UDP_PEER))
+  if ((i < 0) || (i >= net_list_size)) return(IDL_GettmpLong(-1));
+  if ((net_list[i].iState != NET_IO) || (net_list[i].iType == NET_UDP)
+        || net_list[i].pShm || mg_async_busy(i))
     return(IDL_GettmpLong(-1));
   IDL_ENSURE_SIMPLE(argv[1]);
   vpTmp = argv[1];
@@ -432,11 +1035,14 @@ static IDL_VPTR IDL_CDECL mg_net_send(int argc, IDL_VPTR argv[], char *argk) {
   IDL_VarGetData(vpTmp, &iNum, &pbuffer, 1);
   iNum = iNum * IDL_TypeSizeFunc(vpTmp->type);
 
-  iRet = send(net_list[i].socket, pbuffer, iNum, 0);
+  iov.iov_base = pbuffer;
+  iov.iov_len = iNum;
+  iRet = mg_send_all(net_list[i].socket, &iov, 1, NULL, 0, &net_list[i].stats);
+  mg_stats_sent(&net_list[i].stats, iRet, 1);
 
   if (vpTmp != argv[1]) IDL_Deltmp(vpTmp);
 
-  return(IDL_GettmpLong(iRet));
+  return(IDL_GettmpLong64(iRet));
 }
 
 
@@ -456,7 +1062,7 @@ static IDL_VPTR IDL_CDECL mg_net_sendto(int argc, IDL_VPTR argv[], char *argk) {
   int host, addr_len;
 
   i = IDL_LongScalar(argv[0]);
-  if ((i < 0) || (i >= MAX_SOCKETS)) return (IDL_GettmpLong(-1));
+  if ((i < 0) || (i >= net_list_size)) return (IDL_GettmpLong(-1));
   if (net_list[i].iState != NET_IO) return (IDL_GettmpLong(-1));
   IDL_ENSURE_SIMPLE(argv[1]);
   vpTmp = argv[1];
@@ -476,6 +1082,8 @@ static IDL_VPTR IDL_CDECL mg_net_sendto(int argc, IDL_VPTR argv[], char *argk) {
   addr_len = sizeof(struct sockaddr_in);
 
   iRet = sendto(net_list[i].socket, pbuffer, iNum, 0, (struct sockaddr *) &sin, addr_len);
+  net_list[i].stats.syscalls++;
+  mg_stats_sent(&net_list[i].stats, iRet, 1);
 
   if (vpTmp != argv[1]) IDL_Deltmp(vpTmp);
 
@@ -507,8 +1115,8 @@ static IDL_VPTR IDL_CDECL mg_net_recv(int argc, IDL_VPTR argv[], char *argk) {
   IDL_KWGetParams(argc, argv, argk, kw_pars, vpPlainArgs, 1);
 
   i = IDL_LongScalar(vpPlainArgs[0]);
-  if ((i < 0) || (i >= MAX_SOCKETS)) return (IDL_GettmpLong(-1));
-  if (net_list[i].iState != NET_IO) return (IDL_GettmpLong(-1));
+  if ((i < 0) || (i >= net_list_size)) return (IDL_GettmpLong(-1));
+  if ((net_list[i].iState != NET_IO) || net_list[i].pShm) return (IDL_GettmpLong(-1));
   IDL_EXCLUDE_EXPR(vpPlainArgs[1]);
 
   err = IOCTL(net_list[i].socket, FIONREAD, &len);
@@ -522,6 +1130,8 @@ static IDL_VPTR IDL_CDECL mg_net_recv(int argc, IDL_VPTR argv[], char *argk) {
   IDL_VarCopy(vpTmp, vpPlainArgs[1]);
 
   iRet = recv(net_list[i].socket, pbuffer, len, 0);
+  net_list[i].stats.syscalls++;
+  mg_stats_received(&net_list[i].stats, iRet, iRet > 0 ? 1 : 0);
 
   err:
   IDL_KWCleanup(IDL_KW_CLEAN);
@@ -531,82 +1141,587 @@ static IDL_VPTR IDL_CDECL mg_net_recv(int argc, IDL_VPTR argv[], char *argk) {
 
 
 /*
-  err = MG_NET_QUERY(socket [, AVAILABLE_BYTES=a] [, IS_LISTENER=l]
-                     [, LOCAL_HOST=lh] [, LOCAL_PORT=lp]
-                     [, REMOTE_HOST=rh] [, REMOTE_PORT=rp])
+  Internal function to get the current time in seconds since 1970.
+*/
+static double mg_net_time(void) {
+#ifndef WIN32
+  struct timeval tv;
 
-  Returns various information about the socket in question.
+  gettimeofday(&tv, NULL);
+  return((double) tv.tv_sec + 1.0e-6 * tv.tv_usec);
+#else
+  return((double) time(NULL));
+#endif
+}
 
-  AVAILABLE_BYTES: number of bytes available for reading.
-  REMOTE_HOST: host number of the remote host the socket is connected to.
-  IS_LISTENER: true if the socket was created using MG_NET_CREATEPORT()
+
+/*
+  Internal function to get the time in seconds of a clock that is not set
+  back or forward with the system time, for timing intervals.
 */
-static IDL_VPTR IDL_CDECL mg_net_query(int argc, IDL_VPTR argv[], char *argk) {
-  IDL_LONG i;
-  IDL_VPTR vpPlainArgs[1],vpTmp;
-  struct sockaddr_in peer_addr;
-  unsigned int addr_len;
-  int err;
-  IDL_LONG iRet = 0;
+static double mg_net_clock(void) {
+#ifdef MG_NET_THREAD
+  struct timespec ts;
 
-  static IDL_VPTR	vpRHost, vpAvail, vpListen, vpLPort, vpRPort, vpLHost;
-  static IDL_KW_PAR kw_pars[] = { IDL_KW_FAST_SCAN,
-    { "AVAILABLE_BYTES", IDL_TYP_UNDEF, 1, IDL_KW_OUT | IDL_KW_ZERO, 0, IDL_CHARA(vpAvail) },
-    { "IS_LISTENER", IDL_TYP_UNDEF, 1, IDL_KW_OUT | IDL_KW_ZERO, 0, IDL_CHARA(vpListen) },
-    { "LOCAL_HOST", IDL_TYP_UNDEF, 1, IDL_KW_OUT | IDL_KW_ZERO, 0, IDL_CHARA(vpLHost) },
-    { "LOCAL_PORT", IDL_TYP_UNDEF, 1, IDL_KW_OUT | IDL_KW_ZERO, 0, IDL_CHARA(vpLPort) },
-    { "REMOTE_HOST", IDL_TYP_UNDEF, 1, IDL_KW_OUT | IDL_KW_ZERO, 0, IDL_CHARA(vpRHost) },
-    { "REMOTE_PORT", IDL_TYP_UNDEF, 1, IDL_KW_OUT | IDL_KW_ZERO, 0, IDL_CHARA(vpRPort) },
-    { NULL}
-  };
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return((double) ts.tv_sec + 1.0e-9 * ts.tv_nsec);
+#else
+  return(mg_net_time());
+#endif
+}
 
-  IDL_KWCleanup(IDL_KW_MARK);
-  IDL_KWGetParams(argc, argv, argk, kw_pars, vpPlainArgs, 1);
 
-  i = IDL_LongScalar(vpPlainArgs[0]);
-  if ((i < 0) || (i >= MAX_SOCKETS)) {
-    IDL_KWCleanup(IDL_KW_CLEAN);
-    return(IDL_GettmpLong(-1));
+/*
+  Internal function to wait up to timeout seconds, or indefinitely if timeout
+  is negative, for a socket to become readable. The wait is done in slices
+  so that it can be interrupted. Returns 1 if the socket is readable, 0 if
+  not or -1 if interrupted.
+*/
+static int mg_net_wait_readable(SOCKET s, double timeout) {
+  struct pollfd pfd;
+  int n, ms;
+
+  pfd.fd = s;
+  pfd.events = POLLIN;
+  while (1) {
+    ms = (timeout < 0.0) || (timeout >= NET_POLL_SLICE)
+           ? (int) (NET_POLL_SLICE * 1000)
+           : (int) ceil(timeout * 1000.0);
+    pfd.revents = 0;
+    n = POLL(&pfd, 1, ms);
+    if ((n == -1) && (errno == EINTR)) n = 0;
+    if (n != 0) return(n > 0 ? 1 : -1);
+    if (timeout >= 0.0) {
+      timeout -= NET_POLL_SLICE;
+      if (timeout < 0.0) return(0);
+    }
+    if (IDL_BailOut(IDL_FALSE)) return(-1);
   }
+}
 
-  if (vpRHost || vpRPort) {
-    addr_len = sizeof(struct sockaddr_in);
-    err = getpeername(net_list[i].socket,
-                      (struct sockaddr *) &peer_addr, &addr_len);
-    if (err != 0) {
-      iRet = -1;
-    } else {
-      if (vpRHost) {
-        vpTmp = IDL_GettmpULong(peer_addr.sin_addr.s_addr);
-        IDL_VarCopy(vpTmp, vpRHost);
-      }
-      if (vpRPort) {
-        vpTmp = IDL_GettmpLong((long) ntohs(peer_addr.sin_port));
-        IDL_VarCopy(vpTmp, vpRPort);
+
+/*
+  Internal function to read up to n datagrams that are waiting on a socket,
+  datagram j into buffer + j * size. Returns the number of datagrams read or
+  -1 for error.
+*/
+static int mg_recv_datagrams(SOCKET s, char *buffer, IDL_MEMINT size, int n,
+                             net_datagram *dg, net_stats *stats) {
+#ifdef MG_NET_MMSG
+  struct mmsghdr *msgs;
+  struct iovec *iov;
+  struct cmsghdr *cmsg;
+  struct timespec ts;
+  char *control;
+  double now = 0.0;
+  int j, k;
+
+  msgs = (struct mmsghdr *) calloc(n, sizeof(struct mmsghdr)
+                                        + sizeof(struct iovec)
+                                        + NET_CMSG_SIZE);
+  if (!msgs) return(-1);
+  iov = (struct iovec *) (msgs + n);
+  control = (char *) (iov + n);
+
+  for (j = 0; j < n; j++) {
+    iov[j].iov_base = buffer + j * size;
+    iov[j].iov_len = size;
+    msgs[j].msg_hdr.msg_name = &dg[j].from;
+    msgs[j].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+    msgs[j].msg_hdr.msg_iov = &iov[j];
+    msgs[j].msg_hdr.msg_iovlen = 1;
+    msgs[j].msg_hdr.msg_control = control + j * NET_CMSG_SIZE;
+    msgs[j].msg_hdr.msg_controllen = NET_CMSG_SIZE;
+  }
+
+  do {
+    k = recvmmsg(s, msgs, n, MSG_DONTWAIT, NULL);
+    stats->syscalls++;
+  } while ((k == -1) && (errno == EINTR));
+  if ((k == -1) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) k = 0;
+
+  /* kernel timestamps, if enabled when the datagram arrived */
+  for (j = 0; j < k; j++) {
+    dg[j].len = msgs[j].msg_len;
+    dg[j].time = 0.0;
+    for (cmsg = CMSG_FIRSTHDR(&msgs[j].msg_hdr);
+         cmsg;
+         cmsg = CMSG_NXTHDR(&msgs[j].msg_hdr, cmsg)) {
+      if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_TIMESTAMPNS)) {
+        memcpy(&ts, CMSG_DATA(cmsg), sizeof(struct timespec));
+        dg[j].time = (double) ts.tv_sec + 1.0e-9 * ts.tv_nsec;
       }
     }
+    if (dg[j].time == 0.0) {
+      if (now == 0.0) now = mg_net_time();
+      dg[j].time = now;
+    }
   }
-  if (vpAvail) {
-    int len;
-    err = IOCTL(net_list[i].socket, FIONREAD, &len);
-    if (err != 0) {
-      iRet = -1;
-    } else {
-      vpTmp = IDL_GettmpULong(len);
-      IDL_VarCopy(vpTmp, vpAvail);
+
+  free(msgs);
+
+  return(k);
+#else
+  struct pollfd pfd;
+  socklen_t from_len;
+  IDL_MEMINT len;
+  int k;
+
+  pfd.fd = s;
+  pfd.events = POLLIN;
+  for (k = 0; k < n; k++) {
+    pfd.revents = 0;
+    if (POLL(&pfd, 1, 0) <= 0) break;
+    from_len = sizeof(struct sockaddr_in);
+    len = recvfrom(s, buffer + k * size, (int) size, 0,
+                   (struct sockaddr *) &dg[k].from, &from_len);
+    stats->syscalls++;
+    if (len < 0) return(k > 0 ? k : -1);
+    dg[k].len = len;
+    dg[k].time = mg_net_time();
+  }
+
+  return(k);
+#endif
+}
+
+
+/*
+  Internal function to send n datagrams, datagram j from iov[j] to to[j], or
+  to the peer of the socket if to is NULL. Returns the number of datagrams
+  sent or -1 if none could be sent.
+*/
+static IDL_LONG mg_send_datagrams(SOCKET s, struct iovec *iov,
+                                  struct sockaddr_in *to, IDL_LONG n,
+                                  net_stats *stats) {
+  IDL_LONG sent = 0;
+#ifdef MG_NET_MMSG
+  struct mmsghdr *msgs;
+  int j, m, k;
+
+  msgs = (struct mmsghdr *) malloc(IDL_MIN(n, NET_MAX_BATCH) * sizeof(struct mmsghdr));
+  if (!msgs) return(-1);
+
+  while (sent < n) {
+    m = (int) IDL_MIN(n - sent, NET_MAX_BATCH);
+    memset(msgs, 0, m * sizeof(struct mmsghdr));
+    for (j = 0; j < m; j++) {
+      msgs[j].msg_hdr.msg_iov = &iov[sent + j];
+      msgs[j].msg_hdr.msg_iovlen = 1;
+      if (to) {
+        msgs[j].msg_hdr.msg_name = &to[sent + j];
+        msgs[j].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+      }
     }
+    k = sendmmsg(s, msgs, m, MSG_NOSIGNAL);
+    stats->syscalls++;
+    if (k == -1) {
+      if (errno == EINTR) continue;
+      break;
+    }
+    sent += k;
   }
-  if (vpListen) {
-    vpTmp = IDL_GettmpLong(net_list[i].iState == NET_LISTEN);
-    IDL_VarCopy(vpTmp, vpListen);
+
+  free(msgs);
+#else
+  IDL_MEMINT len;
+
+  for (sent = 0; sent < n; sent++) {
+    len = to
+            ? sendto(s, iov[sent].iov_base, (int) iov[sent].iov_len, 0,
+                     (struct sockaddr *) &to[sent], sizeof(struct sockaddr_in))
+            : send(s, iov[sent].iov_base, (int) iov[sent].iov_len, 0);
+    stats->syscalls++;
+    if (len < 0) break;
   }
-  if (vpLPort || vpLHost) {
-    addr_len = sizeof(struct  sockaddr_in);
+#endif
+
+  return((sent > 0) || (n == 0) ? sent : -1);
+}
+
+
+/*
+  n = MG_NET_RECVMMSG(socket, data [, HOSTS=hosts] [, LENGTHS=lengths]
+                      [, MAX_DATAGRAMS=n] [, MAXIMUM_BYTES=b]
+                      [, OFFSETS=offsets] [, /PACKED] [, PORTS=ports]
+                      [, TIMEOUT=seconds] [, TIMESTAMPS=timestamps])
+
+  Reads the datagrams waiting on a UDP socket, up to MAX_DATAGRAMS (64 by
+  default, at most 1024), in as few system calls as possible and returns the
+  number read, or -1 for error. data returns a BYTE array with a column for
+  each datagram, datagram k in data[0:lengths[k] - 1, k], as wide as the
+  longest datagram. Set PACKED to return the datagrams one after another in
+  a BYTE vector instead, datagram k starting at offsets[k]. Datagrams longer
+  than MAXIMUM_BYTES (64 KB by default) are truncated.
+
+  LENGTHS returns the length of each datagram, HOSTS and PORTS its source
+  address, and TIMESTAMPS the time it arrived in seconds since 1970, recorded
+  by the kernel where supported.
+
+  MG_NET_RECVMMSG waits up to TIMEOUT seconds for a datagram to arrive; by
+  default, it returns 0 right away if none is waiting, leaving data and the
+  keywords unchanged. At high datagram rates, increase the receive buffer of
+  the socket with the BUFFER keyword of MG_NET_CREATEPORT or MG_NET_CONNECT
+  so that datagrams are not dropped between calls.
+*/
+static IDL_VPTR IDL_CDECL mg_net_recvmmsg(int argc, IDL_VPTR argv[], char *argk) {
+  IDL_LONG i, n, j, k;
+  IDL_MEMINT size, width, total, pos;
+  IDL_VPTR vpPlainArgs[2], vpTmp;
+  net_datagram *dg = NULL;
+  UCHAR *pdata;
+  IDL_LONG *plengths, *pports;
+  IDL_ULONG *phosts;
+  IDL_LONG64 *poffsets;
+  double *ptimes;
+  IDL_MEMINT dims[2];
+
+  static IDL_LONG iMaxDatagrams, iMax, iPacked;
+  static double dTimeout;
+  static IDL_VPTR vpHosts, vpLengths, vpOffsets, vpPorts, vpTimestamps;
+  static IDL_KW_PAR kw_pars[] = { IDL_KW_FAST_SCAN,
+    { "HOSTS", IDL_TYP_UNDEF, 1, IDL_KW_OUT | IDL_KW_ZERO, 0, IDL_CHARA(vpHosts) },
+    { "LENGTHS", IDL_TYP_UNDEF, 1, IDL_KW_OUT | IDL_KW_ZERO, 0, IDL_CHARA(vpLengths) },
+    { "MAX_DATAGRAMS", IDL_TYP_LONG, 1, IDL_KW_ZERO, 0, IDL_CHARA(iMaxDatagrams) },
+    { "MAXIMUM_BYTES", IDL_TYP_LONG, 1, IDL_KW_ZERO, 0, IDL_CHARA(iMax) },
+    { "OFFSETS", IDL_TYP_UNDEF, 1, IDL_KW_OUT | IDL_KW_ZERO, 0, IDL_CHARA(vpOffsets) },
+    { "PACKED", IDL_TYP_LONG, 1, IDL_KW_ZERO, 0, IDL_CHARA(iPacked) },
+    { "PORTS", IDL_TYP_UNDEF, 1, IDL_KW_OUT | IDL_KW_ZERO, 0, IDL_CHARA(vpPorts) },
+    { "TIMEOUT", IDL_TYP_DOUBLE, 1, IDL_KW_ZERO, 0, IDL_CHARA(dTimeout) },
+    { "TIMESTAMPS", IDL_TYP_UNDEF, 1, IDL_KW_OUT | IDL_KW_ZERO, 0, IDL_CHARA(vpTimestamps) },
+    { NULL }
+  };
+
+  IDL_KWCleanup(IDL_KW_MARK);
+  IDL_KWGetParams(argc, argv, argk, kw_pars, vpPlainArgs, 1);
+
+  i = IDL_LongScalar(vpPlainArgs[0]);
+  k = -1;
+  if ((i < 0) || (i >= net_list_size)) goto done;
+  if ((net_list[i].iState != NET_IO) || (net_list[i].iType == NET_TCP)) goto done;
+  IDL_EXCLUDE_EXPR(vpPlainArgs[1]);
+
+  n = iMaxDatagrams > 0 ? IDL_MIN(iMaxDatagrams, NET_MAX_BATCH) : NET_DEFAULT_BATCH;
+  size = iMax > 0 ? iMax : NET_MAX_DATAGRAM;
+
+#if defined(MG_NET_MMSG) && defined(SO_TIMESTAMPNS)
+  if (vpTimestamps && !net_list[i].iTimestamps) {
+    j = 1;
+    setsockopt(net_list[i].socket, SOL_SOCKET, SO_TIMESTAMPNS, (void *) &j, sizeof(int));
+    net_list[i].iTimestamps = 1;
+  }
+#endif
+
+  /* datagrams are read into a buffer kept between calls */
+  if (net_batch_size < n * size) {
+    free(net_batch);
+    net_batch_size = 0;
+    net_batch = (char *) malloc(n * size);
+    if (!net_batch) goto done;
+    net_batch_size = n * size;
+  }
+  dg = (net_datagram *) malloc(n * sizeof(net_datagram));
+  if (!dg) goto done;
+
+  if (dTimeout != 0.0) {
+    k = mg_net_wait_readable(net_list[i].socket, dTimeout);
+    if (k != 1) goto done;
+  }
+  k = mg_recv_datagrams(net_list[i].socket, net_batch, size, n, dg,
+                        &net_list[i].stats);
+  if (k == -1) net_list[i].stats.recv_errors++;
+  if (k <= 0) goto done;
+
+  for (j = 0, width = 1, total = 0; j < k; j++) {
+    width = IDL_MAX(width, dg[j].len);
+    total += dg[j].len;
+  }
+  mg_stats_received(&net_list[i].stats, total, k);
+  if (iPacked) {
+    pdata = (UCHAR *) IDL_MakeTempVector(IDL_TYP_BYTE, IDL_MAX(total, 1),
+                                         IDL_ARR_INI_ZERO, &vpTmp);
+  } else {
+    dims[0] = width;
+    dims[1] = k;
+    pdata = (UCHAR *) IDL_MakeTempArray(IDL_TYP_BYTE, 2, dims, IDL_ARR_INI_ZERO,
+                                        &vpTmp);
+  }
+  for (j = 0, pos = 0; j < k; j++) {
+    memcpy(pdata + (iPacked ? pos : j * width), net_batch + j * size, dg[j].len);
+    pos += dg[j].len;
+  }
+  IDL_VarCopy(vpTmp, vpPlainArgs[1]);
+
+  if (vpLengths) {
+    plengths = (IDL_LONG *) IDL_MakeTempVector(IDL_TYP_LONG, k, IDL_ARR_INI_NOP, &vpTmp);
+    for (j = 0; j < k; j++) plengths[j] = (IDL_LONG) dg[j].len;
+    IDL_VarCopy(vpTmp, vpLengths);
+  }
+  if (vpOffsets) {
+    poffsets = (IDL_LONG64 *) IDL_MakeTempVector(IDL_TYP_LONG64, k, IDL_ARR_INI_NOP, &vpTmp);
+    for (j = 0, pos = 0; j < k; j++) {
+      poffsets[j] = iPacked ? pos : j * width;
+      pos += dg[j].len;
+    }
+    IDL_VarCopy(vpTmp, vpOffsets);
+  }
+  if (vpHosts) {
+    phosts = (IDL_ULONG *) IDL_MakeTempVector(IDL_TYP_ULONG, k, IDL_ARR_INI_NOP, &vpTmp);
+    for (j = 0; j < k; j++) phosts[j] = dg[j].from.sin_addr.s_addr;
+    IDL_VarCopy(vpTmp, vpHosts);
+  }
+  if (vpPorts) {
+    pports = (IDL_LONG *) IDL_MakeTempVector(IDL_TYP_LONG, k, IDL_ARR_INI_NOP, &vpTmp);
+    for (j = 0; j < k; j++) pports[j] = (IDL_LONG) ntohs(dg[j].from.sin_port);
+    IDL_VarCopy(vpTmp, vpPorts);
+  }
+  if (vpTimestamps) {
+    ptimes = (double *) IDL_MakeTempVector(IDL_TYP_DOUBLE, k, IDL_ARR_INI_NOP, &vpTmp);
+    for (j = 0; j < k; j++) ptimes[j] = dg[j].time;
+    IDL_VarCopy(vpTmp, vpTimestamps);
+  }
+
+  done:
+  IDL_KWCleanup(IDL_KW_CLEAN);
+  free(dg);
+
+  return(IDL_GettmpLong(k));
+}
+
+
+/*
+  n = MG_NET_SENDMMSG(socket, data [, host, port] [, LENGTHS=lengths]
+                      [, OFFSETS=offsets])
+
+  Sends many datagrams on a UDP socket in as few system calls as possible
+  and returns the number of datagrams sent, or -1 for error. data is a BYTE
+  array with a datagram in each column, or, if OFFSETS is given, a BYTE
+  vector with datagram k starting at offsets[k] and running up to the next
+  offset. LENGTHS gives the length of each datagram when shorter than its
+  column or than the distance to the next offset.
+
+  The datagrams are sent to host and port, which are scalars or arrays with
+  an element for each datagram, or to the peer of a socket created by
+  MG_NET_CONNECT with UDP set if host and port are not given.
+*/
+static IDL_VPTR IDL_CDECL mg_net_sendmmsg(int argc, IDL_VPTR inargv[], char *argk) {
+  IDL_LONG i, iRet = -1, n, j;
+  IDL_MEMINT total, width, start, len, n_lengths = 0, n_offsets = 0, n_hosts = 0, n_ports = 0;
+  IDL_VPTR argv[4], vpLengthsTmp = NULL, vpOffsetsTmp = NULL, vpHostsTmp = NULL, vpPortsTmp = NULL;
+  IDL_LONG64 *plengths = NULL, *poffsets = NULL;
+  IDL_ULONG *phosts = NULL;
+  IDL_LONG *pports = NULL;
+  struct iovec *iov = NULL;
+  struct sockaddr_in *to = NULL;
+  char *pdata;
+
+  static IDL_VPTR vpLengths, vpOffsets;
+  static IDL_KW_PAR kw_pars[] = { IDL_KW_FAST_SCAN,
+    { "LENGTHS", IDL_TYP_UNDEF, 1, IDL_KW_VIN | IDL_KW_ZERO, 0, IDL_CHARA(vpLengths) },
+    { "OFFSETS", IDL_TYP_UNDEF, 1, IDL_KW_VIN | IDL_KW_ZERO, 0, IDL_CHARA(vpOffsets) },
+    { NULL }
+  };
+
+  IDL_KWCleanup(IDL_KW_MARK);
+  argc = IDL_KWGetParams(argc, inargv, argk, kw_pars, argv, 1);
+
+  i = IDL_LongScalar(argv[0]);
+  if ((i < 0) || (i >= net_list_size)) goto done;
+  if ((net_list[i].iState != NET_IO) || (net_list[i].iType == NET_TCP)) goto done;
+  if ((argc == 3) || ((argc == 2) && (net_list[i].iType != NET_UDP_PEER))) goto done;
+
+  if (argv[1]->type != IDL_TYP_BYTE) {
+    IDL_MessageFromBlock(msg_block,
+                         MG_NET_BADTYPE,
+                         IDL_MSG_LONGJMP,
+                         IDL_TypeNameFunc(argv[1]->type));
+  }
+  IDL_VarGetData(argv[1], &total, &pdata, 1);
+
+  if (vpLengths) {
+    vpLengthsTmp = IDL_CvtLng64(1, &vpLengths);
+    IDL_VarGetData(vpLengthsTmp, &n_lengths, (char **) &plengths, 1);
+  }
+  if (vpOffsets) {
+    vpOffsetsTmp = IDL_CvtLng64(1, &vpOffsets);
+    IDL_VarGetData(vpOffsetsTmp, &n_offsets, (char **) &poffsets, 1);
+    n = (IDL_LONG) n_offsets;
+    width = total;
+  } else if ((argv[1]->flags & IDL_V_ARR) && (argv[1]->value.arr->n_dim > 1)) {
+    width = argv[1]->value.arr->dim[0];
+    n = (IDL_LONG) (total / width);
+  } else {
+    width = total;
+    n = 1;
+  }
+  if (vpLengths && (n_lengths < n)) goto done;
+
+  if (argc == 4) {
+    vpHostsTmp = IDL_CvtULng(1, &argv[2]);
+    IDL_VarGetData(vpHostsTmp, &n_hosts, (char **) &phosts, 1);
+    vpPortsTmp = IDL_CvtLng(1, &argv[3]);
+    IDL_VarGetData(vpPortsTmp, &n_ports, (char **) &pports, 1);
+    if (((n_hosts != 1) && (n_hosts < n)) || ((n_ports != 1) && (n_ports < n))) {
+      goto done;
+    }
+    to = (struct sockaddr_in *) calloc(n, sizeof(struct sockaddr_in));
+    if (!to) goto done;
+  }
+
+  iov = (struct iovec *) malloc(n * sizeof(struct iovec));
+  if (!iov) goto done;
+  for (j = 0; j < n; j++) {
+    if (poffsets) {
+      start = poffsets[j];
+      len = (j + 1 < n ? poffsets[j + 1] : total) - start;
+    } else {
+      start = j * width;
+      len = width;
+    }
+    if (plengths) {
+      if (plengths[j] > len) goto done;
+      len = plengths[j];
+    }
+    if ((start < 0) || (len < 0) || (start + len > total)) goto done;
+    iov[j].iov_base = pdata + start;
+    iov[j].iov_len = len;
+
+    if (to) {
+      to[j].sin_family = AF_INET;
+      to[j].sin_addr.s_addr = phosts[n_hosts == 1 ? 0 : j];
+      to[j].sin_port = htons((short) pports[n_ports == 1 ? 0 : j]);
+    }
+  }
+
+  iRet = mg_send_datagrams(net_list[i].socket, iov, to, n, &net_list[i].stats);
+  for (j = 0, total = 0; j < iRet; j++) total += iov[j].iov_len;
+  mg_stats_sent(&net_list[i].stats, iRet == -1 ? -1 : total, iRet);
+
+  done:
+  if (vpLengthsTmp && (vpLengthsTmp != vpLengths)) IDL_Deltmp(vpLengthsTmp);
+  if (vpOffsetsTmp && (vpOffsetsTmp != vpOffsets)) IDL_Deltmp(vpOffsetsTmp);
+  if (vpHostsTmp && (vpHostsTmp != argv[2])) IDL_Deltmp(vpHostsTmp);
+  if (vpPortsTmp && (vpPortsTmp != argv[3])) IDL_Deltmp(vpPortsTmp);
+  IDL_KWCleanup(IDL_KW_CLEAN);
+  free(iov);
+  free(to);
+
+  return(IDL_GettmpLong(iRet));
+}
+
+
+/*
+  err = MG_NET_QUERY(socket [, AVAILABLE_BYTES=a] [, IS_LISTENER=l]
+                     [, LOCAL_HOST=lh] [, LOCAL_PORT=lp]
+                     [, RECEIVE_BUFFER=b]
+                     [, REMOTE_HOST=rh] [, REMOTE_PORT=rp]
+                     [, SHARED_MEMORY=bytes] [, STATISTICS=stats])
+
+  Returns various information about the socket in question.
+
+  AVAILABLE_BYTES: number of bytes available for reading.
+  REMOTE_HOST: host number of the remote host the socket is connected to.
+  IS_LISTENER: true if the socket was created using MG_NET_CREATEPORT()
+  RECEIVE_BUFFER: size of the receive buffer in bytes, as set by the system
+    from the BUFFER keyword of MG_NET_CREATEPORT or MG_NET_CONNECT.
+  SHARED_MEMORY: bytes in each direction of the shared memory channel set up
+    by MG_NET_SHM, 0 if none.
+  STATISTICS: structure of the I/O statistics of the socket, as returned by
+    MG_NET_STATS.
+
+  Hosts and ports are 0 for Unix domain sockets.
+*/
+static IDL_VPTR IDL_CDECL mg_net_query(int argc, IDL_VPTR argv[], char *argk) {
+  IDL_LONG i;
+  IDL_VPTR vpPlainArgs[1],vpTmp;
+  struct sockaddr_in peer_addr;
+  unsigned int addr_len;
+  int err;
+  IDL_LONG iRet = 0;
+
+  static IDL_VPTR	vpRHost, vpAvail, vpListen, vpLPort, vpRPort, vpLHost, vpRcvBuf, vpShm, vpStats;
+  static IDL_KW_PAR kw_pars[] = { IDL_KW_FAST_SCAN,
+    { "AVAILABLE_BYTES", IDL_TYP_UNDEF, 1, IDL_KW_OUT | IDL_KW_ZERO, 0, IDL_CHARA(vpAvail) },
+    { "IS_LISTENER", IDL_TYP_UNDEF, 1, IDL_KW_OUT | IDL_KW_ZERO, 0, IDL_CHARA(vpListen) },
+    { "LOCAL_HOST", IDL_TYP_UNDEF, 1, IDL_KW_OUT | IDL_KW_ZERO, 0, IDL_CHARA(vpLHost) },
+    { "LOCAL_PORT", IDL_TYP_UNDEF, 1, IDL_KW_OUT | IDL_KW_ZERO, 0, IDL_CHARA(vpLPort) },
+    { "RECEIVE_BUFFER", IDL_TYP_UNDEF, 1, IDL_KW_OUT | IDL_KW_ZERO, 0, IDL_CHARA(vpRcvBuf) },
+    { "REMOTE_HOST", IDL_TYP_UNDEF, 1, IDL_KW_OUT | IDL_KW_ZERO, 0, IDL_CHARA(vpRHost) },
+    { "REMOTE_PORT", IDL_TYP_UNDEF, 1, IDL_KW_OUT | IDL_KW_ZERO, 0, IDL_CHARA(vpRPort) },
+    { "SHARED_MEMORY", IDL_TYP_UNDEF, 1, IDL_KW_OUT | IDL_KW_ZERO, 0, IDL_CHARA(vpShm) },
+    { "STATISTICS", IDL_TYP_UNDEF, 1, IDL_KW_OUT | IDL_KW_ZERO, 0, IDL_CHARA(vpStats) },
+    { NULL}
+  };
+
+  IDL_KWCleanup(IDL_KW_MARK);
+  IDL_KWGetParams(argc, argv, argk, kw_pars, vpPlainArgs, 1);
+
+  i = IDL_LongScalar(vpPlainArgs[0]);
+  if ((i < 0) || (i >= net_list_size)) {
+    IDL_KWCleanup(IDL_KW_CLEAN);
+    return(IDL_GettmpLong(-1));
+  }
+
+  if (vpRHost || vpRPort) {
+    addr_len = sizeof(struct sockaddr_in);
+    err = getpeername(net_list[i].socket,
+                      (struct sockaddr *) &peer_addr, &addr_len);
+    if (err != 0) {
+      iRet = -1;
+    } else {
+      if (peer_addr.sin_family != AF_INET) memset(&peer_addr, 0, sizeof(peer_addr));
+      if (vpRHost) {
+        vpTmp = IDL_GettmpULong(peer_addr.sin_addr.s_addr);
+        IDL_VarCopy(vpTmp, vpRHost);
+      }
+      if (vpRPort) {
+        vpTmp = IDL_GettmpLong((long) ntohs(peer_addr.sin_port));
+        IDL_VarCopy(vpTmp, vpRPort);
+      }
+    }
+  }
+  if (vpAvail) {
+    int len;
+    err = IOCTL(net_list[i].socket, FIONREAD, &len);
+    if (err != 0) {
+      iRet = -1;
+    } else {
+      vpTmp = IDL_GettmpULong(len);
+      IDL_VarCopy(vpTmp, vpAvail);
+    }
+  }
+  if (vpListen) {
+    vpTmp = IDL_GettmpLong(net_list[i].iState == NET_LISTEN);
+    IDL_VarCopy(vpTmp, vpListen);
+  }
+  if (vpRcvBuf) {
+    int len;
+    addr_len = sizeof(int);
+    err = getsockopt(net_list[i].socket, SOL_SOCKET, SO_RCVBUF,
+                     (void *) &len, &addr_len);
+    if (err != 0) {
+      iRet = -1;
+    } else {
+      vpTmp = IDL_GettmpLong(len);
+      IDL_VarCopy(vpTmp, vpRcvBuf);
+    }
+  }
+  if (vpShm) {
+    vpTmp = IDL_GettmpLong64(net_list[i].pShm ? net_list[i].pShm->size : 0);
+    IDL_VarCopy(vpTmp, vpShm);
+  }
+  if (vpStats) {
+    mg_async_drain();
+    IDL_VarCopy(mg_stats_struct(&net_list[i].stats), vpStats);
+  }
+  if (vpLPort || vpLHost) {
+    addr_len = sizeof(struct  sockaddr_in);
     err = getsockname(net_list[i].socket,
                       (struct sockaddr *) &peer_addr, &addr_len);
     if (err != 0) {
       iRet = -1;
     } else {
+      if (peer_addr.sin_family != AF_INET) memset(&peer_addr, 0, sizeof(peer_addr));
       if (vpLHost) {
         vpTmp = IDL_GettmpULong(peer_addr.sin_addr.s_addr);
         IDL_VarCopy(vpTmp, vpLHost);
@@ -620,191 +1735,2636 @@ static IDL_VPTR IDL_CDECL mg_net_query(int argc, IDL_VPTR argv[], char *argk) {
 
   IDL_KWCleanup(IDL_KW_CLEAN);
 
-  return(IDL_GettmpLong(iRet));
-}
+  return(IDL_GettmpLong(iRet));
+}
+
+
+/*
+  Internal function to make an IDL structure of the statistics of a socket.
+*/
+static IDL_VPTR mg_stats_struct(net_stats *stats) {
+  IDL_VPTR vpTmp;
+  IDL_MEMINT one = 1;
+  IDL_LONG64 counts[9];
+  double times[4];
+  char *data;
+  void *sdef;
+  int t;
+
+  static IDL_MEMINT bins[] = { 1, NET_STATS_BINS };
+  static IDL_STRUCT_TAG_DEF stats_tags[] = {
+    { "BYTES_SENT",        0, (void *) IDL_TYP_LONG64, 0 },
+    { "BYTES_RECEIVED",    0, (void *) IDL_TYP_LONG64, 0 },
+    { "MESSAGES_SENT",     0, (void *) IDL_TYP_LONG64, 0 },
+    { "MESSAGES_RECEIVED", 0, (void *) IDL_TYP_LONG64, 0 },
+    { "SYSCALLS",          0, (void *) IDL_TYP_LONG64, 0 },
+    { "RETRIES",           0, (void *) IDL_TYP_LONG64, 0 },
+    { "SEND_ERRORS",       0, (void *) IDL_TYP_LONG64, 0 },
+    { "RECV_ERRORS",       0, (void *) IDL_TYP_LONG64, 0 },
+    { "ROUND_TRIPS",       0, (void *) IDL_TYP_LONG64, 0 },
+    { "LATENCY_MEAN",      0, (void *) IDL_TYP_DOUBLE, 0 },
+    { "LATENCY_MAX",       0, (void *) IDL_TYP_DOUBLE, 0 },
+    { "SEND_TIME",         0, (void *) IDL_TYP_DOUBLE, 0 },
+    { "RECV_TIME",         0, (void *) IDL_TYP_DOUBLE, 0 },
+    { "LATENCY",           bins, (void *) IDL_TYP_LONG64, 0 },
+    { 0 }
+  };
+
+  counts[0] = stats->bytes_sent;
+  counts[1] = stats->bytes_received;
+  counts[2] = stats->messages_sent;
+  counts[3] = stats->messages_received;
+  counts[4] = stats->syscalls;
+  counts[5] = stats->retries;
+  counts[6] = stats->send_errors;
+  counts[7] = stats->recv_errors;
+  counts[8] = stats->round_trips;
+  times[0] = stats->round_trips > 0 ? stats->latency_total / stats->round_trips : 0.0;
+  times[1] = stats->latency_max;
+  times[2] = stats->send_time;
+  times[3] = stats->recv_time;
+
+  sdef = IDL_MakeStruct(NULL, stats_tags);
+  data = IDL_MakeTempStruct(sdef, 1, &one, &vpTmp, TRUE);
+  for (t = 0; t < 9; t++) {
+    memcpy(data + IDL_StructTagInfoByIndex(sdef, t, IDL_MSG_LONGJMP, NULL),
+           &counts[t], sizeof(IDL_LONG64));
+  }
+  for (t = 0; t < 4; t++) {
+    memcpy(data + IDL_StructTagInfoByIndex(sdef, 9 + t, IDL_MSG_LONGJMP, NULL),
+           &times[t], sizeof(double));
+  }
+  memcpy(data + IDL_StructTagInfoByIndex(sdef, 13, IDL_MSG_LONGJMP, NULL),
+         stats->latency, sizeof(stats->latency));
+
+  return(vpTmp);
+}
+
+
+/*
+  stats = MG_NET_STATS(socket [, /RESET])
+
+  Returns a structure of the I/O statistics of a socket since it was opened
+  or last reset: BYTES_SENT and BYTES_RECEIVED, including the headers of
+  variables; MESSAGES_SENT and MESSAGES_RECEIVED, counting each call of the
+  MG_NET routines, each datagram of MG_NET_SENDMMSG and MG_NET_RECVMMSG and
+  each asynchronous request; SYSCALLS, the send and receive system calls
+  made; RETRIES, the system calls repeated because of partial sends or
+  receives or signals; and SEND_ERRORS and RECV_ERRORS, the calls that
+  failed.
+
+  Round trips are timed from the end of each MG_NET_SENDVAR to the end of the
+  MG_NET_RECVVAR that answers it, the next one on the socket, for up to 16
+  variables in flight. ROUND_TRIPS counts them, LATENCY_MEAN and LATENCY_MAX
+  give their mean and maximum in seconds, and LATENCY is a histogram of them,
+  where element k counts round trips of 2^k to 2^(k+1) microseconds (element
+  0 also those under a microsecond). On the end answering requests, the round
+  trip is the time from its reply to the next request.
+
+  SEND_TIME and RECV_TIME are the seconds spent in MG_NET_SENDVAR and
+  MG_NET_RECVVAR, including waiting for data to arrive. Compared with the
+  elapsed time, they tell how much of it is spent waiting on the network
+  rather than in IDL.
+
+  Set RESET to start the counts over after returning them. Returns -1 for an
+  invalid socket.
+*/
+static IDL_VPTR IDL_CDECL mg_net_stats(int argc, IDL_VPTR argv[], char *argk) {
+  IDL_LONG i;
+  IDL_VPTR vpPlainArgs[1], vpTmp;
+  net_stats *stats;
+  double sent[NET_STATS_PENDING];
+  int first_sent, n_sent;
+
+  static IDL_LONG iReset;
+  static IDL_KW_PAR kw_pars[] = { IDL_KW_FAST_SCAN,
+    { "RESET", IDL_TYP_LONG, 1, IDL_KW_ZERO, 0, IDL_CHARA(iReset) },
+    { NULL }
+  };
+
+  IDL_KWCleanup(IDL_KW_MARK);
+  IDL_KWGetParams(argc, argv, argk, kw_pars, vpPlainArgs, 1);
+  i = IDL_LongScalar(vpPlainArgs[0]);
+  IDL_KWCleanup(IDL_KW_CLEAN);
+
+  if ((i < 0) || (i >= net_list_size)) return(IDL_GettmpLong(-1));
+  if (net_list[i].iState == NET_UNUSED) return(IDL_GettmpLong(-1));
+
+  /* count the asynchronous requests that have completed */
+  mg_async_drain();
+
+  stats = &net_list[i].stats;
+  vpTmp = mg_stats_struct(stats);
+
+  if (iReset) {
+    /* variables in flight are still timed */
+    memcpy(sent, stats->sent, sizeof(sent));
+    first_sent = stats->first_sent;
+    n_sent = stats->n_sent;
+    memset(stats, 0, sizeof(net_stats));
+    memcpy(stats->sent, sent, sizeof(sent));
+    stats->first_sent = first_sent;
+    stats->n_sent = n_sent;
+  }
+
+  return(vpTmp);
+}
+
+/*
+  Internal function to read a (potentially fragmented) block from a socket.
+  If deadline is positive, fails when the block has not arrived by that time
+  of mg_net_clock.
+*/
+static int mg_recv_packet(SOCKET s, void *buffer, IDL_MEMINT len,
+                          double deadline, net_stats *stats) {
+  int n;
+  IDL_MEMINT num = 0;
+  char *pbuf = (char *) buffer;
+
+  while(num < len) {
+    if ((deadline > 0.0)
+          && (mg_net_wait_readable(s, IDL_MAX(deadline - mg_net_clock(), 0.0)) != 1)) {
+      return(-1);
+    }
+    n = recv(s, pbuf, (int) IDL_MIN(len - num, 0x40000000), 0);
+    stats->syscalls++;
+    if ((n == -1) && (errno == EINTR)) {
+      stats->retries++;
+      continue;
+    }
+    if ((n > 0) && (num + n < len)) stats->retries++;
+    if (n <= 0) return(-1);
+    pbuf += n;
+    num += n;
+#ifdef INTERRUPTABLE_READ
+    if (IDL_BailOut(IDL_FALSE)) return(-1);
+#endif
+  }
+
+  return(0);
+}
+
+
+/*
+  Internal function to send a message made of several buffers with a single
+  system call, continuing after partial sends until the whole message is sent.
+  A UDP message is sent as one datagram to the given address. Returns the
+  number of bytes sent or -1 for error.
+*/
+static IDL_MEMINT mg_send_all(SOCKET s, struct iovec *iov, int iovcnt,
+                              struct sockaddr_in *to, int flags,
+                              net_stats *stats) {
+  IDL_MEMINT total = 0;
+#ifndef WIN32
+  struct msghdr msg;
+  ssize_t n;
+  int calls = 0;
+
+  memset(&msg, 0, sizeof(msg));
+  if (to) {
+    msg.msg_name = to;
+    msg.msg_namelen = sizeof(struct sockaddr_in);
+  }
+
+  while (iovcnt > 0) {
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iovcnt;
+    n = sendmsg(s, &msg, flags | MSG_NOSIGNAL);
+    stats->syscalls++;
+    if (calls++ > 0) stats->retries++;
+    if (n == -1) {
+      if (errno == EINTR) continue;
+      return(-1);
+    }
+    total += n;
+
+    /* skip the buffers that were sent completely */
+    while ((iovcnt > 0) && ((size_t) n >= iov->iov_len)) {
+      n -= iov->iov_len;
+      iov++;
+      iovcnt--;
+    }
+    if (iovcnt > 0) {
+      iov->iov_base = (char *) iov->iov_base + n;
+      iov->iov_len -= n;
+    }
+  }
+#else
+  WSABUF *bufs;
+  DWORD n;
+  int j, err;
+
+  bufs = (WSABUF *) malloc(iovcnt * sizeof(WSABUF));
+  if (!bufs) return(-1);
+  for (j = 0; j < iovcnt; j++) {
+    bufs[j].buf = (char *) iov[j].iov_base;
+    bufs[j].len = (ULONG) iov[j].iov_len;
+  }
+
+  /* blocking sends return after the whole message is sent */
+  if (to) {
+    err = WSASendTo(s, bufs, iovcnt, &n, 0, (struct sockaddr *) to,
+                    sizeof(struct sockaddr_in), NULL, NULL);
+  } else {
+    err = WSASend(s, bufs, iovcnt, &n, 0, NULL, NULL);
+  }
+  free(bufs);
+  stats->syscalls++;
+  total = err == 0 ? (IDL_MEMINT) n : -1;
+#endif
+
+  return(total);
+}
+
+
+/*
+  Internal function to check for the numeric types that can be sent as
+  structure tags.
+*/
+static int mg_numeric_type(IDL_LONG type) {
+  switch (type) {
+    case IDL_TYP_BYTE:
+    case IDL_TYP_INT:
+    case IDL_TYP_LONG:
+    case IDL_TYP_FLOAT:
+    case IDL_TYP_DOUBLE:
+    case IDL_TYP_COMPLEX:
+    case IDL_TYP_DCOMPLEX:
+    case IDL_TYP_UINT:
+    case IDL_TYP_ULONG:
+    case IDL_TYP_LONG64:
+    case IDL_TYP_ULONG64:
+      return(1);
+    default:
+      return(0);
+  }
+}
+
+
+/*
+  Internal function to compute the number of elements from the dimensions in
+  a variable header, or -1 if a dimension is not positive or there are too
+  many elements for this platform.
+*/
+static IDL_MEMINT mg_var_nelts(i_var2 *var) {
+  IDL_LONG64 nelts = 1, max_nelts = (IDL_LONG64) (((IDL_UMEMINT) -1) >> 1);
+  int d;
+
+  for (d = 0; d < var->ndims; d++) {
+    if ((var->dims[d] <= 0) || (var->dims[d] > max_nelts / nelts)) return(-1);
+    nelts *= var->dims[d];
+  }
+
+  return((IDL_MEMINT) nelts);
+}
+
+
+/*
+  Internal function to copy the dimensions of a variable header to the form
+  used by the IDL_MakeTemp functions.
+*/
+static IDL_MEMINT *mg_var_dims(i_var2 *var, IDL_MEMINT *dims) {
+  int d;
+
+  for (d = 0; d < var->ndims; d++) dims[d] = (IDL_MEMINT) var->dims[d];
+
+  return(dims);
+}
+
+
+/*
+  Internal function to convert a version 1 header, already in native byte
+  order, to a version 2 header. Returns -1 if the header can not be
+  converted.
+*/
+static int mg_var_from_v1(i_var *old, i_var2 *var, int swab) {
+  IDL_MEMINT dims[sizeof(old->dims) / (sizeof(IDL_MEMINT))];
+  int d;
+
+  /* version 1 senders store the dimensions as IDL_MEMINT in place of IDL_LONG */
+  if ((old->ndims < 0) || (old->ndims > (IDL_LONG) ARRLEN(dims))) return(-1);
+  if (swab && (sizeof(IDL_MEMINT) == 2 * sizeof(IDL_LONG))) {
+    /* the header was swapped in 4 byte pieces, restore the 8 byte order */
+    for (d = 0; d < IDL_MAX_ARRAY_DIM; d += 2) {
+      IDL_LONG t = old->dims[d];
+      old->dims[d] = old->dims[d + 1];
+      old->dims[d + 1] = t;
+    }
+  }
+  memcpy(dims, old->dims, sizeof(dims));
+
+  memset(var, 0, sizeof(i_var2));
+  var->token = TOKEN2;
+  var->version = 1;
+  var->type = old->type;
+  var->ndims = old->ndims;
+  var->len = old->len;
+  var->nelts = old->nelts;
+  for (d = 0; d < old->ndims; d++) var->dims[d] = dims[d];
+  var->chunk_size = IDL_MAX(old->len, 1);
+
+  return(0);
+}
+
+
+/*
+  Internal function to check that a received tag name is a valid IDL
+  structure tag name.
+*/
+static int mg_valid_tag_name(const char *name) {
+  const char *c;
+
+  if (!((*name >= 'A' && *name <= 'Z') || *name == '_')) return(0);
+  for (c = name + 1; *c; c++) {
+    if (!((*c >= 'A' && *c <= 'Z') || (*c >= '0' && *c <= '9')
+            || *c == '_' || *c == '$')) {
+      return(0);
+    }
+  }
+
+  return(1);
+}
+
+
+/*
+  Internal function to pack a string array as the lengths of the strings
+  followed by their characters. Returns a buffer the caller must free, or
+  NULL if out of memory.
+*/
+static char *mg_pack_strings(IDL_STRING *strings, IDL_MEMINT n,
+                             IDL_MEMINT *len) {
+  IDL_MEMINT j, total = n * sizeof(IDL_LONG);
+  IDL_LONG slen;
+  char *buffer, *p;
+
+  for (j = 0; j < n; j++) total += strings[j].slen;
+
+  buffer = (char *) malloc(IDL_MAX(total, 1));
+  if (!buffer) return(NULL);
+
+  p = buffer + n * sizeof(IDL_LONG);
+  for (j = 0; j < n; j++) {
+    slen = strings[j].slen;
+    memcpy(buffer + j * sizeof(IDL_LONG), &slen, sizeof(IDL_LONG));
+    memcpy(p, IDL_STRING_STR(&strings[j]), slen);
+    p += slen;
+  }
+
+  *len = total;
+
+  return(buffer);
+}
+
+
+/*
+  Internal function to unpack a string array packed by mg_pack_strings.
+  Returns NULL if the packed strings do not match the header.
+*/
+static IDL_VPTR mg_unpack_strings(char *buffer, i_var2 *var, int swab) {
+  IDL_VPTR vpTmp;
+  IDL_STRING *strings;
+  IDL_LONG *lengths = (IDL_LONG *) buffer;
+  IDL_MEMINT j, total, dims[IDL_MAX_ARRAY_DIM];
+  char *p;
+
+  if ((var->nelts <= 0) || (var->nelts > var->len / (IDL_LONG64) sizeof(IDL_LONG))) return(NULL);
+  if (mg_var_nelts(var) != var->nelts) return(NULL);
+  total = (IDL_MEMINT) var->nelts * sizeof(IDL_LONG);
+  if (swab) mg_byteswap(lengths, total, sizeof(IDL_LONG));
+  for (j = 0; j < var->nelts; j++) {
+    if (lengths[j] < 0) return(NULL);
+    total += lengths[j];
+  }
+  if (total != var->len) return(NULL);
+
+  strings = (IDL_STRING *) IDL_MakeTempArray(IDL_TYP_STRING, var->ndims,
+                                             mg_var_dims(var, dims),
+                                             IDL_ARR_INI_ZERO, &vpTmp);
+  p = buffer + var->nelts * sizeof(IDL_LONG);
+  for (j = 0; j < var->nelts; j++) {
+    if (lengths[j] > 0) {
+      IDL_StrEnsureLength(&strings[j], lengths[j]);
+      memcpy(strings[j].s, p, lengths[j]);
+      strings[j].s[lengths[j]] = '\0';
+      strings[j].slen = lengths[j];
+      p += lengths[j];
+    }
+  }
+
+  return(vpTmp);
+}
+
+
+/*
+  Internal function to pack a structure whose tags are all numeric as a
+  description of the tags followed by the tag values of each element without
+  any padding. The description is the number of tags and, for each tag, its
+  type, number of dimensions, dimensions, and name length followed by its
+  name padded to a multiple of 4 bytes. Returns a buffer the caller must
+  free, or NULL if a tag is not numeric or out of memory.
+*/
+static char *mg_pack_struct(IDL_VPTR v, IDL_MEMINT *len) {
+  IDL_StructDefPtr sdef = v->value.s.sdef;
+  IDL_ARRAY *arr = v->value.s.arr;
+  IDL_LONG ntags, t, d, *def;
+  IDL_MEMINT *offsets, *sizes, elt_size = 0, def_len, e;
+  IDL_VPTR vpTag;
+  char *buffer = NULL, *p, *name;
+  size_t name_len;
+
+  ntags = IDL_StructNumTags(sdef);
+  offsets = (IDL_MEMINT *) malloc(ntags * sizeof(IDL_MEMINT));
+  sizes = (IDL_MEMINT *) malloc(ntags * sizeof(IDL_MEMINT));
+  if (!offsets || !sizes) goto done;
+
+  /* size the description and the packed elements */
+  def_len = sizeof(IDL_LONG);
+  for (t = 0; t < ntags; t++) {
+    offsets[t] = IDL_StructTagInfoByIndex(sdef, t, IDL_MSG_LONGJMP, &vpTag);
+    if (!mg_numeric_type(vpTag->type)) goto done;
+    sizes[t] = IDL_TypeSizeFunc(vpTag->type);
+    if (vpTag->flags & IDL_V_ARR) {
+      sizes[t] = vpTag->value.arr->arr_len;
+      def_len += vpTag->value.arr->n_dim * sizeof(IDL_LONG);
+    }
+    name = IDL_StructTagNameByIndex(sdef, t, IDL_MSG_LONGJMP, NULL);
+    def_len += 3 * sizeof(IDL_LONG) + (strlen(name) + 3) / 4 * 4;
+    elt_size += sizes[t];
+  }
+
+  *len = def_len + arr->n_elts * elt_size;
+  buffer = (char *) calloc(*len, 1);
+  if (!buffer) goto done;
+
+  def = (IDL_LONG *) buffer;
+  *def++ = ntags;
+  for (t = 0; t < ntags; t++) {
+    IDL_StructTagInfoByIndex(sdef, t, IDL_MSG_LONGJMP, &vpTag);
+    name = IDL_StructTagNameByIndex(sdef, t, IDL_MSG_LONGJMP, NULL);
+    name_len = strlen(name);
+    *def++ = vpTag->type;
+    if (vpTag->flags & IDL_V_ARR) {
+      *def++ = vpTag->value.arr->n_dim;
+      for (d = 0; d < vpTag->value.arr->n_dim; d++) {
+        *def++ = (IDL_LONG) vpTag->value.arr->dim[d];
+      }
+    } else {
+      *def++ = 0;
+    }
+    *def++ = (IDL_LONG) name_len;
+    memcpy(def, name, name_len);
+    def += (name_len + 3) / 4;
+  }
+
+  p = buffer + def_len;
+  for (e = 0; e < arr->n_elts; e++) {
+    for (t = 0; t < ntags; t++) {
+      memcpy(p, arr->data + e * arr->elt_len + offsets[t], sizes[t]);
+      p += sizes[t];
+    }
+  }
+
+  done:
+  free(offsets);
+  free(sizes);
+
+  return(buffer);
+}
+
+
+/*
+  Internal function to unpack a structure packed by mg_pack_struct into a new
+  anonymous structure. Returns NULL if the packed structure is invalid.
+*/
+static IDL_VPTR mg_unpack_struct(char *buffer, i_var2 *var, int swab) {
+  IDL_LONG *def = (IDL_LONG *) buffer, *end = (IDL_LONG *) (buffer + var->len);
+  IDL_LONG ntags, t, d, type, ndims, name_len;
+  IDL_MEMINT elt_size = 0, e, offset, size, swapsize, dims[IDL_MAX_ARRAY_DIM];
+  IDL_STRUCT_TAG_DEF *tags = NULL;
+  IDL_StructDefPtr sdef;
+  IDL_VPTR vpTmp = NULL, vpTag;
+  IDL_ARRAY *arr;
+  char *p, *dst, *name;
+
+  if ((var->len < (IDL_LONG64) sizeof(IDL_LONG)) || (var->ndims <= 0)) return(NULL);
+  if (mg_var_nelts(var) != var->nelts) return(NULL);
+  if (swab) mg_byteswap(def, sizeof(IDL_LONG), sizeof(IDL_LONG));
+  ntags = *def++;
+  if (ntags <= 0) return(NULL);
+
+  tags = (IDL_STRUCT_TAG_DEF *) calloc(ntags + 1, sizeof(IDL_STRUCT_TAG_DEF));
+  if (!tags) return(NULL);
+
+  /* rebuild the tag definitions from the description */
+  for (t = 0; t < ntags; t++) {
+    if (end - def < 2) goto done;
+    if (swab) mg_byteswap(def, 2 * sizeof(IDL_LONG), sizeof(IDL_LONG));
+    type = *def++;
+    ndims = *def++;
+    if (!mg_numeric_type(type) || (ndims < 0) || (ndims > IDL_MAX_ARRAY_DIM)
+          || (end - def < ndims + 1)) {
+      goto done;
+    }
+    tags[t].type = (void *) (IDL_PTRINT) type;
+
+    size = IDL_TypeSizeFunc(type);
+    if (ndims > 0) {
+      tags[t].dims = (IDL_MEMINT *) malloc((ndims + 1) * sizeof(IDL_MEMINT));
+      if (!tags[t].dims) goto done;
+      if (swab) mg_byteswap(def, ndims * sizeof(IDL_LONG), sizeof(IDL_LONG));
+      tags[t].dims[0] = ndims;
+      for (d = 0; d < ndims; d++) {
+        if (def[d] <= 0) goto done;
+        tags[t].dims[d + 1] = def[d];
+        size *= def[d];
+      }
+      def += ndims;
+    }
+    elt_size += size;
+
+    if (swab) mg_byteswap(def, sizeof(IDL_LONG), sizeof(IDL_LONG));
+    name_len = *def++;
+    if ((name_len <= 0) || ((end - def) * 4 < name_len)) goto done;
+    name = (char *) malloc(name_len + 1);
+    if (!name) goto done;
+    memcpy(name, def, name_len);
+    name[name_len] = '\0';
+    tags[t].name = name;
+    if (!mg_valid_tag_name(name)) goto done;
+    def += (name_len + 3) / 4;
+  }
+
+  /* the tag values must exactly fill the rest of the message */
+  if ((char *) end - (char *) def != var->nelts * elt_size) goto done;
+
+  sdef = IDL_MakeStruct(NULL, tags);
+  IDL_MakeTempStruct(sdef, var->ndims, mg_var_dims(var, dims), &vpTmp, TRUE);
+  arr = vpTmp->value.s.arr;
+
+  p = (char *) def;
+  for (t = 0; t < ntags; t++) {
+    offset = IDL_StructTagInfoByIndex(sdef, t, IDL_MSG_LONGJMP, &vpTag);
+    type = vpTag->type;
+    size = vpTag->flags & IDL_V_ARR ? vpTag->value.arr->arr_len : IDL_TypeSizeFunc(type);
+    swapsize = IDL_TypeSizeFunc(type);
+    if ((type == IDL_TYP_COMPLEX) || (type == IDL_TYP_DCOMPLEX)) swapsize /= 2;
+    for (e = 0; e < arr->n_elts; e++) {
+      dst = (char *) arr->data + e * arr->elt_len + offset;
+      memcpy(dst, p + e * elt_size, size);
+      if (swab) mg_byteswap(dst, size, (int) swapsize);
+    }
+    /* tag t + 1 of each element follows tag t */
+    p += size;
+  }
+
+  done:
+  for (t = 0; t < ntags; t++) {
+    free(tags[t].name);
+    free(tags[t].dims);
+  }
+  free(tags);
+
+  return(vpTmp);
+}
+
+
+/*
+  Internal function to make an identifier for a new transfer that is
+  unlikely to repeat, even between processes.
+*/
+static IDL_LONG64 mg_transfer_id(void) {
+  static IDL_ULONG64 counter = 0;
+  IDL_ULONG64 z;
+
+  z = (IDL_ULONG64) time(NULL) ^ ((IDL_ULONG64) clock() << 24)
+        ^ ((IDL_ULONG64) (IDL_PTRINT) &counter << 16);
+#ifndef WIN32
+  z ^= (IDL_ULONG64) getpid() << 40;
+#endif
+  z += ++counter * 0x9E3779B97F4A7C15ULL;
+
+  /* splitmix64 finalizer */
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  z = (z ^ (z >> 31)) & 0x7fffffffffffffffULL;
+
+  return(z ? (IDL_LONG64) z : 1);
+}
+
+
+/*
+  Internal function to find the partially received variable of a transfer.
+*/
+static net_pending *mg_pending_find(IDL_LONG64 transfer_id) {
+  int j;
+
+  if (transfer_id == 0) return(NULL);
+  for (j = 0; j < NET_MAX_PENDING; j++) {
+    if (net_pending_list[j].transfer_id == transfer_id) return(&net_pending_list[j]);
+  }
+
+  return(NULL);
+}
+
+
+/*
+  Internal function to forget a partially received variable.
+*/
+static void mg_pending_clear(net_pending *pending) {
+  free(pending->buffer);
+  memset(pending, 0, sizeof(net_pending));
+}
+
+
+/*
+  Internal function to remember a partially received variable so that the
+  rest of it can be received later, replacing the oldest partially received
+  variable if there are too many. Takes ownership of buffer.
+*/
+static void mg_pending_save(i_var2 *var, IDL_MEMINT received, char *buffer) {
+  static int next = 0;
+  net_pending *pending = mg_pending_find(var->transfer_id);
+
+  if (!pending) {
+    pending = &net_pending_list[next];
+    next = (next + 1) % NET_MAX_PENDING;
+    mg_pending_clear(pending);
+  } else if (pending->buffer != buffer) {
+    free(pending->buffer);
+  }
+
+  pending->transfer_id = var->transfer_id;
+  pending->var = *var;
+  pending->var.offset = 0;
+  pending->received = received;
+  pending->buffer = buffer;
+}
+
+
+/*
+  Internal function to check that a resumed transfer describes the same
+  variable as the partially received one.
+*/
+static int mg_pending_matches(net_pending *pending, i_var2 *var) {
+  int d;
+
+  if ((pending->var.type != var->type) || (pending->var.ndims != var->ndims)
+        || (pending->var.len != var->len) || (pending->var.nelts != var->nelts)
+        || (pending->var.chunk_size != var->chunk_size)) {
+    return(0);
+  }
+  for (d = 0; d < var->ndims; d++) {
+    if (pending->var.dims[d] != var->dims[d]) return(0);
+  }
+
+  return(var->offset <= pending->received);
+}
+
+
+/*
+  Internal function to fill in the header of a variable to send and find its
+  data. String arrays and structures are packed into a buffer the caller
+  must free. Returns -1 if out of memory.
+*/
+static int mg_var_describe(IDL_VPTR v, i_var2 *var, char **data, char **packed) {
+  IDL_ARRAY *arr = NULL;
+  IDL_MEMINT len = 0;
+  int d;
+
+  memset(var, 0, sizeof(i_var2));
+  var->token = TOKEN2;
+  var->version = MG_NET_VERSION;
+  var->type = v->type;
+  *packed = NULL;
+  if ((var->type == IDL_TYP_PTR) ||
+      (var->type == IDL_TYP_OBJREF) ||
+      (var->type == IDL_TYP_UNDEF)) {
+    IDL_MessageFromBlock(msg_block,
+                         MG_NET_BADTYPE,
+                         IDL_MSG_LONGJMP,
+                         IDL_TypeNameFunc(var->type));
+  }
+
+  if (var->type == IDL_TYP_STRUCT) {
+    *packed = mg_pack_struct(v, &len);
+    if (!*packed) {
+      IDL_MessageFromBlock(msg_block,
+                           MG_NET_BADTYPE,
+                           IDL_MSG_LONGJMP,
+                           "structure with non-numeric tags");
+    }
+    *data = *packed;
+    arr = v->value.s.arr;
+  } else if ((v->type == IDL_TYP_STRING) && (v->flags & IDL_V_ARR)) {
+    *packed = mg_pack_strings((IDL_STRING *) v->value.arr->data,
+                              v->value.arr->n_elts, &len);
+    if (!*packed) return(-1);
+    *data = *packed;
+    arr = v->value.arr;
+  } else if (v->type == IDL_TYP_STRING) {
+    *data = IDL_STRING_STR(&(v->value.str));
+    len = v->value.str.slen + 1;
+    var->nelts = len;
+  } else if (v->flags & IDL_V_ARR) {
+    *data = (char *) v->value.arr->data;
+    len = v->value.arr->arr_len;
+    arr = v->value.arr;
+  } else {
+    *data = (char *) &(v->value.c);
+    len = IDL_TypeSizeFunc(var->type);
+    var->nelts = 1;
+  }
+  if (arr) {
+    var->ndims = arr->n_dim;
+    var->nelts = arr->n_elts;
+    for (d = 0; d < arr->n_dim; d++) var->dims[d] = arr->dim[d];
+  }
+  var->len = len;
+
+  return(0);
+}
+
+
+/*
+  err = MG_NET_SENDVAR(socket, variable [, host] [, port] [, /MORE]
+                       [, CHUNK_SIZE=bytes] [, /NO_CHECKSUM]
+                       [, RESUME=[transfer_id, offset]] [, TRANSFER_ID=id]
+                       [, VERSION=1])
+
+  Sends a complete IDL variable to a socket for reading by MG_NET_RECVVAR.
+  Variables of the basic types, including string arrays, are sent with array
+  dimensions and lengths intact. Structures are sent if all their tags are
+  numeric; the receiver gets an anonymous structure with the same tags.
+
+  The header holds lengths and dimensions in 64 bits, so variables of any
+  size can be sent. The data follows in chunks of CHUNK_SIZE bytes (4 MB by
+  default), each one followed by its CRC-32C checksum unless NO_CHECKSUM is
+  set; MG_NET_RECVVAR fails on the first chunk that does not match its
+  checksum. Set VERSION=1 to send the header of older versions of
+  MG_NET_RECVVAR, without chunks or checksums, for variables of less than
+  2 GB and at most 4 dimensions.
+
+  Each transfer has an identifier, returned by TRANSFER_ID. When a transfer
+  on a TCP socket fails part way, MG_NET_RECVVAR keeps what was received and
+  reports the number of bytes that arrived intact; to send the rest, call
+  MG_NET_SENDVAR again with the same variable and RESUME set to the transfer
+  identifier and that number of bytes.
+
+  The header and data go out in a single datagram for UDP sockets, so a
+  variable sent on a UDP socket must fit in a datagram. On TCP sockets,
+  sending continues until the whole variable is sent. Set MORE when other
+  variables will be sent right after this one on a TCP socket: where the
+  system supports it, the data is held back until a variable is sent without
+  MORE, so that several small variables leave in as few packets as possible.
+  On a socket with a shared memory channel set up by MG_NET_SHM, the header
+  and data are written straight into the shared memory, without checksums.
+
+  Returns 1 if the whole variable was sent, or -1 for error.
+
+	When sending data from a UDP socket, you must specify the remote host and
+	port arguments where host is the value returned from the MG_NET_NAME2HOST
+	function.
+
+  Note: This is the easiest way to send a complete variable from one IDL to
+  another. The receiver will byteswap the data if necessary. One should be
+  careful not to mix calls to MG_NET_SEND/RECV and MG_NET_SENDVAR/RECVVAR as
+  the latter send formatted information. You can use the two calls on the same
+  socket as long as they are paired.
+*/
+static IDL_VPTR IDL_CDECL mg_net_sendvar(int argc, IDL_VPTR inargv[], char *argk) {
+  IDL_LONG i, nargs, d;
+  i_var old;
+  i_var2 var;
+  int host = 0, flags, iovcnt, resume = 0;
+  short port = 0;
+  IDL_MEMINT len, pos, n, expected, sent = 0, nresume = 0;
+  IDL_MEMINT dims[sizeof(old.dims) / (sizeof(IDL_MEMINT))];
+  net_stats *stats;
+  double start, end;
+  IDL_LONG64 transfer_id = 0, offset = 0, *presume;
+  IDL_ULONG crc;
+  IDL_VPTR vpTmp, vpResume64, argv[4];
+  char *pbuffer, *packed = NULL;
+  struct sockaddr_in sin, *to = NULL;
+  struct iovec iov[3];
+
+  static IDL_LONG iMore, iNoChecksum, iVersion;
+  static IDL_LONG64 lChunkSize;
+  static IDL_VPTR vpResume, vpTransferId;
+  static IDL_KW_PAR kw_pars[] = { IDL_KW_FAST_SCAN,
+    { "CHUNK_SIZE", IDL_TYP_LONG64, 1, IDL_KW_ZERO, 0, IDL_CHARA(lChunkSize) },
+    { "MORE", IDL_TYP_LONG, 1, IDL_KW_ZERO, 0, IDL_CHARA(iMore) },
+    { "NO_CHECKSUM", IDL_TYP_LONG, 1, IDL_KW_ZERO, 0, IDL_CHARA(iNoChecksum) },
+    { "RESUME", IDL_TYP_UNDEF, 1, IDL_KW_VIN | IDL_KW_ZERO, 0, IDL_CHARA(vpResume) },
+    { "TRANSFER_ID", IDL_TYP_UNDEF, 1, IDL_KW_OUT | IDL_KW_ZERO, 0, IDL_CHARA(vpTransferId) },
+    { "VERSION", IDL_TYP_LONG, 1, IDL_KW_ZERO, 0, IDL_CHARA(iVersion) },
+    { NULL }
+  };
+
+  IDL_KWCleanup(IDL_KW_MARK);
+  nargs = IDL_KWGetParams(argc, inargv, argk, kw_pars, argv, 1);
+  i = IDL_LongScalar(argv[0]);
+  if (nargs == 4) {
+    host = IDL_ULongScalar(argv[2]);
+    port = (short) IDL_LongScalar(argv[3]);
+  }
+  if (vpResume) {
+    vpResume64 = IDL_CvtLng64(1, &vpResume);
+    IDL_VarGetData(vpResume64, &nresume, (char **) &presume, 0);
+    if (nresume == 2) {
+      transfer_id = presume[0];
+      offset = presume[1];
+      resume = 1;
+    }
+    if (vpResume64 != vpResume) IDL_Deltmp(vpResume64);
+  } else if (iVersion != 1) {
+    transfer_id = mg_transfer_id();
+  }
+  if (vpTransferId) IDL_VarCopy(IDL_GettmpLong64(transfer_id), vpTransferId);
+  IDL_KWCleanup(IDL_KW_CLEAN);
+
+  if ((i < 0) || (i >= net_list_size)) return (IDL_GettmpLong(-1));
+  if ((net_list[i].iState != NET_IO) || mg_async_busy(i)) return (IDL_GettmpLong(-1));
+  vpTmp = argv[1];
+  if (vpTmp->type != IDL_TYP_STRUCT) IDL_ENSURE_SIMPLE(vpTmp);
+
+  if (vpResume && ((nresume != 2) || (iVersion == 1))) {
+    IDL_MessageFromBlock(msg_block,
+                         MG_NET_ERROR,
+                         IDL_MSG_RET,
+                         "RESUME must be [transfer_id, offset] and can not be used with VERSION=1");
+    return (IDL_GettmpLong(-1));
+  }
+  if ((iVersion != 0) && (iVersion != 1) && (iVersion != MG_NET_VERSION)) {
+    IDL_MessageFromBlock(msg_block,
+                         MG_NET_ERROR,
+                         IDL_MSG_RET,
+                         "Unsupported VERSION.");
+    return (IDL_GettmpLong(-1));
+  }
+
+  if (net_list[i].iType == NET_UDP) {
+    if (nargs != 4) {
+      IDL_MessageFromBlock(msg_block,
+                           MG_NET_ERROR,
+                           IDL_MSG_RET,
+                           "This UDP socket requires the destination HOST and PORT arguments.");
+      return (IDL_GettmpLong(-1));
+    }
+    sin.sin_addr.s_addr = host;
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(port);
+    to = &sin;
+  }
+
+  stats = &net_list[i].stats;
+  start = mg_net_clock();
+  if (mg_var_describe(vpTmp, &var, &pbuffer, &packed) == -1) {
+    return (IDL_GettmpLong(-1));
+  }
+  len = (IDL_MEMINT) var.len;
+
+  /* a UDP variable goes in one datagram, so in one chunk */
+  var.chunk_size = lChunkSize > 0 ? lChunkSize : NET_CHUNK_SIZE;
+  if ((net_list[i].iType != NET_TCP) || (iVersion == 1)) var.chunk_size = IDL_MAX(len, 1);
+  /* shared memory is not subject to transmission errors */
+  var.flags = iNoChecksum || (iVersion == 1) || net_list[i].pShm ? 0 : MG_NET_CHECKSUM;
+  var.transfer_id = transfer_id;
+  var.offset = offset;
+  if (resume && ((offset < 0) || (offset >= len) || (offset % var.chunk_size != 0))) {
+    free(packed);
+    return (IDL_GettmpLong(-1));
+  }
+
+  /* send native, recvvar swaps if needed */
+  if (iVersion == 1) {
+    /* the version 1 header stores the length in 32 bits */
+    if ((len > 0x7fffffff) || (var.ndims > (IDL_LONG) ARRLEN(dims))) {
+      free(packed);
+      return (IDL_GettmpLong(-1));
+    }
+    memset(&old, 0, sizeof(i_var));
+    old.token = TOKEN;
+    old.type = var.type;
+    old.ndims = var.ndims;
+    old.len = (IDL_LONG) len;
+    old.nelts = (IDL_LONG) var.nelts;
+    memset(dims, 0, sizeof(dims));
+    for (d = 0; d < var.ndims; d++) dims[d] = (IDL_MEMINT) var.dims[d];
+    memcpy(old.dims, dims, sizeof(dims));
+    iov[0].iov_base = (char *) &old;
+    iov[0].iov_len = sizeof(i_var);
+  } else {
+    var.checksum = mg_crc32c(&var, sizeof(i_var2));
+    iov[0].iov_base = (char *) &var;
+    iov[0].iov_len = sizeof(i_var2);
+  }
+  iovcnt = 1;
+  expected = (IDL_MEMINT) iov[0].iov_len;
+
+  /* each chunk goes out with its checksum in one system call */
+  for (pos = offset; pos < len; pos += n) {
+    n = (IDL_MEMINT) IDL_MIN(var.chunk_size, len - pos);
+    iov[iovcnt].iov_base = pbuffer + pos;
+    iov[iovcnt++].iov_len = n;
+    expected += n;
+    if (var.flags & MG_NET_CHECKSUM) {
+      crc = mg_crc32c(pbuffer + pos, n);
+      iov[iovcnt].iov_base = (char *) &crc;
+      iov[iovcnt++].iov_len = sizeof(IDL_ULONG);
+      expected += sizeof(IDL_ULONG);
+    }
+    if (net_list[i].pShm) {
+      for (d = 0; d < iovcnt; d++) {
+        if (mg_shm_write(net_list[i].pShm, net_list[i].socket,
+                         iov[d].iov_base, iov[d].iov_len, stats) == -1) break;
+      }
+      if (d < iovcnt) break;
+    } else {
+      flags = (iMore || (pos + n < len)) && (net_list[i].iType == NET_TCP) ? MSG_MORE : 0;
+      if (mg_send_all(net_list[i].socket, iov, iovcnt, to, flags, stats) != expected) break;
+    }
+    sent += expected;
+    iovcnt = 0;
+    expected = 0;
+  }
+
+  free(packed);
+
+  /* the round trip is timed from the end of the send */
+  end = mg_net_clock();
+  stats->send_time += end - start;
+  mg_stats_sent(stats, pos >= len ? sent : -1, 1);
+  if (pos >= len) mg_stats_start_trip(stats, end);
+
+  return(IDL_GettmpLong(pos >= len ? 1 : -1));
+}
+
+
+/*
+  Internal function to get the size of a variable header from its token, or
+  -1 if the token is not valid.
+*/
+static IDL_MEMINT mg_var_header_size(char *header) {
+  IDL_LONG token;
+
+  memcpy(&token, header, sizeof(IDL_LONG));
+  if ((token == TOKEN) || (token == SWAPTOKEN)) return(sizeof(i_var));
+  if ((token == TOKEN2) || (token == SWAPTOKEN2)) return(sizeof(i_var2));
+
+  return(-1);
+}
+
+
+/*
+  Internal function to decode a variable header as received into a version 2
+  header in native byte order. Returns -1 if the header is not valid.
+*/
+static int mg_var_decode(char *header, i_var2 *var, int *swab) {
+  i_var old;
+  IDL_ULONG checksum;
+
+  memcpy(&old.token, header, sizeof(IDL_LONG));
+  if ((old.token == TOKEN) || (old.token == SWAPTOKEN)) {
+    memcpy(&old, header, sizeof(i_var));
+    *swab = old.token == SWAPTOKEN;
+    if (*swab) mg_byteswap(&old, sizeof(i_var), sizeof(IDL_LONG));
+    if (mg_var_from_v1(&old, var, *swab) == -1) return(-1);
+  } else {
+    memcpy(var, header, sizeof(i_var2));
+    *swab = var->token == SWAPTOKEN2;
+    checksum = var->checksum;
+    var->checksum = 0;
+    if (*swab) mg_byteswap(&checksum, sizeof(IDL_ULONG), sizeof(IDL_ULONG));
+    if (mg_crc32c(var, sizeof(i_var2)) != checksum) return(-1);
+    if (*swab) {
+      mg_byteswap(var, offsetof(i_var2, len), sizeof(IDL_LONG));
+      mg_byteswap(&var->len, sizeof(i_var2) - offsetof(i_var2, len), sizeof(IDL_LONG64));
+    }
+    if (var->version != MG_NET_VERSION) return(-1);
+  }
+
+  if ((var->len <= 0) || (var->nelts <= 0)) return(-1);
+  if ((var->ndims < 0) || (var->ndims > IDL_MAX_ARRAY_DIM)) return(-1);
+  if ((var->chunk_size <= 0) || (var->offset < 0) || (var->offset >= var->len)
+        || (var->offset % var->chunk_size != 0)) {
+    return(-1);
+  }
+  if ((IDL_UMEMINT) var->len != (IDL_ULONG64) var->len) return(-1);
+
+  return(0);
+}
+
+
+/*
+  Internal function to check that the data described by a header fills the
+  variable exactly. Returns -1 if not.
+*/
+static int mg_var_check(i_var2 *var) {
+  if ((var->type == IDL_TYP_STRUCT)
+        || ((var->type == IDL_TYP_STRING) && (var->ndims != 0))) {
+    if (mg_var_nelts(var) != var->nelts) return(-1);
+  } else if (var->type == IDL_TYP_STRING) {
+    if ((var->nelts != var->len) || (var->len > 0x7fffffff)) return(-1);
+  } else {
+    if (!mg_numeric_type(var->type)) return(-1);
+    if (var->len / IDL_TypeSizeFunc(var->type) != var->nelts) return(-1);
+    if (var->len % IDL_TypeSizeFunc(var->type) != 0) return(-1);
+    if ((var->ndims != 0) && (mg_var_nelts(var) != var->nelts)) return(-1);
+    if ((var->ndims == 0) && (var->nelts != 1)) return(-1);
+  }
+
+  return(0);
+}
+
+
+/*
+  Internal function to byteswap the data of a numeric variable.
+*/
+static void mg_var_swap(char *data, i_var2 *var) {
+  int swapsize = IDL_TypeSizeFunc(var->type);
+
+  if ((var->type == IDL_TYP_COMPLEX) || (var->type == IDL_TYP_DCOMPLEX)) {
+    swapsize /= 2;
+  }
+  mg_byteswap(data, var->len, swapsize);
+}
+
+
+/*
+  Internal function to read the next bytes of a variable, from the rest of
+  the datagram for UDP sockets, from the shared memory channel of the socket
+  if it has one, or from the socket for TCP sockets.
+*/
+static int mg_recvvar_data(net_reader *reader, void *buffer, IDL_MEMINT len) {
+  reader->got += len;
+  if (reader->payload) {
+    if (reader->avail < len) return(-1);
+    memcpy(buffer, reader->payload, len);
+    reader->payload += len;
+    reader->avail -= len;
+    return(0);
+  }
+  if (reader->shm) {
+    return(mg_shm_read(reader->shm, reader->s, buffer, len, reader->stats));
+  }
+
+  return(mg_recv_packet(reader->s, buffer, len, reader->deadline, reader->stats));
+}
+
+
+/*
+  Internal function to check whether a variable can hold the data of a
+  numeric variable header without being reallocated.
+*/
+static int mg_recvvar_fits(IDL_VPTR v, i_var2 *var) {
+  if (!mg_numeric_type(var->type) || (v->type != var->type)) return(0);
+  if (v->flags & (IDL_V_STRUCT | IDL_V_CONST)) return(0);
+  if (var->ndims == 0) return(!(v->flags & IDL_V_ARR));
+
+  return((v->flags & IDL_V_ARR) && (v->value.arr->arr_len == var->len));
+}
+
+
+/*
+  Internal function to take a free buffer of at least len bytes from the
+  receive ring. Returns NULL if there is none.
+*/
+static char *mg_ring_get(IDL_MEMINT len) {
+  IDL_LONG j;
+
+  for (j = 0; j < net_ring_size; j++) {
+    if (!net_ring[j].in_use && (net_ring[j].size >= len)) {
+      net_ring[j].in_use = 1;
+      return(net_ring[j].data);
+    }
+  }
+
+  return(NULL);
+}
+
+
+/*
+  Internal function called by IDL when the variable holding a ring buffer is
+  freed, making the buffer available again. Buffers of a ring that has been
+  replaced are freed.
+*/
+static void mg_ring_release(UCHAR *data) {
+  IDL_LONG j;
+
+  for (j = 0; j < net_ring_size; j++) {
+    if (net_ring[j].data == (char *) data) {
+      net_ring[j].in_use = 0;
+      return;
+    }
+  }
+
+  free(data);
+}
+
+
+/*
+  Internal function to free the receive ring. Buffers still held by IDL
+  variables are freed with the variables.
+*/
+static void mg_ring_free(void) {
+  IDL_LONG j;
+
+  for (j = 0; j < net_ring_size; j++) {
+    if (!net_ring[j].in_use) free(net_ring[j].data);
+  }
+  free(net_ring);
+  net_ring = NULL;
+  net_ring_size = 0;
+}
+
+
+/*
+  err = MG_NET_RECVRING(n_buffers, size)
+
+  Sets up a ring of n_buffers receive buffers of size bytes each. While the
+  ring has a free buffer large enough, MG_NET_RECVVAR reads numeric arrays
+  into it instead of allocating a new array for each variable. A buffer
+  returns to the ring when the IDL variable holding it is freed or
+  overwritten, e.g., by the next MG_NET_RECVVAR into the same variable, so a
+  stream of frames received into the same variable allocates no memory with
+  a ring of two buffers. Calling MG_NET_RECVRING again replaces the ring;
+  n_buffers = 0 removes it.
+
+  Returns 1 for success or -1 if the buffers can not be allocated.
+*/
+static IDL_VPTR IDL_CDECL mg_net_recvring(int argc, IDL_VPTR argv[], char *argk) {
+  IDL_LONG j, n;
+  IDL_MEMINT size;
+
+  n = IDL_LongScalar(argv[0]);
+  size = (IDL_MEMINT) IDL_Long64Scalar(argv[1]);
+  if ((n < 0) || ((n > 0) && (size <= 0))) return(IDL_GettmpLong(-1));
+
+  mg_ring_free();
+  if (n == 0) return(IDL_GettmpLong(1));
+
+  net_ring = (net_ring_buffer *) calloc(n, sizeof(net_ring_buffer));
+  if (!net_ring) return(IDL_GettmpLong(-1));
+  for (j = 0; j < n; j++) {
+    net_ring[j].data = (char *) malloc(size);
+    if (!net_ring[j].data) {
+      net_ring_size = j;
+      mg_ring_free();
+      return(IDL_GettmpLong(-1));
+    }
+    net_ring[j].size = size;
+  }
+  net_ring_size = n;
+
+  return(IDL_GettmpLong(1));
+}
+
+
+/*
+  err = MG_NET_RECVVAR(socket, variable [, /INTO] [, RECEIVED=bytes]
+                       [, TRANSFER_ID=id] [, TIMEOUT=seconds])
+
+  Reads an IDL variable from the socket in the form written by MG_NET_SENDVAR.
+  The complete variable is reconstructed. Variables sent by older versions of
+  MG_NET_SENDVAR are read as well. See MG_NET_SENDVAR for more details.
+
+  Set INTO to read a numeric variable directly into variable, without
+  allocating a new one, when variable already has the same type and number
+  of bytes; the dimensions of variable are not changed. Otherwise, numeric
+  arrays are read into a buffer of the ring set up by MG_NET_RECVRING if one
+  is free, or into a new array.
+
+  RECEIVED returns the number of bytes of data received with valid
+  checksums and TRANSFER_ID the identifier of the transfer. If a transfer on
+  a TCP socket fails part way, those bytes are kept: a numeric array is left
+  partially filled in variable, to be passed to MG_NET_RECVVAR again when the
+  sender resumes the transfer with MG_NET_SENDVAR and RESUME=[id, bytes]. The
+  data of a partially received array is not byteswapped.
+
+  Set TIMEOUT to a positive number of seconds to fail if the whole variable
+  has not arrived from a TCP socket by then; by default the read waits as
+  long as it takes. The timeout does not apply to shared memory channels.
+ */
+static IDL_VPTR IDL_CDECL mg_net_recvvar(int argc, IDL_VPTR inargv[], char *argk) {
+  IDL_LONG i, iRet = -1;
+  int swab = 0;
+  char header[sizeof(i_var2)];
+  i_var2 var;
+  net_reader reader;
+  net_pending *pending = NULL;
+  IDL_ULONG checksum;
+  IDL_MEMINT pos = 0, n, dims[IDL_MAX_ARRAY_DIM];
+  IDL_VPTR vpTmp, vpVar, argv[2];
+  char *pbuffer = NULL, *datagram = NULL, *packed = NULL;
+  net_stats *stats = NULL;
+  double start = 0.0, end;
+
+  static IDL_LONG iInto;
+  static double dTimeout;
+  static IDL_VPTR vpReceived, vpTransferId;
+  static IDL_KW_PAR kw_pars[] = { IDL_KW_FAST_SCAN,
+    { "INTO", IDL_TYP_LONG, 1, IDL_KW_ZERO, 0, IDL_CHARA(iInto) },
+    { "RECEIVED", IDL_TYP_UNDEF, 1, IDL_KW_OUT | IDL_KW_ZERO, 0, IDL_CHARA(vpReceived) },
+    { "TIMEOUT", IDL_TYP_DOUBLE, 1, IDL_KW_ZERO, 0, IDL_CHARA(dTimeout) },
+    { "TRANSFER_ID", IDL_TYP_UNDEF, 1, IDL_KW_OUT | IDL_KW_ZERO, 0, IDL_CHARA(vpTransferId) },
+    { NULL }
+  };
+
+  IDL_KWCleanup(IDL_KW_MARK);
+  IDL_KWGetParams(argc, inargv, argk, kw_pars, argv, 1);
+  i = IDL_LongScalar(argv[0]);
+  vpVar = argv[1];
+  IDL_EXCLUDE_EXPR(vpVar);
+  memset(&var, 0, sizeof(i_var2));
+  if ((i < 0) || (i >= net_list_size)) goto done;
+  if ((net_list[i].iState != NET_IO) || mg_async_busy(i)) goto done;
+
+  stats = &net_list[i].stats;
+  start = mg_net_clock();
+  reader.s = net_list[i].socket;
+  reader.payload = NULL;
+  reader.avail = 0;
+  reader.shm = net_list[i].pShm;
+  reader.stats = stats;
+  reader.got = 0;
+  reader.deadline = dTimeout > 0.0 ? start + dTimeout : 0.0;
+
+  /* UDP variables are read as a whole datagram */
+  if (net_list[i].iType != NET_TCP) {
+    datagram = (char *) malloc(NET_MAX_DATAGRAM);
+    if (!datagram) goto done;
+    n = recv(reader.s, datagram, NET_MAX_DATAGRAM, 0);
+    stats->syscalls++;
+    if (n <= 0) goto done;
+    reader.payload = datagram;
+    reader.avail = n;
+  }
+
+  /* the token gives the version of the header and the byte order */
+  if (mg_recvvar_data(&reader, header, sizeof(IDL_LONG)) == -1) goto done;
+  n = mg_var_header_size(header);
+  if (n == -1) goto done;
+  if (mg_recvvar_data(&reader, header + sizeof(IDL_LONG), n - sizeof(IDL_LONG)) == -1) {
+    goto done;
+  }
+  if (mg_var_decode(header, &var, &swab) == -1) goto done;
+  if (datagram && (var.version == 1) && (reader.avail == 0)) {
+    /* older versions send the data in a second datagram */
+    n = recv(reader.s, datagram, NET_MAX_DATAGRAM, 0);
+    stats->syscalls++;
+    if (n <= 0) goto done;
+    reader.payload = datagram;
+    reader.avail = n;
+  }
+  if (mg_var_check(&var) == -1) goto done;
+
+  if (var.offset > 0) {
+    /* continue a transfer that failed part way */
+    pending = mg_pending_find(var.transfer_id);
+    if (!pending || !mg_pending_matches(pending, &var)) goto done;
+    if (pending->buffer) {
+      pbuffer = packed = pending->buffer;
+    } else {
+      if (!(vpVar->flags & IDL_V_ARR) || (vpVar->flags & IDL_V_STRUCT)
+            || (vpVar->type != var.type)
+            || (vpVar->value.arr->arr_len != var.len)) {
+        goto done;
+      }
+      pbuffer = (char *) vpVar->value.arr->data;
+    }
+    pos = var.offset;
+  } else if ((var.type == IDL_TYP_STRUCT)
+               || ((var.type == IDL_TYP_STRING) && (var.ndims != 0))) {
+    /* packed string arrays and structures */
+    pbuffer = packed = (char *) malloc(var.len);
+    if (!packed) goto done;
+  } else if (iInto && mg_recvvar_fits(vpVar, &var)) {
+    /* receive directly into the existing variable */
+    pbuffer = vpVar->flags & IDL_V_ARR
+                ? (char *) vpVar->value.arr->data
+                : (char *) &(vpVar->value.c);
+  } else if (var.type == IDL_TYP_STRING) {
+    vpTmp = IDL_StrToSTRING("");
+    IDL_StrEnsureLength(&(vpTmp->value.str), (int) var.len);
+    vpTmp->value.str.slen = (IDL_STRING_SLEN_T) (var.len - 1);
+    pbuffer = vpTmp->value.str.s;
+    memset(pbuffer, 0x20, var.len - 1);
+    pbuffer[var.len] = '\0';
+    IDL_VarCopy(vpTmp, vpVar);
+  } else if (var.ndims != 0) {
+    pbuffer = mg_ring_get(var.len);
+    if (pbuffer) {
+      vpTmp = IDL_ImportArray(var.ndims, mg_var_dims(&var, dims), var.type,
+                              (UCHAR *) pbuffer, mg_ring_release, NULL);
+    } else {
+      pbuffer = IDL_MakeTempArray(var.type, var.ndims, mg_var_dims(&var, dims),
+                                  IDL_BARR_INI_NOP, &vpTmp);
+    }
+    IDL_VarCopy(vpTmp, vpVar);
+  } else {
+    vpTmp = IDL_GettmpLong(0);
+    IDL_VarCopy(vpTmp, vpVar);
+    IDL_StoreScalarZero(vpVar, var.type);
+    pbuffer = (char *) &(vpVar->value.c);
+  }
+
+  /* read the data a chunk at a time, checking each chunk */
+  while (pos < var.len) {
+    n = (IDL_MEMINT) IDL_MIN(var.chunk_size, var.len - pos);
+    if (mg_recvvar_data(&reader, pbuffer + pos, n) == -1) break;
+    if (var.flags & MG_NET_CHECKSUM) {
+      if (mg_recvvar_data(&reader, &checksum, sizeof(IDL_ULONG)) == -1) break;
+      if (swab) mg_byteswap(&checksum, sizeof(IDL_ULONG), sizeof(IDL_ULONG));
+      if (mg_crc32c(pbuffer + pos, n) != checksum) break;
+    }
+    pos += n;
+  }
+  if (pos < var.len) {
+    /* keep what arrived intact so that the transfer can be resumed */
+    if ((pos > 0) && (var.transfer_id != 0) && (packed || (var.ndims != 0))) {
+      mg_pending_save(&var, pos, packed);
+      packed = NULL;
+    }
+    goto done;
+  }
+  if (datagram && (reader.avail != 0)) goto done;
+  if (pending) {
+    pending->buffer = NULL;
+    mg_pending_clear(pending);
+  }
+
+  if (packed) {
+    vpTmp = var.type == IDL_TYP_STRUCT
+              ? mg_unpack_struct(packed, &var, swab)
+              : mg_unpack_strings(packed, &var, swab);
+    if (!vpTmp) goto done;
+    IDL_VarCopy(vpTmp, vpVar);
+  } else if (swab && (var.type != IDL_TYP_STRING)) {
+    mg_var_swap(pbuffer, &var);
+  }
+  iRet = 1;
+
+  done:
+  if (stats) {
+    end = mg_net_clock();
+    stats->recv_time += end - start;
+    mg_stats_received(stats, iRet == 1 ? reader.got : -1, 1);
+    if (iRet == 1) mg_stats_end_trip(stats, end);
+  }
+  if (vpReceived) IDL_VarCopy(IDL_GettmpLong64(pos), vpReceived);
+  if (vpTransferId) IDL_VarCopy(IDL_GettmpLong64(var.transfer_id), vpTransferId);
+  IDL_KWCleanup(IDL_KW_CLEAN);
+  free(packed);
+  free(datagram);
+
+  return (IDL_GettmpLong(iRet));
+}
+
+
+/*
+  Internal function to free the shared memory channel of a socket, if any.
+*/
+static void mg_shm_free(IDL_LONG i) {
+  net_shm *shm = net_list[i].pShm;
+
+  if (!shm) return;
+#ifdef MG_NET_SHM
+  munmap(shm->base, shm->map_size);
+#endif
+  free(shm);
+  net_list[i].pShm = NULL;
+}
+
+
+#ifdef MG_NET_SHM
+
+/*
+  Internal function to wake the other end of a shared memory channel, which
+  waits on the socket. If the socket buffer is full, the other end already has
+  bytes to wake it.
+*/
+static void mg_shm_signal(SOCKET s) {
+  char c = 0;
+
+  send(s, &c, 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+}
+
+
+/*
+  Internal function to wait for the other end of a shared memory channel to
+  move a counter on from seen. The waiting flag is set before checking the
+  counter again, so the other end either sees the flag and sends a byte on
+  the socket, or moved the counter before the check. Returns -1 if the other
+  end closed the socket or the wait was interrupted.
+*/
+static int mg_shm_wait(SOCKET s, int *waiting, IDL_ULONG64 *counter,
+                       IDL_ULONG64 seen, net_stats *stats) {
+  char signals[64];
+  ssize_t n;
+  int ret = 0;
+
+  NET_STORE(*waiting, 1);
+  NET_FENCE();
+  if (NET_LOAD(*counter) == seen) {
+    stats->syscalls += 2;
+    if (mg_net_wait_readable(s, -1.0) != 1) {
+      ret = -1;
+    } else {
+      /* bytes from earlier waits may be left over, take all of them */
+      n = recv(s, signals, sizeof(signals), MSG_DONTWAIT);
+      if ((n == 0) || ((n == -1) && (errno != EAGAIN) && (errno != EWOULDBLOCK)
+                         && (errno != EINTR))) {
+        ret = -1;
+      }
+    }
+  }
+  NET_STORE(*waiting, 0);
+
+  return(ret);
+}
+
+
+/*
+  Internal function to write data into the outgoing ring of a shared memory
+  channel, waiting for the other end to make room as needed. Data is published
+  a quarter of the ring at a time, so the other end copies out one piece while
+  the next is written. Returns -1 for error.
+*/
+static int mg_shm_write(net_shm *shm, SOCKET s, const char *data, IDL_MEMINT len,
+                        net_stats *stats) {
+  net_shm_ring *ring = shm->out;
+  IDL_ULONG64 head = ring->head, tail;
+  IDL_MEMINT n, pos, first, step = IDL_MAX(shm->size / 4, 1);
+
+  while (len > 0) {
+    tail = NET_LOAD(ring->tail);
+    n = IDL_MIN(IDL_MIN(len, step), shm->size - (IDL_MEMINT) (head - tail));
+    if (n == 0) {
+      if (mg_shm_wait(s, &ring->writer_waiting, &ring->tail, tail, stats) == -1) {
+        return(-1);
+      }
+      continue;
+    }
+    pos = (IDL_MEMINT) (head % shm->size);
+    first = IDL_MIN(n, shm->size - pos);
+    memcpy(shm->out_data + pos, data, first);
+    memcpy(shm->out_data, data + first, n - first);
+    head += n;
+    data += n;
+    len -= n;
+
+    NET_STORE(ring->head, head);
+    NET_FENCE();
+    if (NET_EXCHANGE(ring->reader_waiting, 0)) {
+      mg_shm_signal(s);
+      stats->syscalls++;
+    }
+  }
+
+  return(0);
+}
+
+
+/*
+  Internal function to read data from the incoming ring of a shared memory
+  channel, waiting for the other end to write it as needed. Returns -1 for
+  error.
+*/
+static int mg_shm_read(net_shm *shm, SOCKET s, char *data, IDL_MEMINT len,
+                       net_stats *stats) {
+  net_shm_ring *ring = shm->in;
+  IDL_ULONG64 tail = ring->tail, head;
+  IDL_MEMINT n, pos, first, step = IDL_MAX(shm->size / 4, 1);
+
+  while (len > 0) {
+    head = NET_LOAD(ring->head);
+    n = IDL_MIN(IDL_MIN(len, step), (IDL_MEMINT) (head - tail));
+    if (n == 0) {
+      if (mg_shm_wait(s, &ring->reader_waiting, &ring->head, head, stats) == -1) {
+        return(-1);
+      }
+      continue;
+    }
+    pos = (IDL_MEMINT) (tail % shm->size);
+    first = IDL_MIN(n, shm->size - pos);
+    memcpy(data, shm->in_data + pos, first);
+    memcpy(data + first, shm->in_data, n - first);
+    tail += n;
+    data += n;
+    len -= n;
+
+    NET_STORE(ring->tail, tail);
+    NET_FENCE();
+    if (NET_EXCHANGE(ring->writer_waiting, 0)) {
+      mg_shm_signal(s);
+      stats->syscalls++;
+    }
+  }
+
+  return(0);
+}
+
+
+/*
+  Internal function to create anonymous shared memory of map_size bytes,
+  which only other processes given the file descriptor can map. Returns -1
+  for error.
+*/
+static int mg_shm_open(IDL_MEMINT map_size) {
+  int fd;
+#ifdef MFD_CLOEXEC
+  fd = memfd_create("mg_net", MFD_CLOEXEC);
+#else
+  static int count = 0;
+  char name[64];
+
+  sprintf(name, "/mg_net.%ld.%d", (long) getpid(), count++);
+  fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd != -1) shm_unlink(name);
+#endif
+  if (fd == -1) return(-1);
+
+  if (ftruncate(fd, (off_t) map_size) == -1) {
+    close(fd);
+    return(-1);
+  }
+
+  return(fd);
+}
+
+
+/*
+  Internal function to map the shared memory of a channel for the end that
+  created it, which writes ring 0, or the end that attached to it, which
+  writes ring 1. Returns NULL for error.
+*/
+static net_shm *mg_shm_map(int fd, IDL_MEMINT map_size, int creator) {
+  net_shm_header *header;
+  net_shm *shm;
+  char *base;
+
+  if (map_size <= NET_SHM_HEADER) return(NULL);
+  base = (char *) mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (base == MAP_FAILED) return(NULL);
+
+  header = (net_shm_header *) base;
+  if (creator) {
+    header->magic = NET_SHM_MAGIC;
+    header->version = 1;
+    header->size = (map_size - NET_SHM_HEADER) / 2;
+  } else if ((header->magic != NET_SHM_MAGIC) || (header->version != 1)
+               || (header->size == 0)
+               || (header->size != (IDL_ULONG64) (map_size - NET_SHM_HEADER) / 2)) {
+    munmap(base, map_size);
+    return(NULL);
+  }
+
+  shm = (net_shm *) calloc(1, sizeof(net_shm));
+  if (!shm) {
+    munmap(base, map_size);
+    return(NULL);
+  }
+  shm->base = base;
+  shm->map_size = map_size;
+  shm->size = (IDL_MEMINT) header->size;
+  shm->out = &header->rings[creator ? 0 : 1];
+  shm->in = &header->rings[creator ? 1 : 0];
+  shm->out_data = base + NET_SHM_HEADER + (creator ? 0 : shm->size);
+  shm->in_data = base + NET_SHM_HEADER + (creator ? shm->size : 0);
+
+  return(shm);
+}
+
+
+/*
+  Internal function to pass a file descriptor to the other end of a Unix
+  domain socket. Returns -1 for error.
+*/
+static int mg_shm_send_fd(SOCKET s, int fd) {
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr *cmsg;
+  union {
+    struct cmsghdr align;
+    char buffer[CMSG_SPACE(sizeof(int))];
+  } control;
+  char c = 0;
+
+  memset(&msg, 0, sizeof(msg));
+  memset(&control, 0, sizeof(control));
+  iov.iov_base = &c;
+  iov.iov_len = 1;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buffer;
+  msg.msg_controllen = sizeof(control.buffer);
+  cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+  return(sendmsg(s, &msg, MSG_NOSIGNAL) == 1 ? 0 : -1);
+}
+
+
+/*
+  Internal function to wait for a file descriptor passed by mg_shm_send_fd.
+  Returns -1 for error.
+*/
+static int mg_shm_recv_fd(SOCKET s) {
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr *cmsg;
+  union {
+    struct cmsghdr align;
+    char buffer[CMSG_SPACE(sizeof(int))];
+  } control;
+  char c;
+  int fd = -1;
+
+  if (mg_net_wait_readable(s, -1.0) != 1) return(-1);
+
+  memset(&msg, 0, sizeof(msg));
+  iov.iov_base = &c;
+  iov.iov_len = 1;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buffer;
+  msg.msg_controllen = sizeof(control.buffer);
+  if (recvmsg(s, &msg, 0) != 1) return(-1);
+
+  for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_RIGHTS)) {
+      memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+    }
+  }
+
+  return(fd);
+}
+
+#else
+
+static int mg_shm_write(net_shm *shm, SOCKET s, const char *data, IDL_MEMINT len,
+                        net_stats *stats) {
+  return(-1);
+}
+
+
+static int mg_shm_read(net_shm *shm, SOCKET s, char *data, IDL_MEMINT len,
+                       net_stats *stats) {
+  return(-1);
+}
+
+#endif
+
+
+/*
+  err = MG_NET_SHM(socket [, size])
+
+  Sets up a shared memory channel on a connected Unix domain socket, for
+  passing variables between IDL processes on the same host. One end calls
+  MG_NET_SHM with size, the number of bytes of shared memory for each
+  direction (16 MB if size is 0), and the other end calls it without size to
+  map the same memory.
+
+  MG_NET_SENDVAR and MG_NET_RECVVAR then pass variables through the shared
+  memory in the same form as on a TCP socket: the sender writes a variable
+  once into shared memory and the receiver copies it once out of it.
+  Variables larger than the shared memory stream through it. The socket is
+  only used to wake an end waiting for the other, so MG_NET_SEND, MG_NET_RECV
+  and the asynchronous routines fail on it, and MG_NET_SELECT and MG_NET_POLL
+  do not report variables waiting in shared memory. The shared memory is
+  freed when both ends close the socket.
+
+  Returns 1 for success or -1 for error. Not available on Windows.
+*/
+static IDL_VPTR IDL_CDECL mg_net_shm(int argc, IDL_VPTR argv[], char *argk) {
+#ifdef MG_NET_SHM
+  IDL_LONG i;
+  IDL_LONG64 size = 0;
+  IDL_MEMINT map_size;
+  struct sockaddr_storage addr;
+  socklen_t addr_len = sizeof(addr);
+  struct stat st;
+  net_shm *shm = NULL;
+  int fd;
+
+  i = IDL_LongScalar(argv[0]);
+  if (argc > 1) size = IDL_Long64Scalar(argv[1]);
+  if ((i < 0) || (i >= net_list_size)) return(IDL_GettmpLong(-1));
+  if ((net_list[i].iState != NET_IO) || net_list[i].pShm || (net_list[i].iAsync > 0)) {
+    return(IDL_GettmpLong(-1));
+  }
+  if ((getsockname(net_list[i].socket, (struct sockaddr *) &addr, &addr_len) == -1)
+        || (addr.ss_family != AF_UNIX)) {
+    return(IDL_GettmpLong(-1));
+  }
+
+  if (argc > 1) {
+    if (size <= 0) size = NET_SHM_DEFAULT;
+    size = (size + 63) / 64 * 64;
+    map_size = (IDL_MEMINT) (NET_SHM_HEADER + 2 * size);
+    if ((IDL_LONG64) map_size != NET_SHM_HEADER + 2 * size) return(IDL_GettmpLong(-1));
+    fd = mg_shm_open(map_size);
+    if (fd == -1) return(IDL_GettmpLong(-1));
+    shm = mg_shm_map(fd, map_size, 1);
+    if (shm && (mg_shm_send_fd(net_list[i].socket, fd) == -1)) {
+      munmap(shm->base, shm->map_size);
+      free(shm);
+      shm = NULL;
+    }
+  } else {
+    fd = mg_shm_recv_fd(net_list[i].socket);
+    if (fd == -1) return(IDL_GettmpLong(-1));
+    if (fstat(fd, &st) == 0) shm = mg_shm_map(fd, (IDL_MEMINT) st.st_size, 0);
+  }
+  close(fd);
+  if (!shm) return(IDL_GettmpLong(-1));
+
+  net_list[i].pShm = shm;
+
+  return(IDL_GettmpLong(1));
+#else
+  IDL_MessageFromBlock(msg_block, MG_NET_ERROR, IDL_MSG_RET,
+                       "Shared memory channels are not available on this system.");
+  return(IDL_GettmpLong(-1));
+#endif
+}
+
+
+/*
+  Internal function to add a request to a queue. The queue can not fill up
+  since at most NET_ASYNC_QUEUE requests are in flight.
+*/
+static void mg_queue_push(net_queue *q, net_request *r) {
+  IDL_ULONG64 tail = q->tail;
+
+  q->items[tail & (NET_ASYNC_QUEUE - 1)] = r;
+  NET_STORE(q->tail, tail + 1);
+}
+
+
+/*
+  Internal function to take the next request from a queue, or NULL if the
+  queue is empty.
+*/
+static net_request *mg_queue_pop(net_queue *q) {
+  IDL_ULONG64 head = q->head;
+  net_request *r;
+
+  if (head == NET_LOAD(q->tail)) return(NULL);
+  r = q->items[head & (NET_ASYNC_QUEUE - 1)];
+  NET_STORE(q->head, head + 1);
+
+  return(r);
+}
+
+
+/*
+  Internal function to free a request.
+*/
+static void mg_async_free(net_request *r) {
+  free(r->buffer);
+  free(r);
+}
+
+
+/*
+  Internal function called by IDL when a variable holding data received by
+  an asynchronous request is freed.
+*/
+static void mg_async_release(UCHAR *data) {
+  free(data);
+}
+
+
+/*
+  Internal function, run by the I/O thread, to fill in the checksums of the
+  chunks of a variable to send.
+*/
+static void mg_async_checksums(net_request *r) {
+  char *data = r->buffer + sizeof(i_var2);
+  IDL_MEMINT pos, n;
+  IDL_ULONG crc;
+
+  for (pos = 0; pos < r->var.len; pos += n) {
+    n = (IDL_MEMINT) IDL_MIN(r->var.chunk_size, r->var.len - pos);
+    crc = mg_crc32c(data, n);
+    memcpy(data + n, &crc, sizeof(IDL_ULONG));
+    data += n + sizeof(IDL_ULONG);
+  }
+}
+
+
+/*
+  Internal function, run by the I/O thread, to move on to the next piece of
+  a variable being received once the current piece is complete. Returns 1
+  when the variable is complete, 0 to continue or -1 for error.
+*/
+static int mg_async_next_stage(net_request *r) {
+  IDL_MEMINT size;
+
+  switch (r->stage) {
+    case NET_STAGE_TOKEN:
+      size = mg_var_header_size(r->header);
+      if (size == -1) return(-1);
+      r->stage = NET_STAGE_HEADER;
+      r->target = r->header + sizeof(IDL_LONG);
+      r->want = size - sizeof(IDL_LONG);
+      r->got = 0;
+      return(0);
+    case NET_STAGE_HEADER:
+      /* partial transfers can not be resumed asynchronously */
+      if (mg_var_decode(r->header, &r->var, &r->swab) == -1) return(-1);
+      if (r->var.offset != 0) return(-1);
+      r->buffer = (char *) malloc(r->var.len);
+      if (!r->buffer) return(-1);
+      r->len = r->var.len;
+      break;
+    case NET_STAGE_CHUNK:
+      if (r->var.flags & MG_NET_CHECKSUM) {
+        r->stage = NET_STAGE_CHECKSUM;
+        r->target = (char *) &r->checksum;
+        r->want = sizeof(IDL_ULONG);
+        r->got = 0;
+        return(0);
+      }
+      r->done += r->chunk;
+      break;
+    case NET_STAGE_CHECKSUM:
+      if (r->swab) mg_byteswap(&r->checksum, sizeof(IDL_ULONG), sizeof(IDL_ULONG));
+      if (mg_crc32c(r->buffer + r->done, r->chunk) != r->checksum) return(-1);
+      r->done += r->chunk;
+      break;
+  }
+  if (r->done == r->len) return(1);
+
+  r->stage = NET_STAGE_CHUNK;
+  r->chunk = (IDL_MEMINT) IDL_MIN(r->var.chunk_size, r->len - r->done);
+  r->target = r->buffer + r->done;
+  r->want = r->chunk;
+  r->got = 0;
+
+  return(0);
+}
+
+
+/*
+  Internal function, run by the I/O thread, to send or receive as much of a
+  request as the socket allows without blocking. Returns 1 when the request
+  is complete, 0 if the socket is not ready or -1 for error.
+*/
+static int mg_async_step(net_request *r) {
+  IDL_MEMINT n;
+  size_t len;
+  int status;
+
+  if ((r->op == NET_ASYNC_SEND) && (r->stage == NET_STAGE_CHECKSUM)) {
+    mg_async_checksums(r);
+    r->stage = NET_STAGE_CHUNK;
+  }
+
+  while (1) {
+    len = (size_t) IDL_MIN(r->want - r->got, 0x40000000);
+    if (r->op == NET_ASYNC_SEND) {
+      n = send(r->socket, r->target + r->got, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+    } else {
+      n = recv(r->socket, r->target + r->got, len, MSG_DONTWAIT);
+    }
+    r->syscalls++;
+    if (n == -1) {
+      if (errno == EINTR) continue;
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) return(0);
+      return(-1);
+    }
+    if (r->datagram) {
+      r->done = n;
+      return(1);
+    }
+    /* the peer closed the connection */
+    if ((n == 0) && (r->op != NET_ASYNC_SEND)) return(-1);
+
+    r->got += n;
+    if (r->got < r->want) continue;
+    if (r->op != NET_ASYNC_RECVVAR) {
+      r->done = r->got;
+      return(1);
+    }
+    status = mg_async_next_stage(r);
+    if (status != 0) return(status);
+  }
+}
+
+
+#ifdef MG_NET_THREAD
+/*
+  Internal function, run by the I/O thread, to hand a finished request back
+  to the IDL thread.
+*/
+static void mg_async_complete(net_request *r) {
+  mg_queue_push(&net_completed, r);
+  NET_FENCE();
+  if (NET_EXCHANGE(net_idl_waiting, 0)) {
+    while ((write(net_done_pipe[1], "", 1) == -1) && (errno == EINTR));
+  }
+}
+
+
+/*
+  The I/O thread. Each pass serves the requests in flight in the order they
+  were submitted; a request waits while an earlier request in the same
+  direction on the same socket is blocked. When no request can make
+  progress, the thread waits for one of the blocked sockets to become ready
+  or for a new request.
+*/
+static void *mg_async_worker(void *arg) {
+  net_request *active[NET_ASYNC_QUEUE], *r;
+  struct pollfd fds[NET_ASYNC_QUEUE + 1];
+  int n_active = 0, n_fds, j, k, b, status, progress;
+  short events;
+  char drain[64];
+
+  while (!NET_LOAD(net_thread_stop)) {
+    while ((r = mg_queue_pop(&net_submitted)) != NULL) active[n_active++] = r;
+
+    progress = 0;
+    n_fds = 1;
+    fds[0].fd = net_submit_pipe[0];
+    fds[0].events = POLLIN;
+    fds[0].revents = 0;
+    for (j = 0, k = 0; j < n_active; j++) {
+      r = active[j];
+      events = r->op == NET_ASYNC_SEND ? POLLOUT : POLLIN;
+      for (b = 1; b < n_fds; b++) {
+        if ((fds[b].fd == r->socket) && (fds[b].events == events)) break;
+      }
+      if (b == n_fds) {
+        status = mg_async_step(r);
+        if (status != 0) {
+          r->status = status;
+          mg_async_complete(r);
+          progress = 1;
+          continue;
+        }
+        fds[n_fds].fd = r->socket;
+        fds[n_fds].events = events;
+        fds[n_fds++].revents = 0;
+      }
+      active[k++] = r;
+    }
+    n_active = k;
+    if (progress) continue;
+
+    NET_STORE(net_thread_sleeping, 1);
+    NET_FENCE();
+    if ((NET_LOAD(net_submitted.tail) == net_submitted.head)
+          && !NET_LOAD(net_thread_stop)) {
+      POLL(fds, n_fds, -1);
+    }
+    NET_STORE(net_thread_sleeping, 0);
+    while (read(net_submit_pipe[0], drain, sizeof(drain)) > 0);
+  }
+
+  return(NULL);
+}
+
+
+/*
+  Internal function to close the pipes used to wake up the threads.
+*/
+static void mg_async_close_pipes(void) {
+  int j;
+
+  for (j = 0; j < 2; j++) {
+    if (net_submit_pipe[j] != -1) close(net_submit_pipe[j]);
+    if (net_done_pipe[j] != -1) close(net_done_pipe[j]);
+    net_submit_pipe[j] = -1;
+    net_done_pipe[j] = -1;
+  }
+}
+
+
+/*
+  Internal function to start the I/O thread if it is not running. Returns -1
+  if it can not be started.
+*/
+static int mg_async_start(void) {
+  sigset_t all, old;
+  int j, err;
+
+  if (net_thread_started) return(0);
+
+  if ((pipe(net_submit_pipe) == -1) || (pipe(net_done_pipe) == -1)) {
+    mg_async_close_pipes();
+    return(-1);
+  }
+  for (j = 0; j < 2; j++) {
+    fcntl(net_submit_pipe[j], F_SETFL, O_NONBLOCK);
+    fcntl(net_done_pipe[j], F_SETFL, O_NONBLOCK);
+  }
+
+  /* signals, e.g., interrupts, are left to the IDL thread */
+  net_thread_stop = 0;
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  err = pthread_create(&net_thread, NULL, mg_async_worker, NULL);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  if (err != 0) {
+    mg_async_close_pipes();
+    return(-1);
+  }
+  net_thread_started = 1;
+
+  return(0);
+}
+#endif
+
+
+/*
+  Internal function to stop the I/O thread and free all requests.
+*/
+static void mg_async_stop(void) {
+  net_request *r;
+
+#ifdef MG_NET_THREAD
+  if (net_thread_started) {
+    NET_STORE(net_thread_stop, 1);
+    while ((write(net_submit_pipe[1], "", 1) == -1) && (errno == EINTR));
+    pthread_join(net_thread, NULL);
+    mg_async_close_pipes();
+    net_thread_started = 0;
+  }
+#endif
+
+  while (net_requests) {
+    r = net_requests;
+    net_requests = r->next;
+    mg_async_free(r);
+  }
+  memset(&net_submitted, 0, sizeof(net_queue));
+  memset(&net_completed, 0, sizeof(net_queue));
+  net_queued = 0;
+  net_queued_bytes = 0;
+  net_n_requests = 0;
+}
+
+
+/*
+  Internal function to account for the requests completed by the I/O thread.
+*/
+static void mg_async_drain(void) {
+  net_request *r;
+  net_stats *stats;
+
+  while ((r = mg_queue_pop(&net_completed)) != NULL) {
+    r->completed = 1;
+    net_queued--;
+    if (r->op == NET_ASYNC_SEND) net_queued_bytes -= r->len;
+    if (r->status == 1) {
+      net_n_completed++;
+    } else {
+      net_n_failed++;
+    }
+
+    /* the I/O thread does not touch the statistics of the sockets */
+    stats = &net_list[r->index].stats;
+    stats->syscalls += r->syscalls;
+    if (r->syscalls > 1) stats->retries += r->syscalls - 1;
+    if (r->op == NET_ASYNC_SEND) {
+      mg_stats_sent(stats, r->status == 1 ? r->done : -1, 1);
+    } else {
+      mg_stats_received(stats, r->status == 1 ? r->done : -1, 1);
+    }
+    net_list[r->index].iAsync--;
+  }
+}
+
+
+/*
+  Internal function to check whether socket i has asynchronous requests that
+  have not completed. Synchronous transfers on the socket are refused until
+  they have, so that the caller and the I/O thread do not interleave bytes on
+  the same stream.
+*/
+static int mg_async_busy(IDL_LONG i) {
+  if (net_list[i].iAsync > 0) mg_async_drain();
+  return(net_list[i].iAsync > 0);
+}
+
+
+/*
+  Internal function to wait up to timeout seconds for the I/O thread to
+  complete a request.
+*/
+static void mg_async_wait(double timeout) {
+#ifdef MG_NET_THREAD
+  struct pollfd pfd;
+  char drain[64];
+
+  if (!net_thread_started) return;
+
+  NET_STORE(net_idl_waiting, 1);
+  NET_FENCE();
+  if (NET_LOAD(net_completed.tail) == net_completed.head) {
+    pfd.fd = net_done_pipe[0];
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    POLL(&pfd, 1, (int) ceil(IDL_MAX(timeout, 0.0) * 1000.0));
+  }
+  NET_STORE(net_idl_waiting, 0);
+  while (read(net_done_pipe[0], drain, sizeof(drain)) > 0);
+#endif
+}
+
+
+/*
+  Internal function to wait for a request to complete, for at most timeout
+  seconds unless timeout is negative. The wait is done in slices so that it
+  can be interrupted. Returns -1 if interrupted.
+*/
+static int mg_async_wait_for(net_request *r, double timeout) {
+#ifdef MG_NET_THREAD
+  struct timespec start, now;
+  double remaining = timeout;
+
+  mg_async_drain();
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  while (!r->completed && ((timeout < 0.0) || (remaining > 0.0))) {
+    mg_async_wait((timeout < 0.0) || (remaining > NET_POLL_SLICE)
+                    ? NET_POLL_SLICE
+                    : remaining);
+    mg_async_drain();
+    if (IDL_BailOut(IDL_FALSE)) return(-1);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    remaining = timeout - (now.tv_sec - start.tv_sec)
+                  - 1.0e-9 * (now.tv_nsec - start.tv_nsec);
+  }
+#else
+  mg_async_drain();
+#endif
+
+  return(0);
+}
+
+
+/*
+  Internal function to check for back-pressure before submitting a request
+  that queues len bytes to send. Returns 1 if the request must be refused.
+*/
+static int mg_async_full(IDL_MEMINT len) {
+  mg_async_drain();
+  if ((net_queued >= NET_ASYNC_QUEUE)
+        || ((net_queued_bytes > 0) && (net_queued_bytes + len > NET_ASYNC_MAX_BYTES))) {
+    net_n_rejected++;
+    return(1);
+  }
+
+  return(0);
+}
+
+
+/*
+  Internal function to submit a request on socket i. Returns the identifier
+  of the request, or -1 if the I/O thread can not be started, in which case
+  the request is freed.
+*/
+static IDL_LONG64 mg_async_submit(IDL_LONG i, net_request *r) {
+#ifdef MG_NET_THREAD
+  if (mg_async_start() == -1) {
+    mg_async_free(r);
+    return(-1);
+  }
+#endif
+
+  r->id = net_next_request++;
+  r->index = i;
+  r->socket = net_list[i].socket;
+  r->next = net_requests;
+  net_requests = r;
+  net_n_requests++;
+
+  net_list[i].iAsync++;
+  net_n_submitted++;
+  net_queued++;
+  if (r->op == NET_ASYNC_SEND) net_queued_bytes += r->len;
+  if (net_queued > net_max_queued) net_max_queued = net_queued;
+
+#ifdef MG_NET_THREAD
+  mg_queue_push(&net_submitted, r);
+  NET_FENCE();
+  if (NET_EXCHANGE(net_thread_sleeping, 0)) {
+    while ((write(net_submit_pipe[1], "", 1) == -1) && (errno == EINTR));
+  }
+#else
+  /* without the I/O thread, the request blocks until complete */
+  r->status = mg_async_step(r) == 1 ? 1 : -1;
+  mg_queue_push(&net_completed, r);
+#endif
+
+  return(r->id);
+}
+
+
+/*
+  Internal function to find a request that has not been collected, or NULL.
+*/
+static net_request *mg_async_find(IDL_LONG64 id) {
+  net_request *r;
+
+  for (r = net_requests; r; r = r->next) {
+    if (r->id == id) return(r);
+  }
+
+  return(NULL);
+}
+
+
+/*
+  Internal function to forget a collected request.
+*/
+static void mg_async_remove(net_request *r) {
+  net_request **p;
+
+  for (p = &net_requests; *p; p = &(*p)->next) {
+    if (*p == r) {
+      *p = r->next;
+      break;
+    }
+  }
+  mg_async_free(r);
+  net_n_requests--;
+}
+
+
+/*
+  Internal function to make an IDL variable of the data received by a
+  request. The buffer of the request is used by the variable where possible.
+  Returns NULL if the data is not valid.
+*/
+static IDL_VPTR mg_async_data(net_request *r) {
+  IDL_VPTR vpTmp;
+  IDL_MEMINT dims[IDL_MAX_ARRAY_DIM];
+  char *pbuffer = r->buffer;
+
+  if (r->op == NET_ASYNC_RECV) {
+    if (r->done == 0) return(NULL);
+    r->buffer = NULL;
+    return(IDL_ImportArray(1, &r->done, IDL_TYP_BYTE, (UCHAR *) pbuffer,
+                           mg_async_release, NULL));
+  }
+
+  if (mg_var_check(&r->var) == -1) return(NULL);
+  if (r->var.type == IDL_TYP_STRUCT) {
+    return(mg_unpack_struct(pbuffer, &r->var, r->swab));
+  }
+  if (r->var.type == IDL_TYP_STRING) {
+    if (r->var.ndims != 0) return(mg_unpack_strings(pbuffer, &r->var, r->swab));
+    pbuffer[r->var.len - 1] = '\0';
+    return(IDL_StrToSTRING(pbuffer));
+  }
+
+  if (r->swab) mg_var_swap(pbuffer, &r->var);
+  if (r->var.ndims != 0) {
+    r->buffer = NULL;
+    return(IDL_ImportArray(r->var.ndims, mg_var_dims(&r->var, dims),
+                           r->var.type, (UCHAR *) pbuffer, mg_async_release,
+                           NULL));
+  }
+  vpTmp = IDL_GettmpLong(0);
+  IDL_StoreScalarZero(vpTmp, r->var.type);
+  memcpy(&(vpTmp->value.c), pbuffer, r->var.len);
+
+  return(vpTmp);
+}
+
+
+/*
+  id = MG_NET_SEND_ASYNC(socket, variable [, CHUNK_SIZE=bytes]
+                         [, /NO_CHECKSUM] [, /VARIABLE])
+
+  Sends the raw byte data of the IDL variable on the socket, like
+  MG_NET_SEND, from a background I/O thread. The data is copied, so the
+  variable can be changed right away, and the call returns a request
+  identifier to pass to MG_NET_WAIT or MG_NET_TEST without waiting for the
+  data to be sent. Set VARIABLE to send the variable on a TCP socket in the
+  form written by MG_NET_SENDVAR, for MG_NET_RECVVAR or MG_NET_RECV_ASYNC;
+  CHUNK_SIZE and NO_CHECKSUM are as for MG_NET_SENDVAR and the checksums
+  are computed by the I/O thread.
+
+  Requests on the same socket are served in the order they are made, and
+  MG_NET_SEND, MG_NET_SENDVAR and MG_NET_RECVVAR return -1 on the socket
+  until they have completed. Returns -1 for error, or -2 if too many
+  requests are in flight or too much data is waiting to be sent; collect
+  completed requests with MG_NET_WAIT and try again.
+*/
+static IDL_VPTR IDL_CDECL mg_net_send_async(int argc, IDL_VPTR inargv[], char *argk) {
+  IDL_LONG i;
+  IDL_LONG64 iRet = -1;
+  IDL_MEMINT len, pos, n;
+  IDL_VPTR vpTmp, argv[2];
+  i_var2 var;
+  net_request *r;
+  char *pbuffer, *packed = NULL, *dst;
+
+  static IDL_LONG iNoChecksum, iVariable;
+  static IDL_LONG64 lChunkSize;
+  static IDL_KW_PAR kw_pars[] = { IDL_KW_FAST_SCAN,
+    { "CHUNK_SIZE", IDL_TYP_LONG64, 1, IDL_KW_ZERO, 0, IDL_CHARA(lChunkSize) },
+    { "NO_CHECKSUM", IDL_TYP_LONG, 1, IDL_KW_ZERO, 0, IDL_CHARA(iNoChecksum) },
+    { "VARIABLE", IDL_TYP_LONG, 1, IDL_KW_ZERO, 0, IDL_CHARA(iVariable) },
+    { NULL }
+  };
+
+  IDL_KWCleanup(IDL_KW_MARK);
+  IDL_KWGetParams(argc, inargv, argk, kw_pars, argv, 1);
+  i = IDL_LongScalar(argv[0]);
+  IDL_KWCleanup(IDL_KW_CLEAN);
+
+  if ((i < 0) || (i >= net_list_size)) return(IDL_GettmpLong64(-1));
+  if ((net_list[i].iState != NET_IO) || (net_list[i].iType == NET_UDP)
+        || net_list[i].pShm) {
+    return(IDL_GettmpLong64(-1));
+  }
+  if (iVariable && (net_list[i].iType != NET_TCP)) return(IDL_GettmpLong64(-1));
 
-/*
-  Internal function to read a (potentially fragmented) block from a socket.
-*/
-static int mg_recv_packet(SOCKET s, void *buffer, int len) {
-  int n;
-  int num = 0;
-  char *pbuf = (char *) buffer;
+  vpTmp = argv[1];
+  if (iVariable) {
+    if (mg_var_describe(vpTmp, &var, &pbuffer, &packed) == -1) {
+      return(IDL_GettmpLong64(-1));
+    }
+    var.chunk_size = lChunkSize > 0 ? lChunkSize : NET_CHUNK_SIZE;
+    var.flags = iNoChecksum ? 0 : MG_NET_CHECKSUM;
+    var.transfer_id = mg_transfer_id();
+    var.checksum = mg_crc32c(&var, sizeof(i_var2));
+    len = sizeof(i_var2) + var.len;
+    if (var.flags & MG_NET_CHECKSUM) {
+      len += (var.len + var.chunk_size - 1) / var.chunk_size * sizeof(IDL_ULONG);
+    }
+  } else {
+    IDL_ENSURE_SIMPLE(vpTmp);
+    if (vpTmp->type == IDL_TYP_STRING) vpTmp = IDL_CvtByte(1, &vpTmp);
+    IDL_VarGetData(vpTmp, &n, &pbuffer, 1);
+    len = n * IDL_TypeSizeFunc(vpTmp->type);
+  }
 
-  while(num < len) {
-    n = recv(s, pbuf, len - num, 0);
-    if (n == -1) return(n);
-    pbuf += n;
-    num += n;
-#ifdef INTERRUPTABLE_READ
-    if (IDL_BailOut(IDL_FALSE)) return(-1);
-#endif
+  if (len <= 0) goto done;
+  if (mg_async_full(len)) {
+    iRet = -2;
+    goto done;
   }
 
-  return(len);
-}
+  r = (net_request *) calloc(1, sizeof(net_request));
+  if (!r) goto done;
+  r->buffer = (char *) malloc(len);
+  if (!r->buffer) {
+    free(r);
+    goto done;
+  }
+  r->op = NET_ASYNC_SEND;
+  r->datagram = net_list[i].iType != NET_TCP;
+  r->len = len;
+  r->target = r->buffer;
+  r->want = len;
+  r->stage = NET_STAGE_CHUNK;
+
+  if (iVariable) {
+    /* leave room after each chunk for its checksum */
+    memcpy(r->buffer, &var, sizeof(i_var2));
+    dst = r->buffer + sizeof(i_var2);
+    for (pos = 0; pos < var.len; pos += n) {
+      n = (IDL_MEMINT) IDL_MIN(var.chunk_size, var.len - pos);
+      memcpy(dst, pbuffer + pos, n);
+      dst += n;
+      if (var.flags & MG_NET_CHECKSUM) dst += sizeof(IDL_ULONG);
+    }
+    r->var = var;
+    if (var.flags & MG_NET_CHECKSUM) r->stage = NET_STAGE_CHECKSUM;
+  } else {
+    memcpy(r->buffer, pbuffer, len);
+  }
 
+  iRet = mg_async_submit(i, r);
 
-/*
-  err = MG_NET_SENDVAR(socket, variable [, host] [, port])
+  done:
+  free(packed);
+  if (vpTmp != argv[1]) IDL_Deltmp(vpTmp);
 
-  Sends a complete IDL variable to a socket for reading by MG_NET_RECVVAR. The
-  variable must be one of the basic types, but strings and arrays are sent
-  with array dimensions and lengths intact.
+  return(IDL_GettmpLong64(iRet));
+}
 
-	When sending data from a UDP socket, you must specify the remote host and
-	port arguments where host is the value returned from the MG_NET_NAME2HOST
-	function.
 
-  Note: This is the easiest way to send a complete variable from one IDL to
-  another. The receiver will byteswap the data if necessary. One should be
-  careful not to mix calls to MG_NET_SEND/RECV and MG_NET_SENDVAR/RECVVAR as
-  the latter send formatted information. You can use the two calls on the same
-  socket as long as they are paired.
+/*
+  id = MG_NET_RECV_ASYNC(socket [, nbytes] [, /VARIABLE])
+
+  Receives data on the socket from a background I/O thread. Returns a
+  request identifier right away; MG_NET_WAIT or MG_NET_TEST return the data
+  once it has arrived. On TCP sockets, exactly nbytes bytes are received; on
+  UDP sockets, a single datagram of at most nbytes bytes, 64 KB by default.
+  Set VARIABLE instead of passing nbytes to receive a variable sent on a TCP
+  socket by MG_NET_SENDVAR or by MG_NET_SEND_ASYNC with VARIABLE set. A
+  variable received this way can not be resumed if the transfer fails.
+
+  Requests on the same socket are served in the order they are made.
+  Returns -1 for error or -2 if too many requests are in flight.
 */
-static IDL_VPTR IDL_CDECL mg_net_sendvar(int argc, IDL_VPTR argv[], char *argk) {
+static IDL_VPTR IDL_CDECL mg_net_recv_async(int argc, IDL_VPTR inargv[], char *argk) {
   IDL_LONG i;
-  i_var var;
-  int host, addr_len;
-  short port;
-  IDL_LONG iRet;
-  IDL_VPTR vpTmp;
-  char *pbuffer;
-  struct sockaddr_in sin;
+  IDL_LONG64 nbytes = 0;
+  IDL_VPTR argv[2];
+  net_request *r;
+
+  static IDL_LONG iVariable;
+  static IDL_KW_PAR kw_pars[] = { IDL_KW_FAST_SCAN,
+    { "VARIABLE", IDL_TYP_LONG, 1, IDL_KW_ZERO, 0, IDL_CHARA(iVariable) },
+    { NULL }
+  };
 
+  IDL_KWCleanup(IDL_KW_MARK);
+  argc = IDL_KWGetParams(argc, inargv, argk, kw_pars, argv, 1);
   i = IDL_LongScalar(argv[0]);
-  if ((i < 0) || (i >= MAX_SOCKETS)) return (IDL_GettmpLong(-1));
-  if (net_list[i].iState != NET_IO) return (IDL_GettmpLong(-1));
-  IDL_ENSURE_SIMPLE(argv[1]);
-  vpTmp = argv[1];
+  if (argc > 1) nbytes = IDL_Long64Scalar(argv[1]);
+  IDL_KWCleanup(IDL_KW_CLEAN);
 
-  if (net_list[i].iType == NET_UDP) {
-    if (argc == 4) {
-      host = IDL_ULongScalar(argv[2]);
-      port = (short) IDL_LongScalar(argv[3]);
-    } else {
-      IDL_MessageFromBlock(msg_block,
-                           MG_NET_ERROR,
-                           IDL_MSG_RET,
-                           "This UDP socket requires the destination HOST and PORT arguments.");
-    }
+  if ((i < 0) || (i >= net_list_size)) return(IDL_GettmpLong64(-1));
+  if ((net_list[i].iState != NET_IO) || net_list[i].pShm) return(IDL_GettmpLong64(-1));
+  if (iVariable) {
+    if (net_list[i].iType != NET_TCP) return(IDL_GettmpLong64(-1));
+  } else if (net_list[i].iType != NET_TCP) {
+    if (nbytes <= 0) nbytes = NET_MAX_DATAGRAM;
+  } else if (nbytes <= 0) {
+    return(IDL_GettmpLong64(-1));
   }
 
-  var.token = TOKEN;
-  var.type = vpTmp->type;
-  if ((var.type == IDL_TYP_STRUCT) ||
-      (var.type == IDL_TYP_PTR) ||
-      (var.type == IDL_TYP_OBJREF) ||
-      (var.type == IDL_TYP_UNDEF)) {
-    IDL_MessageFromBlock(msg_block,
-                         MG_NET_BADTYPE,
-                         IDL_MSG_LONGJMP,
-                         IDL_TypeNameFunc(var.type));
-  }
+  if (mg_async_full(0)) return(IDL_GettmpLong64(-2));
 
-  if (vpTmp->type == IDL_TYP_STRING) {
-    if (vpTmp->flags & IDL_V_ARR) return (IDL_GettmpLong(-1));
-    pbuffer = IDL_STRING_STR(&(vpTmp->value.str));
-    var.ndims = 0;
-    var.len = vpTmp->value.str.slen + 1;
-    var.nelts = var.len;
-  } else if (vpTmp->flags & IDL_V_ARR) {
-    pbuffer = (char *) vpTmp->value.arr->data;
-    var.ndims = vpTmp->value.arr->n_dim;
-    var.len = vpTmp->value.arr->arr_len;
-    var.nelts = vpTmp->value.arr->n_elts;
-    memcpy(var.dims, vpTmp->value.arr->dim, IDL_MAX_ARRAY_DIM * sizeof(IDL_LONG));
+  r = (net_request *) calloc(1, sizeof(net_request));
+  if (!r) return(IDL_GettmpLong64(-1));
+  if (iVariable) {
+    r->op = NET_ASYNC_RECVVAR;
+    r->stage = NET_STAGE_TOKEN;
+    r->target = r->header;
+    r->want = sizeof(IDL_LONG);
   } else {
-    pbuffer = (char *) &(vpTmp->value.c);
-    var.ndims = 0;
-    var.len = IDL_TypeSizeFunc(var.type);
-    var.nelts = 1;
+    r->op = NET_ASYNC_RECV;
+    r->datagram = net_list[i].iType != NET_TCP;
+    r->buffer = (char *) malloc((IDL_MEMINT) nbytes);
+    if (!r->buffer) {
+      free(r);
+      return(IDL_GettmpLong64(-1));
+    }
+    r->len = (IDL_MEMINT) nbytes;
+    r->target = r->buffer;
+    r->want = r->len;
   }
 
-  /* send native, recvvar swaps if needed */
-  if (net_list[i].iType == NET_UDP) {
-    sin.sin_addr.s_addr = host;
-    sin.sin_family = AF_INET;
-    sin.sin_port = htons(port);
-    addr_len = sizeof(struct sockaddr_in);
+  return(IDL_GettmpLong64(mg_async_submit(i, r)));
+}
 
-    iRet = sendto(net_list[i].socket, (char *) &var, sizeof(i_var), 0,
-                  (struct sockaddr *) &sin, addr_len);
-    if (iRet == -1) return(IDL_GettmpLong(iRet));
 
-    iRet = sendto(net_list[i].socket, pbuffer, var.len, 0,
-                  (struct sockaddr *) &sin, addr_len);
-  } else {
-    iRet = send(net_list[i].socket,(char *) &var, sizeof(i_var), 0);
-    if (iRet == -1) return (IDL_GettmpLong(iRet));
-    
-    iRet = send(net_list[i].socket, pbuffer, var.len, 0);
+/*
+  Internal function to collect a request for MG_NET_WAIT and MG_NET_TEST.
+*/
+static IDL_VPTR mg_async_collect(int argc, IDL_VPTR inargv[], char *argk,
+                                 int test) {
+  IDL_LONG iRet = -1;
+  double timeout = -1.0;
+  net_request *r;
+  IDL_VPTR vpTmp, argv[2];
+
+  static IDL_VPTR vpBytes, vpData;
+  static IDL_KW_PAR kw_pars[] = { IDL_KW_FAST_SCAN,
+    { "BYTES", IDL_TYP_UNDEF, 1, IDL_KW_OUT | IDL_KW_ZERO, 0, IDL_CHARA(vpBytes) },
+    { "DATA", IDL_TYP_UNDEF, 1, IDL_KW_OUT | IDL_KW_ZERO, 0, IDL_CHARA(vpData) },
+    { NULL }
+  };
+
+  IDL_KWCleanup(IDL_KW_MARK);
+  argc = IDL_KWGetParams(argc, inargv, argk, kw_pars, argv, 1);
+  if (test) {
+    timeout = 0.0;
+  } else if (argc > 1) {
+    timeout = IDL_DoubleScalar(argv[1]);
   }
 
-  return(IDL_GettmpLong(1));
+  r = mg_async_find(IDL_Long64Scalar(argv[0]));
+  if (!r) goto done;
+  if (mg_async_wait_for(r, timeout) == -1) goto done;
+  if (!r->completed) {
+    iRet = 0;
+    goto done;
+  }
+
+  iRet = r->status;
+  if (vpBytes) IDL_VarCopy(IDL_GettmpLong64(r->done), vpBytes);
+  if ((r->status == 1) && vpData && (r->op != NET_ASYNC_SEND)) {
+    vpTmp = mg_async_data(r);
+    if (vpTmp) {
+      IDL_VarCopy(vpTmp, vpData);
+    } else {
+      iRet = -1;
+    }
+  }
+  mg_async_remove(r);
+
+  done:
+  IDL_KWCleanup(IDL_KW_CLEAN);
+
+  return(IDL_GettmpLong(iRet));
 }
 
 
 /*
-  err = MG_NET_RECVVAR(socket, variable)
+  status = MG_NET_WAIT(id [, timeout] [, BYTES=n] [, DATA=data])
 
-  Reads an IDL variable from the socket in the form written by MG_NET_SENDVAR.
-  The complete variable is reconstructed. See MG_NET_SENDVAR for more details.
- */
-static IDL_VPTR IDL_CDECL mg_net_recvvar(int argc, IDL_VPTR argv[], char *argk) {
-  IDL_LONG i, iRet;
-  IDL_LONG swab = 0;
-  i_var var;
-  IDL_VPTR vpTmp;
-  char *pbuffer;
+  Waits for a request made by MG_NET_SEND_ASYNC or MG_NET_RECV_ASYNC to
+  complete, for at most timeout seconds if timeout is given. Returns 1 if
+  the request succeeded, -1 if it failed or id is not a request in flight,
+  or 0 if the timeout expired first. A request is forgotten once it has
+  been reported as succeeded or failed.
 
-  i = IDL_LongScalar(argv[0]);
-  if ((i < 0) || (i >= MAX_SOCKETS)) return (IDL_GettmpLong(-1));
-  if (net_list[i].iState != NET_IO) return (IDL_GettmpLong(-1));
-  IDL_EXCLUDE_EXPR(argv[1]);
+  BYTES returns the number of bytes sent or received. DATA returns the data
+  received, a byte array or, for MG_NET_RECV_ASYNC with VARIABLE set, the
+  variable.
+*/
+static IDL_VPTR IDL_CDECL mg_net_wait(int argc, IDL_VPTR argv[], char *argk) {
+  return(mg_async_collect(argc, argv, argk, 0));
+}
 
-  /* read the header */
-  iRet = mg_recv_packet(net_list[i].socket, &var,sizeof(i_var));
-  if (iRet == -1) return (IDL_GettmpLong(-1));
-  if (var.token == SWAPTOKEN) {
-    mg_byteswap(&var, sizeof(i_var), sizeof(IDL_LONG));
-    swab = 1;
-  }
-  if (var.token != TOKEN) return (IDL_GettmpLong(-1));
 
-  /* allocate the variable */
-  if (var.type == IDL_TYP_STRING) {
-    vpTmp = IDL_StrToSTRING("");
-    IDL_StrEnsureLength(&(vpTmp->value.str), var.len);
-    vpTmp->value.str.slen = var.len - 1;
-    pbuffer = vpTmp->value.str.s;
-    memset(pbuffer, 0x20, var.len-1);
-    pbuffer[var.len] = '\0';
-    IDL_VarCopy(vpTmp, argv[1]);
-  } else if (var.ndims != 0) {
-    pbuffer = IDL_MakeTempArray(var.type, var.ndims, (IDL_LONG64 *) var.dims,
-                                IDL_BARR_INI_NOP, &vpTmp);
-    IDL_VarCopy(vpTmp, argv[1]);
-  } else {
-    vpTmp = IDL_GettmpLong(0);
-    IDL_VarCopy(vpTmp, argv[1]);
-    IDL_StoreScalarZero(argv[1], var.type);
-    pbuffer = (char *) &(argv[1]->value.c);
-  }
+/*
+  status = MG_NET_TEST(id [, BYTES=n] [, DATA=data])
 
-  /* read the data */
-  iRet = mg_recv_packet(net_list[i].socket, pbuffer, var.len);
-  if (iRet == -1) return (IDL_GettmpLong(-1));
-  if (swab) {
-    int	swapsize = var.len / var.nelts;
-    if ((var.type == IDL_TYP_COMPLEX)
-          || (var.type == IDL_TYP_DCOMPLEX)) {
-      swapsize /= 2;
-    }
-    mg_byteswap(pbuffer, var.len, swapsize);
+  Checks whether a request made by MG_NET_SEND_ASYNC or MG_NET_RECV_ASYNC
+  has completed, without waiting. Returns 0 if the request is still in
+  flight, otherwise as MG_NET_WAIT.
+*/
+static IDL_VPTR IDL_CDECL mg_net_test(int argc, IDL_VPTR argv[], char *argk) {
+  return(mg_async_collect(argc, argv, argk, 1));
+}
+
+
+/*
+  stats = MG_NET_ASYNC_STATS([/RESET])
+
+  Returns a structure of statistics of the asynchronous requests: the number
+  of requests SUBMITTED, COMPLETED successfully, FAILED, and REJECTED
+  because of back-pressure; the number of requests QUEUED in flight and the
+  most that have been in flight at once, MAX_QUEUED; the bytes waiting to be
+  sent, QUEUED_BYTES; and the number of completed requests not yet collected
+  by MG_NET_WAIT or MG_NET_TEST, UNCOLLECTED. Set RESET to start the counts
+  over after returning them.
+*/
+static IDL_VPTR IDL_CDECL mg_net_async_stats(int argc, IDL_VPTR argv[], char *argk) {
+  IDL_VPTR vpTmp;
+  IDL_LONG64 *stats;
+  IDL_MEMINT one = 1;
+  void *sdef;
+
+  static IDL_LONG iReset;
+  static IDL_KW_PAR kw_pars[] = { IDL_KW_FAST_SCAN,
+    { "RESET", IDL_TYP_LONG, 1, IDL_KW_ZERO, 0, IDL_CHARA(iReset) },
+    { NULL }
+  };
+  static IDL_STRUCT_TAG_DEF stats_tags[] = {
+    { "SUBMITTED",    0, (void *) IDL_TYP_LONG64, 0 },
+    { "COMPLETED",    0, (void *) IDL_TYP_LONG64, 0 },
+    { "FAILED",       0, (void *) IDL_TYP_LONG64, 0 },
+    { "REJECTED",     0, (void *) IDL_TYP_LONG64, 0 },
+    { "QUEUED",       0, (void *) IDL_TYP_LONG64, 0 },
+    { "MAX_QUEUED",   0, (void *) IDL_TYP_LONG64, 0 },
+    { "QUEUED_BYTES", 0, (void *) IDL_TYP_LONG64, 0 },
+    { "UNCOLLECTED",  0, (void *) IDL_TYP_LONG64, 0 },
+    { 0 }
+  };
+
+  IDL_KWCleanup(IDL_KW_MARK);
+  IDL_KWGetParams(argc, argv, argk, kw_pars, NULL, 1);
+  IDL_KWCleanup(IDL_KW_CLEAN);
+
+  mg_async_drain();
+
+  sdef = IDL_MakeStruct(NULL, stats_tags);
+  stats = (IDL_LONG64 *) IDL_MakeTempStruct(sdef, 1, &one, &vpTmp, TRUE);
+  stats[0] = net_n_submitted;
+  stats[1] = net_n_completed;
+  stats[2] = net_n_failed;
+  stats[3] = net_n_rejected;
+  stats[4] = net_queued;
+  stats[5] = net_max_queued;
+  stats[6] = net_queued_bytes;
+  stats[7] = net_n_requests - net_queued;
+
+  if (iReset) {
+    net_n_submitted = 0;
+    net_n_completed = 0;
+    net_n_failed = 0;
+    net_n_rejected = 0;
+    net_max_queued = net_queued;
   }
 
-  return (IDL_GettmpLong(1));
+  return(vpTmp);
 }
 
 
@@ -817,53 +4377,65 @@ static IDL_VPTR IDL_CDECL mg_net_recvvar(int argc, IDL_VPTR argv[], char *argk)
   The routine waits the number of seconds specified by the timeout argument
   for sockets to become ready. A timeout value of 0 results in a poll of the
   sockets.
+
+  MG_NET_SELECT passes the whole list of sockets to the system on every call;
+  use MG_NET_POLL to wait repeatedly on a large set of sockets.
 */
 static IDL_VPTR IDL_CDECL mg_net_select(int argc, IDL_VPTR argv[], char *argk) {
-  struct timeval timeval;
-  fd_set rfds;
+  struct pollfd *pfds;
+  int ms;
 
   IDL_LONG i, j;
-  IDL_LONG n, num;
+  IDL_LONG n;
 
-  float	fWait;
+  double fWait;
   IDL_LONG *piSocks;
   IDL_VPTR vpSocks;
   IDL_MEMINT iNum;
 
   vpSocks = IDL_CvtLng(1, &(argv[0]));
   IDL_VarGetData(vpSocks, &iNum, (char **) &piSocks, 1);
-  fWait = (float) IDL_DoubleScalar(argv[1]);
+  fWait = IDL_DoubleScalar(argv[1]);
 
-  num = -1;
-  FD_ZERO(&rfds);
+  pfds = (struct pollfd *) malloc(iNum * sizeof(struct pollfd));
+  if (!pfds) {
+    if (vpSocks != argv[0]) IDL_Deltmp(vpSocks);
+    return (IDL_GettmpLong(-1));
+  }
 
   for (j = 0; j < iNum; j++) {
     i = piSocks[j];
-    if ((i < 0) || (i >= MAX_SOCKETS)) {
+    if ((i < 0) || (i >= net_list_size)) {
+      free(pfds);
       if (vpSocks != argv[0]) IDL_Deltmp(vpSocks);
       return (IDL_GettmpLong(-1));
     }
-    if (net_list[i].iState != NET_UNUSED) {
-      FD_SET(net_list[i].socket, &rfds);
-      if (net_list[i].socket > (SOCKET) num) num = net_list[i].socket;
-    }
+    /* negative descriptors are ignored by poll */
+    pfds[j].fd = net_list[i].iState != NET_UNUSED ? net_list[i].socket : -1;
+    pfds[j].events = POLLIN;
+    pfds[j].revents = 0;
   }
-  while (fWait >= 0.0) {
-    if (fWait >= 2.0) {
-      timeval.tv_sec = 2;
-      timeval.tv_usec = 0;
-    } else {
-      timeval.tv_sec = (long) fWait;
-      fWait = fWait - timeval.tv_sec;
-      timeval.tv_usec = (long) (fWait * 1000000);
-    }
-    n = select(num + 1, &rfds, NULL, NULL, &timeval);
-    if (n == -1) fWait = -1.0;
-    if (n > 0) fWait = -1.0;
-    fWait -= 2.0;
+
+  /* wait in slices so that the wait can be interrupted */
+  while (1) {
+    ms = fWait >= NET_POLL_SLICE
+           ? (int) (NET_POLL_SLICE * 1000)
+           : (int) ceil(IDL_MAX(fWait, 0.0) * 1000.0);
+    n = POLL(pfds, (unsigned long) iNum, ms);
+    if (n == -1 && errno == EINTR) n = 0;
+    if (n != 0) break;
+    fWait -= NET_POLL_SLICE;
     if (IDL_BailOut(IDL_FALSE)) {
       n = -1;
-      fWait = -1.0;
+      break;
+    }
+    if (fWait < 0.0) break;
+  }
+
+  /* only report sockets that are readable, closed, or in error */
+  if (n > 0) {
+    for (j = 0, n = 0; j < iNum; j++) {
+      if (pfds[j].revents & (POLLIN | POLLHUP | POLLERR)) n++;
     }
   }
 
@@ -874,23 +4446,297 @@ static IDL_VPTR IDL_CDECL mg_net_select(int argc, IDL_VPTR argv[], char *argk) {
     pOut = (IDL_LONG *) IDL_MakeTempVector(IDL_TYP_LONG,
                                            n, IDL_ARR_INI_NOP, &vpTmp);
     for (j = 0; j < iNum; j++) {
-      i = piSocks[j];
-      if (net_list[i].iState != NET_UNUSED) {
-        if (FD_ISSET(net_list[i].socket, &rfds)) {
-          *pOut++ = i;
-        }
+      if (pfds[j].revents & (POLLIN | POLLHUP | POLLERR)) {
+        *pOut++ = piSocks[j];
       }
     }
+    free(pfds);
     if (vpSocks != argv[0]) IDL_Deltmp(vpSocks);
     return (vpTmp);
   }
 
+  free(pfds);
   if (vpSocks != argv[0]) IDL_Deltmp(vpSocks);
 
   return (IDL_GettmpLong(n));
 }
 
 
+/*
+  Internal function to add a socket to the set watched by MG_NET_POLL, change
+  the events it is watched for, or remove it from the set if events is 0.
+  Returns -1 on error.
+*/
+static int mg_net_poll_ctl(IDL_LONG i, IDL_LONG events) {
+#ifdef MG_NET_EPOLL
+  struct epoll_event ev;
+  int op;
+#endif
+
+  if (events == net_list[i].iPoll) return(0);
+
+#ifdef MG_NET_EPOLL
+  if (net_epoll == -1) {
+    net_epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (net_epoll == -1) return(-1);
+  }
+
+  if (events == 0) {
+    op = EPOLL_CTL_DEL;
+  } else {
+    op = net_list[i].iPoll == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+  }
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN | EPOLLRDHUP;
+  if (events & NET_POLL_WRITE) ev.events |= EPOLLOUT;
+  if (events & NET_POLL_EDGE) ev.events |= EPOLLET;
+  ev.data.u32 = (unsigned int) i;
+  if (epoll_ctl(net_epoll, op, net_list[i].socket, &ev) == -1) return(-1);
+#endif
+
+  if (net_list[i].iPoll == 0) net_n_polled++;
+  if (events == 0) net_n_polled--;
+  net_list[i].iPoll = events;
+
+  return(0);
+}
+
+
+#ifdef MG_NET_EPOLL
+/*
+  Internal function to wait for events on the epoll set. Uses epoll_pwait2 for
+  timeouts finer than a millisecond when the kernel has it.
+*/
+static int mg_net_epoll_wait(struct epoll_event *events, int maxevents,
+                             double timeout) {
+  int n;
+#ifdef SYS_epoll_pwait2
+  static int have_pwait2 = 1;
+  struct timespec ts;
+
+  if (have_pwait2) {
+    ts.tv_sec = (time_t) timeout;
+    ts.tv_nsec = (long) ((timeout - ts.tv_sec) * 1.0e9);
+    n = syscall(SYS_epoll_pwait2, net_epoll, events, maxevents, &ts, NULL, 0);
+    if (n != -1 || errno != ENOSYS) return(n);
+    have_pwait2 = 0;
+  }
+#endif
+
+  n = epoll_wait(net_epoll, events, maxevents, (int) ceil(timeout * 1000.0));
+
+  return(n);
+}
+#endif
+
+
+/*
+  Internal function to wait up to timeout seconds for events on the sockets
+  watched by MG_NET_POLL. Fills in the socket identifiers and NET_POLL_*
+  events of the ready sockets and returns the number of ready sockets, or -1
+  on error.
+*/
+static IDL_LONG mg_net_poll_wait(double timeout, IDL_LONG *ready,
+                                 IDL_LONG *ready_events) {
+  IDL_LONG i, j, n, events;
+#ifdef MG_NET_EPOLL
+  static struct epoll_event *net_events = NULL;
+  static IDL_LONG net_events_size = 0;
+  struct epoll_event *new_events;
+  IDL_LONG size = IDL_MAX(net_n_polled, 1);
+
+  if (net_epoll == -1) {
+    net_epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (net_epoll == -1) return(-1);
+  }
+
+  if (size > net_events_size) {
+    new_events = (struct epoll_event *) realloc(net_events,
+                                                size * sizeof(struct epoll_event));
+    if (!new_events) return(-1);
+    net_events = new_events;
+    net_events_size = size;
+  }
+
+  n = mg_net_epoll_wait(net_events, size, timeout);
+  if (n == -1) return(errno == EINTR ? 0 : -1);
+
+  for (j = 0; j < n; j++) {
+    i = (IDL_LONG) net_events[j].data.u32;
+    events = 0;
+    if (net_events[j].events & EPOLLIN) {
+      events |= net_list[i].iState == NET_LISTEN ? NET_POLL_ACCEPT : NET_POLL_READ;
+    }
+    if (net_events[j].events & EPOLLOUT) events |= NET_POLL_WRITE;
+    if (net_events[j].events & (EPOLLHUP | EPOLLRDHUP | EPOLLERR)) {
+      events |= NET_POLL_HANGUP;
+    }
+    ready[j] = i;
+    ready_events[j] = events;
+  }
+#else
+  struct pollfd *pfds;
+  IDL_LONG *index;
+
+  pfds = (struct pollfd *) malloc(IDL_MAX(net_n_polled, 1) * sizeof(struct pollfd));
+  index = (IDL_LONG *) malloc(IDL_MAX(net_n_polled, 1) * sizeof(IDL_LONG));
+  if (!pfds || !index) {
+    free(pfds);
+    free(index);
+    return(-1);
+  }
+
+  for (i = 0, j = 0; i < net_list_size; i++) {
+    if (net_list[i].iPoll == 0) continue;
+    pfds[j].fd = net_list[i].socket;
+    pfds[j].events = POLLIN;
+    if (net_list[i].iPoll & NET_POLL_WRITE) pfds[j].events |= POLLOUT;
+    pfds[j].revents = 0;
+    index[j++] = i;
+  }
+
+  n = POLL(pfds, (unsigned long) j, (int) ceil(timeout * 1000.0));
+  if (n == -1 && errno == EINTR) n = 0;
+
+  if (n > 0) {
+    for (j = 0, n = 0; j < net_n_polled; j++) {
+      if (pfds[j].revents == 0) continue;
+      i = index[j];
+      events = 0;
+      if (pfds[j].revents & POLLIN) {
+        events |= net_list[i].iState == NET_LISTEN ? NET_POLL_ACCEPT : NET_POLL_READ;
+      }
+      if (pfds[j].revents & POLLOUT) events |= NET_POLL_WRITE;
+      if (pfds[j].revents & (POLLHUP | POLLERR)) events |= NET_POLL_HANGUP;
+      ready[n] = i;
+      ready_events[n++] = events;
+    }
+  }
+
+  free(pfds);
+  free(index);
+#endif
+
+  return(n);
+}
+
+
+/*
+  ready = MG_NET_POLL([sockets, ] timeout [, COUNT=n] [, /EDGE] [, EVENTS=e]
+                      [, /REMOVE] [, /WRITE])
+
+  Waits for events on a set of sockets that is kept between calls, so, unlike
+  MG_NET_SELECT, the cost of a call does not grow with the number of sockets
+  that are not ready. Sockets passed in the sockets argument are added to the
+  set, or have the events they are watched for changed, and stay in the set
+  until they are closed or passed with the REMOVE keyword. Sockets are watched
+  for data to read and, for listening sockets, connections to accept. Set
+  WRITE to also watch for room to write. Set EDGE to report an event only when
+  a socket becomes ready, instead of for as long as it is ready.
+
+  The timeout is in seconds and may be a fraction of a millisecond; a negative
+  timeout waits until a socket is ready. Returns a list of the ready sockets,
+  scalar 0 if no sockets are ready, or -1 on error. Set EVENTS to a named
+  variable to get, for each ready socket, a combination of 1 (data to read),
+  2 (room to write), 4 (connection to accept), and 8 (closed by the peer or in
+  error).
+
+  The set is an epoll set on Linux. On other systems, the set is checked with
+  poll, EDGE is ignored, and timeouts are rounded up to a millisecond.
+*/
+static IDL_VPTR IDL_CDECL mg_net_poll(int argc, IDL_VPTR argv[], char *argk) {
+  IDL_VPTR vpPlainArgs[2], vpSocks = NULL, vpTmp, vpEvents;
+  IDL_LONG *piSocks, *piReady, *piEvents, i, j, n, nargs, events;
+  IDL_MEMINT iNum = 0;
+  double timeout, slice;
+
+  static IDL_LONG iEdge, iRemove, iWrite;
+  static IDL_VPTR vpCount, vpEventsOut;
+  static IDL_KW_PAR kw_pars[] = { IDL_KW_FAST_SCAN,
+    { "COUNT", IDL_TYP_UNDEF, 1, IDL_KW_OUT | IDL_KW_ZERO, 0, IDL_CHARA(vpCount) },
+    { "EDGE", IDL_TYP_LONG, 1, IDL_KW_ZERO, 0, IDL_CHARA(iEdge) },
+    { "EVENTS", IDL_TYP_UNDEF, 1, IDL_KW_OUT | IDL_KW_ZERO, 0, IDL_CHARA(vpEventsOut) },
+    { "REMOVE", IDL_TYP_LONG, 1, IDL_KW_ZERO, 0, IDL_CHARA(iRemove) },
+    { "WRITE", IDL_TYP_LONG, 1, IDL_KW_ZERO, 0, IDL_CHARA(iWrite) },
+    { NULL }
+  };
+
+  IDL_KWCleanup(IDL_KW_MARK);
+  nargs = IDL_KWGetParams(argc, argv, argk, kw_pars, vpPlainArgs, 1);
+
+  if (nargs == 2) {
+    vpSocks = IDL_CvtLng(1, &(vpPlainArgs[0]));
+    IDL_VarGetData(vpSocks, &iNum, (char **) &piSocks, 1);
+  }
+  timeout = IDL_DoubleScalar(vpPlainArgs[nargs - 1]);
+
+  /* update the set of watched sockets */
+  events = iRemove ? 0 : (NET_POLL_READ
+                          | (iWrite ? NET_POLL_WRITE : 0)
+                          | (iEdge ? NET_POLL_EDGE : 0));
+  for (j = 0, n = 0; j < iNum; j++) {
+    i = piSocks[j];
+    if ((i < 0) || (i >= net_list_size) || (net_list[i].iState == NET_UNUSED)) {
+      n = -1;
+      break;
+    }
+    if (mg_net_poll_ctl(i, events) == -1) {
+      n = -1;
+      break;
+    }
+  }
+  if (vpSocks && (vpSocks != vpPlainArgs[0])) IDL_Deltmp(vpSocks);
+  if (n == -1) {
+    IDL_KWCleanup(IDL_KW_CLEAN);
+    return(IDL_GettmpLong(-1));
+  }
+
+  piReady = (IDL_LONG *) malloc(IDL_MAX(net_n_polled, 1) * sizeof(IDL_LONG));
+  piEvents = (IDL_LONG *) malloc(IDL_MAX(net_n_polled, 1) * sizeof(IDL_LONG));
+  if (!piReady || !piEvents) {
+    free(piReady);
+    free(piEvents);
+    IDL_KWCleanup(IDL_KW_CLEAN);
+    return(IDL_GettmpLong(-1));
+  }
+
+  /* wait in slices so that the wait can be interrupted */
+  while (1) {
+    slice = (timeout < 0.0) || (timeout > NET_POLL_SLICE) ? NET_POLL_SLICE : timeout;
+    n = mg_net_poll_wait(slice, piReady, piEvents);
+    if (n != 0) break;
+    if (IDL_BailOut(IDL_FALSE)) {
+      n = -1;
+      break;
+    }
+    if (timeout >= 0.0) {
+      timeout -= slice;
+      if (timeout <= 0.0) break;
+    }
+  }
+
+  if (n > 0) {
+    memcpy(IDL_MakeTempVector(IDL_TYP_LONG, n, IDL_ARR_INI_NOP, &vpTmp),
+           piReady, n * sizeof(IDL_LONG));
+    if (vpEventsOut) {
+      memcpy(IDL_MakeTempVector(IDL_TYP_LONG, n, IDL_ARR_INI_NOP, &vpEvents),
+             piEvents, n * sizeof(IDL_LONG));
+      IDL_VarCopy(vpEvents, vpEventsOut);
+    }
+  } else {
+    vpTmp = IDL_GettmpLong(n);
+    if (vpEventsOut) IDL_VarCopy(IDL_GettmpLong(0), vpEventsOut);
+  }
+  if (vpCount) IDL_VarCopy(IDL_GettmpLong(IDL_MAX(n, 0)), vpCount);
+
+  free(piReady);
+  free(piEvents);
+  IDL_KWCleanup(IDL_KW_CLEAN);
+
+  return(vpTmp);
+}
+
+
 /*
   host = MG_NET_NAME2HOST(name)
 
@@ -951,7 +4797,14 @@ static IDL_VPTR IDL_CDECL mg_net_host2name(int argc, IDL_VPTR argv[], char *argk
 static void mg_rebuffer_socket(SOCKET s, int len) {
   if (len < 10000) return; /* why would you do this??? */
 
+#ifdef SO_RCVBUFFORCE
+  /* privileged processes can go past the system limit */
+  if (setsockopt(s, SOL_SOCKET, SO_RCVBUFFORCE, (void *) &len, sizeof(int)) == -1)
+#endif
   setsockopt(s, SOL_SOCKET, SO_RCVBUF, (void *) &len, sizeof(int));
+#ifdef SO_SNDBUFFORCE
+  if (setsockopt(s, SOL_SOCKET, SO_SNDBUFFORCE, (void *) &len, sizeof(int)) == -1)
+#endif
   setsockopt(s, SOL_SOCKET, SO_SNDBUF, (void *) &len, sizeof(int));
 
   return;
@@ -964,12 +4817,30 @@ static void mg_nodelay_socket(SOCKET s,int flag) {
 
 
 /*
-  Internal function to perform general 2, 4 and 8 byte byteswapping.
+  Internal function to perform general 2, 4 and 8 byte byteswapping in place.
+  With SSE2, 16 bytes are swapped at a time: the bytes of each 16-bit word are
+  swapped, then the words of each element are reversed.
 */
-static void mg_byteswap(void *buffer, int len, int swapsize) {
-  int	num;
+static void mg_byteswap(void *buffer, IDL_MEMINT len, int swapsize) {
+  IDL_MEMINT num;
   char *p = (char *) buffer;
   char t;
+#ifdef __SSE2__
+  __m128i x;
+
+  if ((swapsize == 2) || (swapsize == 4) || (swapsize == 8)) {
+    for (; len >= 16; len -= 16, p += 16) {
+      x = _mm_loadu_si128((__m128i *) p);
+      x = _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+      if (swapsize == 4) {
+        x = _mm_shufflehi_epi16(_mm_shufflelo_epi16(x, 0xB1), 0xB1);
+      } else if (swapsize == 8) {
+        x = _mm_shufflehi_epi16(_mm_shufflelo_epi16(x, 0x1B), 0x1B);
+      }
+      _mm_storeu_si128((__m128i *) p, x);
+    }
+  }
+#endif
 
   switch (swapsize) {
   case 2:
@@ -1023,3 +4894,58 @@ static void mg_byteswap(void *buffer, int len, int swapsize) {
   }
   return;
 }
+
+
+/*
+  Internal function to fill the tables used to compute CRC-32C checksums 8
+  bytes at a time.
+*/
+static void mg_crc32c_init(void) {
+  IDL_ULONG crc;
+  int j, k;
+
+  for (j = 0; j < 256; j++) {
+    crc = j;
+    for (k = 0; k < 8; k++) crc = crc & 1 ? (crc >> 1) ^ 0x82F63B78 : crc >> 1;
+    crc32c_table[0][j] = crc;
+  }
+  for (j = 0; j < 256; j++) {
+    for (k = 1; k < 8; k++) {
+      crc = crc32c_table[k - 1][j];
+      crc32c_table[k][j] = (crc >> 8) ^ crc32c_table[0][crc & 0xff];
+    }
+  }
+}
+
+
+/*
+  Internal function to compute the CRC-32C checksum of a buffer, with the
+  SSE 4.2 crc32 instruction when the compiler targets it.
+*/
+static IDL_ULONG mg_crc32c(const void *data, IDL_MEMINT len) {
+  const unsigned char *p = (const unsigned char *) data;
+  IDL_ULONG crc = 0xffffffff;
+#ifdef __SSE4_2__
+  IDL_ULONG64 crc64 = crc, word;
+
+  for (; len >= 8; len -= 8, p += 8) {
+    memcpy(&word, p, 8);
+    crc64 = _mm_crc32_u64(crc64, word);
+  }
+  crc = (IDL_ULONG) crc64;
+  for (; len > 0; len--) crc = _mm_crc32_u8(crc, *p++);
+#else
+  IDL_ULONG lo;
+
+  for (; len >= 8; len -= 8, p += 8) {
+    lo = crc ^ (p[0] | (p[1] << 8) | (p[2] << 16) | ((IDL_ULONG) p[3] << 24));
+    crc = crc32c_table[7][lo & 0xff] ^ crc32c_table[6][(lo >> 8) & 0xff]
+            ^ crc32c_table[5][(lo >> 16) & 0xff] ^ crc32c_table[4][lo >> 24]
+            ^ crc32c_table[3][p[4]] ^ crc32c_table[2][p[5]]
+            ^ crc32c_table[1][p[6]] ^ crc32c_table[0][p[7]];
+  }
+  for (; len > 0; len--) crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *p++) & 0xff];
+#endif
+
+  return(~crc);
+}
@@ -42,7 +42,34 @@ typedef struct {
   IDL_LONG dims[IDL_MAX_ARRAY_DIM];
 } i_var;
 
-static void mg_byteswap(void *buffer, int len, int swapsize);
+/*
+ * Version 2 headers start with 'IDL2' and hold lengths and dimensions in 64
+ * bits. The data follows the header in chunks of chunk_size bytes, each one
+ * followed by its CRC-32C if the MG_NET_CHECKSUM flag is set.
+ */
+#define TOKEN2      0x49444C32
+#define SWAPTOKEN2  0x324C4449
+
+#define MG_NET_VERSION   2
+#define MG_NET_CHECKSUM  1
+
+/* IDL variable packet header, version 2 */
+typedef struct {
+  IDL_LONG token;
+  IDL_LONG version;
+  IDL_LONG type;
+  IDL_LONG ndims;
+  IDL_LONG flags;
+  IDL_ULONG checksum;       /* CRC-32C of the header with checksum set to 0 */
+  IDL_LONG64 len;           /* bytes of data */
+  IDL_LONG64 nelts;
+  IDL_LONG64 dims[IDL_MAX_ARRAY_DIM];
+  IDL_LONG64 chunk_size;
+  IDL_LONG64 transfer_id;   /* identifies the transfer when it is resumed */
+  IDL_LONG64 offset;        /* first byte of data sent, 0 unless resuming */
+} i_var2;
+
+static void mg_byteswap(void *buffer, IDL_MEMINT len, int swapsize);
 static void mg_net_exit_handler(void);
 
 #endif
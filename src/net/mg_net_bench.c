@@ -0,0 +1,670 @@
+/*
+  Loopback latency and throughput benchmark for the transfers of the mg_net
+  DLM.
+
+  A server thread echoes messages back to the client on loopback for each
+  path and message size:
+
+    send     raw bytes on a TCP socket, as MG_NET_SEND/MG_NET_RECV
+    sendvar  bytes framed as MG_NET_SENDVAR writes a BYTE array: a version 2
+             header, then the data in chunks, each one followed by its
+             CRC-32C unless -n is given
+    udp      a single datagram on a UDP socket, for sizes that fit in one
+
+  Each message makes a round trip; the round trip times give the p50 and p99
+  latencies, and the throughput in GB/s is the bytes that crossed loopback,
+  twice the message size, over the p50 latency. These are the times of the
+  system calls and framing alone, to compare with the same measurements
+  through IDL and the DLM by unit/net_ut/mg_net_bench.pro.
+
+  Usage:
+
+    mg_net_bench [-m min_bytes] [-M max_bytes] [-r repeats] [-b budget]
+                 [-n] [-f text|csv|json] [path ...]
+
+  Message sizes go from min_bytes (8 by default) to max_bytes (1 GB) by
+  factors of 8. Each size is repeated repeats times (1000), but not more than
+  budget bytes (1 GB) are sent at a size, and never fewer than 5 times. With
+  no paths, all are benchmarked.
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#ifdef __SSE4_2__
+#include <nmmintrin.h>
+#endif
+
+#define BENCH_MIN_REPEATS 5
+
+// largest UDP payload on loopback
+#define BENCH_MAX_DATAGRAM 65507
+
+// header of MG_NET_SENDVAR: same layout as i_var2 in mg_net.h
+#define BENCH_TOKEN2      0x49444C32
+#define BENCH_VERSION     2
+#define BENCH_CHECKSUM    1
+#define BENCH_MAX_DIM     8
+#define BENCH_TYP_BYTE    1
+#define BENCH_CHUNK_SIZE  4194304
+
+typedef struct {
+  int32_t token;
+  int32_t version;
+  int32_t type;
+  int32_t ndims;
+  int32_t flags;
+  uint32_t checksum;
+  int64_t len;
+  int64_t nelts;
+  int64_t dims[BENCH_MAX_DIM];
+  int64_t chunk_size;
+  int64_t transfer_id;
+  int64_t offset;
+} bench_header;
+
+typedef enum { BENCH_SEND, BENCH_SENDVAR, BENCH_UDP, BENCH_N_PATHS } bench_path;
+
+static const char *bench_path_names[] = { "send", "sendvar", "udp" };
+
+typedef struct {
+  bench_path path;
+  int fd;
+  char *buffer;
+  int64_t size;
+  int repeats;           // including the warm up round trip
+  int checksum;
+  int failed;
+} bench_server;
+
+typedef struct {
+  const char *path;
+  int64_t size;
+  int repeats;
+  int lost;              // datagrams that did not come back
+  double p50_us;
+  double p99_us;
+  double gbps;
+} bench_result;
+
+
+/**************************************************************************
+  CRC-32C, as computed by the DLM
+***************************************************************************/
+
+static uint32_t crc32c_table[8][256];
+
+
+static void bench_crc32c_init(void) {
+  uint32_t crc;
+  int i, j;
+
+  for (i = 0; i < 256; i++) {
+    crc = i;
+    for (j = 0; j < 8; j++) crc = crc & 1 ? (crc >> 1) ^ 0x82f63b78 : crc >> 1;
+    crc32c_table[0][i] = crc;
+  }
+  for (i = 0; i < 256; i++) {
+    for (j = 1; j < 8; j++) {
+      crc32c_table[j][i] = (crc32c_table[j - 1][i] >> 8)
+                             ^ crc32c_table[0][crc32c_table[j - 1][i] & 0xff];
+    }
+  }
+}
+
+
+static uint32_t bench_crc32c(const void *data, int64_t len) {
+  const unsigned char *p = (const unsigned char *) data;
+  uint32_t crc = 0xffffffff;
+#ifdef __SSE4_2__
+  uint64_t crc64 = crc, word;
+
+  for (; len >= 8; len -= 8, p += 8) {
+    memcpy(&word, p, 8);
+    crc64 = _mm_crc32_u64(crc64, word);
+  }
+  crc = (uint32_t) crc64;
+  for (; len > 0; len--) crc = _mm_crc32_u8(crc, *p++);
+#else
+  uint32_t lo;
+
+  for (; len >= 8; len -= 8, p += 8) {
+    lo = crc ^ (p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24));
+    crc = crc32c_table[7][lo & 0xff] ^ crc32c_table[6][(lo >> 8) & 0xff]
+            ^ crc32c_table[5][(lo >> 16) & 0xff] ^ crc32c_table[4][lo >> 24]
+            ^ crc32c_table[3][p[4]] ^ crc32c_table[2][p[5]]
+            ^ crc32c_table[1][p[6]] ^ crc32c_table[0][p[7]];
+  }
+  for (; len > 0; len--) crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *p++) & 0xff];
+#endif
+
+  return ~crc;
+}
+
+
+/**************************************************************************
+  Transfers
+***************************************************************************/
+
+static int bench_send_all(int fd, const char *data, int64_t len) {
+  ssize_t n;
+
+  while (len > 0) {
+    n = send(fd, data, len, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return -1;
+    data += n;
+    len -= n;
+  }
+  return 0;
+}
+
+
+static int bench_recv_all(int fd, char *data, int64_t len) {
+  ssize_t n;
+
+  while (len > 0) {
+    n = recv(fd, data, len, 0);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return -1;
+    data += n;
+    len -= n;
+  }
+  return 0;
+}
+
+
+// write data of len bytes as MG_NET_SENDVAR writes a BYTE array
+static int bench_sendvar(int fd, const char *data, int64_t len, int checksum) {
+  bench_header h;
+  struct iovec iov[2];
+  int64_t pos, n;
+  ssize_t written;
+  uint32_t crc;
+
+  memset(&h, 0, sizeof(h));
+  h.token = BENCH_TOKEN2;
+  h.version = BENCH_VERSION;
+  h.type = BENCH_TYP_BYTE;
+  h.ndims = 1;
+  h.flags = checksum ? BENCH_CHECKSUM : 0;
+  h.len = len;
+  h.nelts = len;
+  h.dims[0] = len;
+  h.chunk_size = BENCH_CHUNK_SIZE;
+  h.checksum = bench_crc32c(&h, sizeof(h));
+
+  if (bench_send_all(fd, (const char *) &h, sizeof(h)) < 0) return -1;
+  for (pos = 0; pos < len; pos += n) {
+    n = len - pos < BENCH_CHUNK_SIZE ? len - pos : BENCH_CHUNK_SIZE;
+    if (!checksum) {
+      if (bench_send_all(fd, data + pos, n) < 0) return -1;
+      continue;
+    }
+    crc = bench_crc32c(data + pos, n);
+    iov[0].iov_base = (void *) (data + pos);
+    iov[0].iov_len = n;
+    iov[1].iov_base = &crc;
+    iov[1].iov_len = sizeof(crc);
+    written = writev(fd, iov, 2);
+    if (written < 0 && errno != EINTR) return -1;
+    if (written < 0) written = 0;
+
+    // finish a partial write
+    if (written < n) {
+      if (bench_send_all(fd, data + pos + written, n - written) < 0) return -1;
+      written = n;
+    }
+    if (bench_send_all(fd, (const char *) &crc + (written - n),
+                       n + sizeof(crc) - written) < 0) return -1;
+  }
+  return 0;
+}
+
+
+// read a variable written by bench_sendvar into data of len bytes, checking
+// its header and checksums
+static int bench_recvvar(int fd, char *data, int64_t len) {
+  bench_header h;
+  uint32_t crc, expected;
+  int64_t pos, n;
+
+  if (bench_recv_all(fd, (char *) &h, sizeof(h)) < 0) return -1;
+  crc = h.checksum;
+  h.checksum = 0;
+  if (h.token != BENCH_TOKEN2 || h.len != len || h.chunk_size <= 0
+        || crc != bench_crc32c(&h, sizeof(h))) return -1;
+
+  for (pos = 0; pos < len; pos += n) {
+    n = len - pos < h.chunk_size ? len - pos : h.chunk_size;
+    if (bench_recv_all(fd, data + pos, n) < 0) return -1;
+    if (h.flags & BENCH_CHECKSUM) {
+      if (bench_recv_all(fd, (char *) &expected, sizeof(expected)) < 0) return -1;
+      if (expected != bench_crc32c(data + pos, n)) return -1;
+    }
+  }
+  return 0;
+}
+
+
+/**************************************************************************
+  Echo server
+***************************************************************************/
+
+static void *bench_serve(void *arg) {
+  bench_server *server = (bench_server *) arg;
+  struct sockaddr_in from;
+  socklen_t from_len;
+  ssize_t n;
+  int r;
+
+  for (r = 0; r < server->repeats; r++) {
+    switch (server->path) {
+      case BENCH_SEND:
+        if (bench_recv_all(server->fd, server->buffer, server->size) < 0
+              || bench_send_all(server->fd, server->buffer, server->size) < 0) {
+          server->failed = 1;
+        }
+        break;
+      case BENCH_SENDVAR:
+        if (bench_recvvar(server->fd, server->buffer, server->size) < 0
+              || bench_sendvar(server->fd, server->buffer, server->size,
+                               server->checksum) < 0) {
+          server->failed = 1;
+        }
+        break;
+      default:
+        // a lost datagram leaves the server waiting for the rest until its
+        // receive timeout
+        from_len = sizeof(from);
+        n = recvfrom(server->fd, server->buffer, server->size, 0,
+                     (struct sockaddr *) &from, &from_len);
+        if (n < 0) continue;
+        sendto(server->fd, server->buffer, n, 0, (struct sockaddr *) &from, from_len);
+        break;
+    }
+    if (server->failed) {
+      // the client is waiting for the echo; wake it up so it can be joined
+      shutdown(server->fd, SHUT_RDWR);
+      break;
+    }
+  }
+
+  return NULL;
+}
+
+
+/**************************************************************************
+  Sockets
+***************************************************************************/
+
+static void bench_loopback(struct sockaddr_in *addr) {
+  memset(addr, 0, sizeof(*addr));
+  addr->sin_family = AF_INET;
+  addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr->sin_port = 0;
+}
+
+
+// connected pair of TCP sockets on loopback, with Nagle's algorithm off as
+// in a request/reply exchange
+static int bench_tcp_pair(int *client, int *server) {
+  struct sockaddr_in addr;
+  socklen_t len = sizeof(addr);
+  int listener, one = 1;
+
+  bench_loopback(&addr);
+  listener = socket(AF_INET, SOCK_STREAM, 0);
+  if (listener < 0) return -1;
+  if (bind(listener, (struct sockaddr *) &addr, sizeof(addr)) < 0
+        || listen(listener, 1) < 0
+        || getsockname(listener, (struct sockaddr *) &addr, &len) < 0) {
+    close(listener);
+    return -1;
+  }
+
+  *client = socket(AF_INET, SOCK_STREAM, 0);
+  if (*client < 0 || connect(*client, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+    close(listener);
+    return -1;
+  }
+  *server = accept(listener, NULL, NULL);
+  close(listener);
+  if (*server < 0) return -1;
+
+  setsockopt(*client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  setsockopt(*server, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return 0;
+}
+
+
+// pair of UDP sockets on loopback; the client is connected to the server
+static int bench_udp_pair(int *client, int *server) {
+  struct sockaddr_in addr;
+  socklen_t len = sizeof(addr);
+  struct timeval timeout = { 1, 0 };
+  int size = 4 * 1024 * 1024;
+
+  bench_loopback(&addr);
+  *server = socket(AF_INET, SOCK_DGRAM, 0);
+  *client = socket(AF_INET, SOCK_DGRAM, 0);
+  if (*server < 0 || *client < 0) return -1;
+  if (bind(*server, (struct sockaddr *) &addr, sizeof(addr)) < 0
+        || getsockname(*server, (struct sockaddr *) &addr, &len) < 0
+        || connect(*client, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+    return -1;
+  }
+
+  setsockopt(*server, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+  setsockopt(*client, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+  setsockopt(*server, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(*client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  return 0;
+}
+
+
+/**************************************************************************
+  Measurements
+***************************************************************************/
+
+static double bench_now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1.0e6 + ts.tv_nsec * 1.0e-3;
+}
+
+
+static int bench_compare(const void *a, const void *b) {
+  double x = *(const double *) a, y = *(const double *) b;
+
+  return x < y ? -1 : x > y;
+}
+
+
+// round trip of one message from the client; returns 0, or -1 for error
+static int bench_round_trip(bench_path path, int fd, char *send_buffer,
+                            char *recv_buffer, int64_t size, int checksum) {
+  ssize_t n;
+
+  switch (path) {
+    case BENCH_SEND:
+      if (bench_send_all(fd, send_buffer, size) < 0) return -1;
+      return bench_recv_all(fd, recv_buffer, size);
+    case BENCH_SENDVAR:
+      if (bench_sendvar(fd, send_buffer, size, checksum) < 0) return -1;
+      return bench_recvvar(fd, recv_buffer, size);
+    default:
+      if (send(fd, send_buffer, size, 0) != size) return -1;
+      n = recv(fd, recv_buffer, size, 0);
+      return n == size ? 0 : -1;
+  }
+}
+
+
+// time repeats round trips of messages of size bytes on path; returns 0, or
+// -1 if the sockets could not be set up or the transfers failed
+static int bench_measure(bench_path path, int64_t size, int repeats,
+                         int checksum, bench_result *result) {
+  bench_server server;
+  pthread_t thread;
+  char *send_buffer, *recv_buffer;
+  double *times, start;
+  int client = -1, r, n_times = 0, status = 0;
+  int64_t b;
+
+  server.fd = -1;
+
+  send_buffer = malloc(size);
+  recv_buffer = malloc(size);
+  server.buffer = malloc(size);
+  times = malloc(repeats * sizeof(double));
+  if (!send_buffer || !recv_buffer || !server.buffer || !times) {
+    free(send_buffer);
+    free(recv_buffer);
+    free(server.buffer);
+    free(times);
+    return -1;
+  }
+  for (b = 0; b < size; b++) send_buffer[b] = (char) (b * 7);
+
+  status = path == BENCH_UDP
+             ? bench_udp_pair(&client, &server.fd)
+             : bench_tcp_pair(&client, &server.fd);
+  if (status < 0) goto done;
+
+  server.path = path;
+  server.size = size;
+  server.repeats = repeats + 1;
+  server.checksum = checksum;
+  server.failed = 0;
+  if (pthread_create(&thread, NULL, bench_serve, &server) != 0) {
+    status = -1;
+    goto done;
+  }
+
+  result->lost = 0;
+  for (r = 0; r <= repeats; r++) {
+    start = bench_now();
+    if (bench_round_trip(path, client, send_buffer, recv_buffer, size, checksum) < 0) {
+      if (path != BENCH_UDP) {
+        status = -1;
+        shutdown(client, SHUT_RDWR);
+        break;
+      }
+      result->lost++;
+      continue;
+    }
+    // the first round trip warms up the buffers and is not counted
+    if (r > 0) times[n_times++] = bench_now() - start;
+  }
+  pthread_join(thread, NULL);
+  if (server.failed || (path != BENCH_UDP && memcmp(send_buffer, recv_buffer, size) != 0)) {
+    status = -1;
+  }
+
+  if (status == 0) {
+    qsort(times, n_times, sizeof(double), bench_compare);
+    result->path = bench_path_names[path];
+    result->size = size;
+    result->repeats = n_times;
+    result->p50_us = n_times > 0 ? times[(n_times - 1) / 2] : NAN;
+    result->p99_us = n_times > 0 ? times[(int) ceil(0.99 * n_times) - 1] : NAN;
+    result->gbps = n_times > 0 ? 2.0 * size / result->p50_us * 1.0e-3 : NAN;
+  }
+
+  done:
+  if (client >= 0) close(client);
+  if (server.fd >= 0) close(server.fd);
+  free(send_buffer);
+  free(recv_buffer);
+  free(server.buffer);
+  free(times);
+
+  return status;
+}
+
+
+/**************************************************************************
+  Output
+***************************************************************************/
+
+typedef enum { BENCH_TEXT, BENCH_CSV, BENCH_JSON } bench_format;
+
+
+// print a number, or the missing value of the format if it is NaN
+static void bench_print_number(bench_format format, const char *fmt, double v) {
+  if (!isnan(v)) {
+    printf(fmt, v);
+  } else if (format == BENCH_JSON) {
+    printf("null");
+  } else if (format == BENCH_TEXT) {
+    printf("%*s", atoi(fmt + 1), "-");
+  }
+}
+
+
+static void bench_print_header(bench_format format) {
+  switch (format) {
+    case BENCH_TEXT:
+      printf("%-8s %12s %8s %6s %12s %12s %10s\n",
+             "path", "bytes", "repeats", "lost", "p50_us", "p99_us", "gbps");
+      break;
+    case BENCH_CSV:
+      printf("driver,path,bytes,repeats,lost,p50_us,p99_us,gbps\n");
+      break;
+    case BENCH_JSON:
+      printf("[");
+      break;
+  }
+}
+
+
+static void bench_print_result(bench_format format, const bench_result *r, int first) {
+  switch (format) {
+    case BENCH_TEXT:
+      printf("%-8s %12lld %8d %6d ", r->path, (long long) r->size, r->repeats, r->lost);
+      bench_print_number(format, "%12.2f", r->p50_us);
+      printf(" ");
+      bench_print_number(format, "%12.2f", r->p99_us);
+      printf(" ");
+      bench_print_number(format, "%10.4f", r->gbps);
+      printf("\n");
+      break;
+    case BENCH_CSV:
+      printf("c,%s,%lld,%d,%d,", r->path, (long long) r->size, r->repeats, r->lost);
+      bench_print_number(format, "%.3f", r->p50_us);
+      printf(",");
+      bench_print_number(format, "%.3f", r->p99_us);
+      printf(",");
+      bench_print_number(format, "%.6f", r->gbps);
+      printf("\n");
+      break;
+    case BENCH_JSON:
+      printf("%s\n  {\"driver\": \"c\", \"path\": \"%s\", \"bytes\": %lld, "
+             "\"repeats\": %d, \"lost\": %d, ",
+             first ? "" : ",", r->path, (long long) r->size, r->repeats, r->lost);
+      printf("\"p50_us\": ");
+      bench_print_number(format, "%.3f", r->p50_us);
+      printf(", \"p99_us\": ");
+      bench_print_number(format, "%.3f", r->p99_us);
+      printf(", \"gbps\": ");
+      bench_print_number(format, "%.6f", r->gbps);
+      printf("}");
+      break;
+  }
+  fflush(stdout);
+}
+
+
+static void bench_print_footer(bench_format format) {
+  if (format == BENCH_JSON) printf("\n]\n");
+}
+
+
+/**************************************************************************
+  Main
+***************************************************************************/
+
+static void bench_usage(const char *prog) {
+  fprintf(stderr,
+          "usage: %s [-m min_bytes] [-M max_bytes] [-r repeats] [-b budget] "
+          "[-n] [-f text|csv|json] [send|sendvar|udp ...]\n", prog);
+}
+
+
+static int bench_selected(const char *name, int argc, char **argv) {
+  int i;
+
+  if (argc == 0) return 1;
+  for (i = 0; i < argc; i++) {
+    if (strcmp(argv[i], name) == 0) return 1;
+  }
+  return 0;
+}
+
+
+int main(int argc, char **argv) {
+  bench_format format = BENCH_TEXT;
+  int64_t min_size = 8, max_size = 1073741824, budget = 1073741824, size;
+  int repeats = 1000, checksum = 1, n, opt, first = 1, status = EXIT_SUCCESS;
+  bench_result result;
+  bench_path path;
+
+  while ((opt = getopt(argc, argv, "m:M:r:b:nf:h")) != -1) {
+    switch (opt) {
+      case 'm': min_size = strtoll(optarg, NULL, 10); break;
+      case 'M': max_size = strtoll(optarg, NULL, 10); break;
+      case 'r': repeats = atoi(optarg); break;
+      case 'b': budget = strtoll(optarg, NULL, 10); break;
+      case 'n': checksum = 0; break;
+      case 'f':
+        if (strcmp(optarg, "text") == 0) {
+          format = BENCH_TEXT;
+        } else if (strcmp(optarg, "csv") == 0) {
+          format = BENCH_CSV;
+        } else if (strcmp(optarg, "json") == 0) {
+          format = BENCH_JSON;
+        } else {
+          bench_usage(argv[0]);
+          return EXIT_FAILURE;
+        }
+        break;
+      default:
+        bench_usage(argv[0]);
+        return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+
+  if (min_size < 1 || max_size < min_size || repeats < 1 || budget < 1) {
+    bench_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  // a failed transfer shuts its socket down; writev to it must report EPIPE
+  // instead of killing the benchmark
+  signal(SIGPIPE, SIG_IGN);
+
+  bench_crc32c_init();
+  bench_print_header(format);
+
+  for (path = 0; path < BENCH_N_PATHS; path++) {
+    if (!bench_selected(bench_path_names[path], argc - optind, argv + optind)) continue;
+
+    for (size = min_size; size <= max_size; size *= 8) {
+      if (path == BENCH_UDP && size > BENCH_MAX_DATAGRAM) break;
+
+      n = budget / size < repeats ? (int) (budget / size) : repeats;
+      if (n < BENCH_MIN_REPEATS) n = BENCH_MIN_REPEATS;
+
+      if (bench_measure(path, size, n, checksum, &result) < 0) {
+        fprintf(stderr, "%s: %s failed for %lld bytes\n",
+                argv[0], bench_path_names[path], (long long) size);
+        status = EXIT_FAILURE;
+        continue;
+      }
+      bench_print_result(format, &result, first);
+      first = 0;
+    }
+  }
+
+  bench_print_footer(format);
+
+  return status;
+}
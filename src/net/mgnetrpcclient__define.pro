@@ -0,0 +1,644 @@
+; docformat = 'rst'
+
+;+
+; Client of the request/response protocol served by `MGnetRPCServer`.
+;
+; Connections to each server are kept open in a pool and reused, so a call
+; does not pay for a TCP handshake. Each request is tagged with an identifier;
+; several requests can be in flight on the same connection at once, and
+; responses are matched to their requests in whatever order they arrive.
+; Requests go out on the connection to the server with the fewest requests in
+; flight; a new connection is opened when all of them have `MAX_PIPELINE`
+; requests in flight, up to `MAX_CONNECTIONS` connections to each server.
+;
+; Idle connections the server has closed are not reused. A request lost with
+; its connection before any response arrived on it is sent once more on
+; another connection, so methods should be safe to call twice.
+;
+; The status of a request is 0 for success, 1 if the server reported an
+; error, 2 if the request timed out, 3 if the connection was lost, and -1 for
+; an unknown request identifier.
+;
+; :Categories:
+;   networking
+;
+; :Examples:
+;   Make a call and wait for the response::
+;
+;     client = obj_new('MGnetRPCClient', timeout=5.0)
+;     sum = client->call('localhost', 7000L, 'add', [1, 2], status=status)
+;
+;   Or send several requests before waiting for their responses::
+;
+;     ids = lon64arr(10)
+;     for i = 0L, 9L do ids[i] = client->send('localhost', 7000L, 'add', [i, 1])
+;     for i = 0L, 9L do print, client->receive(ids[i])
+;
+; :Properties:
+;   max_connections : type=long
+;     most connections to open to each server, default 2
+;   max_pipeline : type=long
+;     number of requests in flight on each connection before another
+;     connection is opened, default 16
+;   n_connections : type=long
+;     number of open connections
+;   n_pending : type=long
+;     number of requests sent whose responses have not been retrieved
+;   timeout : type=double
+;     default time, in seconds, to wait for a response, default 10.0
+;-
+
+
+;= helper methods
+
+;+
+; Returns a pooled connection to a server, opening a new one if needed.
+;
+; :Private:
+;
+; :Returns:
+;   socket, or -1L if no connection could be opened
+;
+; :Params:
+;   host : in, required, type=string or ulong
+;     server hostname or host identifier from `MG_NET_NAME2HOST`
+;   port : in, required, type=long
+;     server port
+;-
+function mgnetrpcclient::_connection, host, port
+  compile_opt strictarr
+
+  key = strtrim(host[0], 2) + ':' + strtrim(port[0], 2)
+
+  ; an idle connection is only readable if the server has closed it
+  if (self.pool->hasKey(key)) then begin
+    foreach socket, self.pool[key] do begin
+      if (self.counts[socket] gt 0L) then continue
+      ready = mg_net_select(socket, 0.0D)
+      if (size(ready, /n_dimensions) gt 0L) then self->_drop, socket
+    endforeach
+  endif
+  sockets = self.pool->hasKey(key) ? self.pool[key] : lonarr(0)
+
+  ; pick the connection with the fewest requests in flight
+  best = -1L
+  best_n = 0L
+  for s = 0L, n_elements(sockets) - 1L do begin
+    n = self.counts[sockets[s]]
+    if (best lt 0L || n lt best_n) then begin
+      best = sockets[s]
+      best_n = n
+    endif
+  endfor
+
+  if (best ge 0L && (best_n lt self.max_pipeline $
+                     || n_elements(sockets) ge self.max_connections)) then begin
+    return, best
+  endif
+
+  host_id = size(host, /type) eq 13L ? host[0] : mg_net_name2host(host[0])
+  socket = mg_net_connect(host_id, port[0], /tcp, /nodelay)
+  if (socket lt 0L) then return, best
+
+  self.pool[key] = [sockets, socket]
+  self.counts[socket] = 0L
+  self.keys[socket] = key
+
+  return, socket
+end
+
+
+;+
+; Sends a request on a pooled connection to a server.
+;
+; :Private:
+;
+; :Returns:
+;   socket the request was sent on, or -1L if it could not be sent
+;
+; :Params:
+;   id : in, required, type=long64
+;     request identifier
+;   host : in, required, type=string or ulong
+;     server hostname or host identifier from `MG_NET_NAME2HOST`
+;   port : in, required, type=long
+;     server port
+;   method : in, required, type=string
+;     name of the method registered with the server
+;   argument : in, optional, type=any
+;     argument of the method
+;-
+function mgnetrpcclient::_transmit, id, host, port, method, argument
+  compile_opt strictarr
+
+  has_argument = n_elements(argument) gt 0L
+
+  ; a pooled connection may have been closed by the server, so try once more
+  ; on a new connection
+  for attempt = 0L, 1L do begin
+    socket = self->_connection(host, port)
+    if (socket lt 0L) then return, -1L
+
+    header = [1LL, id, long64(has_argument)]
+    ok = mg_net_sendvar(socket, header, /more) eq 1L
+    if (ok) then ok = mg_net_sendvar(socket, string(method), more=has_argument) eq 1L
+    if (ok && has_argument) then ok = mg_net_sendvar(socket, argument) eq 1L
+    if (ok) then break
+
+    self->_drop, socket
+    if (attempt eq 1L) then return, -1L
+  endfor
+
+  self.counts[socket] = self.counts[socket] + 1L
+
+  return, socket
+end
+
+
+;+
+; Closes a connection and fails the requests in flight on it. If no response
+; had arrived on the connection, its requests are sent once more instead.
+;
+; :Private:
+;
+; :Params:
+;   socket : in, required, type=long
+;     socket of the connection
+;
+; :Keywords:
+;   no_retry : in, optional, type=boolean
+;     set to fail the requests in flight without sending them again
+;-
+pro mgnetrpcclient::_drop, socket, no_retry=no_retry
+  compile_opt strictarr
+
+  err = mg_net_close(socket)
+
+  key = self.keys[socket]
+  sockets = self.pool[key]
+  keep = where(sockets ne socket, n_keep)
+  if (n_keep gt 0L) then self.pool[key] = sockets[keep] else self.pool->remove, key
+  self.counts->remove, socket
+  self.keys->remove, socket
+  replied = self.replied->hasKey(socket)
+  if (replied) then self.replied->remove, socket
+
+  retries = list()
+  ids = self.requests->keys()
+  foreach id, ids do begin
+    r = self.requests[id]
+    if (r.socket ne socket || r.done) then continue
+    if (~replied && ~r.retried && ~keyword_set(no_retry)) then retries->add, id
+    r.done = 1B
+    r.status = 3L
+    r.message = 'connection lost'
+    self.requests[id] = r
+  endforeach
+  obj_destroy, ids
+
+  foreach id, retries do begin
+    r = self.requests[id]
+    if (ptr_valid(r.argument)) then begin
+      retry_socket = self->_transmit(id, r.host, r.port, r.method, *r.argument)
+    endif else begin
+      retry_socket = self->_transmit(id, r.host, r.port, r.method)
+    endelse
+    if (retry_socket lt 0L) then continue
+
+    r.socket = retry_socket
+    r.done = 0B
+    r.status = 0L
+    r.message = ''
+    r.retried = 1B
+    self.requests[id] = r
+  endforeach
+  obj_destroy, retries
+end
+
+
+;+
+; Reads a response from a connection and stores it with its request.
+;
+; :Private:
+;
+; :Returns:
+;   1 if a response was read, 0 if the connection was lost
+;
+; :Params:
+;   socket : in, required, type=long
+;     socket of the connection
+;   timeout : in, required, type=double
+;     seconds to wait for the whole response; the connection is dropped if it
+;     has not arrived by then
+;-
+function mgnetrpcclient::_read, socket, timeout
+  compile_opt strictarr
+
+  if (~self.replied->hasKey(socket)) then begin
+    err = mg_net_query(socket, available_bytes=n_available)
+    if (err ge 0L && n_available gt 0L) then self.replied[socket] = 1B
+  endif
+
+  deadline = systime(/seconds) + timeout
+  if (mg_net_recvvar(socket, header, timeout=timeout) ne 1L $
+        || n_elements(header) ne 4L || header[0] ne 2LL) then begin
+    self->_expire
+    self->_drop, socket
+    return, 0
+  endif
+  if (header[3] ne 0LL) then begin
+    if (mg_net_recvvar(socket, value, $
+                       timeout=(deadline - systime(/seconds)) > 0.001D) ne 1L) then begin
+      self->_expire
+      self->_drop, socket
+      return, 0
+    endif
+  endif
+
+  self.counts[socket] = self.counts[socket] - 1L
+
+  ; responses to requests that timed out or were never made are dropped
+  id = header[1]
+  if (~self.requests->hasKey(id)) then return, 1
+  r = self.requests[id]
+  if (r.done) then return, 1
+
+  r.done = 1B
+  if (header[2] eq 0LL) then begin
+    r.status = 0L
+    if (header[3] ne 0LL) then r.result = ptr_new(value, /no_copy)
+  endif else begin
+    r.status = 1L
+    r.message = header[3] ne 0LL ? strjoin(string(value)) : 'remote error'
+  endelse
+  self.requests[id] = r
+
+  return, 1
+end
+
+
+;+
+; Marks requests whose time is up as timed out.
+;
+; :Private:
+;-
+pro mgnetrpcclient::_expire
+  compile_opt strictarr
+
+  now = systime(/seconds)
+  ids = self.requests->keys()
+  foreach id, ids do begin
+    r = self.requests[id]
+    if (r.done || r.deadline gt now) then continue
+    r.done = 1B
+    r.status = 2L
+    r.message = 'request timed out'
+    self.requests[id] = r
+  endforeach
+  obj_destroy, ids
+end
+
+
+;+
+; Returns the time left until the earliest deadline of the requests in flight.
+;
+; :Private:
+;
+; :Returns:
+;   seconds, at least 1 ms
+;-
+function mgnetrpcclient::_timeLeft
+  compile_opt strictarr
+
+  deadline = systime(/seconds) + self.timeout
+  foreach r, self.requests do begin
+    if (~r.done) then deadline <= r.deadline
+  endforeach
+
+  return, (deadline - systime(/seconds)) > 0.001D
+end
+
+
+;+
+; Reads the responses that arrive within a given time.
+;
+; :Private:
+;
+; :Params:
+;   timeout : in, required, type=double
+;     seconds to wait for a response to arrive
+;-
+pro mgnetrpcclient::_poll, timeout
+  compile_opt strictarr
+
+  ; wait on the connections with requests in flight
+  if (self.counts->count() gt 0L) then begin
+    keys = self.counts->keys()
+    values = self.counts->values()
+    sockets = keys->toArray()
+    counts = values->toArray()
+    obj_destroy, [keys, values]
+    busy = where(counts gt 0L, n_busy)
+    if (n_busy gt 0L) then begin
+      ready = mg_net_select(sockets[busy], timeout > 0.0D)
+      if (size(ready, /n_dimensions) gt 0L) then begin
+        foreach socket, ready do begin
+          ; read all the pipelined responses that have arrived, without
+          ; waiting on a stalled server past the time of its requests
+          while (self->_read(socket, self->_timeLeft())) do begin
+            err = mg_net_query(socket, available_bytes=n_available)
+            if (err lt 0L || n_available le 0L) then break
+          endwhile
+        endforeach
+      endif
+    endif
+  endif
+
+  self->_expire
+end
+
+
+;= API
+
+;+
+; Sends a request without waiting for its response.
+;
+; :Returns:
+;   request identifier to pass to `receive` or `test`, or -1LL if the request
+;   could not be sent
+;
+; :Params:
+;   host : in, required, type=string or ulong
+;     server hostname or host identifier from `MG_NET_NAME2HOST`
+;   port : in, required, type=long
+;     server port
+;   method : in, required, type=string
+;     name of the method registered with the server
+;   argument : in, optional, type=any
+;     argument of the method, any variable `MG_NET_SENDVAR` can send
+;
+; :Keywords:
+;   timeout : in, optional, type=double
+;     seconds to wait for the response, default is the `TIMEOUT` property
+;-
+function mgnetrpcclient::send, host, port, method, argument, timeout=timeout
+  compile_opt strictarr
+
+  id = self.next_id + 1LL
+  socket = self->_transmit(id, host, port, method, argument)
+  if (socket lt 0L) then return, -1LL
+
+  self.next_id = id
+  _timeout = n_elements(timeout) gt 0L ? double(timeout) : self.timeout
+  ; keep what is needed to send the request again if its connection is lost
+  self.requests[id] = { socket: socket, $
+                        deadline: systime(/seconds) + _timeout, $
+                        done: 0B, $
+                        status: 0L, $
+                        result: ptr_new(), $
+                        message: '', $
+                        host: host[0], $
+                        port: long(port[0]), $
+                        method: string(method), $
+                        argument: n_elements(argument) gt 0L ? ptr_new(argument) : ptr_new(), $
+                        retried: 0B }
+
+  return, id
+end
+
+
+;+
+; Determines whether the response to a request has arrived, without waiting.
+;
+; :Returns:
+;   1 if the request is complete, 0 if not
+;
+; :Params:
+;   id : in, required, type=long64
+;     request identifier returned by `send`
+;-
+function mgnetrpcclient::test, id
+  compile_opt strictarr
+
+  _id = long64(id)
+  self->_poll, 0.0D
+  if (~self.requests->hasKey(_id)) then return, 0
+  return, (self.requests[_id]).done
+end
+
+
+;+
+; Waits for the response to a request.
+;
+; :Returns:
+;   result of the method, `!null` if it failed or returned nothing
+;
+; :Params:
+;   id : in, required, type=long64
+;     request identifier returned by `send`
+;
+; :Keywords:
+;   status : out, optional, type=long
+;     status of the request: 0 for success, 1 for an error reported by the
+;     server, 2 for timeout, 3 if the connection was lost, -1 for an unknown
+;     request
+;   error_message : out, optional, type=string
+;     error message if `status` is not 0
+;-
+function mgnetrpcclient::receive, id, status=status, error_message=error_message
+  compile_opt strictarr
+
+  _id = long64(id)
+  if (~self.requests->hasKey(_id)) then begin
+    status = -1L
+    error_message = 'unknown request'
+    return, !null
+  endif
+
+  while (~(self.requests[_id]).done) do begin
+    wait_time = (self.requests[_id]).deadline - systime(/seconds)
+    self->_poll, wait_time < 1.0D
+  endwhile
+
+  r = self.requests[_id]
+  self.requests->remove, _id
+
+  ptr_free, r.argument
+  status = r.status
+  error_message = r.message
+  if (~ptr_valid(r.result)) then return, !null
+  result = *r.result
+  ptr_free, r.result
+
+  return, result
+end
+
+
+;+
+; Sends a request and waits for its response.
+;
+; :Returns:
+;   result of the method, `!null` if it failed or returned nothing
+;
+; :Params:
+;   host : in, required, type=string or ulong
+;     server hostname or host identifier from `MG_NET_NAME2HOST`
+;   port : in, required, type=long
+;     server port
+;   method : in, required, type=string
+;     name of the method registered with the server
+;   argument : in, optional, type=any
+;     argument of the method
+;
+; :Keywords:
+;   timeout : in, optional, type=double
+;     seconds to wait for the response, default is the `TIMEOUT` property
+;   status : out, optional, type=long
+;     status of the request, see `receive`
+;   error_message : out, optional, type=string
+;     error message if `status` is not 0
+;-
+function mgnetrpcclient::call, host, port, method, argument, $
+                               timeout=timeout, $
+                               status=status, error_message=error_message
+  compile_opt strictarr
+
+  id = self->send(host, port, method, argument, timeout=timeout)
+  if (id lt 0LL) then begin
+    status = 3L
+    error_message = 'unable to send request'
+    return, !null
+  endif
+
+  return, self->receive(id, status=status, error_message=error_message)
+end
+
+
+;+
+; Closes all connections; requests in flight fail.
+;-
+pro mgnetrpcclient::close
+  compile_opt strictarr
+
+  sockets = self.counts->keys()
+  foreach socket, sockets do self->_drop, socket, /no_retry
+  obj_destroy, sockets
+end
+
+
+;= property access
+
+;+
+; Set properties.
+;-
+pro mgnetrpcclient::setProperty, max_connections=max_connections, $
+                                 max_pipeline=max_pipeline, $
+                                 timeout=timeout
+  compile_opt strictarr
+
+  if (n_elements(max_connections) gt 0L) then self.max_connections = max_connections > 1L
+  if (n_elements(max_pipeline) gt 0L) then self.max_pipeline = max_pipeline > 1L
+  if (n_elements(timeout) gt 0L) then self.timeout = timeout
+end
+
+
+;+
+; Get properties.
+;-
+pro mgnetrpcclient::getProperty, max_connections=max_connections, $
+                                 max_pipeline=max_pipeline, $
+                                 n_connections=n_connections, $
+                                 n_pending=n_pending, $
+                                 timeout=timeout
+  compile_opt strictarr
+
+  max_connections = self.max_connections
+  max_pipeline = self.max_pipeline
+  n_connections = self.counts->count()
+  n_pending = self.requests->count()
+  timeout = self.timeout
+end
+
+
+;= lifecycle methods
+
+;+
+; Free resources, closing all connections.
+;-
+pro mgnetrpcclient::cleanup
+  compile_opt strictarr
+
+  self->close
+  foreach r, self.requests do ptr_free, r.result, r.argument
+  obj_destroy, [self.pool, self.counts, self.keys, self.replied, self.requests]
+end
+
+
+;+
+; Create a client.
+;
+; :Returns:
+;   1 for success, 0 for failure
+;
+; :Keywords:
+;   _extra : in, optional, type=keywords
+;     properties
+;-
+function mgnetrpcclient::init, _extra=e
+  compile_opt strictarr
+
+  self.pool = hash()
+  self.counts = hash()
+  self.keys = hash()
+  self.replied = hash()
+  self.requests = hash()
+
+  self.max_connections = 2L
+  self.max_pipeline = 16L
+  self.timeout = 10.0D
+
+  self->setProperty, _extra=e
+
+  return, 1
+end
+
+
+;+
+; Define instance variables.
+;
+; :Fields:
+;   pool
+;     hash of "host:port" keys to arrays of the sockets connected to them
+;   counts
+;     hash of sockets to the number of requests in flight on them
+;   keys
+;     hash of sockets to their "host:port" keys
+;   replied
+;     hash of the sockets on which response bytes have arrived
+;   requests
+;     hash of request identifiers to structures holding their socket, deadline,
+;     what is needed to send them again and, once complete, status and result
+;   next_id
+;     identifier of the last request sent
+;   max_connections
+;     most connections to each server
+;   max_pipeline
+;     requests in flight on a connection before another is opened
+;   timeout
+;     default seconds to wait for a response
+;-
+pro mgnetrpcclient__define
+  compile_opt strictarr
+
+  define = { MGnetRPCClient, $
+             pool: obj_new(), $
+             counts: obj_new(), $
+             keys: obj_new(), $
+             replied: obj_new(), $
+             requests: obj_new(), $
+             next_id: 0LL, $
+             max_connections: 0L, $
+             max_pipeline: 0L, $
+             timeout: 0.0D $
+           }
+end
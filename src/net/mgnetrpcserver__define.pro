@@ -0,0 +1,454 @@
+; docformat = 'rst'
+
+;+
+; Server of a request/response protocol over `MG_NET_SENDVAR` and
+; `MG_NET_RECVVAR`, for clients using `MGnetRPCClient`.
+;
+; Methods are registered by name with the IDL function, or object method,
+; that handles them. The function is called with the argument of the request,
+; if it has one, and its return value is sent back as the response; an error
+; in the function is sent back as an error message. Results must be variables
+; `MG_NET_SENDVAR` can send.
+;
+; A method registered with `DEFERRED` set is also passed a `REQUEST` keyword
+; and its return value is ignored: the response is sent later, by passing
+; `REQUEST` to `respond`. Responses can then go out in a different order than
+; the requests came in, and clients match them by request identifier.
+;
+; Each request is sent as three variables: a `LONG64` header `[1, id,
+; has_argument]`, the method name, and the argument if there is one. Each
+; response is a `LONG64` header `[2, id, status, has_value]`, where status is
+; 0 for success and 1 for error, followed by the result or error message if
+; there is one. Clients may send many requests on a connection before reading
+; the responses.
+;
+; :Categories:
+;   networking
+;
+; :Examples:
+;   Serve an "add" method for a minute::
+;
+;     server = obj_new('MGnetRPCServer', port=7000L)
+;     server->register, 'add', 'total'
+;     server->run, timeout=60.0
+;     obj_destroy, server
+;
+; :Properties:
+;   n_connections : type=long
+;     number of open client connections
+;   n_requests : type=long64
+;     number of requests handled
+;   port : type=long
+;     port the server listens on
+;   timeout : type=double
+;     seconds to wait for each part of a request once it has started to
+;     arrive before closing the connection, default 10.0
+;-
+
+
+;= helper methods
+
+;+
+; Closes a client connection.
+;
+; :Private:
+;
+; :Params:
+;   socket : in, required, type=long
+;     socket of the connection
+;-
+pro mgnetrpcserver::_close, socket
+  compile_opt strictarr
+
+  err = mg_net_close(socket)
+  if (self.connections->hasKey(socket)) then self.connections->remove, socket
+end
+
+
+;+
+; Sends a response. The response is dropped if the connection it belongs to
+; has been closed, even if its socket has since been reused by a new one.
+;
+; :Private:
+;
+; :Params:
+;   socket : in, required, type=long
+;     socket of the connection
+;   serial : in, required, type=long64
+;     serial of the connection
+;   id : in, required, type=long64
+;     request identifier
+;   status : in, required, type=long
+;     0 for success, 1 for error
+;   value : in, optional, type=any
+;     result, or error message if `status` is 1
+;-
+pro mgnetrpcserver::_send, socket, serial, id, status, value
+  compile_opt strictarr
+
+  if (~self.connections->hasKey(socket)) then return
+  if (self.connections[socket] ne serial) then return
+
+  ; once the header is out, a failure leaves the connection out of step
+  error = 0L
+  catch, error
+  if (error ne 0L) then begin
+    catch, /cancel
+    self->_close, socket
+    return
+  endif
+
+  ; refuse what cannot be sent before the header goes out
+  _status = status
+  if (n_elements(value) gt 0L) then _value = value
+  type = size(value, /type)
+  if (type eq 10L || type eq 11L) then begin
+    _status = 1L
+    _value = 'result is a pointer or object'
+  endif
+
+  has_value = n_elements(_value) gt 0L
+  header = [2LL, id, long64(_status), long64(has_value)]
+  ok = mg_net_sendvar(socket, header, more=has_value) eq 1L
+  if (ok && has_value) then ok = mg_net_sendvar(socket, _value) eq 1L
+  if (~ok) then self->_close, socket
+end
+
+
+;+
+; Reads and handles a request.
+;
+; :Private:
+;
+; :Returns:
+;   1 if a request was read, 0 if the connection was closed
+;
+; :Params:
+;   socket : in, required, type=long
+;     socket of the connection
+;-
+function mgnetrpcserver::_handle, socket
+  compile_opt strictarr
+
+  ; a client that stalls part way through a request is dropped rather than
+  ; holding up every other connection
+  if (mg_net_recvvar(socket, header, timeout=self.timeout) ne 1L $
+        || n_elements(header) ne 3L || header[0] ne 1LL $
+        || mg_net_recvvar(socket, method, timeout=self.timeout) ne 1L) then begin
+    self->_close, socket
+    return, 0
+  endif
+  has_argument = header[2] ne 0LL
+  if (has_argument) then begin
+    if (mg_net_recvvar(socket, argument, timeout=self.timeout) ne 1L) then begin
+      self->_close, socket
+      return, 0
+    endif
+  endif
+
+  id = header[1]
+  serial = self.connections[socket]
+  self.n_requests++
+
+  key = strlowcase(method[0])
+  if (~self.methods->hasKey(key)) then begin
+    self->_send, socket, serial, id, 1L, 'unknown method ' + method[0]
+    return, 1
+  endif
+  m = self.methods[key]
+
+  error = 0L
+  catch, error
+  if (error ne 0L) then begin
+    catch, /cancel
+    self->_send, socket, serial, id, 1L, !error_state.msg
+    return, 1
+  endif
+
+  if (m.deferred) then begin
+    request = [long64(socket), id, serial]
+    if (obj_valid(m.object)) then begin
+      if (has_argument) then begin
+        void = call_method(m.routine, m.object, argument, request=request)
+      endif else begin
+        void = call_method(m.routine, m.object, request=request)
+      endelse
+    endif else begin
+      if (has_argument) then begin
+        void = call_function(m.routine, argument, request=request)
+      endif else begin
+        void = call_function(m.routine, request=request)
+      endelse
+    endelse
+  endif else begin
+    if (obj_valid(m.object)) then begin
+      result = has_argument $
+                 ? call_method(m.routine, m.object, argument) $
+                 : call_method(m.routine, m.object)
+    endif else begin
+      result = has_argument $
+                 ? call_function(m.routine, argument) $
+                 : call_function(m.routine)
+    endelse
+    self->_send, socket, serial, id, 0L, result
+  endelse
+
+  catch, /cancel
+
+  return, 1
+end
+
+
+;= API
+
+;+
+; Registers a method.
+;
+; :Params:
+;   name : in, required, type=string
+;     name clients call the method by, case insensitive
+;   routine : in, required, type=string
+;     name of the function, or method of `OBJECT`, that handles the method
+;
+; :Keywords:
+;   object : in, optional, type=object
+;     object whose method `routine` handles the method
+;   deferred : in, optional, type=boolean
+;     set if `routine` sends its response later with `respond`; it is passed
+;     a `REQUEST` keyword to pass on to `respond`
+;-
+pro mgnetrpcserver::register, name, routine, object=object, deferred=deferred
+  compile_opt strictarr
+
+  self.methods[strlowcase(name)] = { routine: routine, $
+                                     object: n_elements(object) gt 0L ? object : obj_new(), $
+                                     deferred: keyword_set(deferred) }
+end
+
+
+;+
+; Sends the response to a request handled by a deferred method. The response
+; is dropped if the connection of the request has been closed.
+;
+; :Params:
+;   request : in, required, type=lon64arr
+;     value of the `REQUEST` keyword passed to the deferred method
+;   result : in, optional, type=any
+;     result of the method
+;
+; :Keywords:
+;   error_message : in, optional, type=string
+;     set to send an error instead of a result
+;-
+pro mgnetrpcserver::respond, request, result, error_message=error_message
+  compile_opt strictarr
+
+  socket = long(request[0])
+  if (n_elements(error_message) gt 0L) then begin
+    self->_send, socket, request[2], request[1], 1L, error_message
+  endif else begin
+    self->_send, socket, request[2], request[1], 0L, result
+  endelse
+end
+
+
+;+
+; Accepts connections and handles the requests that arrive within a given
+; time.
+;
+; :Returns:
+;   number of requests handled
+;
+; :Params:
+;   timeout : in, optional, type=double, default=0.0
+;     seconds to wait for a request or connection
+;-
+function mgnetrpcserver::step, timeout
+  compile_opt strictarr
+
+  _timeout = n_elements(timeout) gt 0L ? double(timeout) : 0.0D
+
+  sockets = self.listener
+  if (self.connections->count() gt 0L) then begin
+    keys = self.connections->keys()
+    sockets = [sockets, keys->toArray()]
+    obj_destroy, keys
+  endif
+
+  ready = mg_net_select(sockets, _timeout)
+  if (size(ready, /n_dimensions) eq 0L) then return, 0L
+
+  n_handled = 0L
+  foreach socket, ready do begin
+    if (socket eq self.listener) then begin
+      connection = mg_net_accept(self.listener, /nodelay)
+      if (connection ge 0L) then self.connections[connection] = ++self.next_serial
+      continue
+    endif
+
+    ; handle all the pipelined requests that have arrived
+    while (self->_handle(socket)) do begin
+      n_handled++
+      if (self.stopped) then break
+      err = mg_net_query(socket, available_bytes=n_available)
+      if (err lt 0L || n_available le 0L) then break
+    endwhile
+    if (self.stopped) then break
+  endforeach
+
+  return, n_handled
+end
+
+
+;+
+; Handles requests until stopped.
+;
+; :Keywords:
+;   timeout : in, optional, type=double
+;     seconds to serve for, default is until `stop` is called
+;   n_requests : in, optional, type=long
+;     number of requests to handle before returning
+;-
+pro mgnetrpcserver::run, timeout=timeout, n_requests=n_requests
+  compile_opt strictarr
+
+  self.stopped = 0B
+  start = systime(/seconds)
+  n_handled = 0L
+
+  while (~self.stopped) do begin
+    wait_time = 1.0D
+    if (n_elements(timeout) gt 0L) then begin
+      wait_time = (start + timeout - systime(/seconds)) < wait_time
+      if (wait_time lt 0.0D) then break
+    endif
+
+    n_handled += self->step(wait_time)
+    if (n_elements(n_requests) gt 0L && n_handled ge n_requests) then break
+  endwhile
+end
+
+
+;+
+; Stops `run`, for example from a method handling a request.
+;-
+pro mgnetrpcserver::stop
+  compile_opt strictarr
+
+  self.stopped = 1B
+end
+
+
+;= property access
+
+;+
+; Set properties.
+;-
+pro mgnetrpcserver::setProperty, timeout=timeout
+  compile_opt strictarr
+
+  if (n_elements(timeout) gt 0L) then self.timeout = timeout
+end
+
+
+;+
+; Get properties.
+;-
+pro mgnetrpcserver::getProperty, n_connections=n_connections, $
+                                 n_requests=n_requests, $
+                                 port=port, $
+                                 timeout=timeout
+  compile_opt strictarr
+
+  n_connections = self.connections->count()
+  n_requests = self.n_requests
+  port = self.port
+  timeout = self.timeout
+end
+
+
+;= lifecycle methods
+
+;+
+; Free resources, closing the listener and all connections.
+;-
+pro mgnetrpcserver::cleanup
+  compile_opt strictarr
+
+  sockets = self.connections->keys()
+  foreach socket, sockets do err = mg_net_close(socket)
+  obj_destroy, sockets
+  if (self.listener ge 0L) then err = mg_net_close(self.listener)
+  obj_destroy, [self.connections, self.methods]
+end
+
+
+;+
+; Create a server listening for connections.
+;
+; :Returns:
+;   1 for success, 0 for failure
+;
+; :Keywords:
+;   port : in, optional, type=long, default=0
+;     port to listen on; the OS selects an open port if 0, see the `PORT`
+;     property
+;   _extra : in, optional, type=keywords
+;     properties
+;-
+function mgnetrpcserver::init, port=port, _extra=e
+  compile_opt strictarr
+
+  self.connections = hash()
+  self.methods = hash()
+  self.timeout = 10.0D
+
+  self->setProperty, _extra=e
+
+  self.listener = mg_net_createport(n_elements(port) gt 0L ? long(port) : 0L, /tcp)
+  if (self.listener lt 0L) then begin
+    message, 'unable to create listener', /continue
+    return, 0
+  endif
+  err = mg_net_query(self.listener, local_port=local_port)
+  self.port = local_port
+
+  return, 1
+end
+
+
+;+
+; Define instance variables.
+;
+; :Fields:
+;   listener
+;     socket listening for connections
+;   port
+;     port of `listener`
+;   connections
+;     hash of the sockets of client connections to their serials
+;   next_serial
+;     serial of the last connection accepted
+;   methods
+;     hash of method names to structures of their handlers
+;   n_requests
+;     number of requests handled
+;   stopped
+;     set by `stop` to end `run`
+;   timeout
+;     seconds to wait for each part of a request
+;-
+pro mgnetrpcserver__define
+  compile_opt strictarr
+
+  define = { MGnetRPCServer, $
+             listener: 0L, $
+             port: 0L, $
+             connections: obj_new(), $
+             next_serial: 0LL, $
+             methods: obj_new(), $
+             n_requests: 0LL, $
+             stopped: 0B, $
+             timeout: 0.0D $
+           }
+end
@@ -3,6 +3,9 @@
 ;+
 ; Intersecy two ranges together to get a new range.
 ;
+; To combine large sets of ranges at once, use `MG_INTERVAL_INTERSECT` from
+; the `mg_stats` DLM.
+;
 ; :Returns:
 ;   2-element numeric array or `!null`
 ;
@@ -3,6 +3,9 @@
 ;+
 ; Union two ranges together to get a new range.
 ;
+; To combine large sets of ranges at once, use `MG_INTERVAL_UNION` from
+; the `mg_stats` DLM.
+;
 ; :Returns:
 ;   2-element numeric array
 ;
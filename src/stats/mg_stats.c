@@ -0,0 +1,742 @@
+/*
+  Interval set routines: union, intersection, difference, coverage, and
+  stabbing queries over large sets of closed intervals, plus a persistent
+  interval tree for repeated point and interval lookups.
+
+  Intervals are passed as `2 x n` arrays of `[start, end]` pairs. They are
+  treated as closed: touching intervals are merged by a union and overlap in
+  a single point for an intersection. Intervals with `end < start` or NaN
+  endpoints are ignored.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mg_idl_export.h"
+
+
+typedef struct {
+  double start;
+  double end;
+} mg_interval;
+
+
+/**************************************************************************
+  Sorted-sweep helpers
+***************************************************************************/
+
+static int mg_interval_cmp(const void *a, const void *b) {
+  const mg_interval *ia = (const mg_interval *) a;
+  const mg_interval *ib = (const mg_interval *) b;
+
+  if (ia->start < ib->start) return -1;
+  if (ia->start > ib->start) return 1;
+  if (ia->end < ib->end) return -1;
+  if (ia->end > ib->end) return 1;
+  return 0;
+}
+
+
+static int mg_double_cmp(const void *a, const void *b) {
+  double da = *(const double *) a, db = *(const double *) b;
+  return da < db ? -1 : (da > db ? 1 : 0);
+}
+
+
+/*
+  Convert an interval argument to an array of valid intervals. The result
+  must be freed by the caller. If index is not NULL, it receives the element
+  index in the argument of each returned interval.
+*/
+static mg_interval *mg_interval_get(IDL_VPTR arg, const char *name,
+                                    IDL_MEMINT *n, IDL_MEMINT **index) {
+  IDL_VPTR darg;
+  double *data;
+  IDL_MEMINT n_elts, i, k;
+  mg_interval *intervals;
+
+  IDL_ENSURE_SIMPLE(arg);
+  if (!(arg->flags & IDL_V_ARR) || arg->value.arr->n_elts % 2 != 0
+      || (arg->value.arr->n_dim > 1 && arg->value.arr->dim[0] != 2)) {
+    IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                "%s must be a 2 x n array of intervals", name);
+  }
+
+  darg = arg->type == IDL_TYP_DOUBLE ? arg : IDL_CvtDbl(1, &arg);
+  data = (double *) darg->value.arr->data;
+  n_elts = darg->value.arr->n_elts / 2;
+
+  intervals = (mg_interval *) malloc((n_elts > 0 ? n_elts : 1) * sizeof(mg_interval));
+  if (index) *index = (IDL_MEMINT *) malloc((n_elts > 0 ? n_elts : 1) * sizeof(IDL_MEMINT));
+  if (!intervals || (index && !*index)) {
+    if (darg != arg) IDL_Deltmp(darg);
+    free(intervals);
+    if (index) free(*index);
+    IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                "unable to allocate memory for %s", name);
+  }
+
+  // NaN endpoints fail the comparison, so they are dropped here as well
+  for (i = 0, k = 0; i < n_elts; i++) {
+    if (data[2 * i] <= data[2 * i + 1]) {
+      intervals[k].start = data[2 * i];
+      intervals[k].end = data[2 * i + 1];
+      if (index) (*index)[k] = i;
+      k++;
+    }
+  }
+
+  if (darg != arg) IDL_Deltmp(darg);
+
+  *n = k;
+  return intervals;
+}
+
+
+// sort by start unless already sorted, the common case for time windows
+static void mg_interval_sort(mg_interval *intervals, IDL_MEMINT n) {
+  IDL_MEMINT i;
+
+  for (i = 1; i < n; i++) {
+    if (mg_interval_cmp(&intervals[i - 1], &intervals[i]) > 0) {
+      qsort(intervals, n, sizeof(mg_interval), mg_interval_cmp);
+      return;
+    }
+  }
+}
+
+
+// sort and merge overlapping or touching intervals in place, returns the
+// number of disjoint intervals left
+static IDL_MEMINT mg_interval_normalize(mg_interval *intervals, IDL_MEMINT n) {
+  IDL_MEMINT i, m;
+
+  if (n == 0) return 0;
+  mg_interval_sort(intervals, n);
+
+  for (i = 1, m = 0; i < n; i++) {
+    if (intervals[i].start <= intervals[m].end) {
+      if (intervals[i].end > intervals[m].end) intervals[m].end = intervals[i].end;
+    } else {
+      intervals[++m] = intervals[i];
+    }
+  }
+
+  return m + 1;
+}
+
+
+// intersect two normalized sets, result has room for na + nb intervals
+static IDL_MEMINT mg_interval_intersect(const mg_interval *a, IDL_MEMINT na,
+                                        const mg_interval *b, IDL_MEMINT nb,
+                                        mg_interval *result) {
+  IDL_MEMINT i = 0, j = 0, m = 0;
+  double lo, hi;
+
+  while (i < na && j < nb) {
+    lo = a[i].start > b[j].start ? a[i].start : b[j].start;
+    hi = a[i].end < b[j].end ? a[i].end : b[j].end;
+    if (lo <= hi) {
+      result[m].start = lo;
+      result[m++].end = hi;
+    }
+    if (a[i].end < b[j].end) i++; else j++;
+  }
+
+  return m;
+}
+
+
+// remove a normalized set b from a normalized set a, result has room for
+// na + nb intervals; pieces of zero length left over are dropped
+static IDL_MEMINT mg_interval_difference(const mg_interval *a, IDL_MEMINT na,
+                                         const mg_interval *b, IDL_MEMINT nb,
+                                         mg_interval *result) {
+  IDL_MEMINT i, j = 0, k, m = 0;
+  double current;
+
+  for (i = 0; i < na; i++) {
+    while (j < nb && b[j].end < a[i].start) j++;
+
+    if (j == nb || b[j].start > a[i].end) {
+      result[m++] = a[i];
+      continue;
+    }
+
+    current = a[i].start;
+    for (k = j; k < nb && b[k].start <= a[i].end; k++) {
+      if (b[k].start > current) {
+        result[m].start = current;
+        result[m++].end = b[k].start;
+      }
+      if (b[k].end > current) current = b[k].end;
+    }
+    if (current < a[i].end) {
+      result[m].start = current;
+      result[m++].end = a[i].end;
+    }
+  }
+
+  return m;
+}
+
+
+// return m intervals as a 2 x m double array, or -1L if there are none
+static IDL_VPTR mg_interval_result(const mg_interval *intervals, IDL_MEMINT m) {
+  IDL_VPTR result;
+  IDL_MEMINT dims[2] = { 2, m };
+  double *data;
+
+  if (m == 0) return IDL_GettmpLong(-1);
+
+  data = (double *) IDL_MakeTempArray(IDL_TYP_DOUBLE, 2, dims,
+                                      IDL_ARR_INI_NOP, &result);
+  memcpy(data, intervals, m * sizeof(mg_interval));
+  return result;
+}
+
+
+/**************************************************************************
+  Interval set routines
+***************************************************************************/
+
+typedef enum {
+  MG_INTERVAL_UNION,
+  MG_INTERVAL_INTERSECT,
+  MG_INTERVAL_DIFFERENCE
+} mg_interval_op;
+
+
+static IDL_VPTR mg_interval_setop(int argc, IDL_VPTR *argv, char *argk,
+                                  mg_interval_op op) {
+  typedef struct {
+    IDL_KW_RESULT_FIRST_FIELD;
+    IDL_VPTR count;
+    int count_present;
+  } KW_RESULT;
+
+  // make sure to list keyword in alphabetical order
+  static IDL_KW_PAR kw_pars[] = {
+    { "COUNT", IDL_TYP_UNDEF, 1, IDL_KW_OUT | IDL_KW_ZERO,
+      IDL_KW_OFFSETOF(count_present), IDL_KW_OFFSETOF(count) },
+    { NULL }
+  };
+
+  KW_RESULT kw;
+  IDL_VPTR plain_args[2], result;
+  mg_interval *a, *b = NULL, *c;
+  IDL_MEMINT na, nb = 0, m;
+  int nargs;
+
+  nargs = IDL_KWProcessByOffset(argc, argv, argk, kw_pars, plain_args, 1, &kw);
+
+  a = mg_interval_get(plain_args[0], "A", &na, NULL);
+  if (nargs > 1) b = mg_interval_get(plain_args[1], "B", &nb, NULL);
+
+  c = (mg_interval *) malloc((na + nb > 0 ? na + nb : 1) * sizeof(mg_interval));
+  if (!c) {
+    free(a);
+    free(b);
+    IDL_KW_FREE;
+    IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                "unable to allocate memory for result");
+  }
+
+  switch (op) {
+    case MG_INTERVAL_UNION:
+      memcpy(c, a, na * sizeof(mg_interval));
+      if (b) memcpy(c + na, b, nb * sizeof(mg_interval));
+      m = mg_interval_normalize(c, na + nb);
+      break;
+    case MG_INTERVAL_INTERSECT:
+      na = mg_interval_normalize(a, na);
+      nb = mg_interval_normalize(b, nb);
+      m = mg_interval_intersect(a, na, b, nb, c);
+      break;
+    case MG_INTERVAL_DIFFERENCE:
+      na = mg_interval_normalize(a, na);
+      nb = mg_interval_normalize(b, nb);
+      m = mg_interval_difference(a, na, b, nb, c);
+      break;
+  }
+
+  result = mg_interval_result(c, m);
+
+  free(a);
+  free(b);
+  free(c);
+
+  if (kw.count_present) {
+    IDL_ALLTYPES count;
+    count.l64 = m;
+    IDL_StoreScalar(kw.count, IDL_TYP_LONG64, &count);
+  }
+
+  IDL_KW_FREE;
+
+  return result;
+}
+
+
+static IDL_VPTR IDL_CDECL IDL_mg_interval_union(int argc, IDL_VPTR *argv, char *argk) {
+  return mg_interval_setop(argc, argv, argk, MG_INTERVAL_UNION);
+}
+
+
+static IDL_VPTR IDL_CDECL IDL_mg_interval_intersect(int argc, IDL_VPTR *argv, char *argk) {
+  return mg_interval_setop(argc, argv, argk, MG_INTERVAL_INTERSECT);
+}
+
+
+static IDL_VPTR IDL_CDECL IDL_mg_interval_difference(int argc, IDL_VPTR *argv, char *argk) {
+  return mg_interval_setop(argc, argv, argk, MG_INTERVAL_DIFFERENCE);
+}
+
+
+static IDL_VPTR IDL_CDECL IDL_mg_interval_coverage(int argc, IDL_VPTR *argv) {
+  mg_interval *a;
+  IDL_MEMINT na, i;
+  double length = 0.0;
+
+  a = mg_interval_get(argv[0], "A", &na, NULL);
+  na = mg_interval_normalize(a, na);
+  for (i = 0; i < na; i++) length += a[i].end - a[i].start;
+  free(a);
+
+  return IDL_GettmpDouble(length);
+}
+
+
+// number of elements of the sorted array x that are < v (or <= v if
+// inclusive is set)
+static IDL_MEMINT mg_interval_rank(const double *x, IDL_MEMINT n, double v,
+                                   int inclusive) {
+  IDL_MEMINT lo = 0, hi = n, mid;
+
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (x[mid] < v || (inclusive && x[mid] == v)) lo = mid + 1; else hi = mid;
+  }
+  return lo;
+}
+
+
+/*
+  Number of intervals containing each point: the intervals starting at or
+  before the point minus the intervals ending before it.
+*/
+static IDL_VPTR IDL_CDECL IDL_mg_interval_stab(int argc, IDL_VPTR *argv) {
+  mg_interval *a;
+  IDL_MEMINT na, i, n_points;
+  IDL_VPTR points, result;
+  double *starts, *ends, *p;
+  IDL_LONG64 *counts;
+
+  IDL_ENSURE_SIMPLE(argv[1]);
+  a = mg_interval_get(argv[0], "A", &na, NULL);
+
+  starts = (double *) malloc((na > 0 ? na : 1) * sizeof(double));
+  ends = (double *) malloc((na > 0 ? na : 1) * sizeof(double));
+  if (!starts || !ends) {
+    free(a);
+    free(starts);
+    free(ends);
+    IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                "unable to allocate memory");
+  }
+  for (i = 0; i < na; i++) {
+    starts[i] = a[i].start;
+    ends[i] = a[i].end;
+  }
+  free(a);
+  qsort(starts, na, sizeof(double), mg_double_cmp);
+  qsort(ends, na, sizeof(double), mg_double_cmp);
+
+  points = argv[1]->type == IDL_TYP_DOUBLE ? argv[1] : IDL_CvtDbl(1, &argv[1]);
+  if (points->flags & IDL_V_ARR) {
+    n_points = points->value.arr->n_elts;
+    p = (double *) points->value.arr->data;
+    counts = (IDL_LONG64 *) IDL_MakeTempArray(IDL_TYP_LONG64,
+                                              points->value.arr->n_dim,
+                                              points->value.arr->dim,
+                                              IDL_ARR_INI_NOP, &result);
+  } else {
+    n_points = 1;
+    p = &points->value.d;
+    result = IDL_GettmpLong64(0);
+    counts = &result->value.l64;
+  }
+
+  for (i = 0; i < n_points; i++) {
+    counts[i] = mg_interval_rank(starts, na, p[i], 1)
+                  - mg_interval_rank(ends, na, p[i], 0);
+  }
+
+  if (points != argv[1]) IDL_Deltmp(points);
+  free(starts);
+  free(ends);
+
+  return result;
+}
+
+
+/**************************************************************************
+  Interval tree
+
+  An implicit augmented interval tree: the intervals are sorted by start and
+  the sorted array is viewed as a complete binary search tree where the node
+  at index i on level k has children i -/+ 2^(k-1). Each node stores the
+  largest end of its subtree, so subtrees ending before a query are skipped.
+***************************************************************************/
+
+typedef struct {
+  IDL_MEMINT n;
+  int max_level;
+  mg_interval *intervals;  // sorted by start
+  double *max_end;         // largest end in the subtree of each node
+  IDL_MEMINT *index;       // index of each interval in the input array
+} mg_intervaltree;
+
+typedef struct {
+  IDL_MEMINT x;
+  int k;
+  int w;  // set once the left child has been visited
+} mg_intervaltree_node;
+
+typedef struct {
+  mg_interval iv;
+  IDL_MEMINT index;
+} mg_intervaltree_item;
+
+
+static int mg_intervaltree_item_cmp(const void *a, const void *b) {
+  return mg_interval_cmp(&((const mg_intervaltree_item *) a)->iv,
+                         &((const mg_intervaltree_item *) b)->iv);
+}
+
+
+static int mg_intervaltree_index(mg_intervaltree *tree) {
+  IDL_MEMINT i, last_i = 0, x, i0, step, n = tree->n;
+  double last = 0.0, el, er, e;
+  int k;
+
+  if (n == 0) return -1;
+
+  // leaves
+  for (i = 0; i < n; i += 2) {
+    last_i = i;
+    last = tree->max_end[i] = tree->intervals[i].end;
+  }
+
+  // internal nodes, bottom up
+  for (k = 1; ((IDL_MEMINT) 1 << k) <= n; k++) {
+    x = (IDL_MEMINT) 1 << (k - 1);
+    i0 = (x << 1) - 1;
+    step = x << 2;
+    for (i = i0; i < n; i += step) {
+      el = tree->max_end[i - x];
+      er = i + x < n ? tree->max_end[i + x] : last;
+      e = tree->intervals[i].end;
+      if (el > e) e = el;
+      if (er > e) e = er;
+      tree->max_end[i] = e;
+    }
+
+    // move last_i to its parent, updating the largest end of the right edge
+    last_i = (last_i >> k) & 1 ? last_i - x : last_i + x;
+    if (last_i < n && tree->max_end[last_i] > last) last = tree->max_end[last_i];
+  }
+
+  return k - 1;
+}
+
+
+static mg_intervaltree *mg_intervaltree_new(const mg_interval *intervals,
+                                            const IDL_MEMINT *index,
+                                            IDL_MEMINT n) {
+  mg_intervaltree *tree;
+  mg_intervaltree_item *items;
+  IDL_MEMINT i, size = n > 0 ? n : 1;
+
+  tree = (mg_intervaltree *) calloc(1, sizeof(mg_intervaltree));
+  items = (mg_intervaltree_item *) malloc(size * sizeof(mg_intervaltree_item));
+  if (tree) {
+    tree->intervals = (mg_interval *) malloc(size * sizeof(mg_interval));
+    tree->max_end = (double *) malloc(size * sizeof(double));
+    tree->index = (IDL_MEMINT *) malloc(size * sizeof(IDL_MEMINT));
+  }
+  if (!tree || !items || !tree->intervals || !tree->max_end || !tree->index) {
+    if (tree) {
+      free(tree->intervals);
+      free(tree->max_end);
+      free(tree->index);
+      free(tree);
+    }
+    free(items);
+    return NULL;
+  }
+
+  for (i = 0; i < n; i++) {
+    items[i].iv = intervals[i];
+    items[i].index = index[i];
+  }
+  qsort(items, n, sizeof(mg_intervaltree_item), mg_intervaltree_item_cmp);
+  for (i = 0; i < n; i++) {
+    tree->intervals[i] = items[i].iv;
+    tree->index[i] = items[i].index;
+  }
+  free(items);
+
+  tree->n = n;
+  tree->max_level = mg_intervaltree_index(tree);
+
+  return tree;
+}
+
+
+static void mg_intervaltree_free(mg_intervaltree *tree) {
+  if (!tree) return;
+  free(tree->intervals);
+  free(tree->max_end);
+  free(tree->index);
+  free(tree);
+}
+
+
+typedef struct {
+  IDL_LONG64 *data;
+  IDL_MEMINT n;
+  IDL_MEMINT size;
+} mg_intervaltree_hits;
+
+
+static int mg_intervaltree_add_hit(mg_intervaltree_hits *hits, IDL_LONG64 i) {
+  IDL_LONG64 *data;
+
+  if (hits->n == hits->size) {
+    hits->size = hits->size ? 2 * hits->size : 1024;
+    data = (IDL_LONG64 *) realloc(hits->data, hits->size * sizeof(IDL_LONG64));
+    if (!data) return 0;
+    hits->data = data;
+  }
+  hits->data[hits->n++] = i;
+  return 1;
+}
+
+
+// append the input indices of the intervals overlapping [start, end] to hits,
+// in order of their start; returns 0 if out of memory
+static int mg_intervaltree_query(const mg_intervaltree *tree,
+                                 double start, double end,
+                                 mg_intervaltree_hits *hits) {
+  mg_intervaltree_node stack[64], z;
+  const mg_interval *r = tree->intervals;
+  IDL_MEMINT i, i0, i1, y, n = tree->n;
+  int t = 0;
+
+  if (n == 0) return 1;
+
+  stack[t].k = tree->max_level;
+  stack[t].x = ((IDL_MEMINT) 1 << tree->max_level) - 1;
+  stack[t++].w = 0;
+
+  while (t) {
+    z = stack[--t];
+    if (z.k <= 3) {
+      // small subtree: scan it linearly
+      i0 = z.x >> z.k << z.k;
+      i1 = i0 + ((IDL_MEMINT) 1 << (z.k + 1)) - 1;
+      if (i1 > n) i1 = n;
+      for (i = i0; i < i1 && r[i].start <= end; i++) {
+        if (start <= r[i].end && !mg_intervaltree_add_hit(hits, tree->index[i])) return 0;
+      }
+    } else if (z.w == 0) {
+      // revisit z after its left child, which may be out of range
+      y = z.x - ((IDL_MEMINT) 1 << (z.k - 1));
+      stack[t].k = z.k;
+      stack[t].x = z.x;
+      stack[t++].w = 1;
+      if (y >= n || tree->max_end[y] >= start) {
+        stack[t].k = z.k - 1;
+        stack[t].x = y;
+        stack[t++].w = 0;
+      }
+    } else if (z.x < n && r[z.x].start <= end) {
+      if (start <= r[z.x].end && !mg_intervaltree_add_hit(hits, tree->index[z.x])) return 0;
+      stack[t].k = z.k - 1;
+      stack[t].x = z.x + ((IDL_MEMINT) 1 << (z.k - 1));
+      stack[t++].w = 0;
+    }
+  }
+
+  return 1;
+}
+
+
+static IDL_VPTR IDL_CDECL IDL_mg_intervaltree_new(int argc, IDL_VPTR *argv) {
+  mg_intervaltree *tree;
+  mg_interval *a;
+  IDL_MEMINT na, *index;
+
+  a = mg_interval_get(argv[0], "INTERVALS", &na, &index);
+  tree = mg_intervaltree_new(a, index, na);
+  free(a);
+  free(index);
+
+  if (!tree) {
+    IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                "unable to allocate memory for interval tree");
+  }
+
+  return IDL_GettmpMEMINT((IDL_MEMINT) tree);
+}
+
+
+static void IDL_CDECL IDL_mg_intervaltree_free(int argc, IDL_VPTR *argv) {
+  mg_intervaltree_free((mg_intervaltree *) IDL_MEMINTScalar(argv[0]));
+}
+
+
+static IDL_VPTR IDL_CDECL IDL_mg_intervaltree_count(int argc, IDL_VPTR *argv) {
+  mg_intervaltree *tree = (mg_intervaltree *) IDL_MEMINTScalar(argv[0]);
+  return IDL_GettmpLong64(tree->n);
+}
+
+
+/*
+  Query the tree with each point or interval of the second argument. Returns
+  the indices of the overlapping intervals for all queries concatenated, or
+  -1L if there are none. OFFSETS is set to an array of n_queries + 1 elements
+  where the hits of query i are result[offsets[i]:offsets[i + 1] - 1], in
+  the style of the REVERSE_INDICES of HISTOGRAM.
+*/
+static IDL_VPTR IDL_CDECL IDL_mg_intervaltree_query(int argc, IDL_VPTR *argv, char *argk) {
+  typedef struct {
+    IDL_KW_RESULT_FIRST_FIELD;
+    IDL_VPTR count;
+    int count_present;
+    IDL_VPTR offsets;
+    int offsets_present;
+    IDL_LONG points;
+  } KW_RESULT;
+
+  // make sure to list keyword in alphabetical order
+  static IDL_KW_PAR kw_pars[] = {
+    { "COUNT", IDL_TYP_UNDEF, 1, IDL_KW_OUT | IDL_KW_ZERO,
+      IDL_KW_OFFSETOF(count_present), IDL_KW_OFFSETOF(count) },
+    { "OFFSETS", IDL_TYP_UNDEF, 1, IDL_KW_OUT | IDL_KW_ZERO,
+      IDL_KW_OFFSETOF(offsets_present), IDL_KW_OFFSETOF(offsets) },
+    { "POINTS", IDL_TYP_LONG, 1, IDL_KW_ZERO,
+      0, IDL_KW_OFFSETOF(points) },
+    { NULL }
+  };
+
+  KW_RESULT kw;
+  IDL_VPTR plain_args[2], queries, result, offsets_vptr;
+  mg_intervaltree *tree;
+  mg_intervaltree_hits hits = { NULL, 0, 0 };
+  IDL_LONG64 *offsets;
+  IDL_MEMINT n_queries, q;
+  double *data;
+  int ok = 1;
+
+  IDL_KWProcessByOffset(argc, argv, argk, kw_pars, plain_args, 1, &kw);
+
+  tree = (mg_intervaltree *) IDL_MEMINTScalar(plain_args[0]);
+
+  IDL_ENSURE_SIMPLE(plain_args[1]);
+  queries = plain_args[1]->type == IDL_TYP_DOUBLE
+              ? plain_args[1]
+              : IDL_CvtDbl(1, &plain_args[1]);
+  if (queries->flags & IDL_V_ARR) {
+    data = (double *) queries->value.arr->data;
+    n_queries = queries->value.arr->n_elts;
+  } else {
+    data = &queries->value.d;
+    n_queries = 1;
+  }
+  if (!kw.points) {
+    if (n_queries % 2 != 0) {
+      if (queries != plain_args[1]) IDL_Deltmp(queries);
+      IDL_KW_FREE;
+      IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                  "queries must be a 2 x n array of intervals");
+    }
+    n_queries /= 2;
+  }
+
+  offsets = (IDL_LONG64 *) IDL_MakeTempVector(IDL_TYP_LONG64, n_queries + 1,
+                                              IDL_ARR_INI_NOP, &offsets_vptr);
+  for (q = 0; q < n_queries && ok; q++) {
+    offsets[q] = hits.n;
+    if (kw.points) {
+      ok = mg_intervaltree_query(tree, data[q], data[q], &hits);
+    } else if (data[2 * q] <= data[2 * q + 1]) {
+      ok = mg_intervaltree_query(tree, data[2 * q], data[2 * q + 1], &hits);
+    }
+  }
+  offsets[n_queries] = hits.n;
+
+  if (queries != plain_args[1]) IDL_Deltmp(queries);
+
+  if (!ok) {
+    free(hits.data);
+    IDL_Deltmp(offsets_vptr);
+    IDL_KW_FREE;
+    IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                "unable to allocate memory for query results");
+  }
+
+  if (hits.n > 0) {
+    result = IDL_ImportArray(1, &hits.n, IDL_TYP_LONG64, (UCHAR *) hits.data,
+                             (IDL_ARRAY_FREE_CB) free, NULL);
+  } else {
+    free(hits.data);
+    result = IDL_GettmpLong(-1);
+  }
+
+  if (kw.count_present) {
+    IDL_ALLTYPES count;
+    count.l64 = hits.n;
+    IDL_StoreScalar(kw.count, IDL_TYP_LONG64, &count);
+  }
+
+  if (kw.offsets_present) {
+    IDL_VarCopy(offsets_vptr, kw.offsets);
+  } else IDL_Deltmp(offsets_vptr);
+
+  IDL_KW_FREE;
+
+  return result;
+}
+
+
+int IDL_Load(void) {
+  /*
+   * These tables contain information on the functions and procedures
+   * that make up the stats DLM. The information contained in these
+   * tables must be identical to that contained in mg_stats.dlm.
+   */
+  static IDL_SYSFUN_DEF2 function_addr[] = {
+    { IDL_mg_interval_coverage,   "MG_INTERVAL_COVERAGE",   1, 1, 0, 0 },
+    { IDL_mg_interval_difference, "MG_INTERVAL_DIFFERENCE", 2, 2, IDL_SYSFUN_DEF_F_KEYWORDS, 0 },
+    { IDL_mg_interval_intersect,  "MG_INTERVAL_INTERSECT",  2, 2, IDL_SYSFUN_DEF_F_KEYWORDS, 0 },
+    { IDL_mg_interval_stab,       "MG_INTERVAL_STAB",       2, 2, 0, 0 },
+    { IDL_mg_interval_union,      "MG_INTERVAL_UNION",      1, 2, IDL_SYSFUN_DEF_F_KEYWORDS, 0 },
+    { IDL_mg_intervaltree_count,  "MG_INTERVALTREE_COUNT",  1, 1, 0, 0 },
+    { IDL_mg_intervaltree_new,    "MG_INTERVALTREE_NEW",    1, 1, 0, 0 },
+    { IDL_mg_intervaltree_query,  "MG_INTERVALTREE_QUERY",  2, 2, IDL_SYSFUN_DEF_F_KEYWORDS, 0 },
+  };
+
+  static IDL_SYSFUN_DEF2 procedure_addr[] = {
+    { (IDL_SYSRTN_GENERIC) IDL_mg_intervaltree_free, "MG_INTERVALTREE_FREE", 1, 1, 0, 0 },
+  };
+
+  /*
+   * Register our routines. The routines must be specified exactly the same
+   * as in mg_stats.dlm.
+   */
+  return IDL_SysRtnAdd(function_addr, TRUE, IDL_CARRAY_ELTS(function_addr))
+           && IDL_SysRtnAdd(procedure_addr, FALSE, IDL_CARRAY_ELTS(procedure_addr));
+}
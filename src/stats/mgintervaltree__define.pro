@@ -0,0 +1,132 @@
+; docformat = 'rst'
+
+;+
+; Interval tree for repeated point and interval lookups in a large, fixed set
+; of closed intervals.
+;
+; :Examples:
+;   Find the observation windows containing given times and overlapping an
+;   instrument on/off period::
+;
+;     windows = [[0.0, 10.0], [5.0, 15.0], [20.0, 30.0]]
+;     tree = MGIntervalTree(windows)
+;     hits = tree->stab([7.0, 17.0, 25.0], offsets=offsets)
+;     print, hits[offsets[0]:offsets[1] - 1]   ; windows 0 and 1 contain 7.0
+;     print, tree->overlaps([12.0, 22.0], count=count)
+;     obj_destroy, tree
+;
+; :Properties:
+;   count : type=long64
+;     number of intervals in the tree
+;-
+
+
+;+
+; Find the intervals containing each of a set of points.
+;
+; :Returns:
+;   `lon64arr` of indices into the intervals the tree was created with, for
+;   all the points concatenated, or -1L if there are no hits
+;
+; :Params:
+;   points : in, required, type=numeric array
+;     points to query
+;
+; :Keywords:
+;   count : out, optional, type=long64
+;     set to a named variable to retrieve the total number of hits
+;   offsets : out, optional, type=lon64arr
+;     set to a named variable to retrieve `n_elements(points) + 1` offsets;
+;     the hits of point `i` are `result[offsets[i]:offsets[i + 1] - 1]`
+;-
+function mgintervaltree::stab, points, count=count, offsets=offsets
+  compile_opt strictarr
+  on_error, 2
+
+  return, mg_intervaltree_query(self.tree, points, /points, $
+                                count=count, offsets=offsets)
+end
+
+
+;+
+; Find the intervals overlapping each of a set of query intervals.
+;
+; :Returns:
+;   `lon64arr` of indices into the intervals the tree was created with, for
+;   all the queries concatenated, or -1L if there are no hits
+;
+; :Params:
+;   intervals : in, required, type="fltarr(2, n)"
+;     query intervals as `[start, end]` pairs
+;
+; :Keywords:
+;   count : out, optional, type=long64
+;     set to a named variable to retrieve the total number of hits
+;   offsets : out, optional, type=lon64arr
+;     set to a named variable to retrieve `n + 1` offsets; the hits of query
+;     `i` are `result[offsets[i]:offsets[i + 1] - 1]`
+;-
+function mgintervaltree::overlaps, intervals, count=count, offsets=offsets
+  compile_opt strictarr
+  on_error, 2
+
+  return, mg_intervaltree_query(self.tree, intervals, $
+                                count=count, offsets=offsets)
+end
+
+
+;+
+; Get properties.
+;-
+pro mgintervaltree::getProperty, count=count
+  compile_opt strictarr
+
+  if (arg_present(count)) then count = mg_intervaltree_count(self.tree)
+end
+
+
+;+
+; Free resources.
+;-
+pro mgintervaltree::cleanup
+  compile_opt strictarr
+
+  if (self.tree ne 0) then mg_intervaltree_free, self.tree
+end
+
+
+;+
+; Create an interval tree.
+;
+; :Returns:
+;   1 for success, 0 for failure
+;
+; :Params:
+;   intervals : in, required, type="fltarr(2, n)"
+;     intervals as `[start, end]` pairs; intervals with `end < start` or NaN
+;     endpoints are never returned by a query
+;-
+function mgintervaltree::init, intervals
+  compile_opt strictarr
+  on_error, 2
+
+  if (n_elements(intervals) eq 0) then message, 'intervals parameter required'
+
+  self.tree = mg_intervaltree_new(intervals)
+
+  return, 1
+end
+
+
+;+
+; Define instance variables.
+;
+; :Fields:
+;   tree
+;     handle to the native interval tree
+;-
+pro mgintervaltree__define
+  compile_opt strictarr
+
+  define = { MGIntervalTree, tree: 0LL }
+end
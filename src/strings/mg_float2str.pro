@@ -32,18 +32,46 @@
 ;     when not using exponential form
 ;   decimal_sep : in, optional, type=string, default='.'
 ;     decimal point separator
+;   round_trip : in, optional, type=boolean
+;     set to use the shortest representation of each float or double that
+;     reads back as the same value, instead of `N_PLACES` and `N_DIGITS`;
+;     requires the `MG_STRINGS` DLM
 ;-
 function mg_float2str, f, $
                        n_places=n_places, n_digits=n_digits, $
-                       places_sep=places_sep, decimal_sep=decimal_sep
+                       places_sep=places_sep, decimal_sep=decimal_sep, $
+                       round_trip=round_trip
   compile_opt strictarr
   on_error, 2
 
+  type = size(f, /type)
+  if ((type eq 4 || type eq 5) && mg_hasroutine('mg_strfloat')) then begin
+    _decimal_sep = n_elements(decimal_sep) eq 0L ? '.' : decimal_sep
+    if (keyword_set(round_trip)) then begin
+      return, mg_strfloat(f, decimal_sep=_decimal_sep)
+    endif
+
+    ; format whole arrays natively unless places need separators
+    if (n_elements(places_sep) eq 0L || places_sep eq '') then begin
+      default_width = type eq 4 ? 7L : 15L
+      _n_places = n_elements(n_places) eq 0L ? default_width : n_places
+      _n_digits = n_elements(n_digits) eq 0L ? default_width : n_digits
+      return, mg_strfloat(f, $
+                          format=string(_n_digits, format='(%"\%0.%df")'), $
+                          exponential_threshold=_n_places, $
+                          decimal_sep=_decimal_sep)
+    endif
+  endif
+
+  if (keyword_set(round_trip)) then begin
+    message, 'ROUND_TRIP requires a float or double and the MG_STRINGS DLM'
+  endif
+
   if (n_elements(f) gt 1L) then begin
     result = strarr(n_elements(f))
     for i = 0L, n_elements(f) - 1L do begin
       result[i] = mg_float2str(f[i], $
-                               n_places=nplaces, $
+                               n_places=n_places, $
                                n_digits=n_digits, $
                                places_sep=places_sep, $
                                decimal_sep=decimal_sep)
@@ -4,6 +4,11 @@
 ; Returns the correct spelling of the given word. Based on Peter Norvig's
 ; Python `spelling corrector <http://norvig.com/spell-correct.html>`.
 ;
+; When the `mg_strings` DLM is available, the default dictionary is kept in a
+; native `MGSpellIndex`, which is written to `spell_index.bin` in the
+; dictionary directory the first time it is built, and arrays of words can be
+; corrected in a single call.
+;
 ; :Examples:
 ;    Try the main-level program at the end of the file::
 ;
@@ -176,6 +181,52 @@ function mg_spellcorrect_known, words, known_hash=hash
 end
 
 
+;+
+; Returns the native spelling index for the default dictionary, reading it
+; from `spell_index.bin` or building it from `big.txt` or `spell_hash.sav`.
+;
+; :Returns:
+;    `MGSpellIndex` object
+;-
+function mg_spellcorrect_index
+  compile_opt strictarr, hidden
+  common mg_spellcorrect_common, spell_index
+
+  if (obj_valid(spell_index)) then return, spell_index
+
+  index_filename = filepath('spell_index.bin', $
+                            subdir='dictionary', $
+                            root=mg_src_root())
+  if (file_test(index_filename)) then begin
+    spell_index = obj_new('MGSpellIndex', filename=index_filename)
+    return, spell_index
+  endif
+
+  corpus_filename = filepath('big.txt', subdir='dictionary', root=mg_src_root())
+  if (file_test(corpus_filename)) then begin
+    spell_index = obj_new('MGSpellIndex', corpus=corpus_filename)
+  endif else begin
+    restore, filename=filepath('spell_hash.sav', $
+                               subdir='dictionary', $
+                               root=mg_src_root())
+    words = (spell_hash->keys())->toArray()
+    counts = (spell_hash->values())->toArray()
+    obj_destroy, spell_hash
+    spell_index = obj_new('MGSpellIndex', words, counts=counts)
+  endelse
+
+  ; the dictionary directory may not be writable
+  catch, error
+  if (error ne 0L) then begin
+    catch, /cancel
+    return, spell_index
+  endif
+  spell_index->write, index_filename
+
+  return, spell_index
+end
+
+
 ;+
 ; Corrects the spelling of a word.
 ;
@@ -184,7 +235,8 @@ end
 ;
 ; :Params:
 ;   word : in, required, type=string
-;     string to check spelling of
+;     string to check spelling of; may be an array when using the default
+;     dictionary with the `mg_strings` DLM
 ;
 ; :Keywords:
 ;   known_words : in, out, optional, type=hash object
@@ -205,6 +257,14 @@ function mg_spellcorrect, word, $
 
   found = 0B
 
+  if (n_elements(spell_hash) eq 0L && mg_hasroutine('mg_spell_correct')) then begin
+    result = (mg_spellcorrect_index())->correct(word, $
+                                                 distance=distance, $
+                                                 found=found)
+    correct = distance eq 0L
+    return, result
+  endif
+
   if (n_elements(spell_hash) eq 0L) then begin
     spell_hash_filename = filepath('spell_hash.sav', $
                                    subdir='dictionary', $
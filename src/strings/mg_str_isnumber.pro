@@ -24,6 +24,13 @@ function mg_str_isnumber, value, type=type
 
   _type = mg_default(type, 4)
 
+  if ((_type eq 4 || _type eq 5) && size(value, /type) eq 7 $
+        && mg_hasroutine('mg_strtonum')) then begin
+    ; like FIX, blank strings convert to 0
+    !null = mg_strtonum(value, type=_type, missing='', n_errors=n_errors)
+    return, n_errors eq 0
+  endif
+
   !null = fix(value, type=_type)
   return, 1B
 
@@ -45,8 +45,9 @@
 ;   string
 ;
 ; :Params:
-;   str : in, required, type=string
-;     a string to search for expressions and replace them
+;   str : in, required, type=string/strarr
+;     a string to search for expressions and replace them; may be a string
+;     array when `GLOBAL` is set and `EVALUATE` is not
 ;   pattern : in, required, type=string
 ;     a regular expression possibly using subexpressions; see IDL's online
 ;     help for `STREGEX` for help on regular expressions
@@ -61,7 +62,9 @@
 ;   fold_case : in, optional, type=boolean
 ;     set to make a case insensitive match with "pattern"
 ;   global : in, optional, type=boolean
-;     set to replace all expressions that match
+;     set to replace all expressions that match; when the `MG_STRINGS` DLM is
+;     available and `EVALUATE` is not set, the replacement is done natively
+;     and `^` only matches at the start of each string
 ;   start : out, optional, type=integral, default=0, private
 ;     index into string of where to start looking for the pattern
 ;
@@ -76,6 +79,14 @@ function mg_streplace, str, pattern, replacement, $
   compile_opt idl2
   on_error, 2
 
+  if (keyword_set(global) && ~keyword_set(evaluate) $
+        && mg_hasroutine('mg_strreplace')) then begin
+    result = mg_strreplace(str, pattern, replacement, $
+                           fold_case=keyword_set(fold_case))
+    start = strlen(result)
+    return, result
+  endif
+
   if (n_elements(str) ne 1) then begin
     message, 'str parameter must be a scalar string'
   endif
@@ -5,114 +5,404 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
 #include <limits.h>
+#include <locale.h>
+#include <math.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "mg_idl_export.h"
+#include "mg_threads.h"
 #include "tre/tre.h"
 
 
 
-// define the structure for a match
-struct mg_regmatch {
-  struct mg_regmatch *next;
-  int cost;
+// define the structure for a match or one of its subexpressions
+typedef struct {
   regoff_t rm_so;
   regoff_t rm_eo;
-};
-typedef struct mg_regmatch mg_regmatch_t;
+  int cost;
+} mg_regmatch_t;
+
+
+/*
+  Matches found in a call are appended to a growable buffer, which is freed
+  once at the end of the call. Each match takes n_groups consecutive
+  entries: the whole match followed by its subexpressions.
+*/
+typedef struct {
+  mg_regmatch_t *matches;
+  IDL_MEMINT n;
+  IDL_MEMINT capacity;
+  size_t n_groups;
+} mg_regmatch_arena;
+
+
+// Make room for one more element in a growable array, returns 0 if out of
+// memory.
+static int mg_arena_reserve(void **data, IDL_MEMINT n, IDL_MEMINT *capacity,
+                            size_t elt_size) {
+  IDL_MEMINT new_capacity;
+  void *new_data;
+
+  if (n < *capacity) return 1;
+
+  new_capacity = *capacity > 0 ? 2 * *capacity : 64;
+  new_data = realloc(*data, new_capacity * elt_size);
+  if (!new_data) return 0;
+
+  *data = new_data;
+  *capacity = new_capacity;
+
+  return 1;
+}
+
+
+// Add a match found at offset in the input, returns 0 if out of memory.
+static int mg_regmatch_add(mg_regmatch_arena *arena,
+                           const regmatch_t *pmatch, regoff_t offset,
+                           int cost) {
+  mg_regmatch_t *match;
+  size_t g;
+
+  if (!mg_arena_reserve((void **) &arena->matches, arena->n / arena->n_groups,
+                        &arena->capacity,
+                        arena->n_groups * sizeof(mg_regmatch_t))) {
+    return 0;
+  }
+
+  match = &arena->matches[arena->n];
+  for (g = 0; g < arena->n_groups; g++) {
+    // unmatched subexpressions have offsets of -1
+    match[g].rm_so = pmatch[g].rm_so < 0 ? -1 : offset + pmatch[g].rm_so;
+    match[g].rm_eo = pmatch[g].rm_eo < 0 ? -1 : offset + pmatch[g].rm_eo;
+    match[g].cost = cost;
+  }
+  arena->n += arena->n_groups;
+
+  return 1;
+}
+
+
+// Find the first, or all, exact matches in input. Returns 0 if out of memory.
+static int mg_getmatches(const regex_t *preg,
+                         const char *input, regoff_t input_length,
+                         int find_all, mg_regmatch_arena *arena) {
+  regmatch_t *pmatch = (regmatch_t *) malloc(arena->n_groups * sizeof(regmatch_t));
+  regoff_t offset = 0;
+  int ok = pmatch != NULL;
+
+  while (ok && offset <= input_length) {
+    if (tre_regnexec(preg, input + offset, input_length - offset,
+                     arena->n_groups, pmatch, offset > 0 ? REG_NOTBOL : 0) != 0) {
+      break;
+    }
+    ok = mg_regmatch_add(arena, pmatch, offset, 0);
+    if (!find_all) break;
+
+    // an empty match would be found again at the same place
+    offset += pmatch[0].rm_eo > pmatch[0].rm_so
+                ? pmatch[0].rm_eo
+                : pmatch[0].rm_eo + 1;
+  }
+
+  free(pmatch);
+
+  return ok;
+}
 
 
-static IDL_VPTR IDL_CDECL IDL_mg_strsplit(int argc, IDL_VPTR *argv) {
-  return IDL_GettmpLong(5);
+static int mg_regmatch_compare(const void *a, const void *b) {
+  regoff_t so_a = ((const mg_regmatch_t *) a)->rm_so;
+  regoff_t so_b = ((const mg_regmatch_t *) b)->rm_so;
+
+  return so_a < so_b ? -1 : (so_a > so_b ? 1 : 0);
 }
 
-static mg_regmatch_t *mg_getamatches(regex_t *preg,
-                                     char *input, int offset, int input_length,
-                                     int cost_ins, int cost_del, int cost_subst,
-                                     int max_cost, int max_del, int max_err,
-                                     int max_ins, int max_subst,
-                                     int find_all) {
 
+/*
+  Find the first, or all, approximate matches in input. Returns 0 if out of
+  memory.
+
+  TRE returns the lowest cost match in the searched range, which is not
+  necessarily the first, so to find all matches the parts before and after
+  each match must be searched too. The ranges still to search are kept on an
+  explicit stack and the matches, which never overlap, are sorted by
+  position at the end.
+*/
+static int mg_getamatches(const regex_t *preg,
+                          const char *input, regoff_t input_length,
+                          regaparams_t params, int find_all,
+                          mg_regmatch_arena *arena) {
+  typedef struct {
+    regoff_t start;
+    regoff_t end;
+  } mg_amatch_range;
+
+  mg_amatch_range *stack = NULL, range;
+  IDL_MEMINT n_stack = 0, stack_capacity = 0;
   regamatch_t amatch;
-  regaparams_t match_params;
-  regmatch_t pmatch[1];
+  regmatch_t *pmatch = (regmatch_t *) malloc(arena->n_groups * sizeof(regmatch_t));
+  int status, eflags, ok = pmatch != NULL;
 
-  mg_regmatch_t *current_match = NULL;
-  mg_regmatch_t *match = NULL;
-  mg_regmatch_t *before_match = NULL;
-  mg_regmatch_t *after_match = NULL;
+#define MG_AMATCH_PUSH(START, END)                                        \
+  if ((ok = mg_arena_reserve((void **) &stack, n_stack, &stack_capacity,  \
+                             sizeof(mg_amatch_range)))) {                 \
+    stack[n_stack].start = (START);                                       \
+    stack[n_stack++].end = (END);                                         \
+  }
 
-  int search_status;
+  if (ok) { MG_AMATCH_PUSH(0, input_length); }
+
+  while (ok && n_stack > 0) {
+    range = stack[--n_stack];
+
+    amatch.pmatch = pmatch;
+    amatch.nmatch = arena->n_groups;
+    eflags = (range.start > 0 ? REG_NOTBOL : 0)
+               | (range.end < input_length ? REG_NOTEOL : 0);
+    status = tre_reganexec(preg, input + range.start, range.end - range.start,
+                           &amatch, params, eflags);
+
+    // an empty match is not a match
+    if (status || pmatch[0].rm_so == pmatch[0].rm_eo) continue;
+
+    ok = mg_regmatch_add(arena, pmatch, range.start, amatch.cost);
+    if (!find_all) break;
+
+    if (ok && range.start + pmatch[0].rm_eo < range.end) {
+      MG_AMATCH_PUSH(range.start + pmatch[0].rm_eo, range.end);
+    }
+    if (ok && pmatch[0].rm_so > 0) {
+      MG_AMATCH_PUSH(range.start, range.start + pmatch[0].rm_so);
+    }
+  }
+
+#undef MG_AMATCH_PUSH
+
+  if (ok && find_all) {
+    qsort(arena->matches, arena->n / arena->n_groups,
+          arena->n_groups * sizeof(mg_regmatch_t), mg_regmatch_compare);
+  }
+
+  free(stack);
+  free(pmatch);
+
+  return ok;
+}
 
-  // initialize the match params and match
-  tre_regaparams_default(&match_params);
-  match_params.cost_ins = cost_ins;
-  match_params.cost_del = cost_del;
-  match_params.cost_subst = cost_subst;
-  match_params.max_cost = max_cost;
-  match_params.max_del = max_del;
-  match_params.max_err = max_err;
-  match_params.max_ins = max_ins;
-  match_params.max_subst = max_subst;
 
-  amatch.pmatch = pmatch;
-  amatch.nmatch = 1;
 
-  search_status = tre_reganexec(preg, input, input_length,
-                                &amatch, match_params, 0);
+/**************************************************************************
+  Compiled regular expression cache
+***************************************************************************/
 
-  // return NULL pointer if nothing found
-  if (search_status || (pmatch[0].rm_so == pmatch[0].rm_eo)) {
-    return (mg_regmatch_t *)NULL;
+// number of compiled regular expressions kept between calls
+#define MG_REGEX_CACHE_SIZE 16
+
+typedef struct {
+  char *pattern;             // NULL for an unused entry
+  int cflags;
+  regex_t preg;
+  unsigned long last_used;   // 0 for an unused entry
+} mg_regex_cache_entry;
+
+static mg_regex_cache_entry mg_regex_cache[MG_REGEX_CACHE_SIZE];
+static unsigned long mg_regex_cache_clock = 0;
+
+
+// Issue an IDL error for a status code returned by tre_regcomp.
+static void mg_regex_error(int status) {
+  switch (status) {
+    case REG_BADPAT:
+      IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                  "regex contained an invalid multibyte sequence");
+    case REG_ECOLLATE:
+      IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                  "invalid collating element referenced in regex");
+    case REG_ECTYPE:
+      IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                  "unknown character class name in regex");
+    case REG_EESCAPE:
+      IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                  "last character of regex was a backslash");
+    case REG_ESUBREG:
+      IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                  "invalid back reference in regex");
+    case REG_EBRACK:
+      IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                  "unbalanced [] in regex");
+    case REG_EPAREN:
+      IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                  "unbalanced parentheses in regex");
+    case REG_EBRACE:
+      IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                  "unbalanced braces in regex");
+    case REG_BADBR:
+      IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                  "content invalid in regex");
+    case REG_ERANGE:
+      IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                  "invalid character range in regex");
+    case REG_ESPACE:
+      IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                  "out of memory in regex");
+    case REG_BADRPT:
+      IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                  "invalid use of repetition operators in regex");
+    default:
+      IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP, "invalid regex");
   }
+}
 
-  match = (mg_regmatch_t *) malloc(sizeof(mg_regmatch_t));
 
-  match->cost = amatch.cost;
-  match->rm_so = offset + pmatch[0].rm_so;
-  match->rm_eo = offset + pmatch[0].rm_eo;
-  match->next = NULL;
+/*
+  Return the compiled regex for a pattern and compile flags, compiling it and
+  replacing the least recently used entry of the cache if it is not already
+  in the cache. Returns NULL and sets status if the pattern does not compile.
+
+  The cache is only used from the IDL main thread. A compiled regex is not
+  modified by matching, TRE allocates the matcher state in each call, so the
+  returned regex can be shared by worker threads.
+*/
+static regex_t *mg_regex_cache_get(const char *pattern, int cflags, int *status) {
+  mg_regex_cache_entry *entry, *lru = &mg_regex_cache[0];
+  regex_t preg;
+  char *pattern_copy;
+  int i;
 
-  if (find_all) {
-    // search before match
-    if (pmatch[0].rm_so != 0) {
-      before_match = mg_getamatches(preg,
-                                    input, offset, pmatch[0].rm_so,
-                                    cost_ins, cost_del, cost_subst,
-                                    max_cost, max_del, max_err,
-                                    max_ins, max_subst,
-                                    find_all);
+  for (i = 0; i < MG_REGEX_CACHE_SIZE; i++) {
+    entry = &mg_regex_cache[i];
+    if (entry->pattern
+        && entry->cflags == cflags
+        && strcmp(entry->pattern, pattern) == 0) {
+      entry->last_used = ++mg_regex_cache_clock;
+      return &entry->preg;
     }
+    if (entry->last_used < lru->last_used) lru = entry;
+  }
+
+  *status = tre_regcomp(&preg, pattern, cflags);
+  if (*status != 0) return NULL;
+
+  pattern_copy = (char *) malloc(strlen(pattern) + 1);
+  if (!pattern_copy) {
+    tre_regfree(&preg);
+    *status = REG_ESPACE;
+    return NULL;
+  }
+  strcpy(pattern_copy, pattern);
+
+  if (lru->pattern) {
+    tre_regfree(&lru->preg);
+    free(lru->pattern);
+  }
+  lru->pattern = pattern_copy;
+  lru->cflags = cflags;
+  lru->preg = preg;
+  lru->last_used = ++mg_regex_cache_clock;
+
+  return &lru->preg;
+}
+
+
+static void mg_regex_cache_clear(void) {
+  int i;
 
-    // search after match
-    if (pmatch[0].rm_eo < input_length) {
-      after_match = mg_getamatches(preg,
-                                   &input[pmatch[0].rm_eo],
-                                   offset + pmatch[0].rm_eo,
-                                   input_length - pmatch[0].rm_eo,
-                                   cost_ins, cost_del, cost_subst,
-                                   max_cost, max_del, max_err,
-                                   max_ins, max_subst,
-                                   find_all);
+  for (i = 0; i < MG_REGEX_CACHE_SIZE; i++) {
+    if (mg_regex_cache[i].pattern) {
+      tre_regfree(&mg_regex_cache[i].preg);
+      free(mg_regex_cache[i].pattern);
+      mg_regex_cache[i].pattern = NULL;
+      mg_regex_cache[i].last_used = 0;
     }
+  }
+}
+
+
+/**************************************************************************
+  Matching string arrays
+***************************************************************************/
+
+// default minimum number of strings given to each thread
+#define MG_STRINGS_MIN_ELTS 1000
+
+typedef struct {
+  IDL_STRING *strings;
+  regex_t *preg;
+  int approximate;
+  regaparams_t params;
+  size_t n_groups;     // 1, or 1 + number of subexpressions for SUBEXPR
+  regmatch_t *pmatch;  // n_groups matches for each thread
+  IDL_LONG *starts;    // NULL if only matches are needed
+  IDL_LONG *lengths;
+  IDL_LONG *costs;
+  UCHAR *matched;
+} mg_stregex_loop;
+
+
+// Find the first match in each of the strings start to end - 1.
+static void mg_stregex_range(void *data, IDL_MEMINT start, IDL_MEMINT end,
+                             int thread) {
+  mg_stregex_loop *loop = (mg_stregex_loop *) data;
+  regamatch_t amatch;
+  regmatch_t *pmatch = loop->pmatch + thread * loop->n_groups;
+  size_t nmatch = loop->starts || loop->approximate ? loop->n_groups : 0;
+  IDL_STRING *str;
+  IDL_MEMINT i;
+  size_t g;
+  IDL_LONG *starts, *lengths;
+  int status, found;
 
-    // merge lists
-    match->next = after_match;
-    if (before_match == NULL) return match;
+  for (i = start; i < end; i++) {
+    str = &loop->strings[i];
+    amatch.cost = 0;
+    if (loop->approximate) {
+      amatch.pmatch = pmatch;
+      amatch.nmatch = nmatch;
+      status = tre_reganexec(loop->preg, IDL_STRING_STR(str), str->slen,
+                             &amatch, loop->params, 0);
+      // like the scalar case, an empty approximate match is not a match
+      found = status == 0 && pmatch[0].rm_so != pmatch[0].rm_eo;
+    } else {
+      status = tre_regnexec(loop->preg, IDL_STRING_STR(str), str->slen,
+                            nmatch, pmatch, 0);
+      found = status == 0;
+    }
 
-    current_match = before_match;
-    while (current_match->next) {
-      current_match = current_match->next;
+    if (loop->matched) loop->matched[i] = found ? 1 : 0;
+    if (loop->starts) {
+      starts = loop->starts + i * loop->n_groups;
+      lengths = loop->lengths + i * loop->n_groups;
+      for (g = 0; g < loop->n_groups; g++) {
+        if (found && pmatch[g].rm_so >= 0) {
+          starts[g] = pmatch[g].rm_so;
+          lengths[g] = pmatch[g].rm_eo - pmatch[g].rm_so;
+        } else {
+          starts[g] = lengths[g] = -1;
+        }
+      }
+      loop->costs[i] = found ? amatch.cost : -1;
     }
-    current_match->next = match;
-    match = before_match;
-    return match;
-  } else {
-    return match;
   }
 }
 
 
+// Copy the part of s given by start and length into an IDL string.
+static void mg_stregex_extract(IDL_STRING *dst, const IDL_STRING *s,
+                               IDL_LONG start, IDL_LONG length) {
+  if (length <= 0) return;
+  IDL_StrEnsureLength(dst, length);
+  memcpy(dst->s, s->s + start, length);
+  dst->s[length] = '\0';
+  dst->slen = length;
+}
+
 
 static IDL_VPTR IDL_CDECL IDL_mg_stregex(int argc, IDL_VPTR *argv, char *argk) {
   typedef struct {
@@ -142,7 +432,9 @@ static IDL_VPTR IDL_CDECL IDL_mg_stregex(int argc, IDL_VPTR *argv, char *argk) {
     int max_ins_present;
     IDL_LONG max_subst;
     int max_subst_present;
-    IDL_LONG subexpr;  // TODO: handle SUBEXPR keyword
+    IDL_LONG subexpr;
+    IDL_LONG tpool_min_elts;
+    IDL_LONG tpool_nthreads;
   } KW_RESULT;
 
   // make sure to list keyword in alphabetical order
@@ -179,6 +471,10 @@ static IDL_VPTR IDL_CDECL IDL_mg_stregex(int argc, IDL_VPTR *argv, char *argk) {
       IDL_KW_OFFSETOF(max_subst_present), IDL_KW_OFFSETOF(max_subst) },
     { "SUBEXPR", IDL_TYP_LONG, 1, IDL_KW_ZERO | IDL_KW_VALUE | 1,
       0, IDL_KW_OFFSETOF(subexpr) },
+    { "TPOOL_MIN_ELTS", IDL_TYP_LONG, 1, IDL_KW_ZERO,
+      0, IDL_KW_OFFSETOF(tpool_min_elts) },
+    { "TPOOL_NTHREADS", IDL_TYP_LONG, 1, IDL_KW_ZERO,
+      0, IDL_KW_OFFSETOF(tpool_nthreads) },
     { NULL }
   };
 
@@ -201,75 +497,49 @@ static IDL_VPTR IDL_CDECL IDL_mg_stregex(int argc, IDL_VPTR *argv, char *argk) {
                 "conflicting keywords, LENGTH and BOOLEAN");
   }
 
-  char *input = IDL_VarGetString(argv[0]);
+  if ((argv[0]->flags & IDL_V_ARR) && kw.all) {
+    IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                "ALL requires a scalar input string");
+  }
+
+  // array matching without positions doesn't need to track subexpressions
   char *re = IDL_VarGetString(argv[1]);
-  regex_t preg;
-  int compile_status = tre_regcomp(&preg, re,
-                                   REG_EXTENDED
-                                     | (kw.fold_case ? REG_ICASE : 0));
-  if (compile_status != 0) {
-    switch (compile_status) {
-      case REG_BADPAT:
-        IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
-                    "regex contained an invalid multibyte sequence");
-      case REG_ECOLLATE:
-        IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
-                    "invalid collating element referenced in regex");
-      case REG_ECTYPE:
-        IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
-                    "unknown character class name in regex");
-      case REG_EESCAPE:
-        IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
-                    "last character of regex was a backslash");
-      case REG_ESUBREG:
-        IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
-                    "invalid back reference in regex");
-      case REG_EBRACK:
-        IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
-                    "unbalanced [] in regex");
-      case REG_EPAREN:
-        IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
-                    "unbalanced parentheses in regex");
-      case REG_EBRACE:
-        IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
-                    "unbalanced braces in regex");
-      case REG_BADBR:
-        IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
-                    "content invalid in regex");
-      case REG_ERANGE:
-        IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
-                    "invalid character range in regex");
-      case REG_ESPACE:
-        IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
-                    "out of memory in regex");
-      case REG_BADRPT:
-        IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
-                    "invalid use of repetition operators in regex");
-      default:
-        IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP, "invalid regex");
-    }
+  int compile_status = 0;
+  int cflags = REG_EXTENDED | (kw.fold_case ? REG_ICASE : 0);
+  if ((argv[0]->flags & IDL_V_ARR) && kw.boolean && !kw.approximate) {
+    cflags |= REG_NOSUB;
+  }
+  regex_t *preg = mg_regex_cache_get(re, cflags, &compile_status);
+  if (!preg) {
+    IDL_KW_FREE;
+    mg_regex_error(compile_status);
   }
 
-  regamatch_t amatch;
-  regaparams_t match_params;
-  regmatch_t pmatch[1];
-  size_t length;
+  if (argv[0]->type != IDL_TYP_STRING) {
+    IDL_KW_FREE;
+    IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                "input must be a string or string array");
+  }
 
   IDL_VPTR result_vptr;
-  IDL_STRING *extracts;
-  int *starts;
+  IDL_STRING *extracts = NULL;
+  IDL_LONG *starts = NULL;
   IDL_VPTR lengths_vptr;
-  int *lengths;
+  IDL_LONG *lengths;
   IDL_VPTR costs_vptr;
-  int *costs;
+  IDL_LONG *costs;
+  IDL_MEMINT m, n_matches;
+  IDL_MEMINT dims[IDL_MAX_ARRAY_DIM];
+  int n_dims;
+  size_t g;
 
-  int m = 0, nmatches = 0;
-  mg_regmatch_t *matches = NULL;
-  mg_regmatch_t *current_match = NULL;
+  // with SUBEXPR, positions are given for the whole match followed by each
+  // subexpression
+  size_t n_groups = kw.subexpr && !kw.boolean ? preg->re_nsub + 1 : 1;
 
-  int search_status = 0;
-  int offset = 0;
-  int find_all = 1;
+  regaparams_t match_params;
+  mg_regmatch_arena arena = { NULL, 0, 0, n_groups };
+  int ok;
 
   int cost_ins = kw.cost_ins_present ? kw.cost_ins : 1;
   int cost_del = kw.cost_del_present ? kw.cost_del : 1;
@@ -281,93 +551,181 @@ static IDL_VPTR IDL_CDECL IDL_mg_stregex(int argc, IDL_VPTR *argv, char *argk) {
   int max_ins = kw.max_ins_present ? kw.max_ins : INT_MAX;
   int max_subst = kw.max_subst_present ? kw.max_subst : INT_MAX;
 
-  if (kw.approximate) {
-    matches = mg_getamatches(&preg,
-                             input, offset, strlen(input),
-                             cost_ins, cost_del, cost_subst,
-                             max_cost, max_del, max_err,
-                             max_ins,  max_subst,
-                             kw.all);
-    current_match = matches;
-
-    // count up number of matches
-    while (current_match) {
-      nmatches++;
-      current_match = current_match->next;
-    }
-  } else {
-    while (search_status == 0 && offset <= strlen(input) && find_all) {
-
-      search_status = tre_regexec(&preg, &input[offset], (size_t) 1, pmatch, 0);
+  tre_regaparams_default(&match_params);
+  match_params.cost_ins = cost_ins;
+  match_params.cost_del = cost_del;
+  match_params.cost_subst = cost_subst;
+  match_params.max_cost = max_cost;
+  match_params.max_del = max_del;
+  match_params.max_err = max_err;
+  match_params.max_ins = max_ins;
+  match_params.max_subst = max_subst;
 
-      if (search_status == 0) {
-        nmatches++;
+  // find the first match in each element of a string array
+  if (argv[0]->flags & IDL_V_ARR) {
+    mg_stregex_loop loop;
+    IDL_ARRAY *arr = argv[0]->value.arr;
+    IDL_VPTR starts_vptr;
+    IDL_MEMINT e;
+    int nthreads;
 
-        if (current_match == NULL) {
-          current_match = (mg_regmatch_t *) malloc(sizeof(mg_regmatch_t));
-          matches = current_match;
-        } else {
-          current_match->next = (mg_regmatch_t *) malloc(sizeof(mg_regmatch_t));
-          current_match = current_match->next;
-        }
+    // subexpressions are the leading dimension of the result
+    n_dims = 0;
+    if (kw.subexpr) {
+      if (arr->n_dim >= IDL_MAX_ARRAY_DIM) {
+        IDL_KW_FREE;
+        IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                    "too many dimensions for SUBEXPR");
+      }
+      dims[n_dims++] = n_groups;
+    }
+    for (e = 0; e < arr->n_dim; e++) dims[n_dims++] = arr->dim[e];
 
-        current_match->cost = 0;
-        current_match->rm_so = offset + pmatch[0].rm_so;
-        current_match->rm_eo = offset + pmatch[0].rm_eo;
-        current_match->next = NULL;
+    nthreads = mg_threads_count(arr->n_elts, kw.tpool_nthreads,
+                                kw.tpool_min_elts > 0
+                                  ? kw.tpool_min_elts
+                                  : MG_STRINGS_MIN_ELTS);
 
-        offset += pmatch[0].rm_eo;
-      }
+    loop.strings = (IDL_STRING *) arr->data;
+    loop.preg = preg;
+    loop.approximate = kw.approximate;
+    loop.params = match_params;
+    loop.n_groups = n_groups;
+    loop.pmatch = (regmatch_t *) malloc(nthreads * n_groups * sizeof(regmatch_t));
+    if (!loop.pmatch) {
+      IDL_KW_FREE;
+      IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                  "unable to allocate memory for matches");
+    }
 
-      find_all = kw.all;
+    if (kw.boolean) {
+      loop.matched = (UCHAR *) IDL_MakeTempArray(IDL_TYP_BYTE,
+                                                 arr->n_dim, arr->dim,
+                                                 IDL_ARR_INI_NOP, &result_vptr);
+      loop.starts = loop.lengths = loop.costs = NULL;
+    } else {
+      loop.matched = NULL;
+      loop.starts = (IDL_LONG *) IDL_MakeTempArray(IDL_TYP_LONG,
+                                                   n_dims, dims,
+                                                   IDL_ARR_INI_NOP, &starts_vptr);
+      loop.lengths = (IDL_LONG *) IDL_MakeTempArray(IDL_TYP_LONG,
+                                                    n_dims, dims,
+                                                    IDL_ARR_INI_NOP, &lengths_vptr);
+      loop.costs = (IDL_LONG *) IDL_MakeTempArray(IDL_TYP_LONG,
+                                                  arr->n_dim, arr->dim,
+                                                  IDL_ARR_INI_NOP, &costs_vptr);
     }
-  }
 
-  if (kw.boolean) {
-    result_vptr = IDL_GettmpByte(nmatches > 0 ? 1 : 0);
-  } else {
-    if (nmatches > 0) {
+    mg_threads_for(arr->n_elts, nthreads, mg_stregex_range, &loop);
+    free(loop.pmatch);
+
+    if (!kw.boolean) {
+      // extracting creates IDL strings, so it is done after the threads finish
       if (kw.extract) {
-        extracts = (IDL_STRING *)IDL_MakeTempVector(IDL_TYP_STRING,
-                                                    (IDL_MEMINT)nmatches,
+        extracts = (IDL_STRING *) IDL_MakeTempArray(IDL_TYP_STRING,
+                                                    n_dims, dims,
                                                     IDL_ARR_INI_ZERO,
                                                     &result_vptr);
+        for (e = 0; e < arr->n_elts; e++) {
+          for (g = 0; g < n_groups; g++) {
+            m = e * n_groups + g;
+            mg_stregex_extract(&extracts[m], &loop.strings[e],
+                               loop.starts[m], loop.lengths[m]);
+          }
+        }
+        IDL_Deltmp(starts_vptr);
       } else {
-        starts = (int *)IDL_MakeTempVector(IDL_TYP_LONG, (IDL_MEMINT)nmatches,
-                                           IDL_ARR_INI_NOP, &result_vptr);
+        result_vptr = starts_vptr;
       }
-      lengths = (int *)IDL_MakeTempVector(IDL_TYP_LONG, (IDL_MEMINT)nmatches,
-                                          IDL_ARR_INI_NOP, &lengths_vptr);
-      costs = (int *)IDL_MakeTempVector(IDL_TYP_LONG, (IDL_MEMINT)nmatches,
-                                        IDL_ARR_INI_NOP, &costs_vptr);
 
-      current_match = matches;
-      for(m = 0; m < nmatches; m++) {
-        lengths[m] = current_match->rm_eo - current_match->rm_so;
-        costs[m] = current_match->cost;
+      if (kw.length_present) {
+        IDL_VarCopy(lengths_vptr, kw.length);
+      } else IDL_Deltmp(lengths_vptr);
+
+      if (kw.costs_present) {
+        IDL_VarCopy(costs_vptr, kw.costs);
+      } else IDL_Deltmp(costs_vptr);
+    }
+
+    IDL_KW_FREE;
+
+    return result_vptr;
+  }
+
+  IDL_STRING *input = &argv[0]->value.str;
+
+  if (kw.approximate) {
+    ok = mg_getamatches(preg, IDL_STRING_STR(input), input->slen,
+                        match_params, kw.all, &arena);
+  } else {
+    ok = mg_getmatches(preg, IDL_STRING_STR(input), input->slen,
+                       kw.all, &arena);
+  }
+
+  if (!ok) {
+    free(arena.matches);
+    IDL_KW_FREE;
+    IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                "unable to allocate memory for matches");
+  }
+
+  n_matches = arena.n / n_groups;
+
+  if (kw.boolean) {
+    result_vptr = IDL_GettmpByte(n_matches > 0 ? 1 : 0);
+  } else if (n_matches > 0 || (kw.subexpr && !kw.all)) {
+    // like STREGEX, SUBEXPR without a match gives -1 for each subexpression
+    n_dims = 0;
+    if (kw.subexpr) dims[n_dims++] = n_groups;
+    if (!kw.subexpr || kw.all) dims[n_dims++] = n_matches;
+
+    if (kw.extract) {
+      extracts = (IDL_STRING *) IDL_MakeTempArray(IDL_TYP_STRING,
+                                                  n_dims, dims,
+                                                  IDL_ARR_INI_ZERO,
+                                                  &result_vptr);
+    } else {
+      starts = (IDL_LONG *) IDL_MakeTempArray(IDL_TYP_LONG, n_dims, dims,
+                                              IDL_ARR_INI_NOP, &result_vptr);
+    }
+    lengths = (IDL_LONG *) IDL_MakeTempArray(IDL_TYP_LONG, n_dims, dims,
+                                             IDL_ARR_INI_NOP, &lengths_vptr);
+
+    if (n_matches > 0) {
+      costs = (IDL_LONG *) IDL_MakeTempVector(IDL_TYP_LONG, n_matches,
+                                              IDL_ARR_INI_NOP, &costs_vptr);
+      for (m = 0; m < n_matches; m++) costs[m] = arena.matches[m * n_groups].cost;
 
+      for (m = 0; m < arena.n; m++) {
+        if (arena.matches[m].rm_so < 0) {
+          lengths[m] = -1;
+          if (!kw.extract) starts[m] = -1;
+          continue;
+        }
+
+        lengths[m] = arena.matches[m].rm_eo - arena.matches[m].rm_so;
         if (kw.extract) {
-          char *e = (char *) malloc(lengths[m] + 1);
-          strncpy(e, input + current_match->rm_so, lengths[m]);
-          e[lengths[m]] = '\0';
-          IDL_StrEnsureLength(&(extracts[m]), lengths[m]);
-          IDL_StrDelete(&(extracts[m]), 1);
-          IDL_StrStore(&(extracts[m]), e);
-          free(e);
-
-          extracts[m].slen = lengths[m];
+          // copy the match directly into the result string
+          mg_stregex_extract(&extracts[m], input,
+                             arena.matches[m].rm_so, lengths[m]);
         } else {
-          starts[m] = current_match->rm_so;
+          starts[m] = arena.matches[m].rm_so;
         }
-
-        // advance to next match
-        current_match = current_match->next;
       }
     } else {
-      result_vptr = IDL_GettmpLong(-1);
-      lengths_vptr = IDL_GettmpLong(-1);
+      costs_vptr = IDL_GettmpLong(-1);
+      for (g = 0; g < n_groups; g++) {
+        lengths[g] = -1;
+        if (!kw.extract) starts[g] = -1;
+      }
     }
+  } else {
+    result_vptr = IDL_GettmpLong(-1);
+    lengths_vptr = IDL_GettmpLong(-1);
+    costs_vptr = IDL_GettmpLong(-1);
+  }
 
+  if (!kw.boolean) {
     // copy over lengths if LENGTH keyword was passed as a named variable
     if (kw.length_present) {
       IDL_VarCopy(lengths_vptr, kw.length);
@@ -379,16 +737,7 @@ static IDL_VPTR IDL_CDECL IDL_mg_stregex(int argc, IDL_VPTR *argv, char *argk) {
     } else IDL_Deltmp(costs_vptr);
   }
 
-  // free match linked list
-  current_match = matches;
-  while (matches) {
-    matches = matches->next;
-    free(current_match);
-    current_match = matches;
-  }
-
-  // free the compiled regex
-  tre_regfree(&preg);
+  free(arena.matches);
 
   // free the keyword processing information
   IDL_KW_FREE;
@@ -397,82 +746,4217 @@ static IDL_VPTR IDL_CDECL IDL_mg_stregex(int argc, IDL_VPTR *argv, char *argk) {
 }
 
 
-static IDL_VPTR IDL_CDECL IDL_mg_tre_config(int argc, IDL_VPTR *argv, char *argk) {
-  typedef struct {
-    IDL_KW_RESULT_FIRST_FIELD;
-    IDL_LONG approximate;
-    IDL_LONG multi_byte;
-    IDL_LONG system_regex;
-    IDL_LONG version;
-    IDL_LONG wide_character;
-  } KW_RESULT;
+/**************************************************************************
+  Splitting strings
+***************************************************************************/
 
-  // make sure to list keyword in alphabetical order
-  static IDL_KW_PAR kw_pars[] = {
-    { "APPROXIMATE", IDL_TYP_LONG, 1, IDL_KW_ZERO | IDL_KW_VALUE | 1,
-      0, IDL_KW_OFFSETOF(approximate) },
-    { "MULTI_BYTE", IDL_TYP_LONG, 1, IDL_KW_ZERO | IDL_KW_VALUE | 1,
-      0, IDL_KW_OFFSETOF(multi_byte) },
-    { "SYSTEM_REGEX", IDL_TYP_LONG, 1, IDL_KW_ZERO | IDL_KW_VALUE | 1,
-      0, IDL_KW_OFFSETOF(system_regex) },
-    { "VERSION", IDL_TYP_LONG, 1, IDL_KW_ZERO | IDL_KW_VALUE | 1,
-      0, IDL_KW_OFFSETOF(version) },
-    { "WIDE_CHARACTER", IDL_TYP_LONG, 1, IDL_KW_ZERO | IDL_KW_VALUE | 1,
-      0, IDL_KW_OFFSETOF(wide_character) },
-    { NULL }
-  };
+// kinds of delimiters
+#define MG_STRSPLIT_CHAR    0   // a single character
+#define MG_STRSPLIT_CLASS   1   // any of a set of characters
+#define MG_STRSPLIT_LITERAL 2   // a multi-character string
+#define MG_STRSPLIT_REGEX   3   // a regular expression
 
-  KW_RESULT kw;
+// largest character class scanned 16 bytes at a time
+#define MG_STRSPLIT_SIMD_CLASS 4
 
-  int nargs = IDL_KWProcessByOffset(argc, argv, argk, kw_pars, (IDL_VPTR *) NULL, 1, &kw);
-  int nkeywords = kw.approximate + kw.multi_byte + kw.system_regex
-                    + kw.wide_character + kw.version;
-  if (nkeywords == 0 || nkeywords > 1) {
-    IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
-                "one keyword required to be set");
-  }
+typedef struct {
+  IDL_STRING *strings;
+  int mode;
+  int preserve_null;
+  int fold_case;
+  unsigned char is_delim[256];   // character class for MG_STRSPLIT_CLASS
+  unsigned char class_chars[MG_STRSPLIT_SIMD_CLASS];
+  int n_class;
+  const char *delim;             // delimiter for MG_STRSPLIT_LITERAL
+  IDL_LONG delim_len;
+  regex_t *preg;                 // delimiter for MG_STRSPLIT_REGEX
+  IDL_LONG *counts;              // number of tokens in each string
+  IDL_MEMINT *first;             // index of the first token of each string
+  IDL_LONG *offsets;
+  IDL_LONG *lengths;
+} mg_strsplit_loop;
 
-  int status, query;
-  int result;
-  char *version;
 
-  if (kw.approximate) query = TRE_CONFIG_APPROX;
-  if (kw.multi_byte) query = TRE_CONFIG_MULTIBYTE;
-  if (kw.system_regex) query = TRE_CONFIG_SYSTEM_ABI;
-  if (kw.wide_character) query = TRE_CONFIG_WCHAR;
+/*
+  Find the next delimiter in s at or after pos. Returns the offset of the
+  delimiter, or len if there is none, and sets end to the offset just past
+  it.
+*/
+static IDL_LONG mg_strsplit_next(const mg_strsplit_loop *loop,
+                                 const char *s, IDL_LONG len, IDL_LONG pos,
+                                 IDL_LONG *end) {
+  const unsigned char *u = (const unsigned char *) s;
+  const char *p;
+  regmatch_t pmatch[1];
+  IDL_LONG i, j;
 
-  if (kw.version) {
-    status = tre_config(query, &version);
-    if (status) {
-      IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
-                  "invalid configuration request");
-    }
-    IDL_KW_FREE;
-    return IDL_StrToSTRING(version);
-  } else {
-    status = tre_config(query, &result);
-    if (status) {
-      IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
-                  "invalid configuration request");
-    }
-    IDL_KW_FREE;
-    return IDL_GettmpLong(result);
-  }
-}
+  switch (loop->mode) {
+    case MG_STRSPLIT_CHAR:
+      p = (const char *) memchr(s + pos, loop->class_chars[0], len - pos);
+      i = p ? p - s : len;
+      *end = i + 1;
+      return i;
 
+    case MG_STRSPLIT_CLASS:
+      i = pos;
+#ifdef __SSE2__
+      if (loop->n_class <= MG_STRSPLIT_SIMD_CLASS) {
+        __m128i c[MG_STRSPLIT_SIMD_CLASS];
+        int k, mask;
 
-static IDL_VPTR IDL_CDECL IDL_mg_tre_version(int argc, IDL_VPTR *argv) {
+        for (k = 0; k < loop->n_class; k++) c[k] = _mm_set1_epi8((char) loop->class_chars[k]);
+        for (; i + 16 <= len; i += 16) {
+          __m128i v = _mm_loadu_si128((const __m128i *) (u + i));
+          __m128i m = _mm_cmpeq_epi8(v, c[0]);
+          for (k = 1; k < loop->n_class; k++) m = _mm_or_si128(m, _mm_cmpeq_epi8(v, c[k]));
+          mask = _mm_movemask_epi8(m);
+          if (mask) {
+            i += __builtin_ctz(mask);
+            *end = i + 1;
+            return i;
+          }
+        }
+      }
+#endif
+      for (; i < len && !loop->is_delim[u[i]]; i++);
+      *end = i + 1;
+      return i;
+
+    case MG_STRSPLIT_LITERAL:
+      for (i = pos; i + loop->delim_len <= len; i++) {
+        if (loop->fold_case) {
+          for (j = 0; j < loop->delim_len && tolower(u[i + j]) == tolower((unsigned char) loop->delim[j]); j++);
+        } else {
+          p = (const char *) memchr(s + i, loop->delim[0], len - loop->delim_len - i + 1);
+          if (!p) break;
+          i = p - s;
+          for (j = 1; j < loop->delim_len && s[i + j] == loop->delim[j]; j++);
+        }
+        if (j == loop->delim_len) {
+          *end = i + loop->delim_len;
+          return i;
+        }
+      }
+      *end = len + 1;
+      return len;
+
+    case MG_STRSPLIT_REGEX:
+      // empty matches are not delimiters, look for a match further on
+      for (i = pos; i < len; i = i + pmatch[0].rm_so + 1) {
+        if (tre_regnexec(loop->preg, s + i, len - i, 1, pmatch,
+                         i > 0 ? REG_NOTBOL : 0) != 0) {
+          break;
+        }
+        if (pmatch[0].rm_eo > pmatch[0].rm_so) {
+          *end = i + pmatch[0].rm_eo;
+          return i + pmatch[0].rm_so;
+        }
+      }
+      *end = len + 1;
+      return len;
+  }
+
+  *end = len + 1;
+  return len;
+}
+
+
+/*
+  Split a string, returns the number of tokens. If offsets is not NULL, the
+  offsets and lengths of the tokens are stored in offsets and lengths.
+*/
+static IDL_LONG mg_strsplit_string(const mg_strsplit_loop *loop,
+                                   const IDL_STRING *str,
+                                   IDL_LONG *offsets, IDL_LONG *lengths) {
+  const char *s = IDL_STRING_STR(str);
+  IDL_LONG len = str->slen, pos = 0, delim, end, n = 0;
+
+  if (len == 0) {
+    if (!loop->preserve_null) return 0;
+    if (offsets) {
+      offsets[0] = 0;
+      lengths[0] = 0;
+    }
+    return 1;
+  }
+
+  while (1) {
+    delim = mg_strsplit_next(loop, s, len, pos, &end);
+    if (delim > pos || loop->preserve_null) {
+      if (offsets) {
+        offsets[n] = pos;
+        lengths[n] = delim - pos;
+      }
+      n++;
+    }
+    if (delim >= len) break;
+
+    pos = end;
+    if (pos >= len) {
+      // a trailing delimiter ends with an empty token
+      if (loop->preserve_null) {
+        if (offsets) {
+          offsets[n] = len;
+          lengths[n] = 0;
+        }
+        n++;
+      }
+      break;
+    }
+  }
+
+  return n;
+}
+
+
+static void mg_strsplit_count_range(void *data, IDL_MEMINT start, IDL_MEMINT end,
+                                    int thread) {
+  mg_strsplit_loop *loop = (mg_strsplit_loop *) data;
+  IDL_MEMINT i;
+
+  for (i = start; i < end; i++) {
+    loop->counts[i] = mg_strsplit_string(loop, &loop->strings[i], NULL, NULL);
+  }
+}
+
+
+static void mg_strsplit_fill_range(void *data, IDL_MEMINT start, IDL_MEMINT end,
+                                   int thread) {
+  mg_strsplit_loop *loop = (mg_strsplit_loop *) data;
+  IDL_MEMINT i;
+
+  for (i = start; i < end; i++) {
+    mg_strsplit_string(loop, &loop->strings[i],
+                       loop->offsets + loop->first[i],
+                       loop->lengths + loop->first[i]);
+  }
+}
+
+
+/*
+  Split a string or the elements of a string array into tokens. By default,
+  like STRSPLIT, any character of the pattern is a delimiter; LITERAL makes
+  the whole pattern the delimiter and REGEX makes it a regular expression.
+
+  Returns the offsets of the tokens in their strings, or the tokens with
+  EXTRACT, for all the strings concatenated, or -1L if there are no tokens.
+  COUNTS returns the number of tokens of each string.
+*/
+static IDL_VPTR IDL_CDECL IDL_mg_strsplit(int argc, IDL_VPTR *argv, char *argk) {
+  typedef struct {
+    IDL_KW_RESULT_FIRST_FIELD;
+    IDL_VPTR count;
+    int count_present;
+    IDL_VPTR counts;
+    int counts_present;
+    IDL_LONG extract;
+    IDL_LONG fold_case;
+    IDL_VPTR length;
+    int length_present;
+    IDL_LONG literal;
+    IDL_LONG preserve_null;
+    IDL_LONG regex;
+    IDL_LONG tpool_min_elts;
+    IDL_LONG tpool_nthreads;
+  } KW_RESULT;
+
+  // make sure to list keyword in alphabetical order
+  static IDL_KW_PAR kw_pars[] = {
+    { "COUNT", IDL_TYP_UNDEF, 1, IDL_KW_OUT | IDL_KW_ZERO,
+      IDL_KW_OFFSETOF(count_present), IDL_KW_OFFSETOF(count) },
+    { "COUNTS", IDL_TYP_UNDEF, 1, IDL_KW_OUT | IDL_KW_ZERO,
+      IDL_KW_OFFSETOF(counts_present), IDL_KW_OFFSETOF(counts) },
+    { "EXTRACT", IDL_TYP_LONG, 1, IDL_KW_ZERO | IDL_KW_VALUE | 1,
+      0, IDL_KW_OFFSETOF(extract) },
+    { "FOLD_CASE", IDL_TYP_LONG, 1, IDL_KW_ZERO | IDL_KW_VALUE | 1,
+      0, IDL_KW_OFFSETOF(fold_case) },
+    { "LENGTH", IDL_TYP_UNDEF, 1, IDL_KW_OUT | IDL_KW_ZERO,
+      IDL_KW_OFFSETOF(length_present), IDL_KW_OFFSETOF(length) },
+    { "LITERAL", IDL_TYP_LONG, 1, IDL_KW_ZERO | IDL_KW_VALUE | 1,
+      0, IDL_KW_OFFSETOF(literal) },
+    { "PRESERVE_NULL", IDL_TYP_LONG, 1, IDL_KW_ZERO | IDL_KW_VALUE | 1,
+      0, IDL_KW_OFFSETOF(preserve_null) },
+    { "REGEX", IDL_TYP_LONG, 1, IDL_KW_ZERO | IDL_KW_VALUE | 1,
+      0, IDL_KW_OFFSETOF(regex) },
+    { "TPOOL_MIN_ELTS", IDL_TYP_LONG, 1, IDL_KW_ZERO,
+      0, IDL_KW_OFFSETOF(tpool_min_elts) },
+    { "TPOOL_NTHREADS", IDL_TYP_LONG, 1, IDL_KW_ZERO,
+      0, IDL_KW_OFFSETOF(tpool_nthreads) },
+    { NULL }
+  };
+
+  KW_RESULT kw;
+  IDL_VPTR plain_args[2], input, result, counts_vptr, offsets_vptr, lengths_vptr;
+  IDL_ALLTYPES count;
+  mg_strsplit_loop loop;
+  IDL_MEMINT n_strings, n_tokens, i, t;
+  IDL_STRING *tokens;
+  char *pattern;
+  int nargs, nthreads, compile_status = 0, c, k;
+
+  nargs = IDL_KWProcessByOffset(argc, argv, argk, kw_pars, plain_args, 1, &kw);
+
+  if (kw.literal && kw.regex) {
+    IDL_KW_FREE;
+    IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                "conflicting keywords, LITERAL and REGEX");
+  }
+
+  input = plain_args[0];
+  if (input->type != IDL_TYP_STRING) {
+    IDL_KW_FREE;
+    IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                "input must be a string or string array");
+  }
+  if (input->flags & IDL_V_ARR) {
+    loop.strings = (IDL_STRING *) input->value.arr->data;
+    n_strings = input->value.arr->n_elts;
+  } else {
+    loop.strings = &input->value.str;
+    n_strings = 1;
+  }
+
+  // like STRSPLIT, the default delimiters are space and tab
+  pattern = nargs > 1 ? IDL_VarGetString(plain_args[1]) : " \t";
+  if (pattern[0] == '\0') {
+    IDL_KW_FREE;
+    IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                "empty delimiter");
+  }
+
+  loop.preserve_null = kw.preserve_null;
+  loop.fold_case = kw.fold_case;
+  loop.delim = pattern;
+  loop.delim_len = (IDL_LONG) strlen(pattern);
+  loop.preg = NULL;
+  loop.n_class = 0;
+  memset(loop.is_delim, 0, sizeof(loop.is_delim));
+
+  if (kw.regex) {
+    loop.mode = MG_STRSPLIT_REGEX;
+    loop.preg = mg_regex_cache_get(pattern,
+                                   REG_EXTENDED | (kw.fold_case ? REG_ICASE : 0),
+                                   &compile_status);
+    if (!loop.preg) {
+      IDL_KW_FREE;
+      mg_regex_error(compile_status);
+    }
+  } else if (kw.literal && loop.delim_len > 1) {
+    loop.mode = MG_STRSPLIT_LITERAL;
+  } else {
+    for (k = 0; k < loop.delim_len; k++) {
+      c = (unsigned char) pattern[k];
+      loop.is_delim[c] = 1;
+      if (kw.fold_case) {
+        loop.is_delim[tolower(c)] = 1;
+        loop.is_delim[toupper(c)] = 1;
+      }
+    }
+    for (c = 0; c < 256; c++) {
+      if (!loop.is_delim[c]) continue;
+      if (loop.n_class < MG_STRSPLIT_SIMD_CLASS) {
+        loop.class_chars[loop.n_class] = (unsigned char) c;
+      }
+      loop.n_class++;
+    }
+    loop.mode = loop.n_class == 1 ? MG_STRSPLIT_CHAR : MG_STRSPLIT_CLASS;
+  }
+
+  // count the tokens of each string, then fill in the tokens of each string
+  // starting at the total of the counts of the strings before it
+  loop.counts = (IDL_LONG *) IDL_MakeTempVector(IDL_TYP_LONG, n_strings,
+                                                IDL_ARR_INI_NOP, &counts_vptr);
+  loop.first = (IDL_MEMINT *) malloc(n_strings * sizeof(IDL_MEMINT));
+  if (!loop.first) {
+    IDL_Deltmp(counts_vptr);
+    IDL_KW_FREE;
+    IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                "unable to allocate memory for tokens");
+  }
+
+  nthreads = mg_threads_count(n_strings, kw.tpool_nthreads,
+                              kw.tpool_min_elts > 0
+                                ? kw.tpool_min_elts
+                                : MG_STRINGS_MIN_ELTS);
+  mg_threads_for(n_strings, nthreads, mg_strsplit_count_range, &loop);
+
+  for (i = 0, n_tokens = 0; i < n_strings; i++) {
+    loop.first[i] = n_tokens;
+    n_tokens += loop.counts[i];
+  }
+
+  if (n_tokens > 0) {
+    loop.offsets = (IDL_LONG *) IDL_MakeTempVector(IDL_TYP_LONG, n_tokens,
+                                                   IDL_ARR_INI_NOP, &offsets_vptr);
+    loop.lengths = (IDL_LONG *) IDL_MakeTempVector(IDL_TYP_LONG, n_tokens,
+                                                   IDL_ARR_INI_NOP, &lengths_vptr);
+    mg_threads_for(n_strings, nthreads, mg_strsplit_fill_range, &loop);
+
+    // extracting creates IDL strings, so it is done after the threads finish
+    if (kw.extract) {
+      tokens = (IDL_STRING *) IDL_MakeTempVector(IDL_TYP_STRING, n_tokens,
+                                                 IDL_ARR_INI_ZERO, &result);
+      for (i = 0; i < n_strings; i++) {
+        for (t = loop.first[i]; t < loop.first[i] + loop.counts[i]; t++) {
+          if (loop.lengths[t] == 0) continue;
+          IDL_StrEnsureLength(&tokens[t], loop.lengths[t]);
+          memcpy(tokens[t].s, loop.strings[i].s + loop.offsets[t], loop.lengths[t]);
+          tokens[t].s[loop.lengths[t]] = '\0';
+          tokens[t].slen = loop.lengths[t];
+        }
+      }
+      IDL_Deltmp(offsets_vptr);
+    } else {
+      result = offsets_vptr;
+    }
+  } else {
+    result = IDL_GettmpLong(-1);
+    lengths_vptr = IDL_GettmpLong(-1);
+  }
+
+  free(loop.first);
+
+  if (kw.count_present) {
+    count.l64 = n_tokens;
+    IDL_StoreScalar(kw.count, IDL_TYP_LONG64, &count);
+  }
+
+  if (kw.counts_present) {
+    IDL_VarCopy(counts_vptr, kw.counts);
+  } else IDL_Deltmp(counts_vptr);
+
+  if (kw.length_present) {
+    IDL_VarCopy(lengths_vptr, kw.length);
+  } else IDL_Deltmp(lengths_vptr);
+
+  IDL_KW_FREE;
+
+  return result;
+}
+
+
+/**************************************************************************
+  Joining and replacing strings
+***************************************************************************/
+
+/*
+  Join the elements of a string array, with an optional separator, into one
+  string. The length of the result is computed first, so it is built in a
+  single allocation.
+*/
+static IDL_VPTR IDL_CDECL IDL_mg_strjoin(int argc, IDL_VPTR *argv) {
+  IDL_STRING *strings;
+  IDL_VPTR result;
+  IDL_MEMINT n, i, total = 0, pos = 0;
+  const char *sep = "";
+  IDL_MEMINT sep_len = 0;
+  char *s;
+
+  if (argv[0]->type != IDL_TYP_STRING) {
+    IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                "strings must be a string or string array");
+  }
+  if (argc > 1) {
+    sep = IDL_VarGetString(argv[1]);
+    sep_len = strlen(sep);
+  }
+
+  if (argv[0]->flags & IDL_V_ARR) {
+    strings = (IDL_STRING *) argv[0]->value.arr->data;
+    n = argv[0]->value.arr->n_elts;
+  } else {
+    strings = &argv[0]->value.str;
+    n = 1;
+  }
+
+  for (i = 0; i < n; i++) total += strings[i].slen;
+  total += (n - 1) * sep_len;
+  if (total > INT_MAX) {
+    IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                "joined string longer than the maximum string length");
+  }
+
+  result = IDL_StrToSTRING("");
+  if (total == 0) return result;
+
+  IDL_StrEnsureLength(&result->value.str, (int) total);
+  s = result->value.str.s;
+  for (i = 0; i < n; i++) {
+    if (i > 0 && sep_len > 0) {
+      memcpy(s + pos, sep, sep_len);
+      pos += sep_len;
+    }
+    memcpy(s + pos, IDL_STRING_STR(&strings[i]), strings[i].slen);
+    pos += strings[i].slen;
+  }
+  s[total] = '\0';
+  result->value.str.slen = (IDL_STRING_SLEN_T) total;
+
+  return result;
+}
+
+
+// a piece of a replacement: literal text or a subexpression of the match
+typedef struct {
+  int group;                     // subexpression, or -1 for literal text
+  IDL_MEMINT start;              // start of literal text
+  IDL_MEMINT len;
+} mg_replace_part;
+
+typedef struct {
+  IDL_STRING *strings;
+  int literal;
+  int fold_case;
+  const char *pattern;           // pattern for LITERAL
+  IDL_MEMINT pattern_len;
+  regex_t *preg;                 // pattern for regular expressions
+  size_t n_groups;
+  const char *text;              // literal text of the replacement
+  mg_replace_part *parts;
+  int n_parts;
+  regmatch_t *pmatch;            // n_groups matches for each thread
+  char **buffers;                // replaced strings of each thread
+  IDL_MEMINT *offsets;           // offset of each string in its buffer
+  IDL_MEMINT *starts;            // first element of each thread
+  IDL_MEMINT *ends;
+  IDL_MEMINT *counts;            // number of replacements of each thread
+  int failed;
+} mg_strreplace_loop;
+
+
+/*
+  Split a replacement into literal text and references to subexpressions,
+  $& for the whole match and $1, $2, etc. for subexpressions; \$ is a
+  literal $. Returns the number of parts, or -1 for an invalid $.
+*/
+static int mg_strreplace_parse(const char *replacement, char *text,
+                               mg_replace_part *parts) {
+  const char *r = replacement;
+  IDL_MEMINT n_text = 0;
+  int n_parts = 0, group;
+
+  while (*r) {
+    if (*r == '$') {
+      r++;
+      if (*r == '&') {
+        group = 0;
+        r++;
+      } else if (isdigit((unsigned char) *r)) {
+        for (group = 0; isdigit((unsigned char) *r); r++) {
+          if (group < 1000) group = 10 * group + (*r - '0');
+        }
+      } else {
+        return -1;
+      }
+      parts[n_parts].group = group;
+      parts[n_parts++].len = 0;
+      continue;
+    }
+
+    if (n_parts == 0 || parts[n_parts - 1].group >= 0) {
+      parts[n_parts].group = -1;
+      parts[n_parts].start = n_text;
+      parts[n_parts++].len = 0;
+    }
+    if (*r == '\\' && r[1] == '$') r++;
+    text[n_text++] = *r++;
+    parts[n_parts - 1].len++;
+  }
+
+  return n_parts;
+}
+
+
+// Find the next match of a literal pattern in s at or after pos.
+static IDL_MEMINT mg_strreplace_find(const mg_strreplace_loop *loop,
+                                     const char *s, IDL_MEMINT len,
+                                     IDL_MEMINT pos) {
+  const unsigned char *u = (const unsigned char *) s;
+  const char *p;
+  IDL_MEMINT i, j, m = loop->pattern_len;
+
+  for (i = pos; i + m <= len; i++) {
+    if (loop->fold_case) {
+      for (j = 0; j < m && tolower(u[i + j]) == tolower((unsigned char) loop->pattern[j]); j++);
+    } else {
+      p = (const char *) memchr(s + i, loop->pattern[0], len - m - i + 1);
+      if (!p) break;
+      i = p - s;
+      for (j = 1; j < m && s[i + j] == loop->pattern[j]; j++);
+    }
+    if (j == m) return i;
+  }
+
+  return -1;
+}
+
+
+// Append n bytes to a growing buffer, returns 0 if out of memory.
+static int mg_strreplace_append(char **buffer, IDL_MEMINT *size,
+                                IDL_MEMINT *capacity, const char *s,
+                                IDL_MEMINT n) {
+  while (*size + n >= *capacity) {
+    if (!mg_arena_reserve((void **) buffer, *capacity, capacity, 1)) return 0;
+  }
+  memcpy(*buffer + *size, s, n);
+  *size += n;
+
+  return 1;
+}
+
+
+static void mg_strreplace_range(void *data, IDL_MEMINT start, IDL_MEMINT end,
+                                int thread) {
+  mg_strreplace_loop *loop = (mg_strreplace_loop *) data;
+  regmatch_t *pmatch = loop->pmatch + thread * loop->n_groups;
+  char *buffer = NULL;
+  const char *s;
+  IDL_MEMINT i, len, pos, match, match_end, size = 0, capacity = 0, count = 0;
+  mg_replace_part *part;
+  int k, ok = 1;
+
+  loop->starts[thread] = start;
+  loop->ends[thread] = end;
+
+  for (i = start; ok && i < end; i++) {
+    s = IDL_STRING_STR(&loop->strings[i]);
+    len = loop->strings[i].slen;
+    loop->offsets[i] = size;
+
+    for (pos = 0; ok && pos <= len; ) {
+      if (loop->literal) {
+        if ((match = mg_strreplace_find(loop, s, len, pos)) < 0) break;
+        match_end = match + loop->pattern_len;
+      } else {
+        if (tre_regnexec(loop->preg, s + pos, len - pos, loop->n_groups,
+                         pmatch, pos > 0 ? REG_NOTBOL : 0) != 0) {
+          break;
+        }
+        match = pos + pmatch[0].rm_so;
+        match_end = pos + pmatch[0].rm_eo;
+      }
+
+      ok = mg_strreplace_append(&buffer, &size, &capacity, s + pos, match - pos);
+      for (k = 0; ok && k < loop->n_parts; k++) {
+        part = &loop->parts[k];
+        if (loop->literal || part->group < 0) {
+          ok = mg_strreplace_append(&buffer, &size, &capacity,
+                                    loop->text + part->start, part->len);
+        } else if (pmatch[part->group].rm_so >= 0) {
+          ok = mg_strreplace_append(&buffer, &size, &capacity,
+                                    s + pos + pmatch[part->group].rm_so,
+                                    pmatch[part->group].rm_eo - pmatch[part->group].rm_so);
+        }
+      }
+      count++;
+
+      // after an empty match, copy the next character and look past it
+      if (match_end == match) {
+        if (ok && match < len) {
+          ok = mg_strreplace_append(&buffer, &size, &capacity, s + match, 1);
+        }
+        match_end++;
+      }
+      pos = match_end;
+    }
+
+    if (ok && pos < len) {
+      ok = mg_strreplace_append(&buffer, &size, &capacity, s + pos, len - pos);
+    }
+    if (ok) ok = mg_strreplace_append(&buffer, &size, &capacity, "", 1);
+  }
+
+  if (!ok) loop->failed = 1;
+  loop->buffers[thread] = buffer;
+  loop->counts[thread] = count;
+}
+
+
+/*
+  Replace every match of a regular expression, or of a literal string with
+  LITERAL, in a string or the elements of a string array. The replacement
+  can refer to the match with $& and to subexpressions with $1, $2, etc.
+*/
+static IDL_VPTR IDL_CDECL IDL_mg_strreplace(int argc, IDL_VPTR *argv, char *argk) {
+  typedef struct {
+    IDL_KW_RESULT_FIRST_FIELD;
+    IDL_VPTR count;
+    int count_present;
+    IDL_LONG fold_case;
+    IDL_LONG literal;
+    IDL_LONG tpool_min_elts;
+    IDL_LONG tpool_nthreads;
+  } KW_RESULT;
+
+  // make sure to list keyword in alphabetical order
+  static IDL_KW_PAR kw_pars[] = {
+    { "COUNT", IDL_TYP_UNDEF, 1, IDL_KW_OUT | IDL_KW_ZERO,
+      IDL_KW_OFFSETOF(count_present), IDL_KW_OFFSETOF(count) },
+    { "FOLD_CASE", IDL_TYP_LONG, 1, IDL_KW_ZERO | IDL_KW_VALUE | 1,
+      0, IDL_KW_OFFSETOF(fold_case) },
+    { "LITERAL", IDL_TYP_LONG, 1, IDL_KW_ZERO | IDL_KW_VALUE | 1,
+      0, IDL_KW_OFFSETOF(literal) },
+    { "TPOOL_MIN_ELTS", IDL_TYP_LONG, 1, IDL_KW_ZERO,
+      0, IDL_KW_OFFSETOF(tpool_min_elts) },
+    { "TPOOL_NTHREADS", IDL_TYP_LONG, 1, IDL_KW_ZERO,
+      0, IDL_KW_OFFSETOF(tpool_nthreads) },
+    { NULL }
+  };
+
+  KW_RESULT kw;
+  mg_strreplace_loop loop;
+  IDL_VPTR result;
+  IDL_STRING *strings;
+  IDL_MEMINT n, i, min_elts, count = 0;
+  IDL_ALLTYPES count_value;
+  const char *replacement;
+  char *text, msg[64];
+  int nthreads, t, compile_status = 0, k;
+
+  int nargs = IDL_KWProcessByOffset(argc, argv, argk, kw_pars, (IDL_VPTR *) NULL, 1, &kw);
+
+  if (argv[0]->type != IDL_TYP_STRING) {
+    IDL_KW_FREE;
+    IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                "strings must be a string or string array");
+  }
+
+  memset(&loop, 0, sizeof(loop));
+  loop.literal = kw.literal;
+  loop.fold_case = kw.fold_case;
+  loop.pattern = IDL_VarGetString(argv[1]);
+  loop.pattern_len = strlen(loop.pattern);
+  replacement = IDL_VarGetString(argv[2]);
+
+  if (loop.literal) {
+    if (loop.pattern_len == 0) {
+      IDL_KW_FREE;
+      IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                  "pattern must not be empty");
+    }
+    // a literal replacement is a single part of text
+    loop.text = replacement;
+    loop.parts = (mg_replace_part *) malloc(sizeof(mg_replace_part));
+    if (!loop.parts) {
+      IDL_KW_FREE;
+      IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                  "unable to allocate memory for replaced strings");
+    }
+    loop.parts[0].group = -1;
+    loop.parts[0].start = 0;
+    loop.parts[0].len = strlen(replacement);
+    loop.n_parts = 1;
+    loop.n_groups = 1;
+  } else {
+    loop.preg = mg_regex_cache_get(loop.pattern,
+                                   REG_EXTENDED | (kw.fold_case ? REG_ICASE : 0),
+                                   &compile_status);
+    if (!loop.preg) {
+      IDL_KW_FREE;
+      mg_regex_error(compile_status);
+    }
+    loop.n_groups = loop.preg->re_nsub + 1;
+
+    text = (char *) malloc(strlen(replacement) + 1);
+    loop.parts = (mg_replace_part *) malloc((strlen(replacement) + 1) * sizeof(mg_replace_part));
+    loop.text = text;
+    loop.n_parts = text && loop.parts
+                     ? mg_strreplace_parse(replacement, text, loop.parts)
+                     : 0;
+    for (k = 0; k < loop.n_parts; k++) {
+      if (loop.parts[k].group >= (int) loop.n_groups) break;
+    }
+    if (loop.n_parts < 0 || k < loop.n_parts) {
+      if (loop.n_parts < 0) {
+        strcpy(msg, "illegal $, use \\ to escape");
+      } else {
+        snprintf(msg, sizeof(msg), "$%d undefined", loop.parts[k].group);
+      }
+      free(text);
+      free(loop.parts);
+      IDL_KW_FREE;
+      IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP, msg);
+    }
+  }
+
+  if (argv[0]->flags & IDL_V_ARR) {
+    loop.strings = (IDL_STRING *) argv[0]->value.arr->data;
+    n = argv[0]->value.arr->n_elts;
+  } else {
+    loop.strings = &argv[0]->value.str;
+    n = 1;
+  }
+
+  min_elts = kw.tpool_min_elts > 0 ? kw.tpool_min_elts : MG_STRINGS_MIN_ELTS;
+  nthreads = mg_threads_count(n, kw.tpool_nthreads, min_elts);
+
+  loop.pmatch = (regmatch_t *) malloc(nthreads * loop.n_groups * sizeof(regmatch_t));
+  loop.buffers = (char **) calloc(nthreads, sizeof(char *));
+  loop.starts = (IDL_MEMINT *) calloc(nthreads, sizeof(IDL_MEMINT));
+  loop.ends = (IDL_MEMINT *) calloc(nthreads, sizeof(IDL_MEMINT));
+  loop.counts = (IDL_MEMINT *) calloc(nthreads, sizeof(IDL_MEMINT));
+  loop.offsets = (IDL_MEMINT *) malloc(n * sizeof(IDL_MEMINT));
+
+  if (loop.text && loop.parts && loop.pmatch && loop.buffers && loop.starts
+        && loop.ends && loop.counts && loop.offsets) {
+    mg_threads_for(n, nthreads, mg_strreplace_range, &loop);
+  } else {
+    loop.failed = 1;
+  }
+
+  if (!loop.failed) {
+    if (argv[0]->flags & IDL_V_ARR) {
+      strings = (IDL_STRING *) IDL_MakeTempArray(IDL_TYP_STRING,
+                                                 argv[0]->value.arr->n_dim,
+                                                 argv[0]->value.arr->dim,
+                                                 IDL_ARR_INI_ZERO, &result);
+      for (t = 0; t < nthreads; t++) {
+        for (i = loop.starts[t]; i < loop.ends[t]; i++) {
+          IDL_StrStore(&strings[i], loop.buffers[t] + loop.offsets[i]);
+        }
+      }
+    } else {
+      result = IDL_StrToSTRING(loop.buffers[0]);
+    }
+    for (t = 0; t < nthreads; t++) count += loop.counts[t];
+  }
+
+  if (loop.buffers) {
+    for (t = 0; t < nthreads; t++) free(loop.buffers[t]);
+  }
+  free(loop.buffers);
+  free(loop.starts);
+  free(loop.ends);
+  free(loop.counts);
+  free(loop.offsets);
+  free(loop.pmatch);
+  free(loop.parts);
+  if (!loop.literal) free((char *) loop.text);
+
+  if (loop.failed) {
+    IDL_KW_FREE;
+    IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                "unable to allocate memory for replaced strings");
+  }
+
+  if (kw.count_present) {
+    count_value.l64 = count;
+    IDL_StoreScalar(kw.count, IDL_TYP_LONG64, &count_value);
+  }
+
+  IDL_KW_FREE;
+
+  return result;
+}
+
+
+/**************************************************************************
+  Matching many literal patterns
+***************************************************************************/
+
+/*
+  Aho-Corasick automaton for a set of literal patterns. The trie of the
+  patterns is turned into a full DFA over the classes of bytes that occur in
+  the patterns, so scanning takes a single table lookup per input byte.
+*/
+typedef struct {
+  IDL_LONG n_patterns;
+  IDL_LONG *pattern_length;
+  IDL_LONG *pattern_next;        // next pattern with the same text, or -1
+  int n_classes;                 // number of classes, including class 0
+  unsigned short classes[256];   // class of each byte, 0 if in no pattern
+  IDL_LONG n_states;
+  IDL_LONG *delta;               // n_states x n_classes transitions
+  IDL_LONG *state_pattern;       // first pattern ending at a state, or -1
+  IDL_LONG *output;              // the state, or its longest suffix state,
+                                 // with a pattern ending at it, or -1
+  IDL_LONG *output_link;         // longest proper suffix state with a
+                                 // pattern ending at it, or -1
+} mg_strmatcher;
+
+
+static void mg_strmatcher_free(mg_strmatcher *matcher) {
+  if (!matcher) return;
+
+  free(matcher->pattern_length);
+  free(matcher->pattern_next);
+  free(matcher->delta);
+  free(matcher->state_pattern);
+  free(matcher->output);
+  free(matcher->output_link);
+  free(matcher);
+}
+
+
+// Build the automaton for the given patterns. Returns NULL if out of memory.
+static mg_strmatcher *mg_strmatcher_new(const IDL_STRING *patterns,
+                                        IDL_MEMINT n_patterns,
+                                        int fold_case) {
+  mg_strmatcher *matcher = (mg_strmatcher *) calloc(1, sizeof(mg_strmatcher));
+  IDL_MEMINT p, i, c, nc, total = 0, max_states;
+  IDL_LONG s, t, f, q, head = 0, tail = 0;
+  IDL_LONG *fail = NULL, *queue = NULL;
+  const unsigned char *text;
+  int b;
+
+  if (!matcher) return NULL;
+  matcher->n_patterns = n_patterns;
+
+  // assign a class to each byte used in a pattern
+  matcher->n_classes = 1;
+  for (p = 0; p < n_patterns; p++) {
+    text = (const unsigned char *) IDL_STRING_STR(&patterns[p]);
+    for (i = 0; i < patterns[p].slen; i++) {
+      b = fold_case ? tolower(text[i]) : text[i];
+      if (!matcher->classes[b]) matcher->classes[b] = matcher->n_classes++;
+    }
+    total += patterns[p].slen;
+  }
+  if (fold_case) {
+    for (b = 0; b < 256; b++) matcher->classes[b] = matcher->classes[tolower(b)];
+  }
+
+  nc = matcher->n_classes;
+  max_states = total + 1;
+  if (max_states > INT_MAX) {
+    mg_strmatcher_free(matcher);
+    return NULL;
+  }
+
+  matcher->pattern_length = (IDL_LONG *) malloc(n_patterns * sizeof(IDL_LONG));
+  matcher->pattern_next = (IDL_LONG *) malloc(n_patterns * sizeof(IDL_LONG));
+  matcher->delta = (IDL_LONG *) malloc(max_states * nc * sizeof(IDL_LONG));
+  matcher->state_pattern = (IDL_LONG *) malloc(max_states * sizeof(IDL_LONG));
+  matcher->output = (IDL_LONG *) malloc(max_states * sizeof(IDL_LONG));
+  matcher->output_link = (IDL_LONG *) malloc(max_states * sizeof(IDL_LONG));
+  fail = (IDL_LONG *) malloc(max_states * sizeof(IDL_LONG));
+  queue = (IDL_LONG *) malloc(max_states * sizeof(IDL_LONG));
+  if (!matcher->pattern_length || !matcher->pattern_next
+        || !matcher->delta || !matcher->state_pattern
+        || !matcher->output || !matcher->output_link || !fail || !queue) {
+    free(fail);
+    free(queue);
+    mg_strmatcher_free(matcher);
+    return NULL;
+  }
+
+  // build the trie, with -1 for missing transitions
+  for (i = 0; i < max_states * nc; i++) matcher->delta[i] = -1;
+  matcher->n_states = 1;
+  matcher->state_pattern[0] = -1;
+
+  for (p = 0; p < n_patterns; p++) {
+    text = (const unsigned char *) IDL_STRING_STR(&patterns[p]);
+    s = 0;
+    for (i = 0; i < patterns[p].slen; i++) {
+      c = matcher->classes[text[i]];
+      if (matcher->delta[s * nc + c] < 0) {
+        matcher->state_pattern[matcher->n_states] = -1;
+        matcher->delta[s * nc + c] = matcher->n_states++;
+      }
+      s = matcher->delta[s * nc + c];
+    }
+
+    matcher->pattern_length[p] = patterns[p].slen;
+    matcher->pattern_next[p] = -1;
+
+    // empty patterns never match
+    if (patterns[p].slen == 0) continue;
+
+    // keep duplicate patterns in order
+    if (matcher->state_pattern[s] < 0) {
+      matcher->state_pattern[s] = p;
+    } else {
+      for (q = matcher->state_pattern[s];
+           matcher->pattern_next[q] >= 0;
+           q = matcher->pattern_next[q]);
+      matcher->pattern_next[q] = p;
+    }
+  }
+
+  // compute failure links breadth first, filling in missing transitions
+  // from the failure state, whose transitions are already complete
+  matcher->output[0] = matcher->output_link[0] = -1;
+  for (c = 0; c < nc; c++) {
+    t = matcher->delta[c];
+    if (t < 0) {
+      matcher->delta[c] = 0;
+    } else {
+      fail[t] = 0;
+      queue[tail++] = t;
+    }
+  }
+
+  while (head < tail) {
+    s = queue[head++];
+    f = fail[s];
+    matcher->output_link[s] = matcher->state_pattern[f] >= 0
+                                ? f
+                                : matcher->output_link[f];
+    matcher->output[s] = matcher->state_pattern[s] >= 0
+                           ? s
+                           : matcher->output_link[s];
+    for (c = 0; c < nc; c++) {
+      t = matcher->delta[s * nc + c];
+      if (t < 0) {
+        matcher->delta[s * nc + c] = matcher->delta[f * nc + c];
+      } else {
+        fail[t] = matcher->delta[f * nc + c];
+        queue[tail++] = t;
+      }
+    }
+  }
+
+  free(fail);
+  free(queue);
+
+  return matcher;
+}
+
+
+// a match of a pattern
+typedef struct {
+  IDL_LONG pattern;
+  IDL_LONG64 position;
+} mg_strmatch_t;
+
+typedef struct {
+  mg_strmatch_t *matches;
+  IDL_MEMINT n;
+  IDL_MEMINT capacity;
+} mg_strmatch_arena;
+
+// size of the buffer used to read files
+#define MG_STRMATCH_BUFFER_SIZE (1024 * 1024)
+
+typedef struct {
+  const mg_strmatcher *matcher;
+  IDL_STRING *strings;        // strings to scan, or names of files to scan
+  int files;
+  int first_only;             // stop at the first match of each string
+  UCHAR *matched;
+  IDL_LONG64 *n_matches;      // number of matches in each string, -1 for a
+                              // file that can't be read
+  mg_strmatch_arena *arenas;  // matches found by each thread, or NULL
+  IDL_LONG64 *counts;         // matches of each pattern by each thread, or
+                              // NULL
+  int failed;                 // set if out of memory
+} mg_strmatch_loop;
+
+
+/*
+  Scan len bytes of input, continuing from the given automaton state, with
+  pos the position of the start of the bytes in the whole input. Returns the
+  new state, or -1 if the scan should stop.
+*/
+static IDL_LONG mg_strmatch_scan(mg_strmatch_loop *loop, int thread,
+                                 IDL_LONG state,
+                                 const unsigned char *s, IDL_MEMINT len,
+                                 IDL_LONG64 pos, IDL_LONG64 *n_found) {
+  const mg_strmatcher *matcher = loop->matcher;
+  const IDL_LONG *delta = matcher->delta;
+  const unsigned short *classes = matcher->classes;
+  IDL_MEMINT nc = matcher->n_classes, i;
+  IDL_LONG64 *counts = loop->counts
+                         ? loop->counts + (IDL_MEMINT) thread * matcher->n_patterns
+                         : NULL;
+  mg_strmatch_arena *arena = loop->arenas ? &loop->arenas[thread] : NULL;
+  IDL_LONG t, p;
+
+  for (i = 0; i < len; i++) {
+    state = delta[state * nc + classes[s[i]]];
+    if (matcher->output[state] < 0) continue;
+
+    for (t = matcher->output[state]; t >= 0; t = matcher->output_link[t]) {
+      for (p = matcher->state_pattern[t]; p >= 0; p = matcher->pattern_next[p]) {
+        (*n_found)++;
+        if (loop->first_only) return -1;
+        if (counts) counts[p]++;
+        if (arena) {
+          if (!mg_arena_reserve((void **) &arena->matches, arena->n,
+                                &arena->capacity, sizeof(mg_strmatch_t))) {
+            loop->failed = 1;
+            return -1;
+          }
+          arena->matches[arena->n].pattern = p;
+          arena->matches[arena->n++].position
+            = pos + i + 1 - matcher->pattern_length[p];
+        }
+      }
+    }
+  }
+
+  return state;
+}
+
+
+// Scan the strings, or files, start to end - 1.
+static void mg_strmatch_range(void *data, IDL_MEMINT start, IDL_MEMINT end,
+                              int thread) {
+  mg_strmatch_loop *loop = (mg_strmatch_loop *) data;
+  unsigned char *buffer = NULL;
+  IDL_STRING *str;
+  IDL_MEMINT i;
+  IDL_LONG state;
+  IDL_LONG64 n_found, pos;
+  size_t n_read;
+  FILE *fp;
+
+  if (loop->files) {
+    buffer = (unsigned char *) malloc(MG_STRMATCH_BUFFER_SIZE);
+    if (!buffer) {
+      loop->failed = 1;
+      return;
+    }
+  }
+
+  for (i = start; i < end && !loop->failed; i++) {
+    str = &loop->strings[i];
+    n_found = 0;
+
+    if (loop->files) {
+      fp = fopen(IDL_STRING_STR(str), "rb");
+      if (!fp) {
+        loop->n_matches[i] = -1;
+        loop->matched[i] = 0;
+        continue;
+      }
+
+      // the automaton state carries over between blocks of the file
+      state = 0;
+      pos = 0;
+      while (state >= 0
+               && (n_read = fread(buffer, 1, MG_STRMATCH_BUFFER_SIZE, fp)) > 0) {
+        state = mg_strmatch_scan(loop, thread, state, buffer, n_read, pos,
+                                 &n_found);
+        pos += n_read;
+      }
+      if (ferror(fp)) n_found = -1;
+      fclose(fp);
+    } else {
+      mg_strmatch_scan(loop, thread, 0,
+                       (const unsigned char *) IDL_STRING_STR(str), str->slen,
+                       0, &n_found);
+    }
+
+    loop->n_matches[i] = n_found;
+    loop->matched[i] = n_found > 0 ? 1 : 0;
+  }
+
+  free(buffer);
+}
+
+
+static void mg_strmatch_loop_free(mg_strmatch_loop *loop, int nthreads) {
+  int t;
+
+  if (loop->arenas) {
+    for (t = 0; t < nthreads; t++) free(loop->arenas[t].matches);
+    free(loop->arenas);
+  }
+  free(loop->counts);
+  free(loop->n_matches);
+}
+
+
+static mg_strmatcher *mg_strmatcher_get(IDL_VPTR arg) {
+  mg_strmatcher *matcher = (mg_strmatcher *) IDL_MEMINTScalar(arg);
+
+  if (!matcher) {
+    IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP, "invalid matcher");
+  }
+
+  return matcher;
+}
+
+
+static IDL_VPTR IDL_CDECL IDL_mg_strmatch_new(int argc, IDL_VPTR *argv, char *argk) {
+  typedef struct {
+    IDL_KW_RESULT_FIRST_FIELD;
+    IDL_LONG fold_case;
+  } KW_RESULT;
+
+  // make sure to list keyword in alphabetical order
+  static IDL_KW_PAR kw_pars[] = {
+    { "FOLD_CASE", IDL_TYP_LONG, 1, IDL_KW_ZERO | IDL_KW_VALUE | 1,
+      0, IDL_KW_OFFSETOF(fold_case) },
+    { NULL }
+  };
+
+  KW_RESULT kw;
+  IDL_STRING *patterns;
+  IDL_MEMINT n_patterns;
+  mg_strmatcher *matcher;
+
+  int nargs = IDL_KWProcessByOffset(argc, argv, argk, kw_pars, (IDL_VPTR *) NULL, 1, &kw);
+
+  if (argv[0]->type != IDL_TYP_STRING) {
+    IDL_KW_FREE;
+    IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                "patterns must be a string or string array");
+  }
+
+  if (argv[0]->flags & IDL_V_ARR) {
+    patterns = (IDL_STRING *) argv[0]->value.arr->data;
+    n_patterns = argv[0]->value.arr->n_elts;
+  } else {
+    patterns = &argv[0]->value.str;
+    n_patterns = 1;
+  }
+
+  matcher = mg_strmatcher_new(patterns, n_patterns, kw.fold_case);
+
+  IDL_KW_FREE;
+
+  if (!matcher) {
+    IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                "unable to allocate memory for matcher");
+  }
+
+  return IDL_GettmpMEMINT((IDL_MEMINT) matcher);
+}
+
+
+/*
+  Scan a string, string array, or the files named by them, for all the
+  patterns of a matcher at once. Returns a byte array indicating which
+  elements contain any of the patterns.
+*/
+static IDL_VPTR IDL_CDECL IDL_mg_strmatch_any(int argc, IDL_VPTR *argv, char *argk) {
+  typedef struct {
+    IDL_KW_RESULT_FIRST_FIELD;
+    IDL_VPTR count;
+    int count_present;
+    IDL_VPTR counts;
+    int counts_present;
+    IDL_LONG file;
+    IDL_VPTR matches;
+    int matches_present;
+    IDL_VPTR offsets;
+    int offsets_present;
+    IDL_VPTR positions;
+    int positions_present;
+    IDL_LONG tpool_min_elts;
+    IDL_LONG tpool_nthreads;
+  } KW_RESULT;
+
+  // make sure to list keyword in alphabetical order
+  static IDL_KW_PAR kw_pars[] = {
+    { "COUNT", IDL_TYP_UNDEF, 1, IDL_KW_OUT | IDL_KW_ZERO,
+      IDL_KW_OFFSETOF(count_present), IDL_KW_OFFSETOF(count) },
+    { "COUNTS", IDL_TYP_UNDEF, 1, IDL_KW_OUT | IDL_KW_ZERO,
+      IDL_KW_OFFSETOF(counts_present), IDL_KW_OFFSETOF(counts) },
+    { "FILE", IDL_TYP_LONG, 1, IDL_KW_ZERO | IDL_KW_VALUE | 1,
+      0, IDL_KW_OFFSETOF(file) },
+    { "MATCHES", IDL_TYP_UNDEF, 1, IDL_KW_OUT | IDL_KW_ZERO,
+      IDL_KW_OFFSETOF(matches_present), IDL_KW_OFFSETOF(matches) },
+    { "OFFSETS", IDL_TYP_UNDEF, 1, IDL_KW_OUT | IDL_KW_ZERO,
+      IDL_KW_OFFSETOF(offsets_present), IDL_KW_OFFSETOF(offsets) },
+    { "POSITIONS", IDL_TYP_UNDEF, 1, IDL_KW_OUT | IDL_KW_ZERO,
+      IDL_KW_OFFSETOF(positions_present), IDL_KW_OFFSETOF(positions) },
+    { "TPOOL_MIN_ELTS", IDL_TYP_LONG, 1, IDL_KW_ZERO,
+      0, IDL_KW_OFFSETOF(tpool_min_elts) },
+    { "TPOOL_NTHREADS", IDL_TYP_LONG, 1, IDL_KW_ZERO,
+      0, IDL_KW_OFFSETOF(tpool_nthreads) },
+    { NULL }
+  };
+
+  KW_RESULT kw;
+  mg_strmatcher *matcher;
+  mg_strmatch_loop loop;
+  IDL_VPTR result, matches_vptr, positions_vptr, offsets_vptr, counts_vptr;
+  IDL_MEMINT n, i, m, p, total = 0, min_elts;
+  IDL_LONG64 *offsets, *counts;
+  IDL_LONG *matches;
+  IDL_LONG64 *positions;
+  IDL_ALLTYPES count;
+  int nthreads, t;
+
+  int nargs = IDL_KWProcessByOffset(argc, argv, argk, kw_pars, (IDL_VPTR *) NULL, 1, &kw);
+
+  matcher = mg_strmatcher_get(argv[0]);
+
+  if (argv[1]->type != IDL_TYP_STRING) {
+    IDL_KW_FREE;
+    IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                "input must be a string or string array");
+  }
+
+  loop.matcher = matcher;
+  loop.files = kw.file;
+  loop.first_only = !(kw.count_present || kw.counts_present
+                        || kw.matches_present || kw.offsets_present
+                        || kw.positions_present);
+  loop.failed = 0;
+
+  if (argv[1]->flags & IDL_V_ARR) {
+    IDL_ARRAY *arr = argv[1]->value.arr;
+    n = arr->n_elts;
+    loop.strings = (IDL_STRING *) arr->data;
+    loop.matched = (UCHAR *) IDL_MakeTempArray(IDL_TYP_BYTE,
+                                               arr->n_dim, arr->dim,
+                                               IDL_ARR_INI_NOP, &result);
+  } else {
+    n = 1;
+    loop.strings = &argv[1]->value.str;
+    result = IDL_GettmpByte(0);
+    loop.matched = &result->value.c;
+  }
+
+  // files are large, so by default each one can be given its own thread
+  min_elts = kw.tpool_min_elts > 0
+               ? kw.tpool_min_elts
+               : (kw.file ? 1 : MG_STRINGS_MIN_ELTS);
+  nthreads = mg_threads_count(n, kw.tpool_nthreads, min_elts);
+
+  loop.n_matches = (IDL_LONG64 *) malloc(n * sizeof(IDL_LONG64));
+  loop.arenas = kw.matches_present || kw.positions_present
+                  ? (mg_strmatch_arena *) calloc(nthreads, sizeof(mg_strmatch_arena))
+                  : NULL;
+  loop.counts = kw.counts_present
+                  ? (IDL_LONG64 *) calloc((IDL_MEMINT) nthreads * matcher->n_patterns,
+                                          sizeof(IDL_LONG64))
+                  : NULL;
+  if (!loop.n_matches
+        || ((kw.matches_present || kw.positions_present) && !loop.arenas)
+        || (kw.counts_present && !loop.counts)) {
+    loop.failed = 1;
+  } else {
+    mg_threads_for(n, nthreads, mg_strmatch_range, &loop);
+  }
+
+  if (!loop.failed && kw.file) {
+    for (i = 0; i < n; i++) {
+      if (loop.n_matches[i] < 0) {
+        mg_strmatch_loop_free(&loop, nthreads);
+        IDL_Deltmp(result);
+        IDL_KW_FREE;
+        IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                    "unable to read file: %s",
+                    IDL_STRING_STR(&loop.strings[i]));
+      }
+    }
+  }
+
+  if (loop.failed) {
+    mg_strmatch_loop_free(&loop, nthreads);
+    IDL_Deltmp(result);
+    IDL_KW_FREE;
+    IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                "unable to allocate memory for matches");
+  }
+
+  for (i = 0; i < n; i++) total += loop.n_matches[i];
+
+  if (kw.count_present) {
+    count.l64 = total;
+    IDL_StoreScalar(kw.count, IDL_TYP_LONG64, &count);
+  }
+
+  if (kw.offsets_present) {
+    offsets = (IDL_LONG64 *) IDL_MakeTempVector(IDL_TYP_LONG64, n + 1,
+                                                IDL_ARR_INI_NOP, &offsets_vptr);
+    offsets[0] = 0;
+    for (i = 0; i < n; i++) offsets[i + 1] = offsets[i] + loop.n_matches[i];
+    IDL_VarCopy(offsets_vptr, kw.offsets);
+  }
+
+  // the matches of each thread are in order, so concatenate them
+  if (loop.arenas) {
+    if (total > 0) {
+      matches = (IDL_LONG *) IDL_MakeTempVector(IDL_TYP_LONG, total,
+                                                IDL_ARR_INI_NOP, &matches_vptr);
+      positions = (IDL_LONG64 *) IDL_MakeTempVector(IDL_TYP_LONG64, total,
+                                                    IDL_ARR_INI_NOP,
+                                                    &positions_vptr);
+      for (t = 0, m = 0; t < nthreads; t++) {
+        for (i = 0; i < loop.arenas[t].n; i++, m++) {
+          matches[m] = loop.arenas[t].matches[i].pattern;
+          positions[m] = loop.arenas[t].matches[i].position;
+        }
+      }
+    } else {
+      matches_vptr = IDL_GettmpLong(-1);
+      positions_vptr = IDL_GettmpLong(-1);
+    }
+
+    if (kw.matches_present) {
+      IDL_VarCopy(matches_vptr, kw.matches);
+    } else IDL_Deltmp(matches_vptr);
+
+    if (kw.positions_present) {
+      IDL_VarCopy(positions_vptr, kw.positions);
+    } else IDL_Deltmp(positions_vptr);
+  }
+
+  if (kw.counts_present) {
+    counts = (IDL_LONG64 *) IDL_MakeTempVector(IDL_TYP_LONG64,
+                                               matcher->n_patterns,
+                                               IDL_ARR_INI_NOP, &counts_vptr);
+    for (p = 0; p < matcher->n_patterns; p++) {
+      counts[p] = loop.counts[p];
+      for (t = 1; t < nthreads; t++) {
+        counts[p] += loop.counts[(IDL_MEMINT) t * matcher->n_patterns + p];
+      }
+    }
+    IDL_VarCopy(counts_vptr, kw.counts);
+  }
+
+  mg_strmatch_loop_free(&loop, nthreads);
+
+  IDL_KW_FREE;
+
+  return result;
+}
+
+
+static void IDL_CDECL IDL_mg_strmatch_free(int argc, IDL_VPTR *argv) {
+  mg_strmatcher_free((mg_strmatcher *) IDL_MEMINTScalar(argv[0]));
+}
+
+
+/**************************************************************************
+  Word tables
+***************************************************************************/
+
+static IDL_ULONG64 mg_word_hash(const char *s, IDL_MEMINT len) {
+  IDL_ULONG64 h = 14695981039346656037ULL;  // FNV-1a
+  IDL_MEMINT i;
+
+  for (i = 0; i < len; i++) {
+    h ^= (unsigned char) s[i];
+    h *= 1099511628211ULL;
+  }
+
+  return h;
+}
+
+
+/*
+  Distinct words, numbered in the order they were added, with a count for
+  each and an open addressing hash table to look them up.
+*/
+typedef struct {
+  IDL_MEMINT n_words;
+  IDL_MEMINT words_capacity;
+  IDL_LONG64 *counts;
+  IDL_LONG64 *word_offsets;    // n_words + 1 offsets into pool
+  IDL_ULONG64 *hashes;
+  char *pool;                  // the words, each followed by a null
+  IDL_MEMINT pool_size;
+  IDL_MEMINT pool_capacity;
+  IDL_LONG *slots;             // word in each slot, or -1
+  IDL_MEMINT n_slots;          // a power of 2
+} mg_wordtable;
+
+
+static void mg_wordtable_free(mg_wordtable *table) {
+  free(table->counts);
+  free(table->word_offsets);
+  free(table->hashes);
+  free(table->pool);
+  free(table->slots);
+  memset(table, 0, sizeof(mg_wordtable));
+}
+
+
+// Resize the hash table, returns 0 if out of memory.
+static int mg_wordtable_rehash(mg_wordtable *table, IDL_MEMINT n_slots) {
+  IDL_LONG *slots = (IDL_LONG *) malloc(n_slots * sizeof(IDL_LONG));
+  IDL_MEMINT s, w;
+
+  if (!slots) return 0;
+  for (s = 0; s < n_slots; s++) slots[s] = -1;
+
+  for (w = 0; w < table->n_words; w++) {
+    for (s = table->hashes[w] & (n_slots - 1);
+         slots[s] >= 0;
+         s = (s + 1) & (n_slots - 1));
+    slots[s] = (IDL_LONG) w;
+  }
+
+  free(table->slots);
+  table->slots = slots;
+  table->n_slots = n_slots;
+
+  return 1;
+}
+
+
+// Find the slot of a word, or of the empty slot where it would go.
+static IDL_MEMINT mg_wordtable_slot(const mg_wordtable *table,
+                                    const char *word, IDL_MEMINT len,
+                                    IDL_ULONG64 h) {
+  IDL_MEMINT s;
+  IDL_LONG w;
+
+  for (s = h & (table->n_slots - 1);
+       (w = table->slots[s]) >= 0;
+       s = (s + 1) & (table->n_slots - 1)) {
+    if (table->hashes[w] == h
+          && table->word_offsets[w + 1] - table->word_offsets[w] - 1 == len
+          && memcmp(table->pool + table->word_offsets[w], word, len) == 0) {
+      break;
+    }
+  }
+
+  return s;
+}
+
+
+// Returns the number of a word, or -1 if it is not in the table.
+static IDL_LONG mg_wordtable_find(const mg_wordtable *table,
+                                  const char *word, IDL_MEMINT len) {
+  if (table->n_words == 0) return -1;
+  return table->slots[mg_wordtable_slot(table, word, len,
+                                        mg_word_hash(word, len))];
+}
+
+
+/*
+  Add count occurrences of a word. Returns the number of the word, or -1 if
+  out of memory.
+*/
+static IDL_LONG mg_wordtable_add(mg_wordtable *table,
+                                 const char *word, IDL_MEMINT len,
+                                 IDL_LONG64 count) {
+  IDL_ULONG64 h = mg_word_hash(word, len);
+  IDL_MEMINT s, w, capacity;
+  void *data;
+
+  if (2 * (table->n_words + 1) > table->n_slots) {
+    if (!mg_wordtable_rehash(table,
+                             table->n_slots > 0 ? 2 * table->n_slots : 1024)) {
+      return -1;
+    }
+  }
+
+  s = mg_wordtable_slot(table, word, len, h);
+  if (table->slots[s] >= 0) {
+    table->counts[table->slots[s]] += count;
+    return table->slots[s];
+  }
+
+  w = table->n_words;
+  if (w + 1 >= INT_MAX) return -1;
+
+  // grow the arrays of words together, with room for the final offset
+  if (w == table->words_capacity) {
+    capacity = table->words_capacity;
+    if (!mg_arena_reserve((void **) &table->counts, w, &capacity,
+                          sizeof(IDL_LONG64))) {
+      return -1;
+    }
+    if (!(data = realloc(table->hashes, capacity * sizeof(IDL_ULONG64)))) {
+      return -1;
+    }
+    table->hashes = (IDL_ULONG64 *) data;
+    if (!(data = realloc(table->word_offsets,
+                         (capacity + 1) * sizeof(IDL_LONG64)))) {
+      return -1;
+    }
+    table->word_offsets = (IDL_LONG64 *) data;
+    if (w == 0) table->word_offsets[0] = 0;
+    table->words_capacity = capacity;
+  }
+
+  while (table->pool_size + len + 1 > table->pool_capacity) {
+    if (!mg_arena_reserve((void **) &table->pool, table->pool_capacity,
+                          &table->pool_capacity, 1)) {
+      return -1;
+    }
+  }
+
+  memcpy(table->pool + table->pool_size, word, len);
+  table->pool[table->pool_size + len] = '\0';
+  table->pool_size += len + 1;
+  table->word_offsets[w + 1] = table->pool_size;
+  table->counts[w] = count;
+  table->hashes[w] = h;
+  table->slots[s] = (IDL_LONG) w;
+  table->n_words++;
+
+  return (IDL_LONG) w;
+}
+
+
+/**************************************************************************
+  Spelling correction
+***************************************************************************/
+
+/*
+  Symmetric delete spelling correction index (SymSpell). Each string made
+  by deleting up to max_distance characters from a word is a key for the
+  word. A word within max_distance edits of a query shares a key with one
+  of the query's deletes, so only the words of those keys need their edit
+  distance computed. Keys are stored as 64-bit hashes; a collision only
+  adds a candidate which fails the distance check.
+*/
+
+// largest maximum edit distance of an index
+#define MG_SPELL_MAX_DISTANCE 4
+
+// version of the binary file format
+#define MG_SPELL_FILE_VERSION 1
+
+typedef struct {
+  IDL_LONG max_distance;
+  IDL_MEMINT n_words;
+  IDL_LONG64 *counts;          // frequency of each word
+  IDL_LONG64 *word_offsets;    // n_words + 1 offsets into pool
+  char *pool;                  // the words, each followed by a null
+  IDL_MEMINT n_keys;
+  IDL_ULONG64 *keys;           // sorted hashes of deletes
+  IDL_LONG64 *key_offsets;     // n_keys + 1 offsets into ids
+  IDL_ULONG *ids;              // words of each key
+} mg_spell_index;
+
+// header of the binary file format, followed by the arrays of the index
+typedef struct {
+  char magic[8];
+  IDL_ULONG version;
+  IDL_LONG max_distance;
+  IDL_LONG64 n_words;
+  IDL_LONG64 pool_size;
+  IDL_LONG64 n_keys;
+  IDL_LONG64 n_ids;
+} mg_spell_header;
+
+static const char mg_spell_magic[8] = "MGSPELL";
+
+
+static void mg_spell_free(mg_spell_index *index) {
+  if (!index) return;
+
+  free(index->counts);
+  free(index->word_offsets);
+  free(index->pool);
+  free(index->keys);
+  free(index->key_offsets);
+  free(index->ids);
+  free(index);
+}
+
+
+/*
+  Append the hashes of all the strings made by deleting up to max_distance
+  characters from word, including word itself. buffer must hold len bytes.
+  Returns 0 if out of memory.
+*/
+static int mg_spell_deletes(const char *word, IDL_MEMINT len, int max_distance,
+                            char *buffer, IDL_ULONG64 **hashes,
+                            IDL_MEMINT *n, IDL_MEMINT *capacity) {
+  IDL_MEMINT pos[MG_SPELL_MAX_DISTANCE];
+  IDL_MEMINT i, j, k, b;
+
+  for (k = 0; k <= max_distance && k <= len; k++) {
+    // enumerate the sets of k positions to delete in increasing order
+    for (i = 0; i < k; i++) pos[i] = i;
+    while (1) {
+      for (i = 0, j = 0, b = 0; i < len; i++) {
+        if (j < k && pos[j] == i) {
+          j++;
+        } else {
+          buffer[b++] = word[i];
+        }
+      }
+      if (!mg_arena_reserve((void **) hashes, *n, capacity,
+                            sizeof(IDL_ULONG64))) {
+        return 0;
+      }
+      (*hashes)[(*n)++] = mg_word_hash(buffer, b);
+
+      for (i = k - 1; i >= 0 && pos[i] == len - k + i; i--);
+      if (i < 0) break;
+      pos[i]++;
+      for (j = i + 1; j < k; j++) pos[j] = pos[j - 1] + 1;
+    }
+  }
+
+  return 1;
+}
+
+
+/*
+  Add the words of a text file: runs of ASCII letters, in lowercase. Returns
+  0 if out of memory, -1 if the file can't be read.
+*/
+static int mg_spell_add_corpus(mg_wordtable *table, const char *filename) {
+  FILE *fp = fopen(filename, "rb");
+  char *text, *p, *end, *start;
+  long size;
+  int ok = 1;
+
+  if (!fp) return -1;
+
+  if (fseek(fp, 0, SEEK_END) != 0 || (size = ftell(fp)) < 0
+        || fseek(fp, 0, SEEK_SET) != 0) {
+    fclose(fp);
+    return -1;
+  }
+
+  text = (char *) malloc(size > 0 ? size : 1);
+  if (!text) {
+    fclose(fp);
+    return 0;
+  }
+  if (fread(text, 1, size, fp) != (size_t) size) {
+    free(text);
+    fclose(fp);
+    return -1;
+  }
+  fclose(fp);
+
+  for (p = text, end = text + size; ok && p < end; ) {
+    if (!isalpha((unsigned char) *p) || (unsigned char) *p > 127) {
+      p++;
+      continue;
+    }
+    for (start = p; p < end && (unsigned char) *p < 128 && isalpha((unsigned char) *p); p++) {
+      *p = tolower((unsigned char) *p);
+    }
+    ok = mg_wordtable_add(table, start, p - start, 1) >= 0;
+  }
+
+  free(text);
+
+  return ok;
+}
+
+
+// a key of the index for a word
+typedef struct {
+  IDL_ULONG64 hash;
+  IDL_ULONG id;
+} mg_spell_key;
+
+
+static int mg_spell_key_compare(const void *a, const void *b) {
+  const mg_spell_key *ka = (const mg_spell_key *) a;
+  const mg_spell_key *kb = (const mg_spell_key *) b;
+
+  if (ka->hash != kb->hash) return ka->hash < kb->hash ? -1 : 1;
+  return ka->id < kb->id ? -1 : (ka->id > kb->id ? 1 : 0);
+}
+
+
+/*
+  Create an index from the words of a table, which are moved into the
+  index. Returns NULL if out of memory.
+*/
+static mg_spell_index *mg_spell_index_new(mg_wordtable *table,
+                                          int max_distance) {
+  mg_spell_index *index = (mg_spell_index *) calloc(1, sizeof(mg_spell_index));
+  mg_spell_key *keys = NULL;
+  IDL_ULONG64 *hashes = NULL;
+  IDL_MEMINT n_keys = 0, keys_capacity = 0, n_hashes, hashes_capacity = 0;
+  IDL_MEMINT w, h, k, max_len = 0, len;
+  char *buffer = NULL;
+  int ok = index != NULL;
+
+  for (w = 0; w < table->n_words; w++) {
+    len = table->word_offsets[w + 1] - table->word_offsets[w] - 1;
+    if (len > max_len) max_len = len;
+  }
+  if (ok) ok = (buffer = (char *) malloc(max_len + 1)) != NULL;
+
+  // the keys of each word
+  for (w = 0; ok && w < table->n_words; w++) {
+    n_hashes = 0;
+    ok = mg_spell_deletes(table->pool + table->word_offsets[w],
+                          table->word_offsets[w + 1] - table->word_offsets[w] - 1,
+                          max_distance, buffer,
+                          &hashes, &n_hashes, &hashes_capacity);
+    for (h = 0; ok && h < n_hashes; h++) {
+      ok = mg_arena_reserve((void **) &keys, n_keys, &keys_capacity,
+                            sizeof(mg_spell_key));
+      if (ok) {
+        keys[n_keys].hash = hashes[h];
+        keys[n_keys++].id = (IDL_ULONG) w;
+      }
+    }
+  }
+  free(buffer);
+  free(hashes);
+
+  if (ok && n_keys > 0) {
+    qsort(keys, n_keys, sizeof(mg_spell_key), mg_spell_key_compare);
+  }
+
+  // the same key can come from different deletes of a word
+  if (ok) {
+    for (h = 0, k = 0; h < n_keys; h++) {
+      if (k > 0 && keys[h].hash == keys[k - 1].hash && keys[h].id == keys[k - 1].id) {
+        continue;
+      }
+      keys[k++] = keys[h];
+    }
+    n_keys = k;
+
+    index->ids = (IDL_ULONG *) malloc((n_keys > 0 ? n_keys : 1) * sizeof(IDL_ULONG));
+    index->keys = (IDL_ULONG64 *) malloc((n_keys > 0 ? n_keys : 1) * sizeof(IDL_ULONG64));
+    index->key_offsets = (IDL_LONG64 *) malloc((n_keys + 1) * sizeof(IDL_LONG64));
+    ok = index->ids && index->keys && index->key_offsets;
+  }
+
+  if (ok) {
+    index->n_keys = 0;
+    for (h = 0; h < n_keys; h++) {
+      if (h == 0 || keys[h].hash != keys[h - 1].hash) {
+        index->keys[index->n_keys] = keys[h].hash;
+        index->key_offsets[index->n_keys++] = h;
+      }
+      index->ids[h] = keys[h].id;
+    }
+    index->key_offsets[index->n_keys] = n_keys;
+  }
+  free(keys);
+
+  if (!ok) {
+    mg_spell_free(index);
+    return NULL;
+  }
+
+  index->max_distance = max_distance;
+  index->n_words = table->n_words;
+  index->counts = table->counts;
+  index->word_offsets = table->word_offsets;
+  index->pool = table->pool;
+  table->counts = NULL;
+  table->word_offsets = NULL;
+  table->pool = NULL;
+
+  // an empty index still needs its first word offset
+  if (!index->word_offsets) {
+    index->word_offsets = (IDL_LONG64 *) calloc(1, sizeof(IDL_LONG64));
+    if (!index->word_offsets) {
+      mg_spell_free(index);
+      return NULL;
+    }
+  }
+
+  return index;
+}
+
+
+// Write an index to a file, returns 0 on failure.
+static int mg_spell_write(const mg_spell_index *index, const char *filename) {
+  FILE *fp = fopen(filename, "wb");
+  mg_spell_header header;
+  IDL_MEMINT n_ids = index->key_offsets[index->n_keys];
+  int ok;
+
+  if (!fp) return 0;
+
+  memcpy(header.magic, mg_spell_magic, sizeof(header.magic));
+  header.version = MG_SPELL_FILE_VERSION;
+  header.max_distance = index->max_distance;
+  header.n_words = index->n_words;
+  header.pool_size = index->word_offsets[index->n_words];
+  header.n_keys = index->n_keys;
+  header.n_ids = n_ids;
+
+  ok = fwrite(&header, sizeof(header), 1, fp) == 1
+         && fwrite(index->counts, sizeof(IDL_LONG64), index->n_words, fp) == (size_t) index->n_words
+         && fwrite(index->word_offsets, sizeof(IDL_LONG64), index->n_words + 1, fp) == (size_t) index->n_words + 1
+         && fwrite(index->pool, 1, header.pool_size, fp) == (size_t) header.pool_size
+         && fwrite(index->keys, sizeof(IDL_ULONG64), index->n_keys, fp) == (size_t) index->n_keys
+         && fwrite(index->key_offsets, sizeof(IDL_LONG64), index->n_keys + 1, fp) == (size_t) index->n_keys + 1
+         && fwrite(index->ids, sizeof(IDL_ULONG), n_ids, fp) == (size_t) n_ids;
+
+  return fclose(fp) == 0 && ok;
+}
+
+
+// Check that n + 1 offsets start at 0, increase by at least min_step and
+// end at total.
+static int mg_spell_check_offsets(const IDL_LONG64 *offsets, IDL_LONG64 n,
+                                  IDL_LONG64 total, IDL_LONG64 min_step) {
+  IDL_LONG64 i;
+
+  if (offsets[0] != 0 || offsets[n] != total) return 0;
+  for (i = 0; i < n; i++) {
+    if (offsets[i + 1] - offsets[i] < min_step) return 0;
+  }
+
+  return 1;
+}
+
+
+// Read an index from a file, returns NULL on failure.
+static mg_spell_index *mg_spell_read(const char *filename) {
+  FILE *fp = fopen(filename, "rb");
+  mg_spell_header header;
+  mg_spell_index *index;
+  IDL_LONG64 k;
+  int ok;
+
+  if (!fp) return NULL;
+
+  if (fread(&header, sizeof(header), 1, fp) != 1
+        || memcmp(header.magic, mg_spell_magic, sizeof(header.magic)) != 0
+        || header.version != MG_SPELL_FILE_VERSION
+        || header.n_words < 0 || header.pool_size < 0
+        || header.n_keys < 0 || header.n_ids < 0
+        || header.max_distance < 0 || header.max_distance > MG_SPELL_MAX_DISTANCE
+        || !(index = (mg_spell_index *) calloc(1, sizeof(mg_spell_index)))) {
+    fclose(fp);
+    return NULL;
+  }
+
+  index->max_distance = header.max_distance;
+  index->n_words = header.n_words;
+  index->n_keys = header.n_keys;
+  index->counts = (IDL_LONG64 *) malloc((header.n_words + 1) * sizeof(IDL_LONG64));
+  index->word_offsets = (IDL_LONG64 *) malloc((header.n_words + 1) * sizeof(IDL_LONG64));
+  index->pool = (char *) malloc(header.pool_size + 1);
+  index->keys = (IDL_ULONG64 *) malloc((header.n_keys + 1) * sizeof(IDL_ULONG64));
+  index->key_offsets = (IDL_LONG64 *) malloc((header.n_keys + 1) * sizeof(IDL_LONG64));
+  index->ids = (IDL_ULONG *) malloc((header.n_ids + 1) * sizeof(IDL_ULONG));
+
+  ok = index->counts && index->word_offsets && index->pool
+         && index->keys && index->key_offsets && index->ids
+         && fread(index->counts, sizeof(IDL_LONG64), header.n_words, fp) == (size_t) header.n_words
+         && fread(index->word_offsets, sizeof(IDL_LONG64), header.n_words + 1, fp) == (size_t) header.n_words + 1
+         && fread(index->pool, 1, header.pool_size, fp) == (size_t) header.pool_size
+         && fread(index->keys, sizeof(IDL_ULONG64), header.n_keys, fp) == (size_t) header.n_keys
+         && fread(index->key_offsets, sizeof(IDL_LONG64), header.n_keys + 1, fp) == (size_t) header.n_keys + 1
+         && fread(index->ids, sizeof(IDL_ULONG), header.n_ids, fp) == (size_t) header.n_ids;
+  fclose(fp);
+
+  // a truncated or corrupted file must not lead lookups out of bounds: each
+  // word is NUL terminated and each id is a word
+  ok = ok && mg_spell_check_offsets(index->word_offsets, header.n_words, header.pool_size, 1)
+          && mg_spell_check_offsets(index->key_offsets, header.n_keys, header.n_ids, 0);
+  for (k = 0; ok && k < header.n_words; k++) {
+    ok = index->pool[index->word_offsets[k + 1] - 1] == '\0';
+  }
+  for (k = 0; ok && k < header.n_ids; k++) {
+    ok = index->ids[k] < (IDL_ULONG64) header.n_words;
+  }
+
+  if (!ok) {
+    mg_spell_free(index);
+    return NULL;
+  }
+
+  return index;
+}
+
+
+/*
+  Optimal string alignment distance between a and b, i.e., the Levenshtein
+  distance also allowing transpositions of adjacent characters. Returns
+  max + 1 if the distance is more than max. rows must hold 3 * (lb + 1)
+  values.
+*/
+static IDL_LONG mg_spell_distance(const char *a, IDL_LONG la,
+                                  const char *b, IDL_LONG lb,
+                                  IDL_LONG max, IDL_LONG *rows) {
+  IDL_LONG *prev2 = rows, *prev = rows + lb + 1, *cur = rows + 2 * (lb + 1), *tmp;
+  IDL_LONG i, j, d, row_min;
+
+  if (la - lb > max || lb - la > max) return max + 1;
+
+  for (j = 0; j <= lb; j++) prev[j] = j;
+
+  for (i = 1; i <= la; i++) {
+    cur[0] = row_min = i;
+    for (j = 1; j <= lb; j++) {
+      d = prev[j - 1] + (a[i - 1] != b[j - 1]);
+      if (prev[j] + 1 < d) d = prev[j] + 1;
+      if (cur[j - 1] + 1 < d) d = cur[j - 1] + 1;
+      if (i > 1 && j > 1 && a[i - 1] == b[j - 2] && a[i - 2] == b[j - 1]
+            && prev2[j - 2] + 1 < d) {
+        d = prev2[j - 2] + 1;
+      }
+      cur[j] = d;
+      if (d < row_min) row_min = d;
+    }
+    if (row_min > max) return max + 1;
+
+    tmp = prev2;
+    prev2 = prev;
+    prev = cur;
+    cur = tmp;
+  }
+
+  return prev[lb] > max ? max + 1 : prev[lb];
+}
+
+
+static int mg_spell_hash_compare(const void *a, const void *b) {
+  IDL_ULONG64 ha = *(const IDL_ULONG64 *) a, hb = *(const IDL_ULONG64 *) b;
+
+  return ha < hb ? -1 : (ha > hb ? 1 : 0);
+}
+
+
+typedef struct {
+  const mg_spell_index *index;
+  IDL_STRING *words;
+  IDL_LONG max_distance;
+  IDL_LONG *best;              // index of the correction of each word, or -1
+  IDL_LONG *distances;
+  int failed;                  // set if out of memory
+} mg_spell_loop;
+
+
+// Find the corrections of words start to end - 1.
+static void mg_spell_range(void *data, IDL_MEMINT start, IDL_MEMINT end,
+                           int thread) {
+  mg_spell_loop *loop = (mg_spell_loop *) data;
+  const mg_spell_index *index = loop->index;
+  IDL_ULONG64 *hashes = NULL;
+  IDL_MEMINT n_hashes, hashes_capacity = 0, rows_capacity = 0;
+  IDL_MEMINT i, h, lo, hi, mid, k, buffer_size = 0;
+  IDL_LONG *rows = NULL, *seen;
+  char *buffer = NULL;
+  IDL_STRING *word;
+  IDL_ULONG id;
+  IDL_LONG d, best, best_distance, len;
+  const char *candidate;
+
+  // seen[id] is the last query that word id was a candidate for
+  seen = (IDL_LONG *) malloc((index->n_words > 0 ? index->n_words : 1) * sizeof(IDL_LONG));
+  if (!seen) {
+    loop->failed = 1;
+    return;
+  }
+  for (k = 0; k < index->n_words; k++) seen[k] = -1;
+
+  for (i = start; i < end && !loop->failed; i++) {
+    word = &loop->words[i];
+
+    if (word->slen + 1 > buffer_size) {
+      free(buffer);
+      buffer_size = word->slen + 1;
+      if (!(buffer = (char *) malloc(buffer_size))) break;
+    }
+
+    n_hashes = 0;
+    if (!mg_spell_deletes(IDL_STRING_STR(word), word->slen, loop->max_distance,
+                          buffer, &hashes, &n_hashes, &hashes_capacity)) {
+      break;
+    }
+    qsort(hashes, n_hashes, sizeof(IDL_ULONG64), mg_spell_hash_compare);
+
+    best = -1;
+    best_distance = loop->max_distance + 1;
+    for (h = 0; h < n_hashes; h++) {
+      if (h > 0 && hashes[h] == hashes[h - 1]) continue;
+
+      // find the key with binary search
+      for (lo = 0, hi = index->n_keys; lo < hi; ) {
+        mid = lo + (hi - lo) / 2;
+        if (index->keys[mid] < hashes[h]) lo = mid + 1; else hi = mid;
+      }
+      if (lo == index->n_keys || index->keys[lo] != hashes[h]) continue;
+
+      for (k = index->key_offsets[lo]; k < index->key_offsets[lo + 1]; k++) {
+        id = index->ids[k];
+        if (seen[id] == i) continue;
+        seen[id] = (IDL_LONG) i;
+
+        candidate = index->pool + index->word_offsets[id];
+        len = (IDL_LONG) (index->word_offsets[id + 1] - index->word_offsets[id] - 1);
+        if ((len + 1) * 3 > rows_capacity) {
+          free(rows);
+          rows_capacity = (len + 1) * 3;
+          if (!(rows = (IDL_LONG *) malloc(rows_capacity * sizeof(IDL_LONG)))) {
+            loop->failed = 1;
+            break;
+          }
+        }
+
+        // rank by distance, then frequency, then order in the index
+        d = mg_spell_distance(IDL_STRING_STR(word), word->slen,
+                              candidate, len, best_distance, rows);
+        if (d < best_distance
+              || (d == best_distance && d <= loop->max_distance
+                    && (index->counts[id] > index->counts[best]
+                          || (index->counts[id] == index->counts[best] && id < best)))) {
+          best = id;
+          best_distance = d;
+        }
+      }
+      if (loop->failed) break;
+    }
+
+    loop->best[i] = best;
+    loop->distances[i] = best >= 0 ? best_distance : -1;
+  }
+
+  if (i < end) loop->failed = 1;
+
+  free(seen);
+  free(buffer);
+  free(hashes);
+  free(rows);
+}
+
+
+static mg_spell_index *mg_spell_get(IDL_VPTR arg) {
+  mg_spell_index *index = (mg_spell_index *) IDL_MEMINTScalar(arg);
+
+  if (!index) {
+    IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP, "invalid spelling index");
+  }
+
+  return index;
+}
+
+
+static IDL_VPTR IDL_CDECL IDL_mg_spell_new(int argc, IDL_VPTR *argv, char *argk) {
+  typedef struct {
+    IDL_KW_RESULT_FIRST_FIELD;
+    IDL_VPTR corpus;
+    int corpus_present;
+    IDL_VPTR counts;
+    int counts_present;
+    IDL_LONG max_distance;
+    int max_distance_present;
+  } KW_RESULT;
+
+  // make sure to list keyword in alphabetical order
+  static IDL_KW_PAR kw_pars[] = {
+    { "CORPUS", IDL_TYP_UNDEF, 1, IDL_KW_VIN,
+      IDL_KW_OFFSETOF(corpus_present), IDL_KW_OFFSETOF(corpus) },
+    { "COUNTS", IDL_TYP_UNDEF, 1, IDL_KW_VIN,
+      IDL_KW_OFFSETOF(counts_present), IDL_KW_OFFSETOF(counts) },
+    { "MAX_DISTANCE", IDL_TYP_LONG, 1, 0,
+      IDL_KW_OFFSETOF(max_distance_present), IDL_KW_OFFSETOF(max_distance) },
+    { NULL }
+  };
+
+  KW_RESULT kw;
+  mg_wordtable table;
+  mg_spell_index *index;
+  IDL_STRING *words;
+  IDL_LONG64 *counts = NULL;
+  IDL_VPTR counts_vptr = NULL;
+  IDL_MEMINT n_words = 0, w;
+  int max_distance, ok = 1, status, has_corpus, has_counts;
+  char *corpus;
+
+  int nargs = IDL_KWProcessByOffset(argc, argv, argk, kw_pars, (IDL_VPTR *) NULL, 1, &kw);
+
+  // wrappers may pass undefined variables for keywords they didn't receive
+  has_corpus = kw.corpus_present && kw.corpus->type != IDL_TYP_UNDEF;
+  has_counts = kw.counts_present && kw.counts->type != IDL_TYP_UNDEF;
+
+  max_distance = kw.max_distance_present ? kw.max_distance : 2;
+  if (max_distance < 0 || max_distance > MG_SPELL_MAX_DISTANCE) {
+    IDL_KW_FREE;
+    IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                "MAX_DISTANCE must be between 0 and %d", MG_SPELL_MAX_DISTANCE);
+  }
+
+  if (nargs == 0 && !has_corpus) {
+    IDL_KW_FREE;
+    IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                "words or CORPUS required");
+  }
+
+  if (nargs > 0) {
+    if (argv[0]->type != IDL_TYP_STRING) {
+      IDL_KW_FREE;
+      IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                  "words must be a string array");
+    }
+    if (argv[0]->flags & IDL_V_ARR) {
+      words = (IDL_STRING *) argv[0]->value.arr->data;
+      n_words = argv[0]->value.arr->n_elts;
+    } else {
+      words = &argv[0]->value.str;
+      n_words = 1;
+    }
+
+    if (has_counts) {
+      counts_vptr = IDL_BasicTypeConversion(1, &kw.counts, IDL_TYP_LONG64);
+      if ((counts_vptr->flags & IDL_V_ARR ? counts_vptr->value.arr->n_elts : 1) != n_words) {
+        if (counts_vptr != kw.counts) IDL_Deltmp(counts_vptr);
+        IDL_KW_FREE;
+        IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                    "COUNTS must have the same number of elements as words");
+      }
+      counts = counts_vptr->flags & IDL_V_ARR
+                 ? (IDL_LONG64 *) counts_vptr->value.arr->data
+                 : &counts_vptr->value.l64;
+    }
+  }
+
+  memset(&table, 0, sizeof(table));
+
+  for (w = 0; ok && w < n_words; w++) {
+    ok = mg_wordtable_add(&table, IDL_STRING_STR(&words[w]), words[w].slen,
+                          counts ? counts[w] : 1) >= 0;
+  }
+  if (counts_vptr && counts_vptr != kw.counts) IDL_Deltmp(counts_vptr);
+
+  if (ok && has_corpus) {
+    corpus = IDL_VarGetString(kw.corpus);
+    status = mg_spell_add_corpus(&table, corpus);
+    if (status < 0) {
+      mg_wordtable_free(&table);
+      IDL_KW_FREE;
+      IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                  "unable to read corpus: %s", corpus);
+    }
+    ok = status;
+  }
+
+  index = ok ? mg_spell_index_new(&table, max_distance) : NULL;
+  mg_wordtable_free(&table);
+
+  IDL_KW_FREE;
+
+  if (!index) {
+    IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                "unable to allocate memory for spelling index");
+  }
+
+  return IDL_GettmpMEMINT((IDL_MEMINT) index);
+}
+
+
+/*
+  Correct the spelling of a string or string array. Returns the most
+  frequent of the closest words in the index, or the empty string if there
+  is no word within the maximum distance.
+*/
+static IDL_VPTR IDL_CDECL IDL_mg_spell_correct(int argc, IDL_VPTR *argv, char *argk) {
+  typedef struct {
+    IDL_KW_RESULT_FIRST_FIELD;
+    IDL_VPTR counts;
+    int counts_present;
+    IDL_VPTR distance;
+    int distance_present;
+    IDL_VPTR found;
+    int found_present;
+    IDL_LONG max_distance;
+    int max_distance_present;
+    IDL_LONG tpool_min_elts;
+    IDL_LONG tpool_nthreads;
+  } KW_RESULT;
+
+  // make sure to list keyword in alphabetical order
+  static IDL_KW_PAR kw_pars[] = {
+    { "COUNTS", IDL_TYP_UNDEF, 1, IDL_KW_OUT | IDL_KW_ZERO,
+      IDL_KW_OFFSETOF(counts_present), IDL_KW_OFFSETOF(counts) },
+    { "DISTANCE", IDL_TYP_UNDEF, 1, IDL_KW_OUT | IDL_KW_ZERO,
+      IDL_KW_OFFSETOF(distance_present), IDL_KW_OFFSETOF(distance) },
+    { "FOUND", IDL_TYP_UNDEF, 1, IDL_KW_OUT | IDL_KW_ZERO,
+      IDL_KW_OFFSETOF(found_present), IDL_KW_OFFSETOF(found) },
+    { "MAX_DISTANCE", IDL_TYP_LONG, 1, 0,
+      IDL_KW_OFFSETOF(max_distance_present), IDL_KW_OFFSETOF(max_distance) },
+    { "TPOOL_MIN_ELTS", IDL_TYP_LONG, 1, IDL_KW_ZERO,
+      0, IDL_KW_OFFSETOF(tpool_min_elts) },
+    { "TPOOL_NTHREADS", IDL_TYP_LONG, 1, IDL_KW_ZERO,
+      0, IDL_KW_OFFSETOF(tpool_nthreads) },
+    { NULL }
+  };
+
+  KW_RESULT kw;
+  mg_spell_index *index;
+  mg_spell_loop loop;
+  IDL_VPTR result, distance_vptr, found_vptr, counts_vptr;
+  IDL_STRING *corrections;
+  UCHAR *found;
+  IDL_LONG64 *counts;
+  IDL_MEMINT n, i, n_dim, *dim, scalar_dim = 1;
+  int nthreads;
+
+  int nargs = IDL_KWProcessByOffset(argc, argv, argk, kw_pars, (IDL_VPTR *) NULL, 1, &kw);
+
+  index = mg_spell_get(argv[0]);
+
+  if (argv[1]->type != IDL_TYP_STRING) {
+    IDL_KW_FREE;
+    IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                "words must be a string or string array");
+  }
+
+  loop.index = index;
+  loop.max_distance = kw.max_distance_present ? kw.max_distance : index->max_distance;
+  if (loop.max_distance < 0 || loop.max_distance > index->max_distance) {
+    IDL_KW_FREE;
+    IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                "MAX_DISTANCE must be between 0 and %d for this index",
+                index->max_distance);
+  }
+  loop.failed = 0;
+
+  if (argv[1]->flags & IDL_V_ARR) {
+    n = argv[1]->value.arr->n_elts;
+    n_dim = argv[1]->value.arr->n_dim;
+    dim = argv[1]->value.arr->dim;
+    loop.words = (IDL_STRING *) argv[1]->value.arr->data;
+  } else {
+    n = 1;
+    n_dim = 1;
+    dim = &scalar_dim;
+    loop.words = &argv[1]->value.str;
+  }
+
+  loop.best = (IDL_LONG *) malloc(n * sizeof(IDL_LONG));
+  loop.distances = (IDL_LONG *) IDL_MakeTempArray(IDL_TYP_LONG, n_dim, dim,
+                                                  IDL_ARR_INI_NOP,
+                                                  &distance_vptr);
+
+  if (loop.best) {
+    nthreads = mg_threads_count(n, kw.tpool_nthreads,
+                                kw.tpool_min_elts > 0
+                                  ? kw.tpool_min_elts
+                                  : MG_STRINGS_MIN_ELTS);
+    mg_threads_for(n, nthreads, mg_spell_range, &loop);
+  }
+
+  if (!loop.best || loop.failed) {
+    free(loop.best);
+    IDL_Deltmp(distance_vptr);
+    IDL_KW_FREE;
+    IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                "unable to allocate memory for spelling correction");
+  }
+
+  if (argv[1]->flags & IDL_V_ARR) {
+    corrections = (IDL_STRING *) IDL_MakeTempArray(IDL_TYP_STRING, n_dim, dim,
+                                                   IDL_ARR_INI_ZERO, &result);
+  } else {
+    result = IDL_StrToSTRING("");
+    corrections = &result->value.str;
+  }
+
+  for (i = 0; i < n; i++) {
+    if (loop.best[i] < 0) continue;
+    IDL_StrStore(&corrections[i], index->pool + index->word_offsets[loop.best[i]]);
+  }
+
+  if (kw.found_present) {
+    found = (UCHAR *) IDL_MakeTempArray(IDL_TYP_BYTE, n_dim, dim,
+                                        IDL_ARR_INI_NOP, &found_vptr);
+    for (i = 0; i < n; i++) found[i] = loop.best[i] >= 0;
+    IDL_VarCopy(argv[1]->flags & IDL_V_ARR ? found_vptr : IDL_GettmpByte(found[0]),
+                kw.found);
+    if (!(argv[1]->flags & IDL_V_ARR)) IDL_Deltmp(found_vptr);
+  }
+
+  if (kw.counts_present) {
+    counts = (IDL_LONG64 *) IDL_MakeTempArray(IDL_TYP_LONG64, n_dim, dim,
+                                              IDL_ARR_INI_NOP, &counts_vptr);
+    for (i = 0; i < n; i++) {
+      counts[i] = loop.best[i] >= 0 ? index->counts[loop.best[i]] : 0;
+    }
+    IDL_VarCopy(argv[1]->flags & IDL_V_ARR ? counts_vptr : IDL_GettmpLong64(counts[0]),
+                kw.counts);
+    if (!(argv[1]->flags & IDL_V_ARR)) IDL_Deltmp(counts_vptr);
+  }
+
+  if (kw.distance_present) {
+    IDL_VarCopy(argv[1]->flags & IDL_V_ARR
+                  ? distance_vptr
+                  : IDL_GettmpLong(loop.distances[0]),
+                kw.distance);
+    if (!(argv[1]->flags & IDL_V_ARR)) IDL_Deltmp(distance_vptr);
+  } else IDL_Deltmp(distance_vptr);
+
+  free(loop.best);
+
+  IDL_KW_FREE;
+
+  return result;
+}
+
+
+static IDL_VPTR IDL_CDECL IDL_mg_spell_read(int argc, IDL_VPTR *argv) {
+  char *filename = IDL_VarGetString(argv[0]);
+  mg_spell_index *index = mg_spell_read(filename);
+
+  if (!index) {
+    IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                "unable to read spelling index: %s", filename);
+  }
+
+  return IDL_GettmpMEMINT((IDL_MEMINT) index);
+}
+
+
+static void IDL_CDECL IDL_mg_spell_write(int argc, IDL_VPTR *argv) {
+  mg_spell_index *index = mg_spell_get(argv[0]);
+  char *filename = IDL_VarGetString(argv[1]);
+
+  if (!mg_spell_write(index, filename)) {
+    IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                "unable to write spelling index: %s", filename);
+  }
+}
+
+
+static IDL_VPTR IDL_CDECL IDL_mg_spell_n_words(int argc, IDL_VPTR *argv) {
+  return IDL_GettmpLong64(mg_spell_get(argv[0])->n_words);
+}
+
+
+static void IDL_CDECL IDL_mg_spell_free(int argc, IDL_VPTR *argv) {
+  mg_spell_free((mg_spell_index *) IDL_MEMINTScalar(argv[0]));
+}
+
+
+/**************************************************************************
+  Counting words
+***************************************************************************/
+
+// default minimum number of bytes of a file given to each thread
+#define MG_WORDS_MIN_BYTES (1024 * 1024)
+
+// size of the buffer used to read files
+#define MG_WORDS_BUFFER_SIZE (1024 * 1024)
+
+// a word of a document and the number of times it occurs in the document
+typedef struct {
+  IDL_LONG id;
+  IDL_LONG count;
+} mg_word_entry;
+
+// the documents counted by one thread
+typedef struct {
+  mg_wordtable vocabulary;     // words found, unless the vocabulary is fixed
+  IDL_LONG *map;               // number of each word in the merged vocabulary
+  IDL_MEMINT n_documents;
+  IDL_MEMINT documents_capacity;
+  IDL_LONG64 *offsets;         // n_documents + 1 offsets into entries
+  mg_word_entry *entries;
+  IDL_MEMINT n_entries;
+  IDL_MEMINT entries_capacity;
+  char *token;                 // buffer for case folded tokens and lines
+  IDL_MEMINT token_capacity;
+} mg_words_part;
+
+typedef struct {
+  unsigned char is_delim[256];
+  int whole;                   // each string is a single token
+  int fold_case;
+  IDL_LONG min_length;
+  const mg_wordtable *fixed;   // fixed vocabulary, or NULL
+  IDL_STRING *strings;         // documents, or NULL to read a file
+  const char *filename;        // each line of the file is a document
+  mg_words_part *parts;
+  int failed;                  // set if out of memory or a read error
+} mg_words_loop;
+
+
+static void mg_words_part_free(mg_words_part *part) {
+  mg_wordtable_free(&part->vocabulary);
+  free(part->map);
+  free(part->offsets);
+  free(part->entries);
+  free(part->token);
+}
+
+
+static int mg_word_entry_compare(const void *a, const void *b) {
+  IDL_LONG ia = ((const mg_word_entry *) a)->id;
+  IDL_LONG ib = ((const mg_word_entry *) b)->id;
+
+  return ia < ib ? -1 : (ia > ib ? 1 : 0);
+}
+
+
+// Sort the entries of a document by word and combine repeated words.
+// Returns the new number of entries.
+static IDL_MEMINT mg_word_entries_combine(mg_word_entry *entries,
+                                          IDL_MEMINT n) {
+  mg_word_entry e;
+  IDL_MEMINT i, j;
+
+  // documents are usually short
+  if (n < 16) {
+    for (i = 1; i < n; i++) {
+      e = entries[i];
+      for (j = i; j > 0 && entries[j - 1].id > e.id; j--) {
+        entries[j] = entries[j - 1];
+      }
+      entries[j] = e;
+    }
+  } else {
+    qsort(entries, n, sizeof(mg_word_entry), mg_word_entry_compare);
+  }
+
+  for (i = 0, j = 0; i < n; i++) {
+    if (j > 0 && entries[j - 1].id == entries[i].id) {
+      entries[j - 1].count += entries[i].count;
+    } else {
+      entries[j++] = entries[i];
+    }
+  }
+
+  return j;
+}
+
+
+// Make room for len bytes in the token buffer, returns 0 if out of memory.
+static int mg_words_reserve_token(mg_words_part *part, IDL_MEMINT len) {
+  while (len > part->token_capacity) {
+    if (!mg_arena_reserve((void **) &part->token, part->token_capacity,
+                          &part->token_capacity, 1)) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+
+// Add a token to the current document, returns 0 if out of memory.
+static int mg_words_token(const mg_words_loop *loop, mg_words_part *part,
+                          const char *s, IDL_MEMINT len) {
+  IDL_MEMINT i;
+  IDL_LONG id;
+
+  if (loop->fold_case) {
+    if (!mg_words_reserve_token(part, len)) return 0;
+    for (i = 0; i < len; i++) part->token[i] = tolower((unsigned char) s[i]);
+    s = part->token;
+  }
+
+  if (loop->fixed) {
+    // words not in a fixed vocabulary are ignored
+    if ((id = mg_wordtable_find(loop->fixed, s, len)) < 0) return 1;
+  } else {
+    if ((id = mg_wordtable_add(&part->vocabulary, s, len, 1)) < 0) return 0;
+  }
+
+  if (!mg_arena_reserve((void **) &part->entries, part->n_entries,
+                        &part->entries_capacity, sizeof(mg_word_entry))) {
+    return 0;
+  }
+  part->entries[part->n_entries].id = id;
+  part->entries[part->n_entries++].count = 1;
+
+  return 1;
+}
+
+
+// Count the words of a document, returns 0 if out of memory.
+static int mg_words_document(const mg_words_loop *loop, mg_words_part *part,
+                             const char *s, IDL_MEMINT len) {
+  IDL_MEMINT first = part->n_entries, i, start;
+
+  if (!mg_arena_reserve((void **) &part->offsets, part->n_documents + 1,
+                        &part->documents_capacity, sizeof(IDL_LONG64))) {
+    return 0;
+  }
+  if (part->n_documents == 0) part->offsets[0] = 0;
+
+  if (loop->whole) {
+    if (!mg_words_token(loop, part, s, len)) return 0;
+  } else {
+    for (i = 0; i < len; ) {
+      while (i < len && loop->is_delim[(unsigned char) s[i]]) i++;
+      for (start = i; i < len && !loop->is_delim[(unsigned char) s[i]]; i++);
+      if (i > start && i - start >= loop->min_length) {
+        if (!mg_words_token(loop, part, s + start, i - start)) return 0;
+      }
+    }
+  }
+
+  part->n_entries = first + mg_word_entries_combine(part->entries + first,
+                                                    part->n_entries - first);
+  part->offsets[++part->n_documents] = part->n_entries;
+
+  return 1;
+}
+
+
+/*
+  Count the words of the lines of the file which start in bytes start to
+  end - 1. Returns 0 if out of memory or the file can't be read.
+*/
+static int mg_words_file_range(const mg_words_loop *loop, mg_words_part *part,
+                               IDL_MEMINT start, IDL_MEMINT end) {
+  FILE *fp = fopen(loop->filename, "rb");
+  unsigned char *buffer;
+  IDL_MEMINT pos = start, line_start = start, line_len = 0, k;
+  size_t n_read;
+  int skip = 0, ok = 1, done = 0, c;
+
+  if (!fp) return 0;
+
+  // a line started in the previous range belongs to that range
+  if (start > 0) {
+    if (fseek(fp, (long) (start - 1), SEEK_SET) != 0 || (c = fgetc(fp)) == EOF) {
+      fclose(fp);
+      return 0;
+    }
+    skip = c != '\n';
+  }
+
+  if (!(buffer = (unsigned char *) malloc(MG_WORDS_BUFFER_SIZE))) {
+    fclose(fp);
+    return 0;
+  }
+
+  while (ok && !done
+           && (n_read = fread(buffer, 1, MG_WORDS_BUFFER_SIZE, fp)) > 0) {
+    for (k = 0; ok && k < (IDL_MEMINT) n_read; k++, pos++) {
+      if (buffer[k] == '\n') {
+        if (!skip) ok = mg_words_document(loop, part, part->token, line_len);
+        skip = 0;
+        line_len = 0;
+        line_start = pos + 1;
+        if (line_start >= end) {
+          done = 1;
+          break;
+        }
+      } else if (!skip) {
+        ok = mg_words_reserve_token(part, line_len + 1);
+        if (ok) part->token[line_len++] = buffer[k];
+      }
+    }
+  }
+  if (ferror(fp)) ok = 0;
+
+  // a last line without a newline
+  if (ok && !done && !skip && line_len > 0 && line_start < end) {
+    ok = mg_words_document(loop, part, part->token, line_len);
+  }
+
+  free(buffer);
+  fclose(fp);
+
+  return ok;
+}
+
+
+// Count the words of documents, or bytes of a file, start to end - 1.
+static void mg_words_range(void *data, IDL_MEMINT start, IDL_MEMINT end,
+                           int thread) {
+  mg_words_loop *loop = (mg_words_loop *) data;
+  mg_words_part *part = &loop->parts[thread];
+  IDL_MEMINT i;
+  int ok = 1;
+
+  if (loop->strings) {
+    for (i = start; ok && i < end; i++) {
+      ok = mg_words_document(loop, part,
+                             IDL_STRING_STR(&loop->strings[i]),
+                             loop->strings[i].slen);
+    }
+  } else {
+    ok = mg_words_file_range(loop, part, start, end);
+  }
+
+  if (!ok) loop->failed = 1;
+}
+
+
+// Renumber the words of parts start to end - 1 to the merged vocabulary.
+static void mg_words_remap_range(void *data, IDL_MEMINT start, IDL_MEMINT end,
+                                 int thread) {
+  mg_words_loop *loop = (mg_words_loop *) data;
+  mg_words_part *part;
+  IDL_MEMINT p, d, e, first;
+
+  for (p = start; p < end; p++) {
+    part = &loop->parts[p];
+    for (e = 0; e < part->n_entries; e++) {
+      part->entries[e].id = part->map[part->entries[e].id];
+    }
+    for (d = 0; d < part->n_documents; d++) {
+      first = part->offsets[d];
+      mg_word_entries_combine(part->entries + first,
+                              part->offsets[d + 1] - first);
+    }
+  }
+}
+
+
+/*
+  Tokenize documents and count the words of each. Returns the counts of a
+  sparse n_words by n_documents matrix in CSR format, with IDS giving the
+  word of each count and OFFSETS the start of each document.
+*/
+static IDL_VPTR IDL_CDECL IDL_mg_word_counts(int argc, IDL_VPTR *argv, char *argk) {
+  typedef struct {
+    IDL_KW_RESULT_FIRST_FIELD;
+    IDL_LONG alphanumeric;
+    IDL_VPTR delimiters;
+    int delimiters_present;
+    IDL_VPTR document_frequency;
+    int document_frequency_present;
+    IDL_LONG file;
+    IDL_VPTR fixed_vocabulary;
+    int fixed_vocabulary_present;
+    IDL_LONG fold_case;
+    IDL_VPTR ids;
+    int ids_present;
+    IDL_LONG min_length;
+    IDL_VPTR offsets;
+    int offsets_present;
+    IDL_VPTR total_counts;
+    int total_counts_present;
+    IDL_LONG tpool_min_elts;
+    IDL_LONG tpool_nthreads;
+    IDL_VPTR vocabulary;
+    int vocabulary_present;
+  } KW_RESULT;
+
+  // make sure to list keyword in alphabetical order
+  static IDL_KW_PAR kw_pars[] = {
+    { "ALPHANUMERIC", IDL_TYP_LONG, 1, IDL_KW_ZERO | IDL_KW_VALUE | 1,
+      0, IDL_KW_OFFSETOF(alphanumeric) },
+    { "DELIMITERS", IDL_TYP_UNDEF, 1, IDL_KW_VIN,
+      IDL_KW_OFFSETOF(delimiters_present), IDL_KW_OFFSETOF(delimiters) },
+    { "DOCUMENT_FREQUENCY", IDL_TYP_UNDEF, 1, IDL_KW_OUT | IDL_KW_ZERO,
+      IDL_KW_OFFSETOF(document_frequency_present), IDL_KW_OFFSETOF(document_frequency) },
+    { "FILE", IDL_TYP_LONG, 1, IDL_KW_ZERO | IDL_KW_VALUE | 1,
+      0, IDL_KW_OFFSETOF(file) },
+    { "FIXED_VOCABULARY", IDL_TYP_UNDEF, 1, IDL_KW_VIN,
+      IDL_KW_OFFSETOF(fixed_vocabulary_present), IDL_KW_OFFSETOF(fixed_vocabulary) },
+    { "FOLD_CASE", IDL_TYP_LONG, 1, IDL_KW_ZERO | IDL_KW_VALUE | 1,
+      0, IDL_KW_OFFSETOF(fold_case) },
+    { "IDS", IDL_TYP_UNDEF, 1, IDL_KW_OUT | IDL_KW_ZERO,
+      IDL_KW_OFFSETOF(ids_present), IDL_KW_OFFSETOF(ids) },
+    { "MIN_LENGTH", IDL_TYP_LONG, 1, IDL_KW_ZERO,
+      0, IDL_KW_OFFSETOF(min_length) },
+    { "OFFSETS", IDL_TYP_UNDEF, 1, IDL_KW_OUT | IDL_KW_ZERO,
+      IDL_KW_OFFSETOF(offsets_present), IDL_KW_OFFSETOF(offsets) },
+    { "TOTAL_COUNTS", IDL_TYP_UNDEF, 1, IDL_KW_OUT | IDL_KW_ZERO,
+      IDL_KW_OFFSETOF(total_counts_present), IDL_KW_OFFSETOF(total_counts) },
+    { "TPOOL_MIN_ELTS", IDL_TYP_LONG, 1, IDL_KW_ZERO,
+      0, IDL_KW_OFFSETOF(tpool_min_elts) },
+    { "TPOOL_NTHREADS", IDL_TYP_LONG, 1, IDL_KW_ZERO,
+      0, IDL_KW_OFFSETOF(tpool_nthreads) },
+    { "VOCABULARY", IDL_TYP_UNDEF, 1, IDL_KW_OUT | IDL_KW_ZERO,
+      IDL_KW_OFFSETOF(vocabulary_present), IDL_KW_OFFSETOF(vocabulary) },
+    { NULL }
+  };
+
+  KW_RESULT kw;
+  mg_words_loop loop;
+  mg_wordtable vocabulary;
+  const mg_wordtable *words;
+  IDL_VPTR result, vptr;
+  IDL_ALLTYPES none;
+  IDL_STRING *fixed, *vocab;
+  IDL_LONG *counts, *ids, *df;
+  IDL_LONG64 *offsets, *totals;
+  IDL_MEMINT n, i, w, d, e, n_fixed, n_documents = 0, n_entries = 0, size = 0;
+  IDL_MEMINT min_elts;
+  const unsigned char *delims = (const unsigned char *) " \t\n\r\f\v";
+  IDL_MEMINT n_delims = 6;
+  mg_words_part *part;
+  int nthreads, t, ok = 1;
+  FILE *fp;
+
+  int nargs = IDL_KWProcessByOffset(argc, argv, argk, kw_pars, (IDL_VPTR *) NULL, 1, &kw);
+
+  if (argv[0]->type != IDL_TYP_STRING) {
+    IDL_KW_FREE;
+    IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                "documents must be a string or string array");
+  }
+
+  memset(&loop, 0, sizeof(loop));
+  memset(&vocabulary, 0, sizeof(vocabulary));
+  none.l = -1;
+
+  // token rules: delimiters, or only letters and digits
+  if (kw.delimiters_present && kw.delimiters->type == IDL_TYP_STRING) {
+    delims = (const unsigned char *) IDL_VarGetString(kw.delimiters);
+    n_delims = kw.delimiters->flags & IDL_V_ARR
+                 ? 0
+                 : kw.delimiters->value.str.slen;
+    loop.whole = n_delims == 0;
+  }
+  for (i = 0; i < n_delims; i++) loop.is_delim[delims[i]] = 1;
+  if (kw.alphanumeric) {
+    for (i = 0; i < 256; i++) loop.is_delim[i] = i < 128 && !isalnum((int) i);
+  }
+  loop.fold_case = kw.fold_case;
+  loop.min_length = kw.min_length;
+
+  if (kw.fixed_vocabulary_present && kw.fixed_vocabulary->type == IDL_TYP_STRING) {
+    if (kw.fixed_vocabulary->flags & IDL_V_ARR) {
+      fixed = (IDL_STRING *) kw.fixed_vocabulary->value.arr->data;
+      n_fixed = kw.fixed_vocabulary->value.arr->n_elts;
+    } else {
+      fixed = &kw.fixed_vocabulary->value.str;
+      n_fixed = 1;
+    }
+    for (i = 0; ok && i < n_fixed; i++) {
+      ok = mg_wordtable_add(&vocabulary, IDL_STRING_STR(&fixed[i]),
+                            fixed[i].slen, 0) >= 0;
+    }
+    loop.fixed = &vocabulary;
+  }
+
+  if (kw.file) {
+    if (argv[0]->flags & IDL_V_ARR) {
+      mg_wordtable_free(&vocabulary);
+      IDL_KW_FREE;
+      IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                  "FILE requires a scalar filename");
+    }
+    loop.filename = IDL_VarGetString(argv[0]);
+    fp = fopen(loop.filename, "rb");
+    if (!fp || fseek(fp, 0, SEEK_END) != 0 || (size = ftell(fp)) < 0) {
+      if (fp) fclose(fp);
+      mg_wordtable_free(&vocabulary);
+      IDL_KW_FREE;
+      IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                  "unable to read file: %s", loop.filename);
+    }
+    fclose(fp);
+    n = size;
+    min_elts = MG_WORDS_MIN_BYTES;
+  } else {
+    if (argv[0]->flags & IDL_V_ARR) {
+      loop.strings = (IDL_STRING *) argv[0]->value.arr->data;
+      n = argv[0]->value.arr->n_elts;
+    } else {
+      loop.strings = &argv[0]->value.str;
+      n = 1;
+    }
+    min_elts = kw.tpool_min_elts > 0 ? kw.tpool_min_elts : MG_STRINGS_MIN_ELTS;
+  }
+
+  nthreads = mg_threads_count(n, kw.tpool_nthreads, min_elts);
+  loop.parts = (mg_words_part *) calloc(nthreads, sizeof(mg_words_part));
+
+  if (ok && loop.parts) {
+    mg_threads_for(n, nthreads, mg_words_range, &loop);
+    ok = !loop.failed;
+  } else {
+    ok = 0;
+  }
+
+  // merge the vocabularies of the threads, in order of first occurrence
+  words = loop.fixed ? loop.fixed : &vocabulary;
+  for (t = 0; ok && !loop.fixed && t < nthreads; t++) {
+    part = &loop.parts[t];
+    if (part->vocabulary.n_words == 0) continue;
+    part->map = (IDL_LONG *) malloc(part->vocabulary.n_words * sizeof(IDL_LONG));
+    if (!part->map) {
+      ok = 0;
+      break;
+    }
+    for (w = 0; ok && w < part->vocabulary.n_words; w++) {
+      part->map[w] = mg_wordtable_add(&vocabulary,
+                                      part->vocabulary.pool + part->vocabulary.word_offsets[w],
+                                      part->vocabulary.word_offsets[w + 1] - part->vocabulary.word_offsets[w] - 1,
+                                      0);
+      ok = part->map[w] >= 0;
+    }
+    mg_wordtable_free(&part->vocabulary);
+  }
+  if (ok && !loop.fixed) {
+    mg_threads_for(nthreads, nthreads, mg_words_remap_range, &loop);
+  }
+
+  if (!ok) {
+    if (loop.parts) {
+      for (t = 0; t < nthreads; t++) mg_words_part_free(&loop.parts[t]);
+      free(loop.parts);
+    }
+    mg_wordtable_free(&vocabulary);
+    IDL_KW_FREE;
+    IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                kw.file
+                  ? "unable to read file or allocate memory for word counts"
+                  : "unable to allocate memory for word counts");
+  }
+
+  for (t = 0; t < nthreads; t++) {
+    n_documents += loop.parts[t].n_documents;
+    n_entries += loop.parts[t].n_entries;
+  }
+
+  // concatenate the documents of the threads
+  if (n_entries > 0) {
+    counts = (IDL_LONG *) IDL_MakeTempVector(IDL_TYP_LONG, n_entries,
+                                             IDL_ARR_INI_NOP, &result);
+    ids = (IDL_LONG *) IDL_MakeTempVector(IDL_TYP_LONG, n_entries,
+                                          IDL_ARR_INI_NOP, &vptr);
+    for (t = 0, i = 0; t < nthreads; t++) {
+      part = &loop.parts[t];
+      for (e = 0; e < part->n_entries; e++, i++) {
+        counts[i] = part->entries[e].count;
+        ids[i] = part->entries[e].id;
+      }
+    }
+    if (kw.ids_present) {
+      IDL_VarCopy(vptr, kw.ids);
+    } else IDL_Deltmp(vptr);
+  } else {
+    result = IDL_GettmpLong(-1);
+    ids = NULL;
+    counts = NULL;
+    if (kw.ids_present) IDL_StoreScalar(kw.ids, IDL_TYP_LONG, &none);
+  }
+
+  if (kw.offsets_present) {
+    offsets = (IDL_LONG64 *) IDL_MakeTempVector(IDL_TYP_LONG64, n_documents + 1,
+                                                IDL_ARR_INI_NOP, &vptr);
+    offsets[0] = 0;
+    for (t = 0, d = 0; t < nthreads; t++) {
+      part = &loop.parts[t];
+      for (i = 0; i < part->n_documents; i++, d++) {
+        offsets[d + 1] = offsets[d] + part->offsets[i + 1] - part->offsets[i];
+      }
+    }
+    IDL_VarCopy(vptr, kw.offsets);
+  }
+
+  for (t = 0; t < nthreads; t++) mg_words_part_free(&loop.parts[t]);
+  free(loop.parts);
+
+  if (kw.vocabulary_present) {
+    if (words->n_words > 0) {
+      vocab = (IDL_STRING *) IDL_MakeTempVector(IDL_TYP_STRING, words->n_words,
+                                                IDL_ARR_INI_ZERO, &vptr);
+      for (w = 0; w < words->n_words; w++) {
+        IDL_StrStore(&vocab[w], words->pool + words->word_offsets[w]);
+      }
+      IDL_VarCopy(vptr, kw.vocabulary);
+    } else {
+      IDL_VarCopy(IDL_StrToSTRING(""), kw.vocabulary);
+    }
+  }
+
+  if (kw.total_counts_present) {
+    if (words->n_words > 0) {
+      totals = (IDL_LONG64 *) IDL_MakeTempVector(IDL_TYP_LONG64, words->n_words,
+                                                 IDL_ARR_INI_ZERO, &vptr);
+      for (i = 0; i < n_entries; i++) totals[ids[i]] += counts[i];
+      IDL_VarCopy(vptr, kw.total_counts);
+    } else {
+      IDL_StoreScalar(kw.total_counts, IDL_TYP_LONG, &none);
+    }
+  }
+
+  if (kw.document_frequency_present) {
+    if (words->n_words > 0) {
+      df = (IDL_LONG *) IDL_MakeTempVector(IDL_TYP_LONG, words->n_words,
+                                           IDL_ARR_INI_ZERO, &vptr);
+      for (i = 0; i < n_entries; i++) df[ids[i]]++;
+      IDL_VarCopy(vptr, kw.document_frequency);
+    } else {
+      IDL_StoreScalar(kw.document_frequency, IDL_TYP_LONG, &none);
+    }
+  }
+
+  mg_wordtable_free(&vocabulary);
+
+  IDL_KW_FREE;
+
+  return result;
+}
+
+
+/**************************************************************************
+  Formatting numbers
+***************************************************************************/
+
+// size of the buffer for one formatted number
+#define MG_NUMBER_MAX 512
+
+// largest width or precision of a format
+#define MG_FORMAT_MAX 100
+
+// a floating point number f * 2^e
+typedef struct {
+  IDL_ULONG64 f;
+  int e;
+} mg_diyfp;
+
+// normalized approximations of 10^k for k = -348, -340, ..., 340
+static const IDL_ULONG64 mg_cached_powers_f[] = {
+  0xfa8fd5a0081c0288ULL, 0xbaaee17fa23ebf76ULL, 0x8b16fb203055ac76ULL,
+  0xcf42894a5dce35eaULL, 0x9a6bb0aa55653b2dULL, 0xe61acf033d1a45dfULL,
+  0xab70fe17c79ac6caULL, 0xff77b1fcbebcdc4fULL, 0xbe5691ef416bd60cULL,
+  0x8dd01fad907ffc3cULL, 0xd3515c2831559a83ULL, 0x9d71ac8fada6c9b5ULL,
+  0xea9c227723ee8bcbULL, 0xaecc49914078536dULL, 0x823c12795db6ce57ULL,
+  0xc21094364dfb5637ULL, 0x9096ea6f3848984fULL, 0xd77485cb25823ac7ULL,
+  0xa086cfcd97bf97f4ULL, 0xef340a98172aace5ULL, 0xb23867fb2a35b28eULL,
+  0x84c8d4dfd2c63f3bULL, 0xc5dd44271ad3cdbaULL, 0x936b9fcebb25c996ULL,
+  0xdbac6c247d62a584ULL, 0xa3ab66580d5fdaf6ULL, 0xf3e2f893dec3f126ULL,
+  0xb5b5ada8aaff80b8ULL, 0x87625f056c7c4a8bULL, 0xc9bcff6034c13053ULL,
+  0x964e858c91ba2655ULL, 0xdff9772470297ebdULL, 0xa6dfbd9fb8e5b88fULL,
+  0xf8a95fcf88747d94ULL, 0xb94470938fa89bcfULL, 0x8a08f0f8bf0f156bULL,
+  0xcdb02555653131b6ULL, 0x993fe2c6d07b7facULL, 0xe45c10c42a2b3b06ULL,
+  0xaa242499697392d3ULL, 0xfd87b5f28300ca0eULL, 0xbce5086492111aebULL,
+  0x8cbccc096f5088ccULL, 0xd1b71758e219652cULL, 0x9c40000000000000ULL,
+  0xe8d4a51000000000ULL, 0xad78ebc5ac620000ULL, 0x813f3978f8940984ULL,
+  0xc097ce7bc90715b3ULL, 0x8f7e32ce7bea5c70ULL, 0xd5d238a4abe98068ULL,
+  0x9f4f2726179a2245ULL, 0xed63a231d4c4fb27ULL, 0xb0de65388cc8ada8ULL,
+  0x83c7088e1aab65dbULL, 0xc45d1df942711d9aULL, 0x924d692ca61be758ULL,
+  0xda01ee641a708deaULL, 0xa26da3999aef774aULL, 0xf209787bb47d6b85ULL,
+  0xb454e4a179dd1877ULL, 0x865b86925b9bc5c2ULL, 0xc83553c5c8965d3dULL,
+  0x952ab45cfa97a0b3ULL, 0xde469fbd99a05fe3ULL, 0xa59bc234db398c25ULL,
+  0xf6c69a72a3989f5cULL, 0xb7dcbf5354e9beceULL, 0x88fcf317f22241e2ULL,
+  0xcc20ce9bd35c78a5ULL, 0x98165af37b2153dfULL, 0xe2a0b5dc971f303aULL,
+  0xa8d9d1535ce3b396ULL, 0xfb9b7cd9a4a7443cULL, 0xbb764c4ca7a44410ULL,
+  0x8bab8eefb6409c1aULL, 0xd01fef10a657842cULL, 0x9b10a4e5e9913129ULL,
+  0xe7109bfba19c0c9dULL, 0xac2820d9623bf429ULL, 0x80444b5e7aa7cf85ULL,
+  0xbf21e44003acdd2dULL, 0x8e679c2f5e44ff8fULL, 0xd433179d9c8cb841ULL,
+  0x9e19db92b4e31ba9ULL, 0xeb96bf6ebadf77d9ULL, 0xaf87023b9bf0ee6bULL
+};
+
+static const short mg_cached_powers_e[] = {
+  -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980, -954, -927,
+  -901, -874, -847, -821, -794, -768, -741, -715, -688, -661, -635, -608,
+  -582, -555, -529, -502, -475, -449, -422, -396, -369, -343, -316, -289,
+  -263, -236, -210, -183, -157, -130, -103, -77, -50, -24, 3, 30,
+  56, 83, 109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+  375, 402, 428, 455, 481, 508, 534, 561, 588, 614, 641, 667,
+  694, 720, 747, 774, 800, 827, 853, 880, 907, 933, 960, 986,
+  1013, 1039, 1066
+};
+
+static const IDL_ULONG mg_pow10_32[] = {
+  1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+};
+
+static const IDL_ULONG64 mg_pow10_64[] = {
+  1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+  10000000ULL, 100000000ULL, 1000000000ULL, 10000000000ULL,
+  100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+  100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+  100000000000000000ULL, 1000000000000000000ULL, 10000000000000000000ULL
+};
+
+
+// Product of two numbers, keeping the rounded upper 64 bits.
+static mg_diyfp mg_diyfp_multiply(mg_diyfp x, mg_diyfp y) {
+  const IDL_ULONG64 mask = 0xFFFFFFFFULL;
+  IDL_ULONG64 a = x.f >> 32, b = x.f & mask, c = y.f >> 32, d = y.f & mask;
+  IDL_ULONG64 ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+  IDL_ULONG64 tmp = (bd >> 32) + (ad & mask) + (bc & mask) + (1ULL << 31);
+  mg_diyfp r;
+
+  r.f = ac + (ad >> 32) + (bc >> 32) + (tmp >> 32);
+  r.e = x.e + y.e + 64;
+
+  return r;
+}
+
+
+static mg_diyfp mg_diyfp_normalize(mg_diyfp x) {
+  while (!(x.f & (1ULL << 63))) {
+    x.f <<= 1;
+    x.e--;
+  }
+
+  return x;
+}
+
+
+// Move the last digit towards the value while it stays in the boundaries.
+static void mg_grisu_round(char *digits, int len, IDL_ULONG64 delta,
+                           IDL_ULONG64 rest, IDL_ULONG64 ten_kappa,
+                           IDL_ULONG64 wp_w) {
+  while (rest < wp_w && delta - rest >= ten_kappa
+           && (rest + ten_kappa < wp_w
+                 || wp_w - rest > rest + ten_kappa - wp_w)) {
+    digits[len - 1]--;
+    rest += ten_kappa;
+  }
+}
+
+
+// Generate the digits of w, as few as allowed by the upper boundary mp and
+// the width delta of the boundaries. Returns the number of digits.
+static int mg_grisu_digits(mg_diyfp w, mg_diyfp mp, IDL_ULONG64 delta,
+                           char *digits, int *k) {
+  mg_diyfp one;
+  IDL_ULONG64 wp_w = mp.f - w.f, p2, tmp;
+  IDL_ULONG p1, d;
+  int kappa, len = 0;
+
+  one.f = 1ULL << -mp.e;
+  one.e = mp.e;
+  p1 = (IDL_ULONG) (mp.f >> -one.e);
+  p2 = mp.f & (one.f - 1);
+
+  for (kappa = 1; kappa < 10 && p1 >= mg_pow10_32[kappa]; kappa++);
+
+  while (kappa > 0) {
+    d = p1 / mg_pow10_32[kappa - 1];
+    p1 %= mg_pow10_32[kappa - 1];
+    if (d || len) digits[len++] = (char) ('0' + d);
+    kappa--;
+    tmp = ((IDL_ULONG64) p1 << -one.e) + p2;
+    if (tmp <= delta) {
+      *k += kappa;
+      mg_grisu_round(digits, len, delta, tmp,
+                     (IDL_ULONG64) mg_pow10_32[kappa] << -one.e, wp_w);
+      return len;
+    }
+  }
+
+  for (;;) {
+    p2 *= 10;
+    delta *= 10;
+    d = (IDL_ULONG) (p2 >> -one.e);
+    if (d || len) digits[len++] = (char) ('0' + d);
+    p2 &= one.f - 1;
+    kappa--;
+    if (p2 < delta) {
+      *k += kappa;
+      mg_grisu_round(digits, len, delta, p2, one.f,
+                     -kappa < 20 ? wp_w * mg_pow10_64[-kappa] : 0);
+      return len;
+    }
+  }
+}
+
+
+/*
+  Shortest digits (Grisu2) of the positive number f * 2^e, where lower_closer
+  is set if the next smaller number of the type is closer than the next
+  larger one. The number read back from digits * 10^k always rounds to the
+  same value, though in rare cases there are more digits than necessary.
+  Returns the number of digits.
+*/
+static int mg_grisu(IDL_ULONG64 f, int e, int lower_closer,
+                    char *digits, int *k) {
+  mg_diyfp v, plus, minus, c, w, wp, wm;
+  double dk;
+  int ck, index;
+
+  v.f = f;
+  v.e = e;
+
+  plus.f = (f << 1) + 1;
+  plus.e = e - 1;
+  plus = mg_diyfp_normalize(plus);
+  if (lower_closer) {
+    minus.f = (f << 2) - 1;
+    minus.e = e - 2;
+  } else {
+    minus.f = (f << 1) - 1;
+    minus.e = e - 1;
+  }
+  minus.f <<= minus.e - plus.e;
+  minus.e = plus.e;
+
+  // cached power of 10 bringing the exponent of plus into [-60, -32]
+  dk = (-61 - plus.e) * 0.30102999566398114 + 347;
+  ck = (int) dk;
+  if (dk - ck > 0.0) ck++;
+  index = (ck >> 3) + 1;
+  *k = -(-348 + index * 8);
+  c.f = mg_cached_powers_f[index];
+  c.e = mg_cached_powers_e[index];
+
+  w = mg_diyfp_multiply(mg_diyfp_normalize(v), c);
+  wp = mg_diyfp_multiply(plus, c);
+  wm = mg_diyfp_multiply(minus, c);
+  wm.f++;
+  wp.f--;
+
+  return mg_grisu_digits(w, wp, wp.f - wm.f, digits, k);
+}
+
+
+/*
+  Write digits * 10^k in fixed notation when the decimal exponent is less
+  than max_fixed and at least -4, like %g, and in exponential notation
+  otherwise.
+  Returns the length written.
+*/
+static int mg_format_digits(char *s, int negative, const char *digits,
+                            int len, int k, int max_fixed) {
+  int n = 0, point = len + k, i, x;
+
+  if (negative) s[n++] = '-';
+
+  if (point - 1 >= -4 && point - 1 < max_fixed) {
+    if (point <= 0) {
+      s[n++] = '0';
+      s[n++] = '.';
+      for (i = point; i < 0; i++) s[n++] = '0';
+      memcpy(s + n, digits, len);
+      n += len;
+    } else if (point >= len) {
+      memcpy(s + n, digits, len);
+      n += len;
+      for (i = len; i < point; i++) s[n++] = '0';
+    } else {
+      memcpy(s + n, digits, point);
+      n += point;
+      s[n++] = '.';
+      memcpy(s + n, digits + point, len - point);
+      n += len - point;
+    }
+  } else {
+    s[n++] = digits[0];
+    if (len > 1) {
+      s[n++] = '.';
+      memcpy(s + n, digits + 1, len - 1);
+      n += len - 1;
+    }
+    x = point - 1;
+    s[n++] = 'e';
+    s[n++] = x < 0 ? '-' : '+';
+    if (x < 0) x = -x;
+    if (x >= 100) s[n++] = (char) ('0' + x / 100);
+    s[n++] = (char) ('0' + x / 10 % 10);
+    s[n++] = (char) ('0' + x % 10);
+  }
+
+  s[n] = '\0';
+  return n;
+}
+
+
+// Shortest representation of a double that reads back as the same value.
+static int mg_format_shortest_double(char *s, double x) {
+  char digits[32];
+  IDL_ULONG64 bits, f;
+  int biased, len, k;
+
+  memcpy(&bits, &x, sizeof(bits));
+  biased = (int) ((bits >> 52) & 0x7FF);
+  f = bits & ((1ULL << 52) - 1);
+
+  if (x == 0.0) return mg_format_digits(s, bits >> 63, "0", 1, 0, 17);
+
+  len = biased
+          ? mg_grisu(f | (1ULL << 52), biased - 1075, f == 0 && biased > 1, digits, &k)
+          : mg_grisu(f, -1074, 0, digits, &k);
+
+  return mg_format_digits(s, bits >> 63, digits, len, k, 17);
+}
+
+
+// Shortest representation of a float that reads back as the same value.
+static int mg_format_shortest_float(char *s, float x) {
+  char digits[32];
+  IDL_ULONG bits;
+  IDL_ULONG64 f;
+  int biased, len, k;
+
+  memcpy(&bits, &x, sizeof(bits));
+  biased = (int) ((bits >> 23) & 0xFF);
+  f = bits & ((1UL << 23) - 1);
+
+  if (x == 0.0f) return mg_format_digits(s, bits >> 31, "0", 1, 0, 9);
+
+  len = biased
+          ? mg_grisu(f | (1ULL << 23), biased - 150, f == 0 && biased > 1, digits, &k)
+          : mg_grisu(f, -149, 0, digits, &k);
+
+  return mg_format_digits(s, bits >> 31, digits, len, k, 9);
+}
+
+
+/*
+  Format x with precision digits after the decimal point, without the C
+  library, when x * 10^precision is small and not close to a tie. Returns
+  the length written, or -1 if the C library must be used.
+*/
+static int mg_format_fixed(char *s, double x, int precision) {
+  double scaled = fabs(x) * (double) mg_pow10_64[precision], r, frac;
+  IDL_ULONG64 value, integer, fraction;
+  char digits[24];
+  int n = 0, len = 0, i;
+
+  // 2^40, so the error of scaled is less than 2^-14
+  if (!(scaled < 1099511627776.0)) return -1;
+
+  r = floor(scaled);
+  frac = scaled - r;
+  if (fabs(frac - 0.5) < 1.0 / 1024.0) return -1;
+
+  value = (IDL_ULONG64) r + (frac > 0.5);
+  integer = value / mg_pow10_64[precision];
+  fraction = value % mg_pow10_64[precision];
+
+  if (signbit(x)) s[n++] = '-';
+  do {
+    digits[len++] = (char) ('0' + integer % 10);
+    integer /= 10;
+  } while (integer > 0);
+  while (len > 0) s[n++] = digits[--len];
+
+  if (precision > 0) {
+    s[n++] = '.';
+    for (i = precision - 1; i >= 0; i--) {
+      s[n + i] = (char) ('0' + fraction % 10);
+      fraction /= 10;
+    }
+    n += precision;
+  }
+
+  s[n] = '\0';
+  return n;
+}
+
+
+typedef struct {
+  int type;                    // IDL_TYP_FLOAT or IDL_TYP_DOUBLE
+  UCHAR *data;
+  int shortest;                // shortest representation instead of a format
+  char format[16];             // C format of a number
+  char exp_format[16];         // format of numbers past the threshold
+  int precision;               // precision of format
+  int fast;                    // format is "%.Nf" for small N
+  int width;
+  int left;                    // left justify in the width
+  IDL_LONG threshold;          // places before exponential notation, or 0
+  const char *locale_point;    // decimal point used by the C library
+  size_t locale_point_len;
+  const char *decimal_sep;     // decimal point of the output
+  size_t decimal_sep_len;
+  char **buffers;              // formatted numbers of each thread
+  IDL_MEMINT *offsets;         // offset of each number in its buffer
+  IDL_MEMINT *starts;          // first element of each thread
+  IDL_MEMINT *ends;
+  int failed;
+} mg_strfloat_loop;
+
+
+/*
+  Check a C format of one floating point number, "%[flags][width][.precision]"
+  followed by one of "eEfFgG", and make the exponential variant of it.
+  Returns 0 for an invalid format.
+*/
+static int mg_strfloat_parse(mg_strfloat_loop *loop, const char *format) {
+  const char *p = format;
+  int only_zero_flag = 1, n;
+
+  if (*p++ != '%') return 0;
+  for (; *p && strchr("-+ 0#", *p); p++) {
+    if (*p == '-') loop->left = 1;
+    if (*p != '0') only_zero_flag = 0;
+  }
+  for (loop->width = 0; isdigit((unsigned char) *p); p++) {
+    loop->width = 10 * loop->width + (*p - '0');
+    if (loop->width > MG_FORMAT_MAX) return 0;
+  }
+  loop->precision = 6;
+  if (*p == '.') {
+    for (p++, loop->precision = 0; isdigit((unsigned char) *p); p++) {
+      loop->precision = 10 * loop->precision + (*p - '0');
+      if (loop->precision > MG_FORMAT_MAX) return 0;
+    }
+  }
+  if (!*p || !strchr("eEfFgG", *p) || p[1] != '\0') return 0;
+
+  n = (int) (p - format);
+  if (n + 2 > (int) sizeof(loop->format)) return 0;
+  memcpy(loop->format, format, n + 2);
+  memcpy(loop->exp_format, format, n + 2);
+  loop->exp_format[n] = *p == 'E' || *p == 'G' ? 'E' : 'e';
+
+  loop->fast = *p == 'f' && only_zero_flag && loop->width <= 1
+                 && loop->precision <= 9;
+
+  return 1;
+}
+
+
+// Format element i, returns the length written to s.
+static int mg_strfloat_one(const mg_strfloat_loop *loop, IDL_MEMINT i,
+                           char *s) {
+  double x;
+  const char *special;
+  char *point;
+  int n;
+
+  if (loop->type == IDL_TYP_FLOAT) {
+    x = ((float *) loop->data)[i];
+    if (loop->shortest && isfinite(x)) {
+      return mg_format_shortest_float(s, ((float *) loop->data)[i]);
+    }
+  } else {
+    x = ((double *) loop->data)[i];
+    if (loop->shortest && isfinite(x)) return mg_format_shortest_double(s, x);
+  }
+
+  // NaN and infinities are written the same way as IDL does
+  if (!isfinite(x)) {
+    special = isnan(x) ? "NaN" : (x < 0.0 ? "-Inf" : "Inf");
+    return snprintf(s, MG_NUMBER_MAX, loop->left ? "%-*s" : "%*s",
+                    loop->width, special);
+  }
+
+  if (loop->threshold > 0 && x != 0.0
+        && (IDL_LONG) log10(fabs(x)) + 1 > loop->threshold) {
+    n = snprintf(s, MG_NUMBER_MAX, loop->exp_format, x);
+  } else {
+    if (loop->fast && (n = mg_format_fixed(s, x, loop->precision)) >= 0) {
+      return n;
+    }
+    n = snprintf(s, MG_NUMBER_MAX, loop->format, x);
+  }
+
+  // output does not depend on the locale of the C library
+  if (loop->locale_point && (point = strstr(s, loop->locale_point))) {
+    *point = '.';
+    memmove(point + 1, point + loop->locale_point_len,
+            n - (point - s) - loop->locale_point_len + 1);
+    n -= (int) loop->locale_point_len - 1;
+  }
+
+  return n;
+}
+
+
+// Format elements start to end - 1 into the buffer of the thread.
+static void mg_strfloat_range(void *data, IDL_MEMINT start, IDL_MEMINT end,
+                              int thread) {
+  mg_strfloat_loop *loop = (mg_strfloat_loop *) data;
+  char number[MG_NUMBER_MAX], *buffer = NULL;
+  IDL_MEMINT i, size = 0, capacity = 0;
+  int n, c;
+
+  loop->starts[thread] = start;
+  loop->ends[thread] = end;
+
+  for (i = start; i < end; i++) {
+    n = mg_strfloat_one(loop, i, number);
+    while (size + n + (IDL_MEMINT) loop->decimal_sep_len + 1 > capacity) {
+      if (!mg_arena_reserve((void **) &buffer, capacity, &capacity, 1)) {
+        loop->failed = 1;
+        loop->buffers[thread] = buffer;
+        return;
+      }
+    }
+
+    loop->offsets[i] = size;
+    for (c = 0; c < n; c++) {
+      if (number[c] == '.' && loop->decimal_sep) {
+        memcpy(buffer + size, loop->decimal_sep, loop->decimal_sep_len);
+        size += loop->decimal_sep_len;
+      } else {
+        buffer[size++] = number[c];
+      }
+    }
+    buffer[size++] = '\0';
+  }
+
+  loop->buffers[thread] = buffer;
+}
+
+
+/*
+  Convert float or double values to strings. Without FORMAT, the shortest
+  string that reads back as the same value is used.
+*/
+static IDL_VPTR IDL_CDECL IDL_mg_strfloat(int argc, IDL_VPTR *argv, char *argk) {
+  typedef struct {
+    IDL_KW_RESULT_FIRST_FIELD;
+    IDL_VPTR decimal_sep;
+    int decimal_sep_present;
+    IDL_LONG exponential_threshold;
+    IDL_VPTR format;
+    int format_present;
+    IDL_LONG tpool_min_elts;
+    IDL_LONG tpool_nthreads;
+  } KW_RESULT;
+
+  // make sure to list keyword in alphabetical order
+  static IDL_KW_PAR kw_pars[] = {
+    { "DECIMAL_SEP", IDL_TYP_UNDEF, 1, IDL_KW_VIN,
+      IDL_KW_OFFSETOF(decimal_sep_present), IDL_KW_OFFSETOF(decimal_sep) },
+    { "EXPONENTIAL_THRESHOLD", IDL_TYP_LONG, 1, IDL_KW_ZERO,
+      0, IDL_KW_OFFSETOF(exponential_threshold) },
+    { "FORMAT", IDL_TYP_UNDEF, 1, IDL_KW_VIN,
+      IDL_KW_OFFSETOF(format_present), IDL_KW_OFFSETOF(format) },
+    { "TPOOL_MIN_ELTS", IDL_TYP_LONG, 1, IDL_KW_ZERO,
+      0, IDL_KW_OFFSETOF(tpool_min_elts) },
+    { "TPOOL_NTHREADS", IDL_TYP_LONG, 1, IDL_KW_ZERO,
+      0, IDL_KW_OFFSETOF(tpool_nthreads) },
+    { NULL }
+  };
+
+  KW_RESULT kw;
+  mg_strfloat_loop loop;
+  IDL_VPTR result;
+  IDL_STRING *strings;
+  IDL_MEMINT n, i, min_elts;
+  struct lconv *conv;
+  int nthreads, t;
+
+  int nargs = IDL_KWProcessByOffset(argc, argv, argk, kw_pars, (IDL_VPTR *) NULL, 1, &kw);
+
+  if (argv[0]->type != IDL_TYP_FLOAT && argv[0]->type != IDL_TYP_DOUBLE) {
+    IDL_KW_FREE;
+    IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                "values must be float or double");
+  }
+
+  memset(&loop, 0, sizeof(loop));
+  loop.type = argv[0]->type;
+  loop.threshold = kw.exponential_threshold;
+  loop.shortest = !(kw.format_present && kw.format->type != IDL_TYP_UNDEF);
+
+  if (!loop.shortest
+        && (kw.format->type != IDL_TYP_STRING
+              || (kw.format->flags & IDL_V_ARR)
+              || !mg_strfloat_parse(&loop, IDL_VarGetString(kw.format)))) {
+    IDL_KW_FREE;
+    IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                "FORMAT must be a C format of one number such as '%%0.3f'");
+  }
+
+  if (kw.decimal_sep_present && kw.decimal_sep->type == IDL_TYP_STRING
+        && !(kw.decimal_sep->flags & IDL_V_ARR)
+        && strcmp(IDL_VarGetString(kw.decimal_sep), ".") != 0) {
+    loop.decimal_sep = IDL_VarGetString(kw.decimal_sep);
+    loop.decimal_sep_len = strlen(loop.decimal_sep);
+  }
+
+  conv = localeconv();
+  if (conv && conv->decimal_point && strcmp(conv->decimal_point, ".") != 0) {
+    loop.locale_point = conv->decimal_point;
+    loop.locale_point_len = strlen(loop.locale_point);
+  }
+
+  if (argv[0]->flags & IDL_V_ARR) {
+    loop.data = argv[0]->value.arr->data;
+    n = argv[0]->value.arr->n_elts;
+  } else {
+    loop.data = (UCHAR *) &argv[0]->value;
+    n = 1;
+  }
+
+  min_elts = kw.tpool_min_elts > 0 ? kw.tpool_min_elts : MG_STRINGS_MIN_ELTS;
+  nthreads = mg_threads_count(n, kw.tpool_nthreads, min_elts);
+
+  loop.buffers = (char **) calloc(nthreads, sizeof(char *));
+  loop.starts = (IDL_MEMINT *) calloc(nthreads, sizeof(IDL_MEMINT));
+  loop.ends = (IDL_MEMINT *) calloc(nthreads, sizeof(IDL_MEMINT));
+  loop.offsets = (IDL_MEMINT *) malloc(n * sizeof(IDL_MEMINT));
+
+  if (loop.buffers && loop.starts && loop.ends && loop.offsets) {
+    mg_threads_for(n, nthreads, mg_strfloat_range, &loop);
+  } else {
+    loop.failed = 1;
+  }
+
+  if (!loop.failed) {
+    if (argv[0]->flags & IDL_V_ARR) {
+      strings = (IDL_STRING *) IDL_MakeTempArray(IDL_TYP_STRING,
+                                                 argv[0]->value.arr->n_dim,
+                                                 argv[0]->value.arr->dim,
+                                                 IDL_ARR_INI_ZERO, &result);
+      for (t = 0; t < nthreads; t++) {
+        for (i = loop.starts[t]; i < loop.ends[t]; i++) {
+          IDL_StrStore(&strings[i], loop.buffers[t] + loop.offsets[i]);
+        }
+      }
+    } else {
+      result = IDL_StrToSTRING(loop.buffers[0]);
+    }
+  }
+
+  if (loop.buffers) {
+    for (t = 0; t < nthreads; t++) free(loop.buffers[t]);
+  }
+  free(loop.buffers);
+  free(loop.starts);
+  free(loop.ends);
+  free(loop.offsets);
+
+  IDL_KW_FREE;
+
+  if (loop.failed) {
+    IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                "unable to allocate memory for strings");
+  }
+
+  return result;
+}
+
+
+/**************************************************************************
+  Parsing numbers
+***************************************************************************/
+
+#if defined(_WIN32) || (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define MG_SWAR_DIGITS
+#endif
+
+// values of elements of ERRORS
+#define MG_PARSE_OK      0
+#define MG_PARSE_MISSING 1
+#define MG_PARSE_INVALID 2
+
+// exactly representable powers of 10
+static const double mg_pow10_double[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static const float mg_pow10_float[] = {
+  1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f
+};
+
+
+// a decimal number mantissa * 10^exponent as written in a string
+typedef struct {
+  int negative;
+  IDL_ULONG64 mantissa;        // first 19 significant digits
+  int exponent;
+  int truncated;               // set if there are more than 19 digits
+  int has_point;               // fraction or exponent present
+  int special;                 // 1 for NaN, 2 for infinity
+} mg_decimal;
+
+
+// Whether the first n characters of s are lower, ignoring case.
+static int mg_strncaseeq(const char *s, const char *lower, IDL_MEMINT n) {
+  IDL_MEMINT i;
+
+  for (i = 0; i < n; i++) {
+    if (tolower((unsigned char) s[i]) != lower[i]) return 0;
+  }
+
+  return 1;
+}
+
+
+#ifdef MG_SWAR_DIGITS
+
+// Whether 8 bytes, in little endian order, are all digits.
+static int mg_is_eight_digits(IDL_ULONG64 v) {
+  return !(((v + 0x4646464646464646ULL) | (v - 0x3030303030303030ULL))
+             & 0x8080808080808080ULL);
+}
+
+
+// Value of 8 digits, in little endian order.
+static IDL_ULONG mg_parse_eight_digits(IDL_ULONG64 v) {
+  const IDL_ULONG64 mask = 0x000000FF000000FFULL;
+  const IDL_ULONG64 mul1 = 0x000F424000000064ULL;  // 100 + (1000000 << 32)
+  const IDL_ULONG64 mul2 = 0x0000271000000001ULL;  // 1 + (10000 << 32)
+
+  v -= 0x3030303030303030ULL;
+  v = (v * 10) + (v >> 8);
+  v = (((v & mask) * mul1) + (((v >> 16) & mask) * mul2)) >> 32;
+
+  return (IDL_ULONG) v;
+}
+
+#endif
+
+
+/*
+  Add a run of digits starting at s[*i] to the mantissa of d, counting digits
+  past the first 19 as a power of 10 in *dropped. Returns the number of
+  digits in the run.
+*/
+static IDL_MEMINT mg_parse_digits(const char *s, IDL_MEMINT *i, IDL_MEMINT end,
+                                  mg_decimal *d, int *n_significant,
+                                  int *dropped) {
+  IDL_MEMINT start = *i;
+#ifdef MG_SWAR_DIGITS
+  IDL_ULONG64 v;
+#endif
+
+  // skip leading zeros, which are not significant
+  if (*n_significant == 0) {
+    while (*i < end && s[*i] == '0') (*i)++;
+  }
+
+#ifdef MG_SWAR_DIGITS
+  while (*n_significant <= 19 - 8 && end - *i >= 8) {
+    memcpy(&v, s + *i, 8);
+    if (!mg_is_eight_digits(v)) break;
+    d->mantissa = d->mantissa * 100000000 + mg_parse_eight_digits(v);
+    *n_significant += 8;
+    *i += 8;
+  }
+#endif
+
+  for (; *i < end && isdigit((unsigned char) s[*i]); (*i)++) {
+    if (*n_significant < 19) {
+      d->mantissa = d->mantissa * 10 + (s[*i] - '0');
+      if (d->mantissa > 0) (*n_significant)++;
+    } else {
+      if (s[*i] != '0') d->truncated = 1;
+      (*dropped)++;
+    }
+  }
+
+  return *i - start;
+}
+
+
+/*
+  Parse a decimal number with optional surrounding whitespace, sign, fraction
+  and exponent (e or d), or NaN or Inf(inity). Returns 0 if s is not a
+  number.
+*/
+static int mg_parse_decimal(const char *s, IDL_MEMINT len, mg_decimal *d) {
+  IDL_MEMINT i = 0, end = len, n_digits, n_fraction;
+  int n_significant = 0, dropped = 0, exp_negative = 0, exp_value = 0;
+
+  memset(d, 0, sizeof(mg_decimal));
+
+  while (i < end && isspace((unsigned char) s[i])) i++;
+  while (end > i && isspace((unsigned char) s[end - 1])) end--;
+
+  if (i < end && (s[i] == '-' || s[i] == '+')) d->negative = s[i++] == '-';
+
+  if (end - i == 3 && mg_strncaseeq(s + i, "nan", 3)) {
+    d->special = 1;
+    return 1;
+  }
+  if ((end - i == 3 && mg_strncaseeq(s + i, "inf", 3))
+        || (end - i == 8 && mg_strncaseeq(s + i, "infinity", 8))) {
+    d->special = 2;
+    return 1;
+  }
+
+  n_digits = mg_parse_digits(s, &i, end, d, &n_significant, &dropped);
+  d->exponent = dropped;
+
+  if (i < end && s[i] == '.') {
+    i++;
+    d->has_point = 1;
+    dropped = 0;
+    n_fraction = mg_parse_digits(s, &i, end, d, &n_significant, &dropped);
+    d->exponent -= (int) (n_fraction - dropped);
+    n_digits += n_fraction;
+  }
+  if (n_digits == 0) return 0;
+
+  if (i < end && strchr("eEdD", s[i])) {
+    i++;
+    d->has_point = 1;
+    if (i < end && (s[i] == '-' || s[i] == '+')) exp_negative = s[i++] == '-';
+    if (i == end || !isdigit((unsigned char) s[i])) return 0;
+    for (; i < end && isdigit((unsigned char) s[i]); i++) {
+      if (exp_value < 100000) exp_value = 10 * exp_value + (s[i] - '0');
+    }
+    d->exponent += exp_negative ? -exp_value : exp_value;
+  }
+
+  return i == end;
+}
+
+
+/*
+  Convert a number the fast path can't handle with the C library, using the
+  decimal point of its locale. Returns 0 if the number is out of range.
+*/
+static int mg_parse_fallback(const char *s, IDL_MEMINT len, int is_float,
+                             const char *locale_point, double *value) {
+  char buffer[128], *copy = buffer, *p, *end;
+  size_t point_len = locale_point ? strlen(locale_point) : 1;
+  IDL_MEMINT i, n = 0;
+  int ok;
+
+  if (len * (IDL_MEMINT) point_len + 1 > (IDL_MEMINT) sizeof(buffer)) {
+    if (!(copy = (char *) malloc(len * point_len + 1))) return 0;
+  }
+
+  for (i = 0; i < len; i++) {
+    if (s[i] == '.' && locale_point) {
+      memcpy(copy + n, locale_point, point_len);
+      n += point_len;
+    } else {
+      copy[n++] = s[i] == 'd' || s[i] == 'D' ? 'e' : s[i];
+    }
+  }
+  copy[n] = '\0';
+
+  errno = 0;
+  if (is_float) {
+    *value = strtof(copy, &end);
+  } else {
+    *value = strtod(copy, &end);
+  }
+  for (p = end; isspace((unsigned char) *p); p++);
+  ok = *p == '\0' && !(errno == ERANGE && isinf(*value));
+
+  if (copy != buffer) free(copy);
+
+  return ok;
+}
+
+
+// Parse a double, returns 0 if s is not a number or out of range.
+static int mg_parse_double(const char *s, IDL_MEMINT len,
+                           const char *locale_point, double *value) {
+  mg_decimal d;
+
+  if (!mg_parse_decimal(s, len, &d)) return 0;
+
+  if (d.special) {
+    *value = d.special == 1 ? NAN : (d.negative ? -INFINITY : INFINITY);
+    return 1;
+  }
+
+  if (d.mantissa == 0 && !d.truncated) {
+    *value = d.negative ? -0.0 : 0.0;
+    return 1;
+  }
+
+  // exact mantissa and power of 10 give a correctly rounded quotient/product
+  if (!d.truncated && d.mantissa <= (1ULL << 53)
+        && d.exponent >= -22 && d.exponent <= 22) {
+    *value = d.exponent < 0
+               ? (double) d.mantissa / mg_pow10_double[-d.exponent]
+               : (double) d.mantissa * mg_pow10_double[d.exponent];
+    if (d.negative) *value = -*value;
+    return 1;
+  }
+
+  return mg_parse_fallback(s, len, 0, locale_point, value);
+}
+
+
+// Parse a float, returns 0 if s is not a number or out of range.
+static int mg_parse_float(const char *s, IDL_MEMINT len,
+                          const char *locale_point, float *value) {
+  mg_decimal d;
+  double v;
+
+  if (!mg_parse_decimal(s, len, &d)) return 0;
+
+  if (d.special) {
+    *value = d.special == 1 ? NAN : (d.negative ? -INFINITY : INFINITY);
+    return 1;
+  }
+
+  if (d.mantissa == 0 && !d.truncated) {
+    *value = d.negative ? -0.0f : 0.0f;
+    return 1;
+  }
+
+  if (!d.truncated && d.mantissa <= (1ULL << 24)
+        && d.exponent >= -10 && d.exponent <= 10) {
+    *value = d.exponent < 0
+               ? (float) d.mantissa / mg_pow10_float[-d.exponent]
+               : (float) d.mantissa * mg_pow10_float[d.exponent];
+    if (d.negative) *value = -*value;
+    return 1;
+  }
+
+  if (!mg_parse_fallback(s, len, 1, locale_point, &v)) return 0;
+  *value = (float) v;
+
+  return 1;
+}
+
+
+/*
+  Parse an integer in [min, max], or [0, umax] if unsigned. Returns 0 if s
+  is not an integer or is out of range.
+*/
+static int mg_parse_integer(const char *s, IDL_MEMINT len, int is_unsigned,
+                            IDL_LONG64 min, IDL_LONG64 max, IDL_ULONG64 umax,
+                            IDL_ULONG64 *value) {
+  IDL_MEMINT i = 0, end = len, start;
+  IDL_ULONG64 v = 0, limit;
+  int negative = 0;
+#ifdef MG_SWAR_DIGITS
+  IDL_ULONG64 eight;
+#endif
+
+  while (i < end && isspace((unsigned char) s[i])) i++;
+  while (end > i && isspace((unsigned char) s[end - 1])) end--;
+  if (i < end && (s[i] == '-' || s[i] == '+')) negative = s[i++] == '-';
+  if (i == end) return 0;
+
+  limit = is_unsigned
+            ? umax
+            : (negative ? (IDL_ULONG64) -(min + 1) + 1 : (IDL_ULONG64) max);
+
+  while (i < end && s[i] == '0') i++;
+  start = i;
+
+#ifdef MG_SWAR_DIGITS
+  // the first 16 significant digits can't overflow
+  while (i - start <= 8 && end - i >= 8) {
+    memcpy(&eight, s + i, 8);
+    if (!mg_is_eight_digits(eight)) break;
+    v = v * 100000000 + mg_parse_eight_digits(eight);
+    i += 8;
+  }
+#endif
+
+  for (; i < end; i++) {
+    if (!isdigit((unsigned char) s[i])) return 0;
+    if (v > (limit - (s[i] - '0')) / 10) return 0;
+    v = v * 10 + (s[i] - '0');
+  }
+  if (start == i && (i == 0 || s[i - 1] != '0')) return 0;
+  if (v > limit || (is_unsigned && negative && v > 0)) return 0;
+
+  *value = negative ? (IDL_ULONG64) 0 - v : v;
+
+  return 1;
+}
+
+
+typedef struct {
+  IDL_STRING *strings;
+  int type;
+  UCHAR *result;
+  UCHAR *errors;               // ERRORS mask, or NULL
+  const mg_wordtable *missing; // missing value tokens, or NULL
+  double fill;                 // value for missing and invalid elements
+  IDL_LONG64 fill_integer;
+  const char *locale_point;    // decimal point of the C library, if not "."
+  IDL_MEMINT *n_invalid;       // number of invalid elements of each thread
+} mg_strtonum_loop;
+
+
+// Whether a string, without surrounding whitespace, is a missing token.
+static int mg_strtonum_is_missing(const mg_wordtable *missing,
+                                  const char *s, IDL_MEMINT len) {
+  IDL_MEMINT i = 0;
+
+  while (i < len && isspace((unsigned char) s[i])) i++;
+  while (len > i && isspace((unsigned char) s[len - 1])) len--;
+
+  return mg_wordtable_find(missing, s + i, len - i) >= 0;
+}
+
+
+static void mg_strtonum_range(void *data, IDL_MEMINT start, IDL_MEMINT end,
+                              int thread) {
+  mg_strtonum_loop *loop = (mg_strtonum_loop *) data;
+  IDL_MEMINT i, len, n_invalid = 0;
+  IDL_ULONG64 u;
+  const char *s;
+  int status, ok;
+  float f;
+  double d;
+
+  for (i = start; i < end; i++) {
+    s = IDL_STRING_STR(&loop->strings[i]);
+    len = loop->strings[i].slen;
+
+    if (loop->missing && mg_strtonum_is_missing(loop->missing, s, len)) {
+      status = MG_PARSE_MISSING;
+    } else {
+      switch (loop->type) {
+        case IDL_TYP_FLOAT:
+          ok = mg_parse_float(s, len, loop->locale_point, &f);
+          if (ok) ((float *) loop->result)[i] = f;
+          break;
+        case IDL_TYP_DOUBLE:
+          ok = mg_parse_double(s, len, loop->locale_point, &d);
+          if (ok) ((double *) loop->result)[i] = d;
+          break;
+        case IDL_TYP_BYTE:
+          ok = mg_parse_integer(s, len, 1, 0, 0, UCHAR_MAX, &u);
+          if (ok) ((UCHAR *) loop->result)[i] = (UCHAR) u;
+          break;
+        case IDL_TYP_INT:
+          ok = mg_parse_integer(s, len, 0, SHRT_MIN, SHRT_MAX, 0, &u);
+          if (ok) ((IDL_INT *) loop->result)[i] = (IDL_INT) (IDL_LONG64) u;
+          break;
+        case IDL_TYP_UINT:
+          ok = mg_parse_integer(s, len, 1, 0, 0, USHRT_MAX, &u);
+          if (ok) ((IDL_UINT *) loop->result)[i] = (IDL_UINT) u;
+          break;
+        case IDL_TYP_LONG:
+          ok = mg_parse_integer(s, len, 0, INT_MIN, INT_MAX, 0, &u);
+          if (ok) ((IDL_LONG *) loop->result)[i] = (IDL_LONG) (IDL_LONG64) u;
+          break;
+        case IDL_TYP_ULONG:
+          ok = mg_parse_integer(s, len, 1, 0, 0, UINT_MAX, &u);
+          if (ok) ((IDL_ULONG *) loop->result)[i] = (IDL_ULONG) u;
+          break;
+        case IDL_TYP_LONG64:
+          ok = mg_parse_integer(s, len, 0, LLONG_MIN, LLONG_MAX, 0, &u);
+          if (ok) ((IDL_LONG64 *) loop->result)[i] = (IDL_LONG64) u;
+          break;
+        default:
+          ok = mg_parse_integer(s, len, 1, 0, 0, ULLONG_MAX, &u);
+          if (ok) ((IDL_ULONG64 *) loop->result)[i] = u;
+          break;
+      }
+      if (ok) {
+        if (loop->errors) loop->errors[i] = MG_PARSE_OK;
+        continue;
+      }
+      status = MG_PARSE_INVALID;
+      n_invalid++;
+    }
+
+    if (loop->errors) loop->errors[i] = (UCHAR) status;
+    switch (loop->type) {
+      case IDL_TYP_FLOAT: ((float *) loop->result)[i] = (float) loop->fill; break;
+      case IDL_TYP_DOUBLE: ((double *) loop->result)[i] = loop->fill; break;
+      case IDL_TYP_BYTE: ((UCHAR *) loop->result)[i] = (UCHAR) loop->fill_integer; break;
+      case IDL_TYP_INT: ((IDL_INT *) loop->result)[i] = (IDL_INT) loop->fill_integer; break;
+      case IDL_TYP_UINT: ((IDL_UINT *) loop->result)[i] = (IDL_UINT) loop->fill_integer; break;
+      case IDL_TYP_LONG: ((IDL_LONG *) loop->result)[i] = (IDL_LONG) loop->fill_integer; break;
+      case IDL_TYP_ULONG: ((IDL_ULONG *) loop->result)[i] = (IDL_ULONG) loop->fill_integer; break;
+      case IDL_TYP_LONG64: ((IDL_LONG64 *) loop->result)[i] = loop->fill_integer; break;
+      default: ((IDL_ULONG64 *) loop->result)[i] = (IDL_ULONG64) loop->fill_integer; break;
+    }
+  }
+
+  loop->n_invalid[thread] = n_invalid;
+}
+
+
+/*
+  Convert a string array to numbers of the given type code in one pass.
+  Elements that are missing tokens or not valid numbers are set to the FILL
+  value and marked in ERRORS.
+*/
+static IDL_VPTR IDL_CDECL IDL_mg_strtonum(int argc, IDL_VPTR *argv, char *argk) {
+  typedef struct {
+    IDL_KW_RESULT_FIRST_FIELD;
+    IDL_VPTR errors;
+    int errors_present;
+    IDL_VPTR fill;
+    int fill_present;
+    IDL_VPTR missing;
+    int missing_present;
+    IDL_VPTR n_errors;
+    int n_errors_present;
+    IDL_LONG tpool_min_elts;
+    IDL_LONG tpool_nthreads;
+    IDL_LONG type;
+    int type_present;
+  } KW_RESULT;
+
+  // make sure to list keyword in alphabetical order
+  static IDL_KW_PAR kw_pars[] = {
+    { "ERRORS", IDL_TYP_UNDEF, 1, IDL_KW_OUT | IDL_KW_ZERO,
+      IDL_KW_OFFSETOF(errors_present), IDL_KW_OFFSETOF(errors) },
+    { "FILL", IDL_TYP_UNDEF, 1, IDL_KW_VIN,
+      IDL_KW_OFFSETOF(fill_present), IDL_KW_OFFSETOF(fill) },
+    { "MISSING", IDL_TYP_UNDEF, 1, IDL_KW_VIN,
+      IDL_KW_OFFSETOF(missing_present), IDL_KW_OFFSETOF(missing) },
+    { "N_ERRORS", IDL_TYP_UNDEF, 1, IDL_KW_OUT | IDL_KW_ZERO,
+      IDL_KW_OFFSETOF(n_errors_present), IDL_KW_OFFSETOF(n_errors) },
+    { "TPOOL_MIN_ELTS", IDL_TYP_LONG, 1, IDL_KW_ZERO,
+      0, IDL_KW_OFFSETOF(tpool_min_elts) },
+    { "TPOOL_NTHREADS", IDL_TYP_LONG, 1, IDL_KW_ZERO,
+      0, IDL_KW_OFFSETOF(tpool_nthreads) },
+    { "TYPE", IDL_TYP_LONG, 1, 0,
+      IDL_KW_OFFSETOF(type_present), IDL_KW_OFFSETOF(type) },
+    { NULL }
+  };
+
+  KW_RESULT kw;
+  mg_strtonum_loop loop;
+  mg_wordtable missing;
+  IDL_VPTR result, errors_vptr;
+  IDL_STRING *tokens;
+  IDL_MEMINT n, i, n_tokens, n_invalid = 0;
+  IDL_ALLTYPES n_errors;
+  struct lconv *conv;
+  int nthreads, t, ok = 1;
+
+  int nargs = IDL_KWProcessByOffset(argc, argv, argk, kw_pars, (IDL_VPTR *) NULL, 1, &kw);
+
+  if (argv[0]->type != IDL_TYP_STRING) {
+    IDL_KW_FREE;
+    IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                "strings must be a string or string array");
+  }
+
+  memset(&loop, 0, sizeof(loop));
+  loop.type = kw.type_present ? kw.type : IDL_TYP_DOUBLE;
+  switch (loop.type) {
+    case IDL_TYP_BYTE: case IDL_TYP_INT: case IDL_TYP_LONG:
+    case IDL_TYP_FLOAT: case IDL_TYP_DOUBLE: case IDL_TYP_UINT:
+    case IDL_TYP_ULONG: case IDL_TYP_LONG64: case IDL_TYP_ULONG64:
+      break;
+    default:
+      IDL_KW_FREE;
+      IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                  "TYPE must be an integer, float or double type code");
+  }
+
+  // invalid elements are NaN for floating point types and 0 otherwise
+  loop.fill = NAN;
+  if (kw.fill_present && kw.fill->type != IDL_TYP_UNDEF) {
+    loop.fill = IDL_DoubleScalar(kw.fill);
+    loop.fill_integer = IDL_Long64Scalar(kw.fill);
+  }
+
+  memset(&missing, 0, sizeof(missing));
+  if (kw.missing_present && kw.missing->type == IDL_TYP_STRING) {
+    if (kw.missing->flags & IDL_V_ARR) {
+      tokens = (IDL_STRING *) kw.missing->value.arr->data;
+      n_tokens = kw.missing->value.arr->n_elts;
+    } else {
+      tokens = &kw.missing->value.str;
+      n_tokens = 1;
+    }
+    for (i = 0; ok && i < n_tokens; i++) {
+      ok = mg_wordtable_add(&missing, IDL_STRING_STR(&tokens[i]),
+                            tokens[i].slen, 0) >= 0;
+    }
+    loop.missing = &missing;
+  }
+
+  conv = localeconv();
+  if (conv && conv->decimal_point && strcmp(conv->decimal_point, ".") != 0) {
+    loop.locale_point = conv->decimal_point;
+  }
+
+  if (argv[0]->flags & IDL_V_ARR) {
+    loop.strings = (IDL_STRING *) argv[0]->value.arr->data;
+    n = argv[0]->value.arr->n_elts;
+    loop.result = (UCHAR *) IDL_MakeTempArray(loop.type,
+                                              argv[0]->value.arr->n_dim,
+                                              argv[0]->value.arr->dim,
+                                              IDL_ARR_INI_NOP, &result);
+    if (kw.errors_present) {
+      loop.errors = (UCHAR *) IDL_MakeTempArray(IDL_TYP_BYTE,
+                                                argv[0]->value.arr->n_dim,
+                                                argv[0]->value.arr->dim,
+                                                IDL_ARR_INI_NOP, &errors_vptr);
+    }
+  } else {
+    loop.strings = &argv[0]->value.str;
+    n = 1;
+    result = IDL_Gettmp();
+    result->type = loop.type;
+    loop.result = (UCHAR *) &result->value;
+    if (kw.errors_present) {
+      errors_vptr = IDL_GettmpByte(0);
+      loop.errors = &errors_vptr->value.c;
+    }
+  }
+
+  nthreads = mg_threads_count(n, kw.tpool_nthreads,
+                              kw.tpool_min_elts > 0 ? kw.tpool_min_elts : MG_STRINGS_MIN_ELTS);
+  loop.n_invalid = (IDL_MEMINT *) calloc(nthreads, sizeof(IDL_MEMINT));
+
+  if (!ok || !loop.n_invalid) {
+    mg_wordtable_free(&missing);
+    free(loop.n_invalid);
+    IDL_Deltmp(result);
+    if (kw.errors_present) IDL_Deltmp(errors_vptr);
+    IDL_KW_FREE;
+    IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                "unable to allocate memory for missing tokens");
+  }
+
+  mg_threads_for(n, nthreads, mg_strtonum_range, &loop);
+
+  for (t = 0; t < nthreads; t++) n_invalid += loop.n_invalid[t];
+
+  if (kw.errors_present) IDL_VarCopy(errors_vptr, kw.errors);
+  if (kw.n_errors_present) {
+    n_errors.l64 = n_invalid;
+    IDL_StoreScalar(kw.n_errors, IDL_TYP_LONG64, &n_errors);
+  }
+
+  mg_wordtable_free(&missing);
+  free(loop.n_invalid);
+
+  IDL_KW_FREE;
+
+  return result;
+}
+
+
+static IDL_VPTR IDL_CDECL IDL_mg_tre_config(int argc, IDL_VPTR *argv, char *argk) {
+  typedef struct {
+    IDL_KW_RESULT_FIRST_FIELD;
+    IDL_LONG approximate;
+    IDL_LONG multi_byte;
+    IDL_LONG system_regex;
+    IDL_LONG version;
+    IDL_LONG wide_character;
+  } KW_RESULT;
+
+  // make sure to list keyword in alphabetical order
+  static IDL_KW_PAR kw_pars[] = {
+    { "APPROXIMATE", IDL_TYP_LONG, 1, IDL_KW_ZERO | IDL_KW_VALUE | 1,
+      0, IDL_KW_OFFSETOF(approximate) },
+    { "MULTI_BYTE", IDL_TYP_LONG, 1, IDL_KW_ZERO | IDL_KW_VALUE | 1,
+      0, IDL_KW_OFFSETOF(multi_byte) },
+    { "SYSTEM_REGEX", IDL_TYP_LONG, 1, IDL_KW_ZERO | IDL_KW_VALUE | 1,
+      0, IDL_KW_OFFSETOF(system_regex) },
+    { "VERSION", IDL_TYP_LONG, 1, IDL_KW_ZERO | IDL_KW_VALUE | 1,
+      0, IDL_KW_OFFSETOF(version) },
+    { "WIDE_CHARACTER", IDL_TYP_LONG, 1, IDL_KW_ZERO | IDL_KW_VALUE | 1,
+      0, IDL_KW_OFFSETOF(wide_character) },
+    { NULL }
+  };
+
+  KW_RESULT kw;
+
+  int nargs = IDL_KWProcessByOffset(argc, argv, argk, kw_pars, (IDL_VPTR *) NULL, 1, &kw);
+  int nkeywords = kw.approximate + kw.multi_byte + kw.system_regex
+                    + kw.wide_character + kw.version;
+  if (nkeywords == 0 || nkeywords > 1) {
+    IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                "one keyword required to be set");
+  }
+
+  int status, query;
+  int result;
+  char *version;
+
+  if (kw.approximate) query = TRE_CONFIG_APPROX;
+  if (kw.multi_byte) query = TRE_CONFIG_MULTIBYTE;
+  if (kw.system_regex) query = TRE_CONFIG_SYSTEM_ABI;
+  if (kw.wide_character) query = TRE_CONFIG_WCHAR;
+
+  if (kw.version) {
+    status = tre_config(query, &version);
+    if (status) {
+      IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                  "invalid configuration request");
+    }
+    IDL_KW_FREE;
+    return IDL_StrToSTRING(version);
+  } else {
+    status = tre_config(query, &result);
+    if (status) {
+      IDL_Message(IDL_M_NAMED_GENERIC, IDL_MSG_LONGJMP,
+                  "invalid configuration request");
+    }
+    IDL_KW_FREE;
+    return IDL_GettmpLong(result);
+  }
+}
+
+
+static IDL_VPTR IDL_CDECL IDL_mg_tre_version(int argc, IDL_VPTR *argv) {
   return IDL_StrToSTRING(tre_version());
 }
 
 
 int IDL_Load(void) {
   static IDL_SYSFUN_DEF2 function_addr[] = {
-    { IDL_mg_tre_version, "MG_TRE_VERSION", 0, 0, 0, 0 },
-    { IDL_mg_tre_config,  "MG_TRE_CONFIG",  0, 0, IDL_SYSFUN_DEF_F_KEYWORDS, 0 },
-    { IDL_mg_stregex,     "MG_STREGEX",     2, 2, IDL_SYSFUN_DEF_F_KEYWORDS, 0 },
-    { IDL_mg_strsplit,    "MG_STRSPLIT",    2, 2, 0, 0 },
+    { IDL_mg_tre_version,   "MG_TRE_VERSION",   0, 0, 0, 0 },
+    { IDL_mg_tre_config,    "MG_TRE_CONFIG",    0, 0, IDL_SYSFUN_DEF_F_KEYWORDS, 0 },
+    { IDL_mg_stregex,       "MG_STREGEX",       2, 2, IDL_SYSFUN_DEF_F_KEYWORDS, 0 },
+    { IDL_mg_strsplit,      "MG_STRSPLIT",      1, 2, IDL_SYSFUN_DEF_F_KEYWORDS, 0 },
+    { IDL_mg_strjoin,       "MG_STRJOIN",       1, 2, 0, 0 },
+    { IDL_mg_strreplace,    "MG_STRREPLACE",    3, 3, IDL_SYSFUN_DEF_F_KEYWORDS, 0 },
+    { IDL_mg_strmatch_new,  "MG_STRMATCH_NEW",  1, 1, IDL_SYSFUN_DEF_F_KEYWORDS, 0 },
+    { IDL_mg_strmatch_any,  "MG_STRMATCH_ANY",  2, 2, IDL_SYSFUN_DEF_F_KEYWORDS, 0 },
+    { IDL_mg_spell_new,     "MG_SPELL_NEW",     0, 1, IDL_SYSFUN_DEF_F_KEYWORDS, 0 },
+    { IDL_mg_spell_correct, "MG_SPELL_CORRECT", 2, 2, IDL_SYSFUN_DEF_F_KEYWORDS, 0 },
+    { IDL_mg_spell_read,    "MG_SPELL_READ",    1, 1, 0, 0 },
+    { IDL_mg_spell_n_words, "MG_SPELL_N_WORDS", 1, 1, 0, 0 },
+    { IDL_mg_word_counts,   "MG_WORD_COUNTS",   1, 1, IDL_SYSFUN_DEF_F_KEYWORDS, 0 },
+    { IDL_mg_strfloat,      "MG_STRFLOAT",      1, 1, IDL_SYSFUN_DEF_F_KEYWORDS, 0 },
+    { IDL_mg_strtonum,      "MG_STRTONUM",      1, 1, IDL_SYSFUN_DEF_F_KEYWORDS, 0 },
+  };
+
+  static IDL_SYSFUN_DEF2 procedure_addr[] = {
+    { (IDL_SYSRTN_GENERIC) IDL_mg_strmatch_free, "MG_STRMATCH_FREE", 1, 1, 0, 0 },
+    { (IDL_SYSRTN_GENERIC) IDL_mg_spell_write,   "MG_SPELL_WRITE",   2, 2, 0, 0 },
+    { (IDL_SYSRTN_GENERIC) IDL_mg_spell_free,    "MG_SPELL_FREE",    1, 1, 0, 0 },
   };
 
-  return IDL_SysRtnAdd(function_addr, TRUE, IDL_CARRAY_ELTS(function_addr));
+  IDL_ExitRegister(mg_regex_cache_clear);
+
+  return IDL_SysRtnAdd(function_addr, TRUE, IDL_CARRAY_ELTS(function_addr))
+           && IDL_SysRtnAdd(procedure_addr, FALSE, IDL_CARRAY_ELTS(procedure_addr));
 }
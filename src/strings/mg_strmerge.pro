@@ -24,5 +24,8 @@
 function mg_strmerge, s, unix=unix, windows=windows
   compile_opt strictarr
 
-  return, strjoin(s, mg_newline(unix=unix, windows=windows))
+  newline = mg_newline(unix=unix, windows=windows)
+  if (mg_hasroutine('mg_strjoin')) then return, mg_strjoin(s, newline)
+
+  return, strjoin(s, newline)
 end
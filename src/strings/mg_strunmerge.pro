@@ -19,5 +19,11 @@
 function mg_strunmerge, s, unix=unix, windows=windows
   compile_opt strictarr
 
-  return, strsplit(s, mg_newline(unix=unix, windows=windows), /extract)
+  newline = mg_newline(unix=unix, windows=windows)
+  if (mg_hasroutine('mg_strsplit')) then begin
+    lines = mg_strsplit(s, newline, /extract, count=count)
+    return, count eq 0L ? '' : lines
+  endif
+
+  return, strsplit(s, newline, /extract)
 end
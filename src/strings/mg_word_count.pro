@@ -13,6 +13,15 @@
 function mg_word_count, words
   compile_opt strictarr
 
+  if (n_elements(words) eq 0L) then return, hash()
+
+  ; each element of words is a word when counted natively
+  if (mg_hasroutine('mg_word_counts')) then begin
+    !null = mg_word_counts(words, delimiters='', $
+                           vocabulary=vocabulary, total_counts=counts)
+    return, hash(vocabulary, counts)
+  endif
+
   h = hash()
   for t = 0L, n_elements(words) - 1L do begin
     if (h->haskey(words[t])) then begin
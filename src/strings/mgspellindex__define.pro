@@ -0,0 +1,153 @@
+; docformat = 'rst'
+
+;+
+; Native spelling correction index, using symmetric deletes (SymSpell) to
+; find the known words within a maximum edit distance of a word without
+; generating all the edits of the word.
+;
+; :Examples:
+;   Build an index from a text and correct a few words::
+;
+;     index = MGSpellIndex(corpus='big.txt')
+;     print, index->correct(['speling', 'korrect'], distance=distance)
+;     index->write, 'spell_index.bin'
+;     obj_destroy, index
+;
+;   Later, the index can be read back quickly::
+;
+;     index = MGSpellIndex(filename='spell_index.bin')
+;
+; :Properties:
+;   n_words : type=long64
+;     number of distinct words in the index
+;-
+
+
+;+
+; Correct the spelling of words.
+;
+; :Returns:
+;   string/`strarr` of the same dimensions as `words`, the empty string for
+;   words without a known word within the maximum distance
+;
+; :Params:
+;   words : in, required, type=string/strarr
+;     words to correct
+;
+; :Keywords:
+;   max_distance : in, optional, type=long
+;     maximum edit distance of a correction, no more than the maximum
+;     distance of the index
+;   distance : out, optional, type=long/lonarr
+;     set to a named variable to retrieve the edit distance to each
+;     correction, 0 for correctly spelled words and -1 for words without a
+;     correction
+;   found : out, optional, type=byte/bytarr
+;     set to a named variable to retrieve whether a correction was found
+;   counts : out, optional, type=long64/lon64arr
+;     set to a named variable to retrieve the frequency of each correction
+;   _extra : in, optional, type=keywords
+;     `TPOOL_NTHREADS` and `TPOOL_MIN_ELTS`
+;-
+function mgspellindex::correct, words, max_distance=max_distance, $
+                                distance=distance, found=found, $
+                                counts=counts, _extra=e
+  compile_opt strictarr
+  on_error, 2
+
+  return, mg_spell_correct(self.index, words, max_distance=max_distance, $
+                           distance=distance, found=found, counts=counts, $
+                           _extra=e)
+end
+
+
+;+
+; Write the index to a binary file, which can be read by creating an index
+; with the `FILENAME` keyword. The file uses the byte order of the machine
+; writing it.
+;
+; :Params:
+;   filename : in, required, type=string
+;     filename to write to
+;-
+pro mgspellindex::write, filename
+  compile_opt strictarr
+  on_error, 2
+
+  mg_spell_write, self.index, filename
+end
+
+
+;+
+; Get properties.
+;-
+pro mgspellindex::getProperty, n_words=n_words
+  compile_opt strictarr
+
+  if (arg_present(n_words)) then n_words = mg_spell_n_words(self.index)
+end
+
+
+;+
+; Free resources.
+;-
+pro mgspellindex::cleanup
+  compile_opt strictarr
+
+  if (self.index ne 0) then mg_spell_free, self.index
+end
+
+
+;+
+; Create a spelling index from a list of words, a text, or an index file.
+;
+; :Returns:
+;   1 for success, 0 for failure
+;
+; :Params:
+;   words : in, optional, type=strarr
+;     known words; repeated words add to the frequency of the word
+;
+; :Keywords:
+;   counts : in, optional, type=lon64arr
+;     frequency of each element of `words`, 1 for each by default
+;   corpus : in, optional, type=string
+;     filename of a text to add the words of; words are runs of letters and
+;     are converted to lowercase
+;   filename : in, optional, type=string
+;     filename of an index written by the `write` method
+;   max_distance : in, optional, type=long, default=2
+;     maximum edit distance of corrections, from 0 to 4; larger distances
+;     make the index larger
+;-
+function mgspellindex::init, words, counts=counts, corpus=corpus, $
+                             filename=filename, max_distance=max_distance
+  compile_opt strictarr
+  on_error, 2
+
+  if (n_elements(filename) gt 0L) then begin
+    self.index = mg_spell_read(filename)
+  endif else if (n_elements(words) gt 0L) then begin
+    self.index = mg_spell_new(words, counts=counts, corpus=corpus, $
+                              max_distance=max_distance)
+  endif else begin
+    self.index = mg_spell_new(counts=counts, corpus=corpus, $
+                              max_distance=max_distance)
+  endelse
+
+  return, 1
+end
+
+
+;+
+; Define instance variables.
+;
+; :Fields:
+;   index
+;     handle to the native index
+;-
+pro mgspellindex__define
+  compile_opt strictarr
+
+  define = { MGSpellIndex, index: 0LL }
+end
@@ -0,0 +1,138 @@
+; docformat = 'rst'
+
+;+
+; Matcher for a large, fixed set of literal patterns, such as a list of
+; keywords. The patterns are compiled once into an automaton which finds all
+; of them in a single pass over its input, so the time to scan does not grow
+; with the number of patterns like an alternation regular expression does.
+;
+; :Examples:
+;   Find the lines of a log file mentioning any of a list of keywords::
+;
+;     keywords = ['error', 'failed', 'timeout']
+;     matcher = MGStrMatcher(keywords, /fold_case)
+;     has_keyword = matcher->match(lines, counts=counts)
+;     print, lines[where(has_keyword, /null)]
+;     print, keywords + ': ' + strtrim(counts, 2)
+;     obj_destroy, matcher
+;
+; :Properties:
+;   n_patterns : type=long
+;     number of patterns
+;   fold_case : type=boolean
+;     whether matching is case-insensitive
+;-
+
+
+;+
+; Find the patterns in a string, string array, or files.
+;
+; :Returns:
+;   `bytarr` of the same dimensions as `input`, 1B for elements containing any
+;   of the patterns
+;
+; :Params:
+;   input : in, required, type=string/strarr
+;     strings to scan, or names of files to scan if `FILE` is set
+;
+; :Keywords:
+;   file : in, optional, type=boolean
+;     set to scan the whole contents of the files named by `input`
+;   count : out, optional, type=long64
+;     set to a named variable to retrieve the total number of matches
+;   counts : out, optional, type=lon64arr
+;     set to a named variable to retrieve the number of matches of each
+;     pattern
+;   matches : out, optional, type=lonarr
+;     set to a named variable to retrieve the index of the pattern of every
+;     match, -1L if there are no matches; overlapping matches are all found
+;   positions : out, optional, type=lon64arr
+;     set to a named variable to retrieve the byte offset of every match in
+;     its string or file, -1L if there are no matches
+;   offsets : out, optional, type=lon64arr
+;     set to a named variable to retrieve `n_elements(input) + 1` offsets; the
+;     matches of element `i` are `matches[offsets[i]:offsets[i + 1] - 1]`
+;   _extra : in, optional, type=keywords
+;     `TPOOL_NTHREADS` and `TPOOL_MIN_ELTS`
+;-
+function mgstrmatcher::match, input, file=file, count=count, counts=counts, $
+                              matches=matches, positions=positions, $
+                              offsets=offsets, _extra=e
+  compile_opt strictarr
+  on_error, 2
+
+  return, mg_strmatch_any(self.matcher, input, file=file, $
+                          count=count, counts=counts, matches=matches, $
+                          positions=positions, offsets=offsets, _extra=e)
+end
+
+
+;+
+; Get properties.
+;-
+pro mgstrmatcher::getProperty, n_patterns=n_patterns, fold_case=fold_case
+  compile_opt strictarr
+
+  if (arg_present(n_patterns)) then n_patterns = self.n_patterns
+  if (arg_present(fold_case)) then fold_case = self.fold_case
+end
+
+
+;+
+; Free resources.
+;-
+pro mgstrmatcher::cleanup
+  compile_opt strictarr
+
+  if (self.matcher ne 0) then mg_strmatch_free, self.matcher
+end
+
+
+;+
+; Create a matcher.
+;
+; :Returns:
+;   1 for success, 0 for failure
+;
+; :Params:
+;   patterns : in, required, type=strarr
+;     literal patterns to find; empty patterns never match
+;
+; :Keywords:
+;   fold_case : in, optional, type=boolean
+;     set to match patterns without regard to case
+;-
+function mgstrmatcher::init, patterns, fold_case=fold_case
+  compile_opt strictarr
+  on_error, 2
+
+  if (n_elements(patterns) eq 0) then message, 'patterns parameter required'
+
+  self.matcher = mg_strmatch_new(patterns, fold_case=fold_case)
+  self.n_patterns = n_elements(patterns)
+  self.fold_case = keyword_set(fold_case)
+
+  return, 1
+end
+
+
+;+
+; Define instance variables.
+;
+; :Fields:
+;   matcher
+;     handle to the native automaton
+;   n_patterns
+;     number of patterns
+;   fold_case
+;     whether matching is case-insensitive
+;-
+pro mgstrmatcher__define
+  compile_opt strictarr
+
+  define = { MGStrMatcher, $
+             matcher: 0LL, $
+             n_patterns: 0L, $
+             fold_case: 0B $
+           }
+end
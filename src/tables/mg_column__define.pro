@@ -7,10 +7,18 @@ function mg_column::to_html
 
   n_rows = n_elements(*self.data)
 
-  html = strarr(n_rows)
-  for r = 0L, n_rows - 1L do begin
-    html[r] = strtrim(string((*self.data)[r], format=self.format), 2)
-  endfor
+  ; floats with a single C format code are formatted natively in one call
+  native = (self.type eq 4 || self.type eq 5) $
+             && stregex(self.format, '^%[-+ 0#]*[0-9]*(\.[0-9]+)?[eEfFgG]$', /boolean) $
+             && mg_hasroutine('mg_strfloat')
+  if (native) then begin
+    html = strtrim(mg_strfloat(*self.data, format=self.format), 2)
+  endif else begin
+    html = strarr(n_rows)
+    for r = 0L, n_rows - 1L do begin
+      html[r] = strtrim(string((*self.data)[r], format=self.format), 2)
+    endfor
+  endelse
   html = '<td>' + html + '</td>'
 
   return, html
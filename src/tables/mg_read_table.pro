@@ -20,12 +20,36 @@ pro mg_read_table_read, data, lun, column_types
 
   n_rows = n_elements(data)
   n_columns = n_tags(data[0])
+  cells = strarr(n_columns, n_rows)
+  has_tokens = bytarr(n_rows)
   line = ''
   for r = 0L, n_rows - 1L do begin
     readf, lun, line
     tokens = strtrim(strsplit(line, ',', /extract, count=n_tokens), 2)
     if (n_tokens eq 0L) then continue
-    for c = 0L, n_columns - 1L do data[r].(c) = fix(tokens[c], type=column_types[c])
+    cells[*, r] = tokens[0:n_columns - 1L]
+    has_tokens[r] = 1B
+  endfor
+
+  rows = where(has_tokens, n_rows_with_tokens)
+  if (n_rows_with_tokens eq 0L) then return
+
+  ; convert each numeric column at once, leaving the cells the native parser
+  ; rejects, like "1.5" in an integer column, to FIX as before
+  native = mg_hasroutine('mg_strtonum')
+  for c = 0L, n_columns - 1L do begin
+    column = reform(cells[c, rows])
+    if (native && column_types[c] ne 7) then begin
+      values = mg_strtonum(column, type=column_types[c], missing='', fill=0, $
+                           errors=errors, n_errors=n_errors)
+      if (n_errors gt 0L) then begin
+        bad = where(errors eq 2B)
+        values[bad] = fix(column[bad], type=column_types[c])
+      endif
+      data[rows].(c) = values
+    endif else begin
+      data[rows].(c) = fix(column, type=column_types[c])
+    endelse
   endfor
 end
 
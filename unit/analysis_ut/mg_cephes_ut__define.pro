@@ -0,0 +1,144 @@
+; docformat = 'rst'
+
+function mg_cephes_ut::test_scalar
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_cephes'), 'MG_CEPHES DLM not found', /skip
+
+  result = mg_erf(0.5D)
+
+  assert, size(result, /type) eq 5, 'incorrect type'
+  assert, size(result, /n_dimensions) eq 0, 'result not scalar'
+  assert, abs(result - 0.5204998778130465D) lt 1e-15, 'incorrect result'
+
+  return, 1
+end
+
+
+function mg_cephes_ut::test_float
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_cephes'), 'MG_CEPHES DLM not found', /skip
+
+  result = mg_gamma(findgen(5) + 1.0)
+
+  assert, size(result, /type) eq 4, 'incorrect type'
+  assert, array_equal(result, [1.0, 1.0, 2.0, 6.0, 24.0]), 'incorrect result'
+
+  result = mg_gamma(findgen(5) + 1.0, /double)
+  assert, size(result, /type) eq 5, 'incorrect type with DOUBLE'
+
+  return, 1
+end
+
+
+function mg_cephes_ut::test_broadcast
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_cephes'), 'MG_CEPHES DLM not found', /skip
+
+  a = dindgen(3) + 1.0D
+  x = reform(0.5D * (dindgen(4) + 1.0D), 1, 4)
+
+  result = mg_igam(a, x)
+
+  assert, array_equal(size(result, /dimensions), [3, 4]), 'incorrect dimensions'
+  for i = 0L, 2L do begin
+    for j = 0L, 3L do begin
+      assert, result[i, j] eq mg_igam(a[i], x[0, j]), $
+              'incorrect result at [%d, %d]', i, j
+    endfor
+  endfor
+
+  return, 1
+end
+
+
+function mg_cephes_ut::test_batch
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_cephes'), 'MG_CEPHES DLM not found', /skip
+
+  ; arrays long enough for the batched kernels, with a partial last vector,
+  ; checked against long double references
+  x = [-7.5D, -3.0D, -1.0D, -0.25D, 0.0D, 0.5D, 1.0D, 2.5D, 4.0D, 9.0D]
+
+  erf_expected = [-1.0D, -0.99997790950300141D, -0.84270079294971487D, $
+                  -0.27632639016823693D, 0.0D, 0.52049987781304654D, $
+                  0.84270079294971487D, 0.99959304798255504D, $
+                  0.9999999845827421D, 1.0D]
+  assert, max(abs(mg_erf(x) - erf_expected)) le 1e-15, 'incorrect erf'
+
+  i0_expected = [268.16131151518936D, 4.8807925858650241D, $
+                 1.2660658777520083D, 1.0156861412236079D, 1.0D, $
+                 1.0634833707413235D, 1.2660658777520083D, $
+                 3.289839144050123D, 11.30192195213633D, 1093.5883545113747D]
+  assert, max(abs(mg_i0(x) - i0_expected) / i0_expected) le 1e-14, $
+          'incorrect i0'
+
+  j0_expected = [0.2663396578803784D, -0.26005195490193344D, $
+                 0.76519768655796655D, 0.9844359292958527D, 1.0D, $
+                 0.9384698072408129D, 0.76519768655796655D, $
+                 -0.048383776468197996D, -0.39714980986384737D, $
+                 -0.090333611182876134D]
+  assert, max(abs(mg_j0(x) - j0_expected)) le 1e-14, 'incorrect j0'
+
+  g = [0.5D, 1.5D, 4.5D, -1.5D, 10.0D, 2.25D, 7.0D, -0.5D, 3.0D]
+  gamma_expected = [1.772453850905516D, 0.88622692545275801D, $
+                    11.631728396567449D, 2.3632718012073547D, 362880.0D, $
+                    1.1330030963193463D, 720.0D, -3.5449077018110321D, 2.0D]
+  assert, max(abs(mg_gamma(g) - gamma_expected) / abs(gamma_expected)) le 1e-14, $
+          'incorrect gamma'
+
+  return, 1
+end
+
+
+function mg_cephes_ut::test_incompatible
+  compile_opt strictarr
+  @error_is_pass
+
+  assert, self->have_dlm('mg_cephes'), 'MG_CEPHES DLM not found', /skip
+
+  result = mg_beta(findgen(3) + 1.0, findgen(4) + 1.0)
+
+  return, 0
+end
+
+
+function mg_cephes_ut::test_threads
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_cephes'), 'MG_CEPHES DLM not found', /skip
+
+  x = 6.0D * dindgen(1000000L) / 1000000.0D - 3.0D
+
+  serial = mg_ndtr(x, tpool_nthreads=1)
+  parallel = mg_ndtr(x, tpool_nthreads=4, tpool_min_elts=1000)
+
+  assert, array_equal(serial, parallel), 'threaded result differs'
+
+  return, 1
+end
+
+
+function mg_cephes_ut::test_procedure
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_cephes'), 'MG_CEPHES DLM not found', /skip
+
+  mg_sici, [1.0D, 2.0D], si, ci
+
+  assert, n_elements(si) eq 2 && n_elements(ci) eq 2, 'incorrect number of elements'
+  assert, abs(si[0] - 0.946083070367183D) lt 1e-12, 'incorrect sine integral'
+  assert, abs(ci[0] - 0.337403922900968D) lt 1e-12, 'incorrect cosine integral'
+
+  return, 1
+end
+
+
+pro mg_cephes_ut__define
+  compile_opt strictarr
+
+  define = { mg_cephes_ut, inherits MGutLibTestCase }
+end
@@ -0,0 +1,128 @@
+; docformat = 'rst'
+
+function mg_interval_ut::test_union
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_stats'), 'MG_STATS DLM not found', /skip
+
+  a = [[5, 10], [0, 2], [1, 3], [12, 13], [3, 4], [8, 7]]
+  result = mg_interval_union(a, count=count)
+
+  assert, count eq 3, 'incorrect count: %d', count
+  assert, array_equal(result, [[0, 4], [5, 10], [12, 13]]), 'incorrect result'
+
+  result = mg_interval_union(a, [[2.5, 6], [9, 12.5]], count=count)
+  assert, count eq 1, 'incorrect count with B: %d', count
+  assert, array_equal(result, [0, 13]), 'incorrect result with B'
+
+  return, 1
+end
+
+
+function mg_interval_ut::test_intersect
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_stats'), 'MG_STATS DLM not found', /skip
+
+  a = [[0, 4], [5, 10], [12, 13]]
+  b = [[2.5, 6], [9, 12.5]]
+  result = mg_interval_intersect(a, b, count=count)
+
+  assert, count eq 4, 'incorrect count: %d', count
+  assert, array_equal(result, [[2.5, 4], [5, 6], [9, 10], [12, 12.5]]), $
+          'incorrect result'
+
+  result = mg_interval_intersect([0, 1], [2, 3], count=count)
+  assert, count eq 0 && result eq -1L, 'incorrect empty result'
+
+  return, 1
+end
+
+
+function mg_interval_ut::test_difference
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_stats'), 'MG_STATS DLM not found', /skip
+
+  a = [[0, 4], [5, 10], [12, 13]]
+  b = [[2.5, 6], [9, 12.5]]
+  result = mg_interval_difference(a, b, count=count)
+
+  assert, count eq 3, 'incorrect count: %d', count
+  assert, array_equal(result, [[0, 2.5], [6, 9], [12.5, 13]]), $
+          'incorrect result'
+
+  return, 1
+end
+
+
+function mg_interval_ut::test_coverage
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_stats'), 'MG_STATS DLM not found', /skip
+
+  result = mg_interval_coverage([[0, 2], [1, 3], [5, 10]])
+  assert, result eq 8.0D, 'incorrect result: %f', result
+
+  return, 1
+end
+
+
+function mg_interval_ut::test_stab
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_stats'), 'MG_STATS DLM not found', /skip
+
+  a = [[0, 10], [5, 15], [20, 30]]
+  result = mg_interval_stab(a, [-1, 0, 7, 15, 17, 25])
+
+  assert, array_equal(result, [0, 1, 2, 1, 0, 1]), 'incorrect result'
+
+  return, 1
+end
+
+
+function mg_interval_ut::test_tree
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_stats'), 'MG_STATS DLM not found', /skip
+
+  n = 10000L
+  starts = 1000.0D * randomu(0L, n, /double)
+  intervals = transpose([[starts], [starts + 20.0D * randomu(1L, n, /double)]])
+
+  tree = MGIntervalTree(intervals)
+  tree->getProperty, count=count
+  assert, count eq n, 'incorrect number of intervals: %d', count
+
+  points = [-1.0D, 250.0D, 500.0D, 999.0D]
+  hits = tree->stab(points, offsets=offsets, count=n_hits)
+  assert, n_hits eq offsets[n_elements(points)], 'incorrect offsets'
+
+  for p = 0L, n_elements(points) - 1L do begin
+    ind = where(intervals[0, *] le points[p] and intervals[1, *] ge points[p], n_found)
+    assert, offsets[p + 1] - offsets[p] eq n_found, $
+            'incorrect number of hits for point %d', p
+    if (n_found gt 0L) then begin
+      found = hits[offsets[p]:offsets[p + 1] - 1L]
+      assert, array_equal(found[sort(found)], ind), $
+              'incorrect hits for point %d', p
+    endif
+  endfor
+
+  hits = tree->overlaps([[100.0D, 110.0D], [2000.0D, 3000.0D]], offsets=offsets)
+  ind = where(intervals[0, *] le 110.0D and intervals[1, *] ge 100.0D, n_found)
+  assert, offsets[1] eq n_found, 'incorrect number of overlaps'
+  assert, offsets[2] eq offsets[1], 'incorrect number of overlaps out of range'
+
+  obj_destroy, tree
+
+  return, 1
+end
+
+
+pro mg_interval_ut__define
+  compile_opt strictarr
+
+  define = { mg_interval_ut, inherits MGutLibTestCase }
+end
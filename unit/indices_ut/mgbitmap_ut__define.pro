@@ -0,0 +1,154 @@
+; docformat = 'rst'
+
+function mgbitmap_ut::test_mask
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_indices'), 'MG_INDICES DLM not found', /skip
+
+  x = randomu(0L, 300000L)
+  mask = x gt 0.3 and x lt 0.31
+  b = MGBitmap(mask=mask)
+
+  ind = b->indices(count=count)
+  standard = where(mask, n_standard)
+  assert, count eq n_standard, 'incorrect count: %d', count
+  assert, array_equal(ind, standard), 'incorrect indices'
+  assert, array_equal(b->mask(mask), mask), 'incorrect mask'
+
+  b->getProperty, cardinality=cardinality
+  assert, cardinality eq n_standard, 'incorrect cardinality: %d', cardinality
+
+  obj_destroy, b
+
+  return, 1
+end
+
+
+function mgbitmap_ut::test_ops
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_indices'), 'MG_INDICES DLM not found', /skip
+
+  n = 1000000L
+  x = randomu(1L, n)
+  mask1 = x lt 0.6
+  mask2 = x gt 0.4 or (lindgen(n) mod 1000L) eq 0L
+
+  b1 = MGBitmap(mask=mask1)
+  b2 = MGBitmap(mask=mask2)
+
+  b = b1 and b2
+  assert, array_equal(b->mask(n), mask1 and mask2), 'incorrect AND'
+  obj_destroy, b
+
+  b = b1 or b2
+  assert, array_equal(b->mask(n), mask1 or mask2), 'incorrect OR'
+  obj_destroy, b
+
+  b = b1 - b2
+  assert, array_equal(b->mask(n), mask1 and ~mask2), 'incorrect ANDNOT'
+  obj_destroy, b
+
+  b = b1 xor b2
+  assert, array_equal(b->mask(n), mask1 xor mask2), 'incorrect XOR'
+  obj_destroy, b
+
+  b = b1->complement(n)
+  assert, array_equal(b->mask(n), ~mask1), 'incorrect complement'
+  obj_destroy, b
+
+  obj_destroy, [b1, b2]
+
+  return, 1
+end
+
+
+function mgbitmap_ut::test_indices
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_indices'), 'MG_INDICES DLM not found', /skip
+
+  b = MGBitmap(indices=[70000L, 5L, 3L, 5L, -1L, 4000000000LL])
+
+  ind = b->indices(count=count)
+  assert, count eq 4, 'incorrect count: %d', count
+  assert, size(ind, /type) eq 14, 'incorrect type'
+  assert, array_equal(ind, [3LL, 5LL, 70000LL, 4000000000LL]), 'incorrect indices'
+  assert, array_equal(b->contains([3, 4, 70000]), [1B, 0B, 1B]), $
+          'incorrect contains'
+
+  values = b->next(6, 10, count=count)
+  assert, count eq 2, 'incorrect number of next values: %d', count
+  assert, array_equal(values, [70000LL, 4000000000LL]), 'incorrect next values'
+
+  i = 0L
+  foreach v, b do begin
+    assert, v eq ind[i++], 'incorrect value in iteration'
+  endforeach
+  assert, i eq 4, 'incorrect number of iterations'
+
+  obj_destroy, b
+
+  b = MGBitmap(indices=-1L)
+  assert, ~b, 'bitmap not empty'
+  assert, b->indices(count=count) eq -1L && count eq 0, 'incorrect empty result'
+  obj_destroy, b
+
+  return, 1
+end
+
+
+function mgbitmap_ut::test_range
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_indices'), 'MG_INDICES DLM not found', /skip
+
+  b = MGBitmap(range=[10, 200000])
+  b->getProperty, cardinality=cardinality, n_bytes=n_bytes
+  assert, cardinality eq 199991, 'incorrect cardinality: %d', cardinality
+  assert, n_bytes lt 40000, 'range not compressed: %d bytes', n_bytes
+
+  ind = b->indices()
+  assert, array_equal(ind, lindgen(199991) + 10L), 'incorrect indices'
+
+  obj_destroy, b
+
+  return, 1
+end
+
+
+function mgbitmap_ut::test_foreach
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_indices'), 'MG_INDICES DLM not found', /skip
+
+  ; bitset containers, iterated across several blocks
+  b = MGBitmap(range=[10, 200000])
+  i = 0L
+  foreach v, b do begin
+    if (v ne i + 10L) then break
+    i++
+  endforeach
+  assert, i eq 199991, 'incorrect iteration over range at %d', i
+  obj_destroy, b
+
+  ; array containers, with a block ending inside a container
+  ind = [lindgen(3000) + 65000L, 5LL * lindgen(2000) + 300000LL]
+  b = MGBitmap(indices=ind)
+  i = 0L
+  foreach v, b do begin
+    if (v ne ind[i]) then break
+    i++
+  endforeach
+  assert, i eq n_elements(ind), 'incorrect iteration over indices at %d', i
+  obj_destroy, b
+
+  return, 1
+end
+
+
+pro mgbitmap_ut__define
+  compile_opt strictarr
+
+  define = { mgbitmap_ut, inherits MGutLibTestCase }
+end
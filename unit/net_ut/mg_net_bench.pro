@@ -0,0 +1,380 @@
+; docformat = 'rst'
+
+;+
+; Loopback latency and throughput benchmark of the `MG_NET` DLM.
+;
+; An echo server runs in a child IDL process started with `IDL_IDLBridge`, so
+; both ends of each transfer go through IDL and the DLM. For each path and
+; message size, the client times round trips of a `BYTE` array:
+;
+;   - send: `MG_NET_SEND` and `MG_NET_RECV` on a TCP socket
+;   - sendvar: `MG_NET_SENDVAR` and `MG_NET_RECVVAR` on a TCP socket
+;   - udp: `MG_NET_SENDTO` and `MG_NET_RECV` of a single datagram, for the
+;     sizes that fit in one
+;
+; The results hold the p50 and p99 round trip latencies and the throughput in
+; GB/s, twice the message size over the p50 latency, in the same form as the
+; `mg_net_bench` program built with the DLM, which times the same transfers in
+; C without IDL. Writing both to JSON files gives results to compare between
+; builds and against the system's own loopback speed::
+;
+;   IDL> mg_net_bench, filename='mg_net_bench.json'
+;   $ mg_net_bench -f json > mg_net_bench_c.json
+;-
+
+
+;= helper routines
+
+;+
+; Creates the sockets of the echo server, in the child process.
+;
+; :Private:
+;
+; :Params:
+;   listener : out, required, type=long
+;     TCP listener
+;   udp : out, required, type=long
+;     UDP socket
+;   port : out, required, type=long
+;     port of `listener`
+;   udp_port : out, required, type=long
+;     port of `udp`
+;-
+pro mg_net_bench_listen, listener, udp, port, udp_port
+  compile_opt strictarr
+
+  listener = mg_net_createport(0L, /tcp)
+  err = mg_net_query(listener, local_port=port)
+  udp = mg_net_createport(0L, /udp, buffer=4L * 1024L * 1024L)
+  err = mg_net_query(udp, local_port=udp_port)
+end
+
+
+;+
+; Reads exactly `n_bytes` bytes from a TCP socket with `MG_NET_RECV`.
+;
+; :Private:
+;
+; :Returns:
+;   1 if all the bytes arrived, 0 if not
+;
+; :Params:
+;   socket : in, required, type=long
+;     TCP socket
+;   buffer : in, out, required, type=bytarr
+;     array of at least `n_bytes` bytes to read into
+;   n_bytes : in, required, type=long64
+;     number of bytes to read
+;-
+function mg_net_bench_recv, socket, buffer, n_bytes
+  compile_opt strictarr
+
+  pos = 0LL
+  while (pos lt n_bytes) do begin
+    ready = mg_net_select(socket, 5.0)
+    if (size(ready, /n_dimensions) eq 0L) then return, 0
+
+    remaining = n_bytes - pos
+    n = mg_net_recv(socket, chunk, maximum_bytes=remaining < 2147483647LL)
+    if (n le 0L) then return, 0
+    buffer[pos] = chunk
+    pos += n
+  endwhile
+
+  return, 1
+end
+
+
+;+
+; Echoes messages until told to stop, in the child process.
+;
+; The client sends each command as a `LONG64` array `[path, bytes, repeats,
+; udp_port]` with `MG_NET_SENDVAR`, then makes `repeats` round trips on
+; `path`; path 0 stops the server.
+;
+; :Private:
+;
+; :Params:
+;   listener : in, required, type=long
+;     TCP listener created by `mg_net_bench_listen`
+;   udp : in, required, type=long
+;     UDP socket created by `mg_net_bench_listen`
+;-
+pro mg_net_bench_serve, listener, udp
+  compile_opt strictarr
+
+  if (size(mg_net_select(listener, 30.0), /n_dimensions) eq 0L) then return
+  socket = mg_net_accept(listener, /nodelay)
+  host = mg_net_name2host('127.0.0.1')
+
+  while (1B) do begin
+    if (mg_net_recvvar(socket, command) ne 1L) then break
+    if (command[0] eq 0LL) then break
+
+    n_bytes = command[1]
+    case command[0] of
+      1: begin
+          buffer = bytarr(n_bytes, /nozero)
+          for r = 0L, command[2] - 1L do begin
+            if (~mg_net_bench_recv(socket, buffer, n_bytes)) then break
+            if (mg_net_send(socket, buffer) ne n_bytes) then break
+          endfor
+        end
+      2: begin
+          for r = 0L, command[2] - 1L do begin
+            if (mg_net_recvvar(socket, data) ne 1L) then break
+            if (mg_net_sendvar(socket, data) ne 1L) then break
+          endfor
+        end
+      3: begin
+          for r = 0L, command[2] - 1L do begin
+            if (size(mg_net_select(udp, 1.0), /n_dimensions) eq 0L) then continue
+            if (mg_net_recv(udp, data) le 0L) then continue
+            err = mg_net_sendto(udp, data, host, command[3])
+          endfor
+        end
+    endcase
+  endwhile
+
+  err = mg_net_close(socket)
+  err = mg_net_close(udp)
+  err = mg_net_close(listener)
+end
+
+
+;+
+; Times round trips of messages of one size on one path.
+;
+; :Private:
+;
+; :Returns:
+;   `DOUBLE` array of round trip times in microseconds, one per round trip
+;   that completed, or -1.0D if the transfers failed
+;
+; :Params:
+;   path : in, required, type=long
+;     1 for send, 2 for sendvar, 3 for udp
+;   socket : in, required, type=long
+;     TCP socket connected to the server
+;   udp : in, required, type=long
+;     UDP socket of the client
+;   server_udp_port : in, required, type=long
+;     port of the UDP socket of the server
+;   n_bytes : in, required, type=long64
+;     size of the messages
+;   repeats : in, required, type=long
+;     number of round trips to time, after one to warm up
+;
+; :Keywords:
+;   lost : out, optional, type=long
+;     number of datagrams that did not come back
+;   no_checksum : in, optional, type=boolean
+;     set to send variables without checksums
+;-
+function mg_net_bench_measure, path, socket, udp, server_udp_port, $
+                               n_bytes, repeats, $
+                               lost=lost, no_checksum=no_checksum
+  compile_opt strictarr
+
+  lost = 0L
+  host = mg_net_name2host('127.0.0.1')
+  err = mg_net_query(udp, local_port=udp_port)
+
+  command = [long64(path), n_bytes, repeats + 1LL, long64(udp_port)]
+  if (mg_net_sendvar(socket, command) ne 1L) then return, -1.0D
+
+  data = bindgen(n_bytes)
+  if (path eq 1L) then buffer = bytarr(n_bytes, /nozero)
+
+  times = dblarr(repeats)
+  n_times = 0L
+  for r = 0L, repeats do begin
+    start = systime(/seconds)
+    case path of
+      1: begin
+          if (mg_net_send(socket, data) ne n_bytes) then return, -1.0D
+          if (~mg_net_bench_recv(socket, buffer, n_bytes)) then return, -1.0D
+        end
+      2: begin
+          if (mg_net_sendvar(socket, data, no_checksum=no_checksum) ne 1L) then return, -1.0D
+          if (mg_net_recvvar(socket, result) ne 1L) then return, -1.0D
+        end
+      3: begin
+          err = mg_net_sendto(udp, data, host, server_udp_port)
+          if (size(mg_net_select(udp, 1.0), /n_dimensions) eq 0L $
+                || mg_net_recv(udp, result) ne n_bytes) then begin
+            lost++
+            continue
+          endif
+        end
+    endcase
+
+    ; the first round trip warms up the buffers and is not counted
+    if (r gt 0L) then begin
+      times[n_times] = 1.0D6 * (systime(/seconds) - start)
+      n_times++
+    endif
+  endfor
+
+  case path of
+    1: ok = array_equal(buffer, data)
+    2: ok = array_equal(result, data)
+    3: ok = 1B
+  endcase
+  if (~ok) then return, -1.0D
+
+  return, n_times eq 0L ? -1.0D : times[0:n_times - 1L]
+end
+
+
+;+
+; Converts benchmark results to JSON, in the form written by the
+; `mg_net_bench` program.
+;
+; :Private:
+;
+; :Returns:
+;   string
+;
+; :Params:
+;   results : in, required, type=structure array
+;     results of `mg_net_bench`
+;-
+function mg_net_bench_json, results
+  compile_opt strictarr
+
+  lines = strarr(n_elements(results))
+  for r = 0L, n_elements(results) - 1L do begin
+    lines[r] = string(results[r].driver, results[r].path, results[r].bytes, $
+                      results[r].repeats, results[r].lost, $
+                      results[r].p50_us, results[r].p99_us, results[r].gbps, $
+                      format='(%"  {\"driver\": \"%s\", \"path\": \"%s\", \"bytes\": %d, \"repeats\": %d, \"lost\": %d, \"p50_us\": %0.3f, \"p99_us\": %0.3f, \"gbps\": %0.6f}")')
+  endfor
+
+  return, '[' + string(10B) + strjoin(lines, ',' + string(10B)) + string(10B) + ']'
+end
+
+
+;= main routine
+
+;+
+; Runs the benchmark and prints a table of the results.
+;
+; :Keywords:
+;   paths : in, optional, type=strarr, default="['send', 'sendvar', 'udp']"
+;     paths to benchmark
+;   min_bytes : in, optional, type=long64, default=8
+;     smallest message size
+;   max_bytes : in, optional, type=long64, default=1 GB
+;     largest message size; sizes go from `MIN_BYTES` to `MAX_BYTES` by
+;     factors of 8
+;   repeats : in, optional, type=long, default=1000
+;     number of round trips at each size
+;   budget : in, optional, type=long64, default=1 GB
+;     most bytes to send at each size, fewer round trips are made for large
+;     messages, but never fewer than 5
+;   no_checksum : in, optional, type=boolean
+;     set to send variables without checksums
+;   filename : in, optional, type=string
+;     filename to write the results to as JSON
+;   json : out, optional, type=string
+;     set to a named variable to retrieve the results as JSON
+;   results : out, optional, type=structure array
+;     set to a named variable to retrieve the results as an array of
+;     structures with fields `driver`, `path`, `bytes`, `repeats`, `lost`,
+;     `p50_us`, `p99_us`, and `gbps`
+;-
+pro mg_net_bench, paths=paths, $
+                  min_bytes=min_bytes, max_bytes=max_bytes, $
+                  repeats=repeats, budget=budget, no_checksum=no_checksum, $
+                  filename=filename, json=json, results=results
+  compile_opt strictarr
+
+  path_names = ['send', 'sendvar', 'udp']
+  _paths = n_elements(paths) gt 0L ? strlowcase(paths) : path_names
+  _min_bytes = n_elements(min_bytes) gt 0L ? long64(min_bytes) : 8LL
+  _max_bytes = n_elements(max_bytes) gt 0L ? long64(max_bytes) : 1073741824LL
+  _repeats = n_elements(repeats) gt 0L ? long(repeats) : 1000L
+  _budget = n_elements(budget) gt 0L ? long64(budget) : 1073741824LL
+  max_datagram = 65507LL
+
+  ; start the echo server in a child process
+  bridge = obj_new('IDL_IDLBridge')
+  bridge->setVar, 'path', !path
+  bridge->execute, '!path = path'
+  bridge->execute, 'resolve_routine, ''mg_net_bench'''
+  bridge->execute, 'mg_net_bench_listen, listener, udp, port, udp_port'
+  port = bridge->getVar('port')
+  server_udp_port = bridge->getVar('udp_port')
+  bridge->execute, 'mg_net_bench_serve, listener, udp', /nowait
+
+  socket = mg_net_connect(mg_net_name2host('127.0.0.1'), port, /nodelay)
+  udp = mg_net_createport(0L, /udp, buffer=4L * 1024L * 1024L)
+  if (socket lt 0L || udp lt 0L) then begin
+    obj_destroy, bridge
+    message, 'unable to connect to echo server'
+  endif
+
+  result = { driver: 'idl', path: '', bytes: 0LL, repeats: 0L, lost: 0L, $
+             p50_us: 0.0D, p99_us: 0.0D, gbps: 0.0D }
+  results_list = list()
+
+  print, 'path', 'bytes', 'repeats', 'lost', 'p50_us', 'p99_us', 'gbps', $
+         format='(%"%-8s %12s %8s %6s %12s %12s %10s")'
+  for p = 0L, n_elements(path_names) - 1L do begin
+    if (total(_paths eq path_names[p], /integer) eq 0L) then continue
+
+    n_bytes = _min_bytes
+    while (n_bytes le _max_bytes) do begin
+      if (path_names[p] eq 'udp' && n_bytes gt max_datagram) then break
+
+      n = (_budget / n_bytes) < _repeats > 5L
+      times = mg_net_bench_measure(p + 1L, socket, udp, server_udp_port, $
+                                   n_bytes, n, $
+                                   lost=lost, no_checksum=no_checksum)
+      if (times[0] lt 0.0D) then begin
+        message, string(path_names[p], n_bytes, $
+                        format='(%"%s failed for %d bytes")'), /informational
+        break
+      endif
+
+      times = times[sort(times)]
+      n_times = n_elements(times)
+      result.path = path_names[p]
+      result.bytes = n_bytes
+      result.repeats = n_times
+      result.lost = lost
+      result.p50_us = times[(n_times - 1L) / 2L]
+      result.p99_us = times[ceil(0.99D * n_times) - 1L]
+      result.gbps = 2.0D * n_bytes / result.p50_us * 1.0D-3
+      results_list->add, result
+
+      print, result.path, result.bytes, result.repeats, result.lost, $
+             result.p50_us, result.p99_us, result.gbps, $
+             format='(%"%-8s %12d %8d %6d %12.2f %12.2f %10.4f")'
+
+      n_bytes *= 8LL
+    endwhile
+  endfor
+
+  ; stop the server
+  err = mg_net_sendvar(socket, [0LL, 0LL, 0LL, 0LL])
+  err = mg_net_close(socket)
+  err = mg_net_close(udp)
+  while (bridge->status() eq 1) do wait, 0.1
+  obj_destroy, bridge
+
+  if (results_list->count() eq 0L) then begin
+    obj_destroy, results_list
+    message, 'no results'
+  endif
+  results = results_list->toArray()
+  obj_destroy, results_list
+
+  json = mg_net_bench_json(results)
+  if (n_elements(filename) gt 0L) then begin
+    openw, lun, filename, /get_lun
+    printf, lun, json
+    free_lun, lun
+  endif
+end
@@ -0,0 +1,401 @@
+; docformat = 'rst'
+
+function mg_net_ut::_connect, listener=listener, client=client, server=server
+  compile_opt strictarr
+
+  listener = mg_net_createport(0L, /tcp)
+  err = mg_net_query(listener, local_port=port)
+  client = mg_net_connect(mg_net_name2host('127.0.0.1'), port)
+  server = mg_net_accept(listener)
+
+  return, listener ge 0L && client ge 0L && server ge 0L
+end
+
+
+function mg_net_ut::test_poll
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_net'), 'MG_NET DLM not found', /skip
+  assert, self->_connect(listener=listener, client=client, server=server), $
+          'unable to connect'
+
+  ready = mg_net_poll([listener, server], 0.0005, count=count)
+  assert, count eq 0L && ready eq 0L, 'incorrect ready sockets'
+
+  err = mg_net_sendvar(client, 'hello')
+  ready = mg_net_poll(1.0, count=count, events=events)
+  assert, count eq 1L && ready[0] eq server, 'incorrect ready socket'
+  assert, events[0] eq 1L, 'incorrect events: %d', events[0]
+
+  ready = mg_net_poll(client, 1.0, /write, count=count, events=events)
+  ind = where(ready eq client, n_client)
+  assert, n_client eq 1L && (events[ind[0]] and 2L) ne 0L, $
+          'client not ready to write'
+
+  ready = mg_net_poll(client, 0.0, /remove, count=count)
+  assert, count eq 1L && ready[0] eq server, 'incorrect ready socket after remove'
+
+  err = mg_net_close(client)
+  ready = mg_net_poll(0.5, count=count, events=events)
+  assert, count eq 1L && (events[0] and 8L) ne 0L, 'hangup not reported'
+
+  err = mg_net_close(server)
+  err = mg_net_close(listener)
+
+  return, 1
+end
+
+
+function mg_net_ut::test_many
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_net'), 'MG_NET DLM not found', /skip
+
+  n = 300L
+  listener = mg_net_createport(0L, /tcp)
+  err = mg_net_query(listener, local_port=port)
+  host = mg_net_name2host('127.0.0.1')
+  clients = lonarr(n)
+  servers = lonarr(n)
+  for i = 0L, n - 1L do begin
+    clients[i] = mg_net_connect(host, port)
+    servers[i] = mg_net_accept(listener)
+  endfor
+  assert, min([clients, servers]) ge 0L, 'unable to create sockets'
+
+  ready = mg_net_select(servers, 0.0)
+  assert, ready eq 0L, 'incorrect ready sockets with select'
+
+  for i = 0L, n - 1L do err = mg_net_close(clients[i])
+  for i = 0L, n - 1L do err = mg_net_close(servers[i])
+  err = mg_net_close(listener)
+
+  return, 1
+end
+
+
+function mg_net_ut::test_sendvar
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_net'), 'MG_NET DLM not found', /skip
+  assert, self->_connect(listener=listener, client=client, server=server), $
+          'unable to connect'
+
+  data = findgen(100, 3)
+  names = [['alpha', ''], ['gamma delta', 'z']]
+  records = replicate({ id: 0L, position: dblarr(2), flag: 0B }, 3)
+  records.id = [10L, 11L, 12L]
+  records[1].position = [1.25D, -1.0D]
+
+  assert, mg_net_sendvar(client, data, /more) eq 1, 'unable to send array'
+  assert, mg_net_sendvar(client, names, /more) eq 1, 'unable to send strings'
+  assert, mg_net_sendvar(client, records) eq 1, 'unable to send structure'
+
+  assert, mg_net_recvvar(server, result) eq 1, 'unable to receive array'
+  assert, array_equal(result, data), 'incorrect array'
+  assert, array_equal(size(result, /dimensions), [100, 3]), $
+          'incorrect array dimensions'
+
+  assert, mg_net_recvvar(server, result) eq 1, 'unable to receive strings'
+  assert, array_equal(result, names), 'incorrect strings'
+  assert, array_equal(size(result, /dimensions), [2, 2]), $
+          'incorrect string dimensions'
+
+  assert, mg_net_recvvar(server, result) eq 1, 'unable to receive structure'
+  assert, n_elements(result) eq 3, 'incorrect number of structures'
+  assert, array_equal(tag_names(result), ['ID', 'POSITION', 'FLAG']), $
+          'incorrect tag names'
+  assert, array_equal(result.id, records.id), 'incorrect tag values'
+  assert, array_equal(result[1].position, records[1].position), $
+          'incorrect array tag values'
+
+  err = mg_net_close(client)
+  err = mg_net_close(server)
+  err = mg_net_close(listener)
+
+  return, 1
+end
+
+
+function mg_net_ut::test_sendvar_chunks
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_net'), 'MG_NET DLM not found', /skip
+  assert, self->_connect(listener=listener, client=client, server=server), $
+          'unable to connect'
+
+  data = dindgen(1000, 2)
+  assert, mg_net_sendvar(client, data, chunk_size=1000, transfer_id=id) eq 1, $
+          'unable to send in chunks'
+  assert, mg_net_recvvar(server, result, received=received, $
+                         transfer_id=received_id) eq 1, $
+          'unable to receive chunks'
+  assert, array_equal(result, data), 'incorrect chunked array'
+  assert, received eq 16000LL, 'incorrect number of bytes received: %d', received
+  assert, received_id eq id, 'incorrect transfer id'
+
+  ; older versions of MG_NET_RECVVAR read version 1 headers
+  assert, mg_net_sendvar(client, data, version=1) eq 1, $
+          'unable to send version 1 header'
+  assert, mg_net_recvvar(server, result) eq 1, $
+          'unable to receive version 1 header'
+  assert, array_equal(result, data), 'incorrect version 1 array'
+
+  err = mg_net_close(client)
+  err = mg_net_close(server)
+  err = mg_net_close(listener)
+
+  return, 1
+end
+
+
+function mg_net_ut::test_recvvar_into
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_net'), 'MG_NET DLM not found', /skip
+  assert, self->_connect(listener=listener, client=client, server=server), $
+          'unable to connect'
+
+  frame = bytarr(64, 48)
+  result = bytarr(64, 48)
+  for f = 0, 3 do begin
+    frame[0] = f
+    assert, mg_net_sendvar(client, frame) eq 1, 'unable to send frame %d', f
+    assert, mg_net_recvvar(server, result, /into) eq 1, $
+            'unable to receive frame %d', f
+    assert, result[0] eq f, 'incorrect frame %d', f
+  endfor
+
+  ; frames received into the ring
+  assert, mg_net_recvring(2, 64 * 48) eq 1, 'unable to create ring'
+  for f = 0, 3 do begin
+    frame[0] = f
+    assert, mg_net_sendvar(client, frame) eq 1, 'unable to send frame %d', f
+    assert, mg_net_recvvar(server, result) eq 1, $
+            'unable to receive frame %d into ring', f
+    assert, array_equal(result, frame), 'incorrect frame %d from ring', f
+  endfor
+  assert, mg_net_recvring(0, 0) eq 1, 'unable to remove ring'
+  assert, array_equal(result, frame), 'incorrect frame after removing ring'
+
+  err = mg_net_close(client)
+  err = mg_net_close(server)
+  err = mg_net_close(listener)
+
+  return, 1
+end
+
+
+function mg_net_ut::test_recvvar_timeout
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_net'), 'MG_NET DLM not found', /skip
+  assert, self->_connect(listener=listener, client=client, server=server), $
+          'unable to connect'
+
+  start = systime(/seconds)
+  assert, mg_net_recvvar(server, result, timeout=0.2) eq -1, $
+          'received variable that was not sent'
+  elapsed = systime(/seconds) - start
+  assert, elapsed ge 0.15 && elapsed lt 2.0, 'incorrect wait: %f s', elapsed
+
+  assert, mg_net_sendvar(client, findgen(10)) eq 1, 'unable to send variable'
+  assert, mg_net_recvvar(server, result, timeout=2.0) eq 1, $
+          'unable to receive variable'
+  assert, array_equal(result, findgen(10)), 'incorrect variable'
+
+  err = mg_net_close(client)
+  err = mg_net_close(server)
+  err = mg_net_close(listener)
+
+  return, 1
+end
+
+
+function mg_net_ut::test_async
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_net'), 'MG_NET DLM not found', /skip
+  assert, self->_connect(listener=listener, client=client, server=server), $
+          'unable to connect'
+
+  data = findgen(100, 3)
+  recv_id = mg_net_recv_async(server, /variable)
+  send_id = mg_net_send_async(client, data, /variable)
+  assert, recv_id gt 0 && send_id gt 0, 'unable to make requests'
+  assert, mg_net_wait(send_id, 5.0) eq 1, 'unable to send variable'
+  assert, mg_net_wait(recv_id, 5.0, data=result) eq 1, $
+          'unable to receive variable'
+  assert, array_equal(result, data), 'incorrect variable'
+  assert, array_equal(size(result, /dimensions), [100, 3]), $
+          'incorrect variable dimensions'
+
+  ; raw bytes
+  recv_id = mg_net_recv_async(server, 10)
+  assert, mg_net_test(recv_id) eq 0, 'receive completed before send'
+  assert, mg_net_send(server, 1B) eq -1 && mg_net_sendvar(server, 1L) eq -1, $
+          'synchronous send during asynchronous receive'
+  send_id = mg_net_send_async(client, bindgen(10))
+  assert, mg_net_wait(recv_id, 5.0, data=result, bytes=n_bytes) eq 1, $
+          'unable to receive bytes'
+  assert, n_bytes eq 10 && array_equal(result, bindgen(10)), 'incorrect bytes'
+  assert, mg_net_wait(send_id) eq 1, 'unable to send bytes'
+  assert, mg_net_wait(send_id) eq -1, 'request collected twice'
+
+  stats = mg_net_async_stats(/reset)
+  assert, stats.submitted ge 4 && stats.failed eq 0, 'incorrect statistics'
+  assert, stats.queued eq 0 && stats.uncollected eq 0, 'requests left over'
+
+  ; requests in flight fail when their socket is closed
+  recv_id = mg_net_recv_async(server, 4)
+  err = mg_net_close(server)
+  assert, mg_net_wait(recv_id, 5.0) eq -1, 'receive on closed socket succeeded'
+
+  err = mg_net_close(client)
+  err = mg_net_close(listener)
+
+  return, 1
+end
+
+
+function mg_net_ut::test_recvmmsg
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_net'), 'MG_NET DLM not found', /skip
+
+  receiver = mg_net_createport(0L, /udp, buffer=4L * 1024L * 1024L)
+  err = mg_net_query(receiver, local_port=port)
+  sender = mg_net_createport(0L, /udp)
+  host = mg_net_name2host('127.0.0.1')
+
+  assert, mg_net_recvmmsg(receiver, data) eq 0, 'datagrams received from nowhere'
+
+  datagrams = bindgen(10, 5)
+  lengths = 2L * lindgen(5) + 1L
+  assert, mg_net_sendmmsg(sender, datagrams, host, port, lengths=lengths) eq 5, $
+          'unable to send datagrams'
+  n = mg_net_recvmmsg(receiver, data, lengths=received_lengths, ports=ports, $
+                      timestamps=timestamps, timeout=1.0)
+  assert, n eq 5, 'incorrect number of datagrams: %d', n
+  assert, array_equal(received_lengths, lengths), 'incorrect lengths'
+  assert, array_equal(size(data, /dimensions), [9, 5]), 'incorrect dimensions'
+  for d = 0L, n - 1L do begin
+    assert, array_equal(data[0:lengths[d] - 1L, d], datagrams[0:lengths[d] - 1L, d]), $
+            'incorrect datagram %d', d
+  endfor
+  err = mg_net_query(sender, local_port=sender_port)
+  assert, array_equal(ports, replicate(sender_port, n)), 'incorrect ports'
+  assert, min(timestamps) gt 0.0D, 'missing timestamps'
+
+  ; datagrams packed in a vector
+  assert, mg_net_sendmmsg(sender, bindgen(30), host, port, offsets=[0, 7, 20]) eq 3, $
+          'unable to send packed datagrams'
+  n = mg_net_recvmmsg(receiver, data, /packed, offsets=offsets, timeout=1.0)
+  assert, n eq 3 && array_equal(offsets, [0, 7, 20]), 'incorrect offsets'
+  assert, array_equal(data, bindgen(30)), 'incorrect packed datagrams'
+
+  err = mg_net_close(sender)
+  err = mg_net_close(receiver)
+
+  return, 1
+end
+
+
+function mg_net_ut::test_shm
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_net'), 'MG_NET DLM not found', /skip
+  assert, !version.os_family ne 'Windows', 'Unix domain sockets not available', /skip
+
+  path = filepath('mg_net_ut_' + strtrim(mg_pid(), 2) + '.sock', /tmp)
+  listener = mg_net_createport(path)
+  client = mg_net_connect(path)
+  server = mg_net_accept(listener)
+  assert, listener ge 0L && client ge 0L && server ge 0L, 'unable to connect'
+
+  assert, mg_net_shm(client, 65536L) eq 1, 'unable to create shared memory'
+  assert, mg_net_shm(server) eq 1, 'unable to attach shared memory'
+  err = mg_net_query(server, shared_memory=n_bytes, remote_port=port)
+  assert, n_bytes eq 65536LL, 'incorrect shared memory size: %d', n_bytes
+  assert, port eq 0L, 'Unix domain socket has a port'
+
+  data = findgen(100, 3)
+  assert, mg_net_sendvar(client, data) eq 1, 'unable to send array'
+  assert, mg_net_sendvar(client, 'hello') eq 1, 'unable to send string'
+  assert, mg_net_recvvar(server, result) eq 1, 'unable to receive array'
+  assert, array_equal(result, data), 'incorrect array'
+  assert, array_equal(size(result, /dimensions), [100, 3]), $
+          'incorrect array dimensions'
+  assert, mg_net_recvvar(server, result) eq 1, 'unable to receive string'
+  assert, result eq 'hello', 'incorrect string'
+
+  ; the socket only carries wakeups
+  assert, mg_net_send(client, bindgen(4)) eq -1, 'raw send on shared memory'
+
+  err = mg_net_close(client)
+  err = mg_net_close(server)
+  err = mg_net_close(listener)
+
+  ; closing the listener removes its file, so the path can be used again
+  assert, ~file_test(path), 'socket file left behind'
+  listener = mg_net_createport(path)
+  assert, listener ge 0L, 'unable to create listener again'
+  err = mg_net_close(listener)
+
+  return, 1
+end
+
+
+function mg_net_ut::test_stats
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_net'), 'MG_NET DLM not found', /skip
+  assert, self->_connect(listener=listener, client=client, server=server), $
+          'unable to connect'
+
+  data = findgen(1000)
+  for i = 0L, 9L do begin
+    err = mg_net_sendvar(client, data)
+    err = mg_net_recvvar(server, request)
+    err = mg_net_sendvar(server, request)
+    err = mg_net_recvvar(client, reply)
+  endfor
+
+  stats = mg_net_stats(client)
+  assert, stats.messages_sent eq 10LL && stats.messages_received eq 10LL, $
+          'incorrect message counts'
+  assert, stats.bytes_sent gt 40000LL && stats.bytes_sent eq stats.bytes_received, $
+          'incorrect byte counts'
+  assert, stats.syscalls ge 20LL, 'incorrect system calls: %d', stats.syscalls
+  assert, stats.round_trips eq 10LL && total(stats.latency, /integer) eq 10LL, $
+          'incorrect round trips'
+  assert, stats.latency_max ge stats.latency_mean && stats.latency_mean gt 0.0D, $
+          'incorrect latencies'
+  assert, stats.send_errors eq 0LL && stats.recv_errors eq 0LL, 'errors counted'
+
+  err = mg_net_query(server, statistics=server_stats)
+  assert, server_stats.messages_received eq 10LL, 'incorrect query statistics'
+
+  stats = mg_net_stats(client, /reset)
+  stats = mg_net_stats(client)
+  assert, stats.bytes_sent eq 0LL && stats.round_trips eq 0LL, 'statistics not reset'
+
+  ; receiving from a closed peer is an error
+  err = mg_net_close(client)
+  assert, mg_net_recvvar(server, result) eq -1, 'received from closed socket'
+  stats = mg_net_stats(server)
+  assert, stats.recv_errors eq 1LL, 'error not counted'
+  assert, size(mg_net_stats(client), /type) eq 3, 'statistics of closed socket'
+
+  err = mg_net_close(server)
+  err = mg_net_close(listener)
+
+  return, 1
+end
+
+
+pro mg_net_ut__define
+  compile_opt strictarr
+
+  define = { mg_net_ut, inherits MGutLibTestCase }
+end
@@ -0,0 +1,315 @@
+; docformat = 'rst'
+
+function mgnetrpc_ut_add, x
+  compile_opt strictarr
+
+  return, total(x, /preserve_type)
+end
+
+
+function mgnetrpc_ut_fail, x
+  compile_opt strictarr
+
+  message, 'bad argument'
+end
+
+
+function mgnetrpc_ut::_later, x, request=request
+  compile_opt strictarr
+
+  self.requests->add, { request: request, x: x }
+  return, 0
+end
+
+
+function mgnetrpc_ut::_serve, server, n_requests
+  compile_opt strictarr
+
+  n = 0L
+  start = systime(/seconds)
+  while (n lt n_requests && systime(/seconds) - start lt 5.0D) do begin
+    n += server->step(0.1)
+  endwhile
+
+  return, n eq n_requests
+end
+
+
+function mgnetrpc_ut::test_call
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_net'), 'MG_NET DLM not found', /skip
+
+  server = obj_new('MGnetRPCServer')
+  server->getProperty, port=port
+  server->register, 'add', 'mgnetrpc_ut_add'
+  client = obj_new('MGnetRPCClient', timeout=5.0)
+
+  id = client->send('127.0.0.1', port, 'add', [1L, 2L])
+  assert, id gt 0LL, 'unable to send request'
+  assert, self->_serve(server, 1), 'request not handled'
+  result = client->receive(id, status=status)
+  assert, status eq 0L, 'incorrect status: %d', status
+  assert, result eq 3L, 'incorrect result: %d', result
+
+  ; the connection is reused
+  id = client->send('127.0.0.1', port, 'ADD', [4L, 5L])
+  assert, self->_serve(server, 1), 'request not handled'
+  assert, client->receive(id) eq 9L, 'incorrect result'
+  client->getProperty, n_connections=n_connections, n_pending=n_pending
+  assert, n_connections eq 1L, 'incorrect number of connections: %d', n_connections
+  assert, n_pending eq 0L, 'requests left over'
+
+  obj_destroy, [client, server]
+
+  return, 1
+end
+
+
+function mgnetrpc_ut::test_pipeline
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_net'), 'MG_NET DLM not found', /skip
+
+  server = obj_new('MGnetRPCServer')
+  server->getProperty, port=port
+  server->register, 'add', 'mgnetrpc_ut_add'
+  client = obj_new('MGnetRPCClient', max_pipeline=4, max_connections=2)
+
+  ids = lon64arr(10)
+  for i = 0L, 9L do ids[i] = client->send('127.0.0.1', port, 'add', [i, 100L])
+  client->getProperty, n_connections=n_connections
+  assert, n_connections eq 2L, 'incorrect number of connections: %d', n_connections
+  assert, self->_serve(server, 10), 'requests not handled'
+
+  ; collect the responses in reverse order
+  for i = 9L, 0L, -1L do begin
+    result = client->receive(ids[i], status=status)
+    assert, status eq 0L && result eq i + 100L, 'incorrect result for request %d', i
+  endfor
+
+  obj_destroy, [client, server]
+
+  return, 1
+end
+
+
+function mgnetrpc_ut::test_out_of_order
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_net'), 'MG_NET DLM not found', /skip
+
+  server = obj_new('MGnetRPCServer')
+  server->getProperty, port=port
+  server->register, 'later', '_later', object=self, /deferred
+  client = obj_new('MGnetRPCClient')
+
+  self.requests->remove, /all
+  id1 = client->send('127.0.0.1', port, 'later', 1L)
+  id2 = client->send('127.0.0.1', port, 'later', 2L)
+  assert, self->_serve(server, 2), 'requests not handled'
+  assert, self.requests->count() eq 2L, 'requests not deferred'
+  assert, ~client->test(id1), 'response before it was sent'
+
+  ; respond to the second request first
+  server->respond, (self.requests[1]).request, 20L
+  server->respond, (self.requests[0]).request, 10L
+  assert, client->receive(id1) eq 10L, 'incorrect first result'
+  assert, client->receive(id2) eq 20L, 'incorrect second result'
+
+  obj_destroy, [client, server]
+
+  return, 1
+end
+
+
+function mgnetrpc_ut::test_timeout
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_net'), 'MG_NET DLM not found', /skip
+
+  server = obj_new('MGnetRPCServer')
+  server->getProperty, port=port
+  server->register, 'later', '_later', object=self, /deferred
+  server->register, 'add', 'mgnetrpc_ut_add'
+  client = obj_new('MGnetRPCClient')
+
+  self.requests->remove, /all
+  id = client->send('127.0.0.1', port, 'later', 1L, timeout=0.2)
+  assert, self->_serve(server, 1), 'request not handled'
+  result = client->receive(id, status=status, error_message=msg)
+  assert, status eq 2L, 'incorrect status: %d', status
+  assert, n_elements(result) eq 0L, 'result from a request that timed out'
+
+  ; a late response is dropped and the connection is still good
+  server->respond, (self.requests[0]).request, 10L
+  id = client->send('127.0.0.1', port, 'add', [1L, 1L])
+  assert, self->_serve(server, 1), 'request not handled'
+  assert, client->receive(id, status=status) eq 2L && status eq 0L, $
+          'incorrect result after a late response'
+
+  result = client->receive(id, status=status)
+  assert, status eq -1L, 'request collected twice'
+
+  obj_destroy, [client, server]
+
+  return, 1
+end
+
+
+function mgnetrpc_ut::test_stale
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_net'), 'MG_NET DLM not found', /skip
+
+  server = obj_new('MGnetRPCServer')
+  server->getProperty, port=port
+  server->register, 'later', '_later', object=self, /deferred
+  server->register, 'add', 'mgnetrpc_ut_add'
+  client = obj_new('MGnetRPCClient', timeout=5.0)
+
+  self.requests->remove, /all
+  id = client->send('127.0.0.1', port, 'later', 1L)
+  assert, self->_serve(server, 1), 'request not handled'
+  server->respond, (self.requests[0]).request, 10L
+  assert, client->receive(id) eq 10L, 'incorrect result'
+
+  ; the server closes the idle connection, so a new one is opened
+  server->_close, long((self.requests[0]).request[0])
+  wait, 0.1
+  id = client->send('127.0.0.1', port, 'add', [1L, 2L])
+  assert, self->_serve(server, 1), 'request not handled'
+  result = client->receive(id, status=status)
+  assert, status eq 0L && result eq 3L, 'incorrect result on a new connection'
+  client->getProperty, n_connections=n_connections
+  assert, n_connections eq 1L, 'incorrect number of connections: %d', n_connections
+
+  obj_destroy, [client, server]
+
+  return, 1
+end
+
+
+function mgnetrpc_ut::test_reconnect
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_net'), 'MG_NET DLM not found', /skip
+
+  server = obj_new('MGnetRPCServer')
+  server->getProperty, port=port
+  server->register, 'later', '_later', object=self, /deferred
+  client = obj_new('MGnetRPCClient', timeout=5.0)
+
+  self.requests->remove, /all
+  id = client->send('127.0.0.1', port, 'later', 1L)
+  assert, self->_serve(server, 1), 'request not handled'
+
+  ; the connection is lost before any response, so the request is sent again
+  server->_close, long((self.requests[0]).request[0])
+  wait, 0.1
+  assert, ~client->test(id), 'lost request not sent again'
+  assert, self->_serve(server, 1), 'request sent again not handled'
+  assert, self.requests->count() eq 2L, 'request not deferred again'
+
+  ; the response for the closed connection is not sent on the new one, even
+  ; if it has the same socket
+  server->respond, (self.requests[0]).request, 10L
+  server->respond, (self.requests[1]).request, 20L
+  result = client->receive(id, status=status)
+  assert, status eq 0L, 'incorrect status: %d', status
+  assert, result eq 20L, 'incorrect result: %d', result
+
+  obj_destroy, [client, server]
+
+  return, 1
+end
+
+
+function mgnetrpc_ut::test_stalled
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_net'), 'MG_NET DLM not found', /skip
+
+  server = obj_new('MGnetRPCServer', timeout=0.2)
+  server->getProperty, port=port
+
+  ; a client sends the header of a request and nothing more
+  socket = mg_net_connect(mg_net_name2host('127.0.0.1'), port, /tcp)
+  assert, socket ge 0L, 'unable to connect'
+  assert, mg_net_sendvar(socket, [1LL, 1LL, 0LL]) eq 1L, 'unable to send header'
+
+  start = systime(/seconds)
+  n = 0L
+  while (n lt 2L && systime(/seconds) - start lt 5.0D) do begin
+    n_handled = server->step(0.1)
+    server->getProperty, n_connections=n_connections
+    if (n_connections gt 0L) then n = 1L
+    if (n eq 1L && n_connections eq 0L) then n = 2L
+  endwhile
+  assert, n eq 2L, 'stalled connection not closed'
+  elapsed = systime(/seconds) - start
+  assert, elapsed lt 2.0D, 'server blocked for %f s', elapsed
+
+  err = mg_net_close(socket)
+  obj_destroy, server
+
+  return, 1
+end
+
+
+function mgnetrpc_ut::test_errors
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_net'), 'MG_NET DLM not found', /skip
+
+  server = obj_new('MGnetRPCServer')
+  server->getProperty, port=port
+  server->register, 'fail', 'mgnetrpc_ut_fail'
+  client = obj_new('MGnetRPCClient')
+
+  id1 = client->send('127.0.0.1', port, 'fail', 1L)
+  id2 = client->send('127.0.0.1', port, 'missing')
+  assert, self->_serve(server, 2), 'requests not handled'
+
+  result = client->receive(id1, status=status, error_message=msg)
+  assert, status eq 1L, 'incorrect status: %d', status
+  assert, strpos(msg, 'bad argument') ge 0L, 'incorrect error message: %s', msg
+  result = client->receive(id2, status=status, error_message=msg)
+  assert, status eq 1L, 'unknown method succeeded'
+
+  ; requests in flight fail when the server goes away
+  id = client->send('127.0.0.1', port, 'fail', 1L)
+  obj_destroy, server
+  result = client->receive(id, status=status)
+  assert, status eq 3L, 'incorrect status: %d', status
+
+  obj_destroy, client
+
+  return, 1
+end
+
+
+function mgnetrpc_ut::init, _extra=e
+  compile_opt strictarr
+
+  if (~self->MGutLibTestCase::init(_extra=e)) then return, 0
+
+  self.requests = list()
+
+  return, 1
+end
+
+
+pro mgnetrpc_ut::cleanup
+  compile_opt strictarr
+
+  obj_destroy, self.requests
+  self->MGutLibTestCase::cleanup
+end
+
+
+pro mgnetrpc_ut__define
+  compile_opt strictarr
+
+  define = { mgnetrpc_ut, inherits MGutLibTestCase, requests: obj_new() }
+end
@@ -82,6 +82,38 @@ function mg_float2str_ut::test_double
   return, self->_perform_test(1.0D, '1.000000000000000')
 end
 
+function mg_float2str_ut::test_round_trip
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_strings'), 'MG_STRINGS DLM not found', /skip
+
+  result = mg_float2str([0.1, 1.0, 1.0e9, 2.0 / 3.0], /round_trip)
+  assert, array_equal(result, ['0.1', '1', '1e+09', '0.6666667']), $
+          'incorrect float result'
+
+  values = randomu(seed, 1000, /double) * 10.0D^(20L * randomu(seed, 1000) - 10L)
+  result = mg_float2str(values, /round_trip)
+  assert, array_equal(double(result), values), 'double values do not round-trip'
+
+  return, 1
+end
+
+function mg_float2str_ut::test_strfloat
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_strings'), 'MG_STRINGS DLM not found', /skip
+
+  values = [1.5D, -0.004D, !values.d_nan, -!values.d_infinity, 123456.789D]
+  result = mg_strfloat(values, format='%0.2f', exponential_threshold=5)
+  assert, array_equal(result, ['1.50', '-0.00', 'NaN', '-Inf', '1.23e+05']), $
+          'incorrect fixed result'
+
+  result = mg_strfloat(3.14159, format='%8.3g', decimal_sep=',')
+  assert, result eq '    3,14', 'incorrect width result: %s', result
+
+  return, 1
+end
+
 function mg_float2str_ut::init, _extra=e
   compile_opt strictarr
 
@@ -60,6 +60,127 @@ function mg_stregex_ut::test_basic
 end
 
 
+function mg_stregex_ut::test_array
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_strings'), 'MG_STRINGS DLM not found', /skip
+
+  urlRe = '(([[:alnum:]_-]+://?|www[.])[^[:space:]()<>]+(\([[:alnum:]_[:digit:]]+\)|([^[:punct:][:space:]]|/)))'
+
+  urlsFilename = filepath('urls.txt', root=mg_src_root())
+  urlsFile = mg_file(urlsFilename)
+  urls = urlsFile->readf()
+  obj_destroy, urlsFile
+
+  correctPositions = [0, 0, 16, 0, 16, 0, 0, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 5, 7]
+  correctLength = [24, 25, 24, 36, 36, 24, 25, 24, 25, 24, 37, 19, 11, 10, 39, 25, 30, 34, 23, 70, 17, 14, 18, 15]
+
+  positions = mg_stregex(urls, urlRe, length=length)
+  assert, array_equal(positions, correctPositions), 'incorrect positions'
+  assert, array_equal(length, correctLength), 'incorrect length'
+
+  ; split across threads
+  positions = mg_stregex(urls, urlRe, length=length, $
+                         tpool_nthreads=4, tpool_min_elts=1)
+  assert, array_equal(positions, correctPositions), 'incorrect threaded positions'
+  assert, array_equal(length, correctLength), 'incorrect threaded length'
+
+  return, 1
+end
+
+
+function mg_stregex_ut::test_array_extract
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_strings'), 'MG_STRINGS DLM not found', /skip
+
+  s = ['foo bar 123', 'no digits', '', 'x9y88', '42']
+
+  result = mg_stregex(s, '[0-9]+', /extract, length=length)
+  assert, array_equal(result, ['123', '', '', '9', '42']), 'incorrect extracted strings'
+  assert, array_equal(length, [3, -1, -1, 1, 2]), 'incorrect lengths'
+
+  result = mg_stregex(reform(s, 1, 5), '[0-9]+', /boolean)
+  assert, size(result, /type) eq 1, 'incorrect type'
+  assert, array_equal(size(result, /dimensions), [1, 5]), 'incorrect dimensions'
+  assert, array_equal(result, reform([1B, 0B, 0B, 1B, 1B], 1, 5)), $
+          'incorrect boolean result'
+
+  return, 1
+end
+
+
+function mg_stregex_ut::test_all_long
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_strings'), 'MG_STRINGS DLM not found', /skip
+
+  n = 500000L
+  s = strjoin(replicate('abc7', n))
+  result = mg_stregex(s, '[0-9]+', /all, /extract, length=length)
+  assert, n_elements(result) eq n, 'incorrect number of matches: %d', $
+          n_elements(result)
+  assert, array_equal(result, '7'), 'incorrect matches'
+  assert, array_equal(length, 1L), 'incorrect lengths'
+
+  result = mg_stregex(s, 'c7a', /all, /approximate, costs=costs)
+  assert, n_elements(result) eq n - 1L, 'incorrect number of approximate matches'
+  assert, result[1] eq 6L, 'incorrect approximate start: %d', result[1]
+  assert, array_equal(costs, 0L), 'incorrect costs'
+
+  result = mg_stregex('abc', 'x*', /all)
+  assert, n_elements(result) eq 4L, 'incorrect number of empty matches'
+
+  return, 1
+end
+
+
+function mg_stregex_ut::test_subexpr
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_strings'), 'MG_STRINGS DLM not found', /skip
+
+  re = '([a-z]+)=([0-9]+)(x)?'
+  result = mg_stregex('a=1 bb=22x c=3', re, /subexpr, length=length)
+  assert, array_equal(result, [0, 0, 2, -1]), 'incorrect positions'
+  assert, array_equal(length, [3, 1, 1, -1]), 'incorrect lengths'
+
+  result = mg_stregex('a=1 bb=22x c=3', re, /subexpr, /all, /extract)
+  assert, array_equal(size(result, /dimensions), [4, 3]), 'incorrect dimensions'
+  assert, array_equal(result[*, 1], ['bb=22x', 'bb', '22', 'x']), $
+          'incorrect extracted subexpressions'
+
+  result = mg_stregex('a=1 bb=22x c=3', re, /subexpr, /all, /approximate, $
+                      max_cost=0)
+  assert, array_equal(result[*, 2], [11, 11, 13, -1]), $
+          'incorrect approximate subexpressions'
+
+  result = mg_stregex('nothing', re, /subexpr)
+  assert, array_equal(result, [-1, -1, -1, -1]), 'incorrect result for no match'
+
+  return, 1
+end
+
+
+function mg_stregex_ut::test_array_subexpr
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_strings'), 'MG_STRINGS DLM not found', /skip
+
+  s = ['x k=5', 'none', 'zz=77x']
+  result = mg_stregex(s, '([a-z]+)=([0-9]+)(x)?', /subexpr, /extract, $
+                      length=length)
+  assert, array_equal(size(result, /dimensions), [4, 3]), 'incorrect dimensions'
+  assert, array_equal(result[*, 0], ['k=5', 'k', '5', '']), 'incorrect first'
+  assert, array_equal(result[*, 1], ''), 'incorrect result for no match'
+  assert, array_equal(result[*, 2], ['zz=77x', 'zz', '77', 'x']), $
+          'incorrect last'
+  assert, array_equal(length[*, 1], -1L), 'incorrect lengths for no match'
+
+  return, 1
+end
+
+
 function mg_stregex_ut::init, _extra=e
   compile_opt strictarr
 
@@ -0,0 +1,69 @@
+; docformat = 'rst'
+
+function mg_strreplace_ut::test_regex
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_strings'), 'MG_STRINGS DLM not found', /skip
+
+  s = ['john smith', 'jane doe', '']
+  result = mg_strreplace(s, '([a-z]+) ([a-z]+)', '$2, $1', count=count)
+  assert, array_equal(result, ['smith, john', 'doe, jane', '']), $
+          'incorrect result'
+  assert, count eq 2, 'incorrect count: %d', count
+
+  result = mg_strreplace('a1b22c333', '[0-9]+', '<$&>', count=count)
+  assert, result eq 'a<1>b<22>c<333>', 'incorrect result: %s', result
+  assert, count eq 3, 'incorrect count: %d', count
+
+  result = mg_strreplace('abc', 'x*', '-')
+  assert, result eq '-a-b-c-', 'incorrect empty match result: %s', result
+
+  result = mg_strreplace('price', 'I', '\$', /fold_case)
+  assert, result eq 'pr$ce', 'incorrect escaped result: %s', result
+
+  return, 1
+end
+
+
+function mg_strreplace_ut::test_literal
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_strings'), 'MG_STRINGS DLM not found', /skip
+
+  s = reform(['a.b.c', 'Hello HELLO hello', '...', 'x'], 2, 2)
+  result = mg_strreplace(s, '.', '$1', /literal, count=count)
+  assert, array_equal(size(result, /dimensions), [2, 2]), 'incorrect dimensions'
+  assert, array_equal(result, reform(['a$1b$1c', 'Hello HELLO hello', '$1$1$1', 'x'], 2, 2)), $
+          'incorrect result'
+  assert, count eq 5, 'incorrect count: %d', count
+
+  result = mg_strreplace('Hello HELLO hello', 'hello', 'bye', /literal, /fold_case)
+  assert, result eq 'bye bye bye', 'incorrect folded result: %s', result
+
+  return, 1
+end
+
+
+function mg_strreplace_ut::test_join
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_strings'), 'MG_STRINGS DLM not found', /skip
+
+  result = mg_strjoin(['a', '', 'bc'], ', ')
+  assert, result eq 'a, , bc', 'incorrect result: %s', result
+
+  result = mg_strjoin(['a', '', 'bc'])
+  assert, result eq 'abc', 'incorrect result without separator: %s', result
+
+  s = mg_strunmerge(mg_strmerge(['line 1', 'line 2'], /unix), /unix)
+  assert, array_equal(s, ['line 1', 'line 2']), 'incorrect merged lines'
+
+  return, 1
+end
+
+
+pro mg_strreplace_ut__define
+  compile_opt strictarr
+
+  define = { mg_strreplace_ut, inherits MGutLibTestCase }
+end
@@ -0,0 +1,87 @@
+; docformat = 'rst'
+
+function mg_strsplit_ut::test_basic
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_strings'), 'MG_STRINGS DLM not found', /skip
+
+  s = '  the quick	brown fox '
+  result = mg_strsplit(s, length=length, count=count)
+  standard = strsplit(s, length=standard_length, count=standard_count)
+
+  assert, count eq standard_count, 'incorrect count: %d', count
+  assert, array_equal(result, standard), 'incorrect offsets'
+  assert, array_equal(length, standard_length), 'incorrect lengths'
+
+  result = mg_strsplit(s, /extract)
+  assert, array_equal(result, ['the', 'quick', 'brown', 'fox']), $
+          'incorrect tokens'
+
+  result = mg_strsplit(',,,', ',', count=count)
+  assert, count eq 0 && result eq -1L, 'incorrect result without tokens'
+
+  return, 1
+end
+
+
+function mg_strsplit_ut::test_array
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_strings'), 'MG_STRINGS DLM not found', /skip
+
+  s = ['a,b', '', 'a,,b', ',lead,trail,']
+
+  result = mg_strsplit(s, ',', /extract, counts=counts)
+  assert, array_equal(result, ['a', 'b', 'a', 'b', 'lead', 'trail']), $
+          'incorrect tokens'
+  assert, array_equal(counts, [2, 0, 2, 2]), 'incorrect counts'
+
+  result = mg_strsplit(s, ',', /extract, /preserve_null, counts=counts)
+  assert, array_equal(result, ['a', 'b', '', 'a', '', 'b', '', 'lead', 'trail', '']), $
+          'incorrect tokens with PRESERVE_NULL'
+  assert, array_equal(counts, [2, 1, 3, 4]), 'incorrect counts with PRESERVE_NULL'
+
+  result = mg_strsplit(s, ',', counts=counts, length=length, $
+                       tpool_nthreads=2, tpool_min_elts=1)
+  assert, array_equal(result, [0, 2, 0, 3, 1, 6]), 'incorrect threaded offsets'
+  assert, array_equal(length, [1, 1, 1, 1, 4, 5]), 'incorrect threaded lengths'
+
+  return, 1
+end
+
+
+function mg_strsplit_ut::test_literal
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_strings'), 'MG_STRINGS DLM not found', /skip
+
+  result = mg_strsplit('x::y:z::::w', '::', /literal, /extract)
+  assert, array_equal(result, ['x', 'y:z', 'w']), 'incorrect tokens'
+
+  result = mg_strsplit('oneANDtwoandthree', 'and', /literal, /fold_case, /extract)
+  assert, array_equal(result, ['one', 'two', 'three']), $
+          'incorrect tokens with FOLD_CASE'
+
+  return, 1
+end
+
+
+function mg_strsplit_ut::test_regex
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_strings'), 'MG_STRINGS DLM not found', /skip
+
+  result = mg_strsplit(['a1b22c', '333d'], '[0-9]+', /regex, /extract, $
+                       counts=counts)
+  assert, array_equal(result, ['a', 'b', 'c', 'd']), 'incorrect tokens'
+  assert, array_equal(counts, [3, 1]), 'incorrect counts'
+
+  return, 1
+end
+
+
+pro mg_strsplit_ut__define
+  compile_opt strictarr
+
+  define = { mg_strsplit_ut, inherits MGutLibTestCase }
+end
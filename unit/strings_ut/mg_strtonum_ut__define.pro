@@ -0,0 +1,72 @@
+; docformat = 'rst'
+
+function mg_strtonum_ut::test_double
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_strings'), 'MG_STRINGS DLM not found', /skip
+
+  s = [' 1.5 ', '-2e3', '1d-2', '.5', 'NaN', '-Inf', 'abc', '1.2.3']
+  result = mg_strtonum(s, errors=errors, n_errors=n_errors)
+
+  assert, size(result, /type) eq 5, 'incorrect type'
+  assert, array_equal(result[0:3], [1.5D, -2000.0D, 0.01D, 0.5D]), $
+          'incorrect values'
+  assert, finite(result[4], /nan), 'incorrect NaN'
+  assert, finite(result[5], /infinity, sign=-1), 'incorrect -Inf'
+  assert, finite(result[6], /nan) && finite(result[7], /nan), $
+          'incorrect fill for invalid elements'
+  assert, array_equal(errors, [0B, 0B, 0B, 0B, 0B, 0B, 2B, 2B]), $
+          'incorrect errors'
+  assert, n_errors eq 2, 'incorrect number of errors: %d', n_errors
+
+  values = randomu(seed, 1000, /double) * 10.0D^(20L * randomu(seed, 1000) - 10L)
+  result = mg_strtonum(string(values, format='(%"%0.17g")'))
+  assert, array_equal(result, values), 'incorrect round-trip values'
+
+  return, 1
+end
+
+
+function mg_strtonum_ut::test_integer
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_strings'), 'MG_STRINGS DLM not found', /skip
+
+  result = mg_strtonum(['127', '-32768', '32768', '1.0', ' 42 '], type=2, $
+                       errors=errors, fill=-1)
+  assert, size(result, /type) eq 2, 'incorrect type'
+  assert, array_equal(result, [127, -32768, -1, -1, 42]), 'incorrect values'
+  assert, array_equal(errors, [0B, 0B, 2B, 2B, 0B]), 'incorrect errors'
+
+  result = mg_strtonum('18446744073709551615', type=15, errors=errors)
+  assert, result eq 18446744073709551615ULL && errors eq 0B, $
+          'incorrect ULONG64 value'
+
+  result = mg_strtonum('-1', type=1, errors=errors)
+  assert, errors eq 2B, 'negative BYTE not an error'
+
+  return, 1
+end
+
+
+function mg_strtonum_ut::test_missing
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_strings'), 'MG_STRINGS DLM not found', /skip
+
+  result = mg_strtonum(['1', 'NA', ' -999 ', '', 'x'], type=4, $
+                       missing=['NA', '-999', ''], fill=-1.0, $
+                       errors=errors, n_errors=n_errors)
+  assert, array_equal(result, [1.0, -1.0, -1.0, -1.0, -1.0]), 'incorrect values'
+  assert, array_equal(errors, [0B, 1B, 1B, 1B, 2B]), 'incorrect errors'
+  assert, n_errors eq 1, 'incorrect number of errors: %d', n_errors
+
+  return, 1
+end
+
+
+pro mg_strtonum_ut__define
+  compile_opt strictarr
+
+  define = { mg_strtonum_ut, inherits MGutLibTestCase }
+end
@@ -0,0 +1,115 @@
+; docformat = 'rst'
+
+function mg_word_counts_ut::test_basic
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_strings'), 'MG_STRINGS DLM not found', /skip
+
+  docs = ['the cat sat on the mat', '', 'The  dog sat']
+  counts = mg_word_counts(docs, /fold_case, ids=ids, offsets=offsets, $
+                          vocabulary=vocabulary, total_counts=total_counts, $
+                          document_frequency=document_frequency)
+
+  assert, array_equal(vocabulary, ['the', 'cat', 'sat', 'on', 'mat', 'dog']), $
+          'incorrect vocabulary'
+  assert, array_equal(offsets, [0, 5, 5, 8]), 'incorrect offsets'
+  assert, array_equal(ids, [0, 1, 2, 3, 4, 0, 2, 5]), 'incorrect ids'
+  assert, array_equal(counts, [2, 1, 1, 1, 1, 1, 1, 1]), 'incorrect counts'
+  assert, array_equal(total_counts, [3, 1, 2, 1, 1, 1]), 'incorrect total counts'
+  assert, array_equal(document_frequency, [2, 1, 2, 1, 1, 1]), $
+          'incorrect document frequency'
+
+  return, 1
+end
+
+
+function mg_word_counts_ut::test_tokens
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_strings'), 'MG_STRINGS DLM not found', /skip
+
+  counts = mg_word_counts('a,b;; a-bc', /alphanumeric, vocabulary=vocabulary)
+  assert, array_equal(vocabulary, ['a', 'b', 'bc']), 'incorrect alphanumeric words'
+  assert, array_equal(counts, [2, 1, 1]), 'incorrect alphanumeric counts'
+
+  counts = mg_word_counts('a,b;; a-bc', /alphanumeric, min_length=2, $
+                          vocabulary=vocabulary)
+  assert, vocabulary[0] eq 'bc' && n_elements(vocabulary) eq 1, $
+          'incorrect MIN_LENGTH words'
+
+  counts = mg_word_counts('x:y:x', delimiters=':', vocabulary=vocabulary)
+  assert, array_equal(vocabulary, ['x', 'y']), 'incorrect DELIMITERS words'
+
+  !null = mg_word_counts(['x y', 'z', 'x y'], delimiters='', $
+                         vocabulary=vocabulary, total_counts=total_counts)
+  assert, array_equal(vocabulary, ['x y', 'z']), 'incorrect whole words'
+  assert, array_equal(total_counts, [2, 1]), 'incorrect whole word counts'
+
+  counts = mg_word_counts('', vocabulary=vocabulary, offsets=offsets)
+  assert, counts eq -1L && vocabulary eq '', 'incorrect empty result'
+  assert, array_equal(offsets, [0, 0]), 'incorrect empty offsets'
+
+  return, 1
+end
+
+
+function mg_word_counts_ut::test_fixed_vocabulary
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_strings'), 'MG_STRINGS DLM not found', /skip
+
+  counts = mg_word_counts(['b a c a', 'c d'], fixed_vocabulary=['a', 'b'], $
+                          ids=ids, offsets=offsets)
+  assert, array_equal(ids, [0, 1]), 'incorrect ids'
+  assert, array_equal(counts, [2, 1]), 'incorrect counts'
+  assert, array_equal(offsets, [0, 2, 2]), 'incorrect offsets'
+
+  return, 1
+end
+
+
+function mg_word_counts_ut::test_file
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_strings'), 'MG_STRINGS DLM not found', /skip
+
+  docs = ['one two two', 'three', '', 'two one']
+  filename = filepath('mg_word_counts_ut.txt', /tmp)
+  openw, lun, filename, /get_lun
+  printf, lun, docs, format='(A)'
+  free_lun, lun
+
+  counts = mg_word_counts(filename, /file, ids=ids, offsets=offsets, $
+                          vocabulary=vocabulary)
+  file_delete, filename
+
+  expected_counts = mg_word_counts(docs, ids=expected_ids, $
+                                   offsets=expected_offsets)
+  assert, array_equal(vocabulary, ['one', 'two', 'three']), $
+          'incorrect vocabulary'
+  assert, array_equal(counts, expected_counts), 'incorrect counts'
+  assert, array_equal(ids, expected_ids), 'incorrect ids'
+  assert, array_equal(offsets, expected_offsets), 'incorrect offsets'
+
+  return, 1
+end
+
+
+function mg_word_counts_ut::test_word_count
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_strings'), 'MG_STRINGS DLM not found', /skip
+
+  h = mg_word_count(['a', 'b', 'a'])
+  assert, h['a'] eq 2 && h['b'] eq 1 && h->count() eq 2, 'incorrect hash'
+  obj_destroy, h
+
+  return, 1
+end
+
+
+pro mg_word_counts_ut__define
+  compile_opt strictarr
+
+  define = { mg_word_counts_ut, inherits MGutLibTestCase }
+end
@@ -0,0 +1,128 @@
+; docformat = 'rst'
+
+function mgspellindex_ut::test_basic
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_strings'), 'MG_STRINGS DLM not found', /skip
+
+  words = ['correct', 'information', 'known', 'spelling', 'spell']
+  index = MGSpellIndex(words, counts=[10, 5, 3, 2, 7])
+
+  index->getProperty, n_words=n_words
+  assert, n_words eq 5, 'incorrect number of words: %d', n_words
+
+  result = index->correct(['corect', 'information', 'informtion', 'spel', $
+                           'xyzzy'], $
+                          distance=distance, found=found, counts=counts)
+  assert, array_equal(result, ['correct', 'information', 'information', $
+                               'spell', '']), $
+          'incorrect corrections'
+  assert, array_equal(distance, [1, 0, 1, 1, -1]), 'incorrect distances'
+  assert, array_equal(found, [1B, 1B, 1B, 1B, 0B]), 'incorrect found'
+  assert, array_equal(counts, [10, 5, 5, 7, 0]), 'incorrect counts'
+
+  result = index->correct('knwon', distance=distance)
+  assert, result eq 'known', 'incorrect transposition correction: %s', result
+  assert, distance eq 1L, 'incorrect transposition distance: %d', distance
+
+  result = index->correct('knwon', max_distance=0, found=found)
+  assert, result eq '' && ~found, 'incorrect result for MAX_DISTANCE=0'
+
+  obj_destroy, index
+
+  return, 1
+end
+
+
+function mgspellindex_ut::test_frequency
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_strings'), 'MG_STRINGS DLM not found', /skip
+
+  ; repeated words add to the frequency, so "cat" beats "car"
+  index = MGSpellIndex(['car', 'cat', 'cat', 'cot'])
+  result = index->correct('cax', counts=counts)
+  assert, result eq 'cat', 'incorrect correction: %s', result
+  assert, counts eq 2LL, 'incorrect count: %d', counts
+
+  obj_destroy, index
+
+  return, 1
+end
+
+
+function mgspellindex_ut::test_corpus
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_strings'), 'MG_STRINGS DLM not found', /skip
+
+  corpus_filename = filepath('mgspellindex_ut.txt', /tmp)
+  index_filename = filepath('mgspellindex_ut.bin', /tmp)
+
+  openw, lun, corpus_filename, /get_lun
+  printf, lun, 'The quick brown fox jumps over the lazy dog.'
+  printf, lun, 'THE END, the end.'
+  free_lun, lun
+
+  index = MGSpellIndex(corpus=corpus_filename)
+  index->write, index_filename
+  obj_destroy, index
+  file_delete, corpus_filename
+
+  index = MGSpellIndex(filename=index_filename)
+  file_delete, index_filename
+
+  index->getProperty, n_words=n_words
+  assert, n_words eq 9, 'incorrect number of words: %d', n_words
+
+  result = index->correct(['teh', 'quikc', 'brwn'], counts=counts)
+  assert, array_equal(result, ['the', 'quick', 'brown']), $
+          'incorrect corrections'
+  assert, counts[0] eq 4LL, 'incorrect count of "the": %d', counts[0]
+
+  obj_destroy, index
+
+  return, 1
+end
+
+
+function mgspellindex_ut::test_corrupt
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_strings'), 'MG_STRINGS DLM not found', /skip
+
+  index_filename = filepath('mgspellindex_ut_corrupt.bin', /tmp)
+
+  index = MGSpellIndex(['correct', 'known', 'spell'])
+  index->write, index_filename
+  obj_destroy, index
+
+  ; point the last id of the file past the words
+  openu, lun, index_filename, /get_lun
+  point_lun, lun, (file_info(index_filename)).size - 4L
+  writeu, lun, 1000UL
+  free_lun, lun
+
+  error = 0L
+  catch, error
+  if (error ne 0L) then begin
+    catch, /cancel
+    file_delete, index_filename
+    return, 1
+  endif
+
+  index = MGSpellIndex(filename=index_filename)
+  catch, /cancel
+  obj_destroy, index
+  file_delete, index_filename
+  assert, 0, 'corrupted index read'
+
+  return, 1
+end
+
+
+pro mgspellindex_ut__define
+  compile_opt strictarr
+
+  define = { mgspellindex_ut, inherits MGutLibTestCase }
+end
@@ -0,0 +1,95 @@
+; docformat = 'rst'
+
+function mgstrmatcher_ut::test_basic
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_strings'), 'MG_STRINGS DLM not found', /skip
+
+  matcher = MGStrMatcher(['he', 'she', 'his', 'hers'])
+  lines = ['ushers', 'nothing', 'this is his']
+  result = matcher->match(lines, count=count, counts=counts, $
+                          matches=matches, positions=positions, $
+                          offsets=offsets)
+
+  assert, array_equal(result, [1B, 0B, 1B]), 'incorrect result'
+  assert, count eq 5, 'incorrect count: %d', count
+  assert, array_equal(counts, [1, 1, 2, 1]), 'incorrect counts'
+  assert, array_equal(offsets, [0, 3, 3, 5]), 'incorrect offsets'
+  assert, array_equal(matches[0:2], [1, 0, 3]), 'incorrect matches'
+  assert, array_equal(positions[0:2], [1, 2, 2]), 'incorrect positions'
+  assert, array_equal(positions[3:4], [1, 8]), 'incorrect positions in his'
+
+  obj_destroy, matcher
+
+  return, 1
+end
+
+
+function mgstrmatcher_ut::test_fold_case
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_strings'), 'MG_STRINGS DLM not found', /skip
+
+  matcher = MGStrMatcher(['Error', 'timeout'], /fold_case)
+  result = matcher->match(['ERROR: disk', 'TimeOut', 'ok'], counts=counts)
+
+  assert, array_equal(result, [1B, 1B, 0B]), 'incorrect result'
+  assert, array_equal(counts, [1, 1]), 'incorrect counts'
+
+  obj_destroy, matcher
+
+  return, 1
+end
+
+
+function mgstrmatcher_ut::test_many
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_strings'), 'MG_STRINGS DLM not found', /skip
+
+  keywords = 'kw' + strtrim(lindgen(5000), 2) + 'z'
+  lines = 'line with ' + keywords[lindgen(100) * 50] + ' in it'
+  lines = [lines, 'kw5000z is not a keyword']
+
+  matcher = MGStrMatcher(keywords)
+  result = matcher->match(lines, matches=matches)
+
+  assert, array_equal(result, [replicate(1B, 100), 0B]), 'incorrect result'
+  assert, array_equal(matches, lindgen(100) * 50), 'incorrect matches'
+
+  obj_destroy, matcher
+
+  return, 1
+end
+
+
+function mgstrmatcher_ut::test_file
+  compile_opt strictarr
+
+  assert, self->have_dlm('mg_strings'), 'MG_STRINGS DLM not found', /skip
+
+  filename = filepath('mgstrmatcher_ut.txt', /tmp)
+  openw, lun, filename, /get_lun
+  printf, lun, 'first line'
+  printf, lun, 'second line with a keyword'
+  free_lun, lun
+
+  matcher = MGStrMatcher(['keyword', 'missing'])
+  result = matcher->match(filename, /file, counts=counts, positions=positions)
+  file_delete, filename
+
+  assert, result eq 1B, 'incorrect result'
+  assert, array_equal(counts, [1, 0]), 'incorrect counts'
+  assert, positions[0] eq 30, 'incorrect position: %d', positions[0]
+
+  obj_destroy, matcher
+
+  return, 1
+end
+
+
+pro mgstrmatcher_ut__define
+  compile_opt strictarr
+
+  define = { mgstrmatcher_ut, inherits MGutLibTestCase }
+end